@@ -35,19 +35,45 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 
 # Object Files
 OBJECTFILES= \
+	${OBJECTDIR}/src/Algorithms/EntQuery.o \
 	${OBJECTDIR}/src/Algorithms/EntsAlgorithms.o \
+	${OBJECTDIR}/src/Algorithms/ParallelTraversal.o \
+	${OBJECTDIR}/src/Algorithms/ParentCycles.o \
+	${OBJECTDIR}/src/Algorithms/RelationSearch.o \
+	${OBJECTDIR}/src/Algorithms/RelativeStream.o \
+	${OBJECTDIR}/src/Algorithms/TreeDiff.o \
+	${OBJECTDIR}/src/Algorithms/TreeMerge.o \
 	${OBJECTDIR}/src/CLI/CLI.o \
+	${OBJECTDIR}/src/Core/ChangeLog.o \
 	${OBJECTDIR}/src/Core/Ent.o \
+	${OBJECTDIR}/src/Core/EntList.o \
+	${OBJECTDIR}/src/Core/EntSet.o \
+	${OBJECTDIR}/src/Core/EntSetCache.o \
+	${OBJECTDIR}/src/Core/Epoch.o \
+	${OBJECTDIR}/src/Core/NameIndex.o \
 	${OBJECTDIR}/src/Core/Root.o \
 	${OBJECTDIR}/src/Core/Tree.o \
+	${OBJECTDIR}/src/Core/TreeSnapshot.o \
+	${OBJECTDIR}/src/Core/UIDAllocator.o \
 	${OBJECTDIR}/src/Interface/EntX.o \
 	${OBJECTDIR}/src/Interface/EntsInterface.o \
 	${OBJECTDIR}/src/Interface/Tests.o \
 	${OBJECTDIR}/src/Interface/TreeInstance.o \
+	${OBJECTDIR}/src/Network/CoreServer.o \
 	${OBJECTDIR}/src/Network/EntsClient.o \
+	${OBJECTDIR}/src/Network/EntsFollower.o \
+	${OBJECTDIR}/src/Network/EntsProtocol.o \
 	${OBJECTDIR}/src/Network/EntsServer.o \
+	${OBJECTDIR}/src/Network/EntsService.o \
+	${OBJECTDIR}/src/Network/QueryCache.o \
+	${OBJECTDIR}/src/Network/ReplicationSource.o \
+	${OBJECTDIR}/src/Network/ShardCluster.o \
+	${OBJECTDIR}/src/Network/ShardRouter.o \
+	${OBJECTDIR}/src/Network/WatchHub.o \
 	${OBJECTDIR}/src/Util/EntsFile.o \
 	${OBJECTDIR}/src/Util/IO.o \
+	${OBJECTDIR}/src/Util/Importer.o \
+	${OBJECTDIR}/src/Util/LatencyHistogram.o \
 	${OBJECTDIR}/src/Util/Prime.o \
 	${OBJECTDIR}/src/main.o
 
@@ -66,7 +92,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=
+LDLIBSOPTIONS=-lpthread
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
@@ -76,21 +102,86 @@ ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/ents: ${OBJECTFILES}
 	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
 	${LINK.cc} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/ents ${OBJECTFILES} ${LDLIBSOPTIONS}
 
+${OBJECTDIR}/src/Algorithms/EntQuery.o: src/Algorithms/EntQuery.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Algorithms
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Algorithms/EntQuery.o src/Algorithms/EntQuery.cpp
+
 ${OBJECTDIR}/src/Algorithms/EntsAlgorithms.o: src/Algorithms/EntsAlgorithms.cpp
 	${MKDIR} -p ${OBJECTDIR}/src/Algorithms
 	${RM} "$@.d"
 	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Algorithms/EntsAlgorithms.o src/Algorithms/EntsAlgorithms.cpp
 
+${OBJECTDIR}/src/Algorithms/ParallelTraversal.o: src/Algorithms/ParallelTraversal.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Algorithms
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Algorithms/ParallelTraversal.o src/Algorithms/ParallelTraversal.cpp
+
+${OBJECTDIR}/src/Algorithms/ParentCycles.o: src/Algorithms/ParentCycles.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Algorithms
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Algorithms/ParentCycles.o src/Algorithms/ParentCycles.cpp
+
+${OBJECTDIR}/src/Algorithms/RelationSearch.o: src/Algorithms/RelationSearch.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Algorithms
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Algorithms/RelationSearch.o src/Algorithms/RelationSearch.cpp
+
+${OBJECTDIR}/src/Algorithms/RelativeStream.o: src/Algorithms/RelativeStream.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Algorithms
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Algorithms/RelativeStream.o src/Algorithms/RelativeStream.cpp
+
+${OBJECTDIR}/src/Algorithms/TreeDiff.o: src/Algorithms/TreeDiff.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Algorithms
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Algorithms/TreeDiff.o src/Algorithms/TreeDiff.cpp
+
+${OBJECTDIR}/src/Algorithms/TreeMerge.o: src/Algorithms/TreeMerge.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Algorithms
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Algorithms/TreeMerge.o src/Algorithms/TreeMerge.cpp
+
 ${OBJECTDIR}/src/CLI/CLI.o: src/CLI/CLI.cpp
 	${MKDIR} -p ${OBJECTDIR}/src/CLI
 	${RM} "$@.d"
 	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/CLI/CLI.o src/CLI/CLI.cpp
 
+${OBJECTDIR}/src/Core/ChangeLog.o: src/Core/ChangeLog.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Core
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Core/ChangeLog.o src/Core/ChangeLog.cpp
+
 ${OBJECTDIR}/src/Core/Ent.o: src/Core/Ent.cpp
 	${MKDIR} -p ${OBJECTDIR}/src/Core
 	${RM} "$@.d"
 	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Core/Ent.o src/Core/Ent.cpp
 
+${OBJECTDIR}/src/Core/EntList.o: src/Core/EntList.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Core
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Core/EntList.o src/Core/EntList.cpp
+
+${OBJECTDIR}/src/Core/EntSet.o: src/Core/EntSet.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Core
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Core/EntSet.o src/Core/EntSet.cpp
+
+${OBJECTDIR}/src/Core/EntSetCache.o: src/Core/EntSetCache.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Core
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Core/EntSetCache.o src/Core/EntSetCache.cpp
+
+${OBJECTDIR}/src/Core/Epoch.o: src/Core/Epoch.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Core
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Core/Epoch.o src/Core/Epoch.cpp
+
+${OBJECTDIR}/src/Core/NameIndex.o: src/Core/NameIndex.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Core
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Core/NameIndex.o src/Core/NameIndex.cpp
+
 ${OBJECTDIR}/src/Core/Root.o: src/Core/Root.cpp
 	${MKDIR} -p ${OBJECTDIR}/src/Core
 	${RM} "$@.d"
@@ -101,6 +192,16 @@ ${OBJECTDIR}/src/Core/Tree.o: src/Core/Tree.cpp
 	${RM} "$@.d"
 	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Core/Tree.o src/Core/Tree.cpp
 
+${OBJECTDIR}/src/Core/TreeSnapshot.o: src/Core/TreeSnapshot.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Core
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Core/TreeSnapshot.o src/Core/TreeSnapshot.cpp
+
+${OBJECTDIR}/src/Core/UIDAllocator.o: src/Core/UIDAllocator.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Core
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Core/UIDAllocator.o src/Core/UIDAllocator.cpp
+
 ${OBJECTDIR}/src/Interface/EntX.o: src/Interface/EntX.cpp
 	${MKDIR} -p ${OBJECTDIR}/src/Interface
 	${RM} "$@.d"
@@ -121,16 +222,61 @@ ${OBJECTDIR}/src/Interface/TreeInstance.o: src/Interface/TreeInstance.cpp
 	${RM} "$@.d"
 	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Interface/TreeInstance.o src/Interface/TreeInstance.cpp
 
+${OBJECTDIR}/src/Network/CoreServer.o: src/Network/CoreServer.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Network
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Network/CoreServer.o src/Network/CoreServer.cpp
+
 ${OBJECTDIR}/src/Network/EntsClient.o: src/Network/EntsClient.cpp
 	${MKDIR} -p ${OBJECTDIR}/src/Network
 	${RM} "$@.d"
 	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Network/EntsClient.o src/Network/EntsClient.cpp
 
+${OBJECTDIR}/src/Network/EntsFollower.o: src/Network/EntsFollower.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Network
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Network/EntsFollower.o src/Network/EntsFollower.cpp
+
+${OBJECTDIR}/src/Network/EntsProtocol.o: src/Network/EntsProtocol.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Network
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Network/EntsProtocol.o src/Network/EntsProtocol.cpp
+
 ${OBJECTDIR}/src/Network/EntsServer.o: src/Network/EntsServer.cpp
 	${MKDIR} -p ${OBJECTDIR}/src/Network
 	${RM} "$@.d"
 	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Network/EntsServer.o src/Network/EntsServer.cpp
 
+${OBJECTDIR}/src/Network/EntsService.o: src/Network/EntsService.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Network
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Network/EntsService.o src/Network/EntsService.cpp
+
+${OBJECTDIR}/src/Network/QueryCache.o: src/Network/QueryCache.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Network
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Network/QueryCache.o src/Network/QueryCache.cpp
+
+${OBJECTDIR}/src/Network/ReplicationSource.o: src/Network/ReplicationSource.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Network
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Network/ReplicationSource.o src/Network/ReplicationSource.cpp
+
+${OBJECTDIR}/src/Network/ShardCluster.o: src/Network/ShardCluster.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Network
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Network/ShardCluster.o src/Network/ShardCluster.cpp
+
+${OBJECTDIR}/src/Network/ShardRouter.o: src/Network/ShardRouter.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Network
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Network/ShardRouter.o src/Network/ShardRouter.cpp
+
+${OBJECTDIR}/src/Network/WatchHub.o: src/Network/WatchHub.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Network
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Network/WatchHub.o src/Network/WatchHub.cpp
+
 ${OBJECTDIR}/src/Util/EntsFile.o: src/Util/EntsFile.cpp
 	${MKDIR} -p ${OBJECTDIR}/src/Util
 	${RM} "$@.d"
@@ -141,6 +287,16 @@ ${OBJECTDIR}/src/Util/IO.o: src/Util/IO.cpp
 	${RM} "$@.d"
 	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Util/IO.o src/Util/IO.cpp
 
+${OBJECTDIR}/src/Util/Importer.o: src/Util/Importer.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Util
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Util/Importer.o src/Util/Importer.cpp
+
+${OBJECTDIR}/src/Util/LatencyHistogram.o: src/Util/LatencyHistogram.cpp
+	${MKDIR} -p ${OBJECTDIR}/src/Util
+	${RM} "$@.d"
+	$(COMPILE.cc) -O2 -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Util/LatencyHistogram.o src/Util/LatencyHistogram.cpp
+
 ${OBJECTDIR}/src/Util/Prime.o: src/Util/Prime.cpp
 	${MKDIR} -p ${OBJECTDIR}/src/Util
 	${RM} "$@.d"
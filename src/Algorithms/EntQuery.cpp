@@ -0,0 +1,844 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "EntQuery.h"
+#include "../Core/EntSetCache.h"
+#include <algorithm>
+#include <unordered_set>
+#include <random>
+#include <sstream>
+#include <cctype>
+
+using namespace std;
+
+EntQuery::EntQuery(TreeSnapshot&& snap, const string& text):
+        snapshot(std::move(snap)), averageAncestors(1), averageParents(1),
+        stopped(false), steps(0) {
+    
+    Tree* tree = snapshot.getTree();
+    treeSize = tree->getNameMap()->size();
+    highWater = tree->getUIDAllocator()->getHighWater();
+    setCache = tree->getSetCache();
+    
+    size_t at = 0;
+    root = parseUnion(text, &at);
+    while (at < text.size() && isspace((unsigned char) text[at]))
+        at++;
+    if (root != nullptr && at < text.size())
+        fail("Expected &, | or -", at);
+    if (!error.empty()) {
+        root.reset();
+        return;
+    }
+    
+    //A lone function has nothing to choose between, so it only needs samples
+    //if its walk runs out of budget.
+    if (!isRelation(root->type))
+        sample();
+    plan(root.get());
+}
+
+EntQuery::~EntQuery() {
+}
+
+
+static void skipSpace(const string& text, size_t* at) {
+    while (*at < text.size() && isspace((unsigned char) text[*at]))
+        (*at)++;
+}
+
+void EntQuery::fail(const string& why, size_t at) {
+    //Only the first problem is worth reporting. The rest follow from it.
+    if (error.empty())
+        error = why + " at character " + to_string(at + 1) + ".";
+}
+
+unique_ptr<EntQuery::Node> EntQuery::parseUnion(const string& text, size_t* at) {
+    
+    unique_ptr<Node> left = parseIntersection(text, at);
+    while (left != nullptr) {
+        skipSpace(text, at);
+        if (*at == text.size() || (text[*at] != '|' && text[*at] != '-'))
+            break;
+        unique_ptr<Node> node(new Node(text[*at] == '|' ? NODE_OR : NODE_EXCEPT));
+        (*at)++;
+        node->left = std::move(left);
+        node->right = parseIntersection(text, at);
+        if (node->right == nullptr)
+            return nullptr;
+        left = std::move(node);
+    }
+    return left;
+}
+
+unique_ptr<EntQuery::Node> EntQuery::parseIntersection(const string& text, size_t* at) {
+    
+    unique_ptr<Node> left = parseTerm(text, at);
+    while (left != nullptr) {
+        skipSpace(text, at);
+        if (*at == text.size() || text[*at] != '&')
+            break;
+        unique_ptr<Node> node(new Node(NODE_AND));
+        (*at)++;
+        node->left = std::move(left);
+        node->right = parseTerm(text, at);
+        if (node->right == nullptr)
+            return nullptr;
+        left = std::move(node);
+    }
+    return left;
+}
+
+unique_ptr<EntQuery::Node> EntQuery::parseTerm(const string& text, size_t* at) {
+    
+    skipSpace(text, at);
+    if (*at < text.size() && text[*at] == '(') {
+        (*at)++;
+        unique_ptr<Node> inside = parseUnion(text, at);
+        if (inside == nullptr)
+            return nullptr;
+        skipSpace(text, at);
+        if (*at == text.size() || text[*at] != ')') {
+            fail("Expected )", *at);
+            return nullptr;
+        }
+        (*at)++;
+        return inside;
+    }
+    
+    size_t start = *at;
+    string word;
+    while (*at < text.size() && isalpha((unsigned char) text[*at]))
+        word += char(tolower((unsigned char) text[(*at)++]));
+    
+    unique_ptr<Node> node;
+    if (word == "descendents" || word == "descendants")
+        node.reset(new Node(NODE_DESCENDENTS));
+    else if (word == "ancestors")
+        node.reset(new Node(NODE_ANCESTORS));
+    else if (word == "children")
+        node.reset(new Node(NODE_CHILDREN));
+    else if (word == "parents")
+        node.reset(new Node(NODE_PARENTS));
+    else if (word == "ent")
+        node.reset(new Node(NODE_ENT));
+    else {
+        fail(word.empty() ? "Expected a function, like descendents(Name),"
+                : "There's no function called \"" + word + "\"", start);
+        return nullptr;
+    }
+    
+    skipSpace(text, at);
+    if (*at == text.size() || text[*at] != '(') {
+        fail("Expected ( after " + word, *at);
+        return nullptr;
+    }
+    (*at)++;
+    size_t nameAt = *at;
+    if (!parseName(text, at, &node->name))
+        return nullptr;
+    skipSpace(text, at);
+    if (*at == text.size() || text[*at] != ')') {
+        fail("Expected )", *at);
+        return nullptr;
+    }
+    (*at)++;
+    
+    node->ent = snapshot.getEntPtrByName(node->name);
+    if (node->ent == nullptr) {
+        fail("There's no Ent called \"" + node->name + "\"", nameAt);
+        return nullptr;
+    }
+    return node;
+}
+
+bool EntQuery::parseName(const string& text, size_t* at, string* name) {
+    
+    skipSpace(text, at);
+    if (*at < text.size() && text[*at] == '"') {
+        size_t close = text.find('"', *at + 1);
+        if (close == string::npos) {
+            fail("Expected a closing \"", text.size());
+            return false;
+        }
+        name->assign(text, *at + 1, close - *at - 1);
+        *at = close + 1;
+    } else {
+        size_t close = text.find(')', *at);
+        if (close == string::npos)
+            close = text.size();
+        size_t end = close;
+        while (end > *at && isspace((unsigned char) text[end - 1]))
+            end--;
+        name->assign(text, *at, end - *at);
+        *at = close;
+    }
+    if (name->empty()) {
+        fail("Expected the name of an Ent", *at);
+        return false;
+    }
+    return true;
+}
+
+
+double EntQuery::estimateRelatives(Ent* ent, bool up, bool* exact) {
+    
+    uint64_t version = snapshot.getVersion();
+    unordered_set<Ent*> seen;
+    seen.insert(ent);
+    vector<Ent*> queue(1, ent);
+    size_t next = 0;
+    
+    //Breadth first, so the budget is spent on the nearest levels. It's
+    //short, apart from one long list maybe, so it's all under one guard.
+    EpochGuard guard;
+    while (next < queue.size() && seen.size() <= EST_BUDGET) {
+        Ent* at = queue[next++];
+        for (Ent* relative : at->getList(up ? RELATION_PARENT : RELATION_CHILD).view(version)) {
+            if (seen.insert(relative).second)
+                queue.push_back(relative);
+        }
+    }
+    
+    double found = seen.size() - 1;
+    *exact = next == queue.size();
+    if (*exact)
+        return found;
+    //Guess that the Ents still waiting lead to as many more each as the ones
+    //looked at so far did.
+    double waiting = queue.size() - next;
+    double guess = found + waiting * found / next;
+    return min(guess, double(max<size_t>(treeSize, 1) - 1));
+}
+
+void EntQuery::sample() {
+    
+    if (highWater == 0)
+        return;
+    
+    mt19937 random(snapshot.getVersion());
+    uint64_t version = snapshot.getVersion();
+    double ancestors = 0;
+    double parents = 0;
+    unordered_set<Ent*> above;
+    vector<Ent*> next;
+    //Only a few thousand Ents in all, so they're looked at under one guard.
+    EpochGuard guard;
+    
+    //UIDs can have gaps, so not every try finds one.
+    for (size_t tries = 0; tries < SAMPLES * 4 && samples.size() < SAMPLES; tries++) {
+        Ent* ent = snapshot.getEntPtrByUID(random() % highWater + 1);
+        if (ent == nullptr)
+            continue;
+        Sample sample;
+        sample.ent = ent;
+        for (Ent* parent : ent->getList(RELATION_PARENT).view(version))
+            sample.parents.push_back(parent);
+        above.clear();
+        next.assign(1, ent);
+        while (!next.empty()) {
+            Ent* at = next.back();
+            next.pop_back();
+            for (Ent* parent : at->getList(RELATION_PARENT).view(version)) {
+                if (above.insert(parent).second)
+                    next.push_back(parent);
+            }
+        }
+        sample.ancestors.assign(above.begin(), above.end());
+        sort(sample.ancestors.begin(), sample.ancestors.end());
+        ancestors += sample.ancestors.size();
+        parents += sample.parents.size();
+        samples.push_back(std::move(sample));
+    }
+    if (!samples.empty()) {
+        averageAncestors = max(1.0, ancestors / samples.size());
+        averageParents = max(1.0, parents / samples.size());
+    }
+}
+
+void EntQuery::trySamples(Node* node) {
+    
+    if (samples.empty())
+        return;
+    
+    Node* a = node->left.get();
+    Node* b = node->right.get();
+    if (!isRelation(node->type) && (!a->sampled || !b->sampled))
+        return;
+    
+    //Only small sets of ancestors are worth finding for this.
+    unordered_set<Ent*> above;
+    if (node->type == NODE_ANCESTORS) {
+        if (!node->exact)
+            return;
+        above = snapshot.getAncestors(node->ent);
+    } else if (node->type == NODE_PARENTS) {
+        vector<Ent*> parents = snapshot.getParents(node->ent);
+        above.insert(parents.begin(), parents.end());
+    }
+    
+    node->sampled = true;
+    node->hits.resize(samples.size());
+    for (size_t i = 0; i < samples.size(); i++) {
+        Sample& sample = samples[i];
+        bool hit;
+        switch (node->type) {
+            case NODE_ENT:
+                hit = sample.ent == node->ent;
+                break;
+            case NODE_DESCENDENTS:
+                hit = binary_search(sample.ancestors.begin(), sample.ancestors.end(),
+                        node->ent);
+                break;
+            case NODE_ANCESTORS:
+            case NODE_PARENTS:
+                hit = above.count(sample.ent) > 0;
+                break;
+            case NODE_CHILDREN:
+                hit = std::find(sample.parents.begin(), sample.parents.end(), node->ent)
+                        != sample.parents.end();
+                break;
+            case NODE_AND:
+                hit = a->hits[i] && b->hits[i];
+                break;
+            case NODE_OR:
+                hit = a->hits[i] || b->hits[i];
+                break;
+            default:
+                hit = a->hits[i] && !b->hits[i];
+                break;
+        }
+        node->hits[i] = hit;
+    }
+}
+
+size_t EntQuery::countHits(const Node* node) {
+    return std::count(node->hits.begin(), node->hits.end(), 1);
+}
+
+void EntQuery::markProbed(Node* node) {
+    node->probed = true;
+    if (node->left != nullptr)
+        markProbed(node->left.get());
+    if (node->right != nullptr)
+        markProbed(node->right.get());
+}
+
+void EntQuery::plan(Node* node) {
+    
+    if (isRelation(node->type)) {
+        node->exact = true;
+        switch (node->type) {
+            case NODE_ENT:
+                node->rows = 1;
+                node->testCost = 1;
+                break;
+            case NODE_CHILDREN: {
+                EpochGuard guard;
+                node->rows = node->ent->getList(RELATION_CHILD).size();
+                //Checked by looking for the Ent among the tested one's parents.
+                node->testCost = averageParents;
+                break;
+            }
+            case NODE_PARENTS: {
+                EpochGuard guard;
+                node->rows = node->ent->getList(RELATION_PARENT).size();
+                node->testCost = 1;
+                node->setupCost = node->rows;
+                break;
+            }
+            case NODE_ANCESTORS:
+                node->rows = estimateRelatives(node->ent, true, &node->exact);
+                node->testCost = 1;
+                node->setupCost = node->rows;
+                break;
+            default:
+                node->members = setCache == nullptr ? nullptr
+                        : setCache->peek(snapshot, node->ent);
+                if (node->members != nullptr) {
+                    node->cached = true;
+                    node->rows = node->members->size();
+                    node->testCost = 1;
+                    break;
+                }
+                node->rows = estimateRelatives(node->ent, false, &node->exact);
+                //Checked by walking up from the tested Ent.
+                node->testCost = averageAncestors;
+                break;
+        }
+        //The walk only gives a rough lower bound if it ran out of budget.
+        if (!node->exact && samples.empty())
+            sample();
+        trySamples(node);
+        if (!node->exact && node->sampled)
+            node->rows = min(max(node->rows, countHits(node) * scale()),
+                    double(max<size_t>(treeSize, 1) - 1));
+        node->cost = node->cached ? node->rows * SET_COST : node->rows;
+        return;
+    }
+    
+    Node* a = node->left.get();
+    Node* b = node->right.get();
+    plan(a);
+    plan(b);
+    trySamples(node);
+    
+    //Without knowing better, the sides are taken to be independent.
+    double both = a->rows * b->rows / max<size_t>(treeSize, 1);
+    if (node->sampled) {
+        size_t shared = 0;
+        for (size_t i = 0; i < samples.size(); i++)
+            shared += a->hits[i] && b->hits[i];
+        //No shared samples only says the overlap is fairly small.
+        both = shared > 0 ? shared * scale() : min(both, scale() / 2);
+    }
+    both = min(both, min(a->rows, b->rows));
+    node->testCost = a->testCost + b->testCost;
+    node->setupCost = a->setupCost + b->setupCost;
+    node->strategy = PLAN_BITMAP;
+    node->cost = a->cost + b->cost + (a->rows + b->rows) * SET_COST;
+    
+    double probeRight = a->cost + b->setupCost + a->rows * b->testCost;
+    double probeLeft = b->cost + a->setupCost + b->rows * a->testCost;
+    
+    if (node->type == NODE_AND) {
+        node->rows = both;
+        if (probeRight < node->cost) {
+            node->strategy = PLAN_PROBE_RIGHT;
+            node->cost = probeRight;
+        }
+        if (probeLeft < node->cost) {
+            node->strategy = PLAN_PROBE_LEFT;
+            node->cost = probeLeft;
+        }
+    } else if (node->type == NODE_OR) {
+        node->rows = a->rows + b->rows - both;
+    } else {
+        node->rows = a->rows - both;
+        if (probeRight < node->cost) {
+            node->strategy = PLAN_PROBE_RIGHT;
+            node->cost = probeRight;
+        }
+    }
+    
+    if (node->strategy == PLAN_PROBE_RIGHT)
+        markProbed(b);
+    else if (node->strategy == PLAN_PROBE_LEFT)
+        markProbed(a);
+}
+
+
+bool EntQuery::carryOn() {
+    if (!stopped && ++steps % 1024 == 0 && stopping && stopping())
+        stopped = true;
+    return !stopped;
+}
+
+bool EntQuery::stopNow() {
+    if (!stopped && stopping && stopping())
+        stopped = true;
+    return stopped;
+}
+
+bool EntQuery::run(vector<Ent*>* out, function<bool()> stop) {
+    
+    out->clear();
+    if (root == nullptr)
+        return false;
+    stopping = stop;
+    stopped = false;
+    shared_ptr<const EntSet> found = list(root.get());
+    if (stopped)
+        return false;
+    *out = snapshot.getEnts(*found);
+    return true;
+}
+
+shared_ptr<const EntSet> EntQuery::list(Node* node) {
+    shared_ptr<const EntSet> found = isRelation(node->type) ? relatives(node) : combine(node);
+    node->ran = true;
+    node->found = found->size();
+    return found;
+}
+
+shared_ptr<const EntSet> EntQuery::relatives(Node* node) {
+    
+    //Already read from the cache while planning.
+    if (node->members != nullptr)
+        return node->members;
+    
+    shared_ptr<EntSet> found = make_shared<EntSet>();
+    function<bool()> stop = [this]() { return stopNow(); };
+    
+    switch (node->type) {
+        case NODE_ENT:
+            found->insert(node->ent->getUID());
+            break;
+        case NODE_CHILDREN:
+        case NODE_PARENTS: {
+            bool up = node->type == NODE_PARENTS;
+            EpochGuard guard;
+            for (Ent* relative : node->ent->getList(up ? RELATION_PARENT : RELATION_CHILD).view(snapshot.getVersion()))
+                found->insert(relative->getUID());
+            break;
+        }
+        case NODE_ANCESTORS:
+            *found = snapshot.getAncestorSet(node->ent, stop);
+            break;
+        default:
+            if (setCache != nullptr)
+                return setCache->getDescendents(snapshot, node->ent, stop);
+            *found = snapshot.getDescendentSet(node->ent, stop);
+            break;
+    }
+    return found;
+}
+
+shared_ptr<const EntSet> EntQuery::combine(Node* node) {
+    
+    if (node->strategy == PLAN_PROBE_RIGHT || node->strategy == PLAN_PROBE_LEFT) {
+        bool right = node->strategy == PLAN_PROBE_RIGHT;
+        Node* tested = right ? node->right.get() : node->left.get();
+        bool keepIn = node->type != NODE_EXCEPT;
+        shared_ptr<EntSet> found = make_shared<EntSet>();
+        //In order of UID, so the set is only ever added to at the end.
+        for (Ent* ent : snapshot.getEnts(*list(right ? node->left.get() : node->right.get()))) {
+            if (!carryOn())
+                break;
+            if (test(tested, ent) == keepIn)
+                found->insert(ent->getUID());
+        }
+        return found;
+    }
+    
+    shared_ptr<const EntSet> a = list(node->left.get());
+    shared_ptr<const EntSet> b = list(node->right.get());
+    if (node->type == NODE_OR)
+        return make_shared<EntSet>(*a | *b);
+    if (node->type == NODE_AND)
+        return make_shared<EntSet>(*a & *b);
+    return make_shared<EntSet>(*a - *b);
+}
+
+bool EntQuery::test(Node* node, Ent* ent) {
+    
+    bool in;
+    switch (node->type) {
+        case NODE_ENT:
+            in = ent == node->ent;
+            break;
+        case NODE_CHILDREN: {
+            EpochGuard guard;
+            in = false;
+            for (Ent* parent : ent->getList(RELATION_PARENT).view(snapshot.getVersion())) {
+                if (parent == node->ent) {
+                    in = true;
+                    break;
+                }
+            }
+            break;
+        }
+        case NODE_PARENTS:
+        case NODE_ANCESTORS:
+            if (node->members == nullptr)
+                node->members = relatives(node);
+            in = node->members->contains(ent->getUID());
+            break;
+        case NODE_DESCENDENTS:
+            in = node->members != nullptr ? node->members->contains(ent->getUID())
+                    : isUnder(node, ent);
+            break;
+        case NODE_AND:
+            in = test(node->left.get(), ent) && test(node->right.get(), ent);
+            break;
+        case NODE_OR:
+            in = test(node->left.get(), ent) || test(node->right.get(), ent);
+            break;
+        default:
+            in = test(node->left.get(), ent) && !test(node->right.get(), ent);
+            break;
+    }
+    node->tested++;
+    if (in)
+        node->found++;
+    return in;
+}
+
+bool EntQuery::isUnder(Node* node, Ent* ent) {
+    
+    if (ent == node->ent || node->outside.contains(ent->getUID()))
+        return false;
+    if (node->under.contains(ent->getUID()))
+        return true;
+    
+    uint64_t version = snapshot.getVersion();
+    unordered_set<Ent*> seen;
+    seen.insert(ent);
+    vector<Ent*> next(1, ent);
+    while (!next.empty() && carryOn()) {
+        Ent* at = next.back();
+        next.pop_back();
+        EpochGuard guard;
+        for (Ent* parent : at->getList(RELATION_PARENT).view(version)) {
+            if (parent == node->ent || node->under.contains(parent->getUID())) {
+                //at is on the way up, so it's under the Ent too. Its other
+                //children will find it.
+                node->under.insert(at->getUID());
+                node->under.insert(ent->getUID());
+                return true;
+            }
+            if (!node->outside.contains(parent->getUID()) && seen.insert(parent).second)
+                next.push_back(parent);
+        }
+    }
+    if (stopped)
+        return false;
+    
+    //Everything above these was looked at, and none of it was the Ent.
+    for (Ent* looked : seen)
+        node->outside.insert(looked->getUID());
+    return false;
+}
+
+
+/**
+ * Rounds an estimate for showing.
+ */
+static string roughly(double amount) {
+    ostringstream out;
+    if (amount < 10 && amount != double(size_t(amount)))
+        out.precision(2);
+    else
+        out.precision(0);
+    out << fixed << amount;
+    return out.str();
+}
+
+string EntQuery::explain() const {
+    string out;
+    if (root != nullptr)
+        explain(root.get(), 0, &out);
+    return out;
+}
+
+void EntQuery::explain(const Node* node, int depth, string* out) const {
+    
+    static const char* functions[] = {"ent", "descendents", "ancestors", "children", "parents"};
+    static const char* operators[] = {"and", "or", "except"};
+    
+    ostringstream line;
+    line << string(depth * 2, ' ');
+    if (isRelation(node->type))
+        line << functions[node->type] << "(" << node->name << ")";
+    else
+        line << operators[node->type - NODE_AND];
+    line << ": ";
+    
+    if (node->probed) {
+        if (!isRelation(node->type))
+            line << "test both sides";
+        else if (node->cached)
+            line << "test against the cached set";
+        else if (node->type == NODE_DESCENDENTS)
+            line << "test by walking up";
+        else if (node->type == NODE_CHILDREN)
+            line << "test by reading parents";
+        else if (node->type == NODE_ENT)
+            line << "test";
+        else
+            line << "test against a set";
+        line << ", ~" << roughly(node->testCost) << " per test";
+        if (node->setupCost > 0)
+            line << " after ~" << roughly(node->setupCost) << " up front";
+        if (node->tested > 0)
+            line << ". " << node->found << " of " << node->tested << " passed";
+    } else {
+        if (node->cached)
+            line << "read from the set cache";
+        else if (node->type == NODE_DESCENDENTS || node->type == NODE_ANCESTORS)
+            line << "walk";
+        else if (isRelation(node->type))
+            line << "list";
+        else if (node->strategy == PLAN_BITMAP)
+            line << "list both sides, combine the sets";
+        else if (node->strategy == PLAN_PROBE_RIGHT)
+            line << "list left side, test against right";
+        else
+            line << "list right side, test against left";
+        line << ", " << (node->exact ? "" : "~") << roughly(node->rows) << " Ents, cost ~"
+                << roughly(node->cost);
+        if (node->ran)
+            line << ". Found " << node->found;
+    }
+    
+    *out += line.str() + "\n";
+    if (node->left != nullptr)
+        explain(node->left.get(), depth + 1, out);
+    if (node->right != nullptr)
+        explain(node->right.get(), depth + 1, out);
+}
+
+string EntQuery::check() {
+    
+    //Parents are picked mostly from the first Ents, so those have most of
+    //the Tree under them, and the planner has big and small sides to weigh.
+    mt19937 random(48);
+    Tree tree("Query check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 4000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        tree.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 50 == 0) {
+            Ent::connectUnchecked(tree.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[min(random() % ents.size(), random() % ents.size())];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    
+    auto relatives = [](TreeSnapshot& snapshot, Ent* ent, bool up) {
+        unordered_set<Ent*> found;
+        vector<Ent*> queue(1, ent);
+        for (size_t at = 0; at < queue.size(); at++) {
+            for (Ent* next : up ? snapshot.getParents(queue[at]) : snapshot.getChildren(queue[at])) {
+                if (found.insert(next).second)
+                    queue.push_back(next);
+            }
+        }
+        return found;
+    };
+    
+    //A random query, bracketed so it doesn't lean on precedence, along with
+    //its answer.
+    typedef pair<string, unordered_set<Ent*> > Part;
+    function<Part(TreeSnapshot&, int)> make = [&](TreeSnapshot& snapshot, int depth) {
+        Part part;
+        if (depth == 0 || random() % 3 == 0) {
+            Ent* ent = ents[random() % (random() % 2 ? 50 : ents.size())];
+            const char* names[] = {"ent", "descendents", "descendants", "ancestors",
+                    "children", "parents"};
+            int function = random() % 6;
+            part.first = string(names[function]) + "(" + ent->getName() + ")";
+            vector<Ent*> list;
+            switch (function) {
+                case 0:
+                    part.second.insert(ent);
+                    break;
+                case 1:
+                case 2:
+                    part.second = relatives(snapshot, ent, false);
+                    break;
+                case 3:
+                    part.second = relatives(snapshot, ent, true);
+                    break;
+                case 4:
+                    list = snapshot.getChildren(ent);
+                    part.second.insert(list.begin(), list.end());
+                    break;
+                default:
+                    list = snapshot.getParents(ent);
+                    part.second.insert(list.begin(), list.end());
+            }
+            return part;
+        }
+        Part left = make(snapshot, depth - 1);
+        Part right = make(snapshot, depth - 1);
+        const char* operators[] = {" & ", " | ", " - ", "&", "|", "-"};
+        int op = random() % 6;
+        part.first = "(" + left.first + operators[op] + right.first + ")";
+        for (Ent* ent : left.second) {
+            bool inRight = right.second.count(ent) == 1;
+            if ((op % 3 == 0 && inRight) || op % 3 == 1 || (op % 3 == 2 && !inRight))
+                part.second.insert(ent);
+        }
+        if (op % 3 == 1)
+            part.second.insert(right.second.begin(), right.second.end());
+        return part;
+    };
+    
+    auto ask = [&tree](const string& text, unordered_set<Ent*>* answer) -> string {
+        EntQuery query(tree.snapshot(), text);
+        if (!query.isValid())
+            return "\"" + text + "\" wasn't taken as a query: " + query.getError();
+        vector<Ent*> found;
+        if (!query.run(&found))
+            return "\"" + text + "\" gave up";
+        answer->insert(found.begin(), found.end());
+        if (answer->size() != found.size())
+            return "\"" + text + "\" found some Ents twice";
+        return "";
+    };
+    
+    for (int cached = 0; cached < 2; cached++) {
+        if (cached)
+            tree.startSetCache();
+        TreeSnapshot snapshot = tree.snapshot();
+        for (int i = 0; i < 200; i++) {
+            Part part = make(snapshot, 1 + random() % 3);
+            unordered_set<Ent*> answer;
+            string failure = ask(part.first, &answer);
+            if (!failure.empty())
+                return failure;
+            if (answer != part.second)
+                return "\"" + part.first + "\" found " + to_string(answer.size())
+                        + " Ents, not " + to_string(part.second.size())
+                        + (cached ? ", with a set cache" : "");
+        }
+    }
+    
+    //& goes first, and the others left to right.
+    Ent* a = ents[1];
+    Ent* b = ents[2];
+    Ent* c = ents[3];
+    string names[] = {"descendents(" + a->getName() + ")", "descendents(" + b->getName() + ")",
+            "children(" + c->getName() + ")"};
+    TreeSnapshot snapshot = tree.snapshot();
+    unordered_set<Ent*> x = relatives(snapshot, a, false), y = relatives(snapshot, b, false);
+    vector<Ent*> list = snapshot.getChildren(c);
+    unordered_set<Ent*> z(list.begin(), list.end());
+    unordered_set<Ent*> expected[3];
+    for (Ent* ent : x) {
+        if (!y.count(ent) || z.count(ent))
+            expected[1].insert(ent);
+        if (!y.count(ent) && !z.count(ent))
+            expected[2].insert(ent);
+    }
+    for (Ent* ent : y) {
+        if (z.count(ent))
+            expected[0].insert(ent);
+    }
+    expected[0].insert(x.begin(), x.end());
+    expected[1].insert(z.begin(), z.end());
+    string texts[] = {names[0] + " | " + names[1] + " & " + names[2],
+            names[0] + " - " + names[1] + " | " + names[2],
+            names[0] + " - " + names[1] + " - " + names[2]};
+    for (int i = 0; i < 3; i++) {
+        unordered_set<Ent*> answer;
+        string failure = ask(texts[i], &answer);
+        if (!failure.empty())
+            return failure;
+        if (answer != expected[i])
+            return "\"" + texts[i] + "\" was read in the wrong order";
+    }
+    
+    return "";
+}
@@ -0,0 +1,343 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ENTQUERY_H
+#define ENTQUERY_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include "../Core/Tree.h"
+#include "../Core/EntSet.h"
+
+using namespace std;
+
+/**
+ * The parts a query is made of.
+ */
+typedef enum {
+    /** Just the named Ent. */
+    NODE_ENT,
+    NODE_DESCENDENTS,
+    NODE_ANCESTORS,
+    NODE_CHILDREN,
+    NODE_PARENTS,
+    /** Ents in both sides, written &. */
+    NODE_AND,
+    /** Ents in either side, written |. */
+    NODE_OR,
+    /** Ents in the left side but not the right, written -. */
+    NODE_EXCEPT
+} QueryNodeType;
+
+/**
+ * How the planner has a part of a query listed.
+ */
+typedef enum {
+    /** Read the Ent's list, or walk its relatives. */
+    PLAN_WALK,
+    /** List both sides as EntSets and combine them. */
+    PLAN_BITMAP,
+    /** List the left side and test each of its Ents against the right. */
+    PLAN_PROBE_RIGHT,
+    /** List the right side and test each of its Ents against the left. */
+    PLAN_PROBE_LEFT
+} PlanStrategy;
+
+/**
+ * A question about a Tree asked in a few words instead of code, like
+ *
+ *      descendents(Dogs) & descendents(Pets) - descendents(Small)
+ *
+ * which is the Ents under both Dogs and Pets but not under Small. The
+ * functions are descendents (or descendants), ancestors, children, parents
+ * and ent, which is just the Ent itself. Each takes an Ent's name, which can
+ * be put in double quotes if it has brackets in it. & binds tighter than |
+ * and -, which go left to right, and brackets group as usual.
+ *
+ * The query is planned when it's made. Each part gets an estimate of how
+ * many Ents it has. It's exact for an Ent's own lists, and for descendents
+ * and ancestors when a walk of EST_BUDGET relatives finds them all. Past
+ * that it comes from SAMPLES Ents picked at random: whichever of them are
+ * under the Ent stand for the same share of the Tree. Samples are also
+ * tried against &, | and -, so sides that overlap a lot, like Ents under
+ * Dogs and under Animals, aren't taken as independent. From the estimates,
+ * each & and - picks whether to list both sides and combine them, or to
+ * list one side and test its Ents against the other. Every part is listed
+ * as an EntSet, so combining two is cheap, a word at a time where they're
+ * dense. Testing is cheaper still when the other side can be checked
+ * without listing it: whether an Ent is under Dogs is found by walking up
+ * from it, and whether it's a child of Dogs by reading its parents. So
+ * "descendents(Pets) & descendents(Dogs)", with a small Pets and a huge
+ * Dogs, never walks all of Dogs. | always lists both sides.
+ *
+ * If the Tree has an EntSetCache, descendents are read from it, and a
+ * popular Ent's are already there. The planner counts those as almost free.
+ *
+ * It all reads a snapshot, so the plan and the answer see the same Tree,
+ * whatever Writers do meanwhile.
+ */
+class EntQuery {
+
+    /**
+     * An Ent picked at random for the planner to try parts of the query on.
+     */
+    struct Sample {
+        Ent* ent;
+        vector<Ent*> parents;
+        /** Sorted, to be searched. */
+        vector<Ent*> ancestors;
+    };
+
+    struct Node {
+        QueryNodeType type;
+        /** The Ent a function was given. */
+        string name;
+        Ent* ent;
+        unique_ptr<Node> left;
+        unique_ptr<Node> right;
+
+        //From the planner.
+        PlanStrategy strategy;
+        /** Whether its parent tests Ents against it instead of listing it. */
+        bool probed;
+        /** How many Ents it's thought to have. */
+        double rows;
+        bool exact;
+        /** For descendents, whether the Tree's EntSetCache has them. */
+        bool cached;
+        /** Roughly how many Ents are looked at to list it. */
+        double cost;
+        /** The same, to test one Ent against it. */
+        double testCost;
+        /** The same, up front before testing against it. */
+        double setupCost;
+        /**
+         * Whether each of the samples is in it, if that could be worked out
+         * cheaply.
+         */
+        bool sampled;
+        vector<char> hits;
+
+        //From run().
+        bool ran;
+        /** How many Ents it listed, or how many passed when tested. */
+        size_t found;
+        size_t tested;
+        /** Its Ents, listed up front for testing against. */
+        shared_ptr<const EntSet> members;
+        /**
+         * For descendents walked up to, the Ents known to be under the Ent,
+         * and known not to be.
+         */
+        EntSet under;
+        EntSet outside;
+
+        Node(QueryNodeType t): type(t), ent(nullptr), strategy(PLAN_WALK),
+                probed(false), rows(0), exact(false), cached(false), cost(0), testCost(0),
+                setupCost(0), sampled(false), ran(false), found(0), tested(0) {}
+    };
+
+    TreeSnapshot snapshot;
+    unique_ptr<Node> root;
+    string error;
+    /**
+     * How many Ents the Tree has.
+     */
+    size_t treeSize;
+    /** The highest UID handed out, for picking samples. */
+    size_t highWater;
+    /** The Tree's, if it has one. */
+    EntSetCache* setCache;
+    vector<Sample> samples;
+    /**
+     * How many ancestors and parents the samples have.
+     */
+    double averageAncestors;
+    double averageParents;
+
+    /**
+     * Checked every so often by run(), which gives up once it says so.
+     */
+    function<bool()> stopping;
+    bool stopped;
+    size_t steps;
+
+    //The parser. Each sets error and returns nullptr if the text is wrong.
+    unique_ptr<Node> parseUnion(const string& text, size_t* at);
+    unique_ptr<Node> parseIntersection(const string& text, size_t* at);
+    unique_ptr<Node> parseTerm(const string& text, size_t* at);
+    bool parseName(const string& text, size_t* at, string* name);
+    void fail(const string& why, size_t at);
+
+    /**
+     * Fills in the estimates and strategy of a node and all below it.
+     */
+    void plan(Node* node);
+
+    /**
+     * Counts the relatives of an Ent, or guesses from the first EST_BUDGET
+     * if there are more.
+     * @return          The count, or the guess.
+     */
+    double estimateRelatives(Ent* ent, bool up, bool* exact);
+
+    /**
+     * Picks the samples, and works out averageAncestors and averageParents
+     * from them.
+     */
+    void sample();
+
+    /**
+     * Works out which samples are in a node, if it can.
+     */
+    void trySamples(Node* node);
+
+    /**
+     * How many Ents each sample stands for.
+     */
+    double scale() const {
+        return samples.empty() ? 0 : double(treeSize) / samples.size();
+    }
+
+    /**
+     * How many of the samples are in a node.
+     */
+    static size_t countHits(const Node* node);
+
+    /**
+     * Lists the Ents of a node.
+     */
+    shared_ptr<const EntSet> list(Node* node);
+
+    /**
+     * Lists the relatives a function node stands for.
+     */
+    shared_ptr<const EntSet> relatives(Node* node);
+
+    /**
+     * Lists the Ents of an &, | or - node, the way it was planned.
+     */
+    shared_ptr<const EntSet> combine(Node* node);
+
+    /**
+     * Whether an Ent is in a node's set.
+     */
+    bool test(Node* node, Ent* ent);
+
+    /**
+     * Whether an Ent is under another, by walking up from it. Remembers what
+     * it learns in the node's sets, so later tests can stop early.
+     */
+    bool isUnder(Node* node, Ent* ent);
+
+    /**
+     * Counts a step of work.
+     * @return          false once it's time to stop.
+     */
+    bool carryOn();
+
+    /**
+     * For walks done elsewhere to check, every so often.
+     * @return          true once it's time to stop.
+     */
+    bool stopNow();
+
+    void explain(const Node* node, int depth, string* out) const;
+
+    /**
+     * Has a node, and everything in it, tested against instead of listed.
+     */
+    static void markProbed(Node* node);
+
+    static bool isRelation(QueryNodeType type) {
+        return type <= NODE_PARENTS;
+    }
+
+public:
+
+    /**
+     * How many relatives estimates look at before guessing the rest.
+     */
+    static const size_t EST_BUDGET = 256;
+    /**
+     * How many Ents are sampled for planning.
+     */
+    static const size_t SAMPLES = 256;
+    /**
+     * What combining sets costs for each Ent in them, next to looking at an
+     * Ent while walking.
+     */
+    static constexpr double SET_COST = 0.1;
+
+    /**
+     * Parses a query and plans it.
+     * @param snapshot  The version of the Tree to ask. The query keeps it.
+     * @param text      The query.
+     */
+    EntQuery(TreeSnapshot&& snapshot, const string& text);
+
+    ~EntQuery();
+
+    /**
+     * Whether the text was a query, naming Ents the Tree has.
+     */
+    bool isValid() const {
+        return root != nullptr;
+    }
+
+    /**
+     * What's wrong with the text, if it isn't valid.
+     */
+    const string& getError() const {
+        return error;
+    }
+
+    /**
+     * Carries the plan out. Meant to be done once.
+     * @param out       Where to put the Ents found. They're in no particular
+     *                  order, and each is there once.
+     * @param stop      Called now and then. Once it returns true the query
+     *                  gives up.
+     * @return          false if it gave up, or isn't valid.
+     */
+    bool run(vector<Ent*>* out, function<bool()> stop = nullptr);
+
+    /**
+     * The plan, one part to a line, indented under what it's part of. Each
+     * line has how the part is listed or tested, and its estimates. Once
+     * it's been run, also how many Ents each part really had.
+     */
+    string explain() const;
+
+    TreeSnapshot& getSnapshot() {
+        return snapshot;
+    }
+
+    /**
+     * Runs made up queries on a made up Tree, with and without an
+     * EntSetCache, and compares the answers with working out each part
+     * straight from the snapshot.
+     * @return          "" if they agree, otherwise what went wrong.
+     */
+    static string check();
+
+};
+
+#endif /* ENTQUERY_H */
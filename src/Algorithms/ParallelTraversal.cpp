@@ -0,0 +1,368 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ParallelTraversal.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+using namespace std;
+
+ParallelTraversal::ParallelTraversal(unsigned int threadCount): version(LATEST_VERSION), job(0),
+        working(0), stopping(false), idle(0) {
+    
+    if (threadCount == 0)
+        threadCount = max(1u, thread::hardware_concurrency());
+    for (unsigned int i = 0; i < threadCount; i++)
+        workers.push_back(unique_ptr<Worker>(new Worker()));
+    //Worker 0 is whoever calls.
+    for (unsigned int i = 1; i < threadCount; i++)
+        threads.push_back(thread(&ParallelTraversal::threadMain, this, i));
+}
+
+ParallelTraversal::~ParallelTraversal() {
+    {
+        lock_guard<mutex> hold(jobLock);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (thread& t : threads)
+        t.join();
+}
+
+void ParallelTraversal::threadMain(unsigned int index) {
+    
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            unique_lock<mutex> hold(jobLock);
+            jobReady.wait(hold, [&] { return stopping || job != seen; });
+            if (stopping)
+                return;
+            seen = job;
+        }
+        {
+            //Keeps the lists it walks from being freed under it.
+            EpochGuard guard;
+            work(workers[index].get());
+        }
+        {
+            lock_guard<mutex> hold(jobLock);
+            working--;
+        }
+        jobDone.notify_all();
+    }
+}
+
+bool ParallelTraversal::mark(Ent* ent) {
+    
+    size_t uid = ent->getUID();
+    size_t page = uid / PAGE_SIZE;
+    if (uid == 0 || page >= visited.size()) {
+        lock_guard<mutex> hold(strayLock);
+        return strays.insert(ent).second;
+    }
+    atomic<uint64_t>* words = visited[page].load(memory_order_acquire);
+    if (words == nullptr)
+        words = makePage(page);
+    atomic<uint64_t>& word = words[uid % PAGE_SIZE / 64];
+    uint64_t bit = uint64_t(1) << (uid % 64);
+    //Checking first saves the atomic or, which is slower, for Ents with
+    //several parents found more than once.
+    if (word.load(memory_order_relaxed) & bit)
+        return false;
+    return (word.fetch_or(bit, memory_order_relaxed) & bit) == 0;
+}
+
+atomic<uint64_t>* ParallelTraversal::makePage(size_t page) {
+    
+    atomic<uint64_t>* made = new atomic<uint64_t>[PAGE_SIZE / 64];
+    for (size_t i = 0; i < PAGE_SIZE / 64; i++)
+        made[i].store(0, memory_order_relaxed);
+    atomic<uint64_t>* found = nullptr;
+    if (!visited[page].compare_exchange_strong(found, made, memory_order_acq_rel)) {
+        delete[] made;
+        return found;
+    }
+    lock_guard<mutex> hold(pageLock);
+    pagesMade.push_back(page);
+    return made;
+}
+
+void ParallelTraversal::push(Worker* w, Run run) {
+    
+    w->local.push_back(run);
+    //Give others something to steal if they've taken it all.
+    if (w->local.size() > 1 && w->sharedCount.load(memory_order_relaxed) == 0) {
+        size_t half = w->local.size() / 2;
+        lock_guard<mutex> hold(w->lock);
+        //The oldest runs are nearest the top, so they're likely the biggest.
+        w->shared.insert(w->shared.end(), w->local.begin(), w->local.begin() + half);
+        w->sharedCount.store(w->shared.size(), memory_order_relaxed);
+        w->local.erase(w->local.begin(), w->local.begin() + half);
+    }
+}
+
+bool ParallelTraversal::steal(Worker* w, Run* run) {
+    
+    //Its own first, from the back. Then others', from the front.
+    if (w->sharedCount.load(memory_order_relaxed) != 0) {
+        lock_guard<mutex> hold(w->lock);
+        if (!w->shared.empty()) {
+            *run = w->shared.back();
+            w->shared.pop_back();
+            w->sharedCount.store(w->shared.size(), memory_order_relaxed);
+            return true;
+        }
+    }
+    size_t n = workers.size();
+    size_t self = w - workers[0].get();
+    for (size_t i = 1; i < n; i++) {
+        Worker* victim = workers[(self + i) % n].get();
+        if (victim == w || victim->sharedCount.load(memory_order_relaxed) == 0)
+            continue;
+        lock_guard<mutex> hold(victim->lock);
+        if (!victim->shared.empty()) {
+            *run = victim->shared.front();
+            victim->shared.pop_front();
+            victim->sharedCount.store(victim->shared.size(), memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ParallelTraversal::work(Worker* w) {
+    
+    size_t n = workers.size();
+    for (;;) {
+        while (!w->local.empty()) {
+            Run run = w->local.back();
+            w->local.pop_back();
+            process(w, run);
+        }
+        Run run;
+        if (steal(w, &run)) {
+            process(w, run);
+            continue;
+        }
+        //Out of work. Once every worker is, there's none left anywhere,
+        //since only a busy worker can share more.
+        idle.fetch_add(1);
+        for (;;) {
+            if (idle.load() == n)
+                return;
+            //Count itself busy again before stealing, so the others don't
+            //finish while it holds what it stole.
+            idle.fetch_sub(1);
+            if (steal(w, &run))
+                break;
+            idle.fetch_add(1);
+            this_thread::yield();
+        }
+        process(w, run);
+    }
+}
+
+void ParallelTraversal::process(Worker* w, Run run) {
+    
+    while (size_t(run.end - run.begin) > SPLIT_AT) {
+        const EntEdge* middle = run.begin + (run.end - run.begin) / 2;
+        push(w, Run{middle, run.end});
+        run.end = middle;
+    }
+    for (EntEdgeIterator it(run.begin, run.end, version), end(run.end,
+            run.end, version); it != end; ++it) {
+        Ent* child = *it;
+        if (!mark(child))
+            continue;
+        w->found.push_back(child);
+        EntListView below = child->getList(RELATION_CHILD).view(version);
+        if (!below.empty())
+            push(w, Run{below.begin().getEdge(), below.end().getEdge()});
+    }
+}
+
+vector<Ent*> ParallelTraversal::getDescendentList(Tree* tree, Ent* ent, uint64_t v) {
+    
+    EpochGuard guard;
+    version = v;
+    
+    //A place for a page for every UID handed out so far. The pages
+    //themselves are made as they're needed.
+    size_t pages = tree->getUIDAllocator()->getHighWater() / PAGE_SIZE + 1;
+    if (visited.size() < pages) {
+        visited = vector<atomic<atomic<uint64_t>*> >(pages);
+        for (atomic<atomic<uint64_t>*>& page : visited)
+            page.store(nullptr, memory_order_relaxed);
+    }
+    strays.clear();
+    idle.store(0);
+    
+    Worker* caller = workers[0].get();
+    EntListView children = ent->getList(RELATION_CHILD).view(version);
+    if (!children.empty())
+        caller->local.push_back(Run{children.begin().getEdge(), children.end().getEdge()});
+    
+    {
+        lock_guard<mutex> hold(jobLock);
+        job++;
+        working = threads.size();
+    }
+    jobReady.notify_all();
+    work(caller);
+    {
+        unique_lock<mutex> hold(jobLock);
+        jobDone.wait(hold, [this] { return working == 0; });
+    }
+    
+    size_t total = 0;
+    for (unique_ptr<Worker>& w : workers)
+        total += w->found.size();
+    vector<Ent*> found;
+    found.reserve(total);
+    for (unique_ptr<Worker>& w : workers) {
+        found.insert(found.end(), w->found.begin(), w->found.end());
+        w->found.clear();
+    }
+    for (size_t page : pagesMade) {
+        delete[] visited[page].load(memory_order_relaxed);
+        visited[page].store(nullptr, memory_order_relaxed);
+    }
+    pagesMade.clear();
+    return found;
+}
+
+unordered_set<Ent*> ParallelTraversal::getDescendents(Tree* tree, Ent* ent, uint64_t v) {
+    vector<Ent*> found = getDescendentList(tree, ent, v);
+    return unordered_set<Ent*>(found.begin(), found.end());
+}
+
+vector<Ent*> ParallelTraversal::getDescendentListSequential(Ent* ent) {
+    
+    EpochGuard guard;
+    unordered_set<Ent*> seen;
+    vector<Ent*> found;
+    vector<Ent*> pending(1, ent);
+    while (!pending.empty()) {
+        Ent* next = pending.back();
+        pending.pop_back();
+        for (Ent* child : next->getList(RELATION_CHILD).view()) {
+            if (seen.insert(child).second) {
+                found.push_back(child);
+                pending.push_back(child);
+            }
+        }
+    }
+    return found;
+}
+
+TraversalBenchmark ParallelTraversal::benchmark(Tree* tree, Ent* ent, unsigned int threadCount) {
+    
+    TraversalBenchmark result;
+    ParallelTraversal pool(threadCount);
+    result.threads = pool.getThreadCount();
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<Ent*> sequential = getDescendentListSequential(ent);
+    chrono::steady_clock::time_point middle = chrono::steady_clock::now();
+    vector<Ent*> parallel = pool.getDescendentList(tree, ent);
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    
+    result.found = parallel.size();
+    result.sequentialSeconds = chrono::duration<double>(middle - start).count();
+    result.parallelSeconds = chrono::duration<double>(end - middle).count();
+    
+    sort(sequential.begin(), sequential.end());
+    sort(parallel.begin(), parallel.end());
+    result.agree = sequential == parallel;
+    
+    return result;
+}
+
+string ParallelTraversal::check() {
+    
+    //Ent::getDescendents() follows every path and stops 10 deep, so the
+    //Tree is kept shallow, with Ents taking parents from the layer above.
+    //UIDs are spread out so the walk marks them across several pages.
+    mt19937 random(35);
+    Tree tree("Traversal check");
+    vector<vector<Ent*> > layers;
+    vector<Ent*> ents;
+    const unsigned int sizes[] = {20, 100, 400, 1500, 4000};
+    for (unsigned int size : sizes) {
+        vector<Ent*> layer;
+        for (unsigned int i = 0; i < size; i++) {
+            Ent* ent = new Ent();
+            ent->setName("e" + to_string(ents.size()));
+            ent->setUID(2 + ents.size() * 37);
+            tree.addEntToNameMapUnattached(ent);
+            if (layers.empty()) {
+                Ent::connectUnchecked(tree.getRoot(), ent);
+            } else {
+                for (unsigned int n = random() % 2; n < 2; n++) {
+                    Ent* parent = layers.back()[random() % layers.back().size()];
+                    if (!ent->isChildOf(parent))
+                        Ent::connectUnchecked(parent, ent);
+                }
+            }
+            layer.push_back(ent);
+            ents.push_back(ent);
+        }
+        layers.push_back(layer);
+    }
+    
+    //The pools are reused after the edits, so whatever one traversal
+    //marked mustn't be left over for the next.
+    vector<unique_ptr<ParallelTraversal> > pools;
+    for (unsigned int threads : {1u, 2u, 4u})
+        pools.push_back(unique_ptr<ParallelTraversal>(new ParallelTraversal(threads)));
+    
+    for (int round = 0; round < 2; round++) {
+        vector<Ent*> starts = {tree.getRoot()};
+        for (int i = 0; i < 10; i++)
+            starts.push_back(ents[random() % ents.size()]);
+        for (Ent* start : starts) {
+            unordered_set<Ent*> expected = start->getDescendents();
+            for (unique_ptr<ParallelTraversal>& pool : pools) {
+                vector<Ent*> found = pool->getDescendentList(&tree, start);
+                unordered_set<Ent*> foundSet(found.begin(), found.end());
+                if (foundSet.size() != found.size())
+                    return "found some of " + start->getName() + "'s descendents twice";
+                if (foundSet != expected)
+                    return to_string(pool->getThreadCount()) + " threads found "
+                            + to_string(found.size()) + " below " + start->getName()
+                            + ", not " + to_string(expected.size());
+            }
+        }
+        
+        //Cut some Ents off from a parent and give others a new one.
+        for (int i = 0; i < 500; i++) {
+            size_t l = 1 + random() % (layers.size() - 1);
+            Ent* child = layers[l][random() % layers[l].size()];
+            vector<Ent*> parents = child->getParents();
+            if (parents.size() > 1)
+                Ent::disconnectUnchecked(parents[random() % parents.size()], child);
+            Ent* parent = layers[l - 1][random() % layers[l - 1].size()];
+            if (!child->isChildOf(parent))
+                Ent::connectUnchecked(parent, child);
+        }
+    }
+    
+    return "";
+}
@@ -0,0 +1,228 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLELTRAVERSAL_H
+#define PARALLELTRAVERSAL_H
+
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include "../Core/Tree.h"
+#include "../Core/CacheAligned.h"
+
+using namespace std;
+
+/**
+ * Timings from ParallelTraversal::benchmark(), comparing one thread walking
+ * the descendents of an Ent with the pool doing it.
+ */
+struct TraversalBenchmark {
+    size_t found;
+    unsigned int threads;
+    double sequentialSeconds;
+    double parallelSeconds;
+    /** Whether both found exactly the same Ents. */
+    bool agree;
+};
+
+/**
+ * Finds all the descendents of an Ent using a pool of threads, for Trees too
+ * big to walk on one thread.
+ *
+ * Work is handed out as runs of an Ent's children. Each thread keeps its own
+ * stack of runs and works on the newest, so it mostly stays near what it
+ * just looked at. When its shared deque is empty it moves its oldest runs
+ * there, and threads that run out of work steal from the front of another's
+ * deque. Long runs, like root's children, are split in half before they're
+ * worked on, so they get spread around too.
+ *
+ * Ents are marked in a bitmap indexed by UID as they're found, with an
+ * atomic or, so only the thread that marks one first goes on below it. Each
+ * thread keeps what it found in its own buffer, and the buffers are joined
+ * at the end.
+ *
+ * The threads are kept between calls. The calling thread works too, so a
+ * pool of n threads starts n - 1 of its own. Only one traversal runs on a
+ * pool at a time. It's safe while other threads edit the Tree, but an Ent
+ * moved while it runs may be missed, unless it walks a snapshot's version.
+ */
+class ParallelTraversal {
+
+    /**
+     * Some of the edges of one Ent's children list.
+     */
+    struct Run {
+        const EntEdge* begin;
+        const EntEdge* end;
+    };
+
+    /**
+     * The version of the Tree being walked.
+     */
+    uint64_t version;
+
+    struct alignas(64) Worker : CacheAligned {
+        /**
+         * Only the owning thread touches these.
+         */
+        vector<Run> local;
+        vector<Ent*> found;
+        /**
+         * What others can steal.
+         */
+        mutex lock;
+        deque<Run> shared;
+        atomic<size_t> sharedCount;
+
+        Worker(): sharedCount(0) {}
+    };
+
+    /**
+     * Runs longer than this are split before they're worked on.
+     */
+    static const size_t SPLIT_AT = 512;
+
+    vector<unique_ptr<Worker> > workers;
+    vector<thread> threads;
+
+    /**
+     * Handing out a traversal, and waiting for it to be done.
+     */
+    mutex jobLock;
+    condition_variable jobReady;
+    condition_variable jobDone;
+    uint64_t job;
+    unsigned int working;
+    bool stopping;
+
+    /**
+     * How many workers have found nothing left to do or steal.
+     */
+    atomic<unsigned int> idle;
+    /**
+     * How many UIDs each page of visited has a bit for.
+     */
+    static const size_t PAGE_SIZE = 65536;
+    /**
+     * One bit per UID, in pages that are only made once a traversal reaches
+     * one of their UIDs, so it takes time and room for what it finds rather
+     * than for every UID handed out.
+     */
+    vector<atomic<atomic<uint64_t>*> > visited;
+    /**
+     * The pages of visited made so far, to be let go when it's done.
+     */
+    mutex pageLock;
+    vector<size_t> pagesMade;
+    /**
+     * Ents with no UID, or one past the end of visited, which can't be marked
+     * there. Shouldn't happen in a Tree, but just in case.
+     */
+    mutex strayLock;
+    unordered_set<Ent*> strays;
+
+    /**
+     * Marks an Ent found.
+     * @return      false if some thread found it first.
+     */
+    bool mark(Ent* ent);
+
+    /**
+     * Makes a page of visited, unless another thread just has.
+     * @return      The page.
+     */
+    atomic<uint64_t>* makePage(size_t page);
+
+    void push(Worker* w, Run run);
+
+    bool steal(Worker* w, Run* run);
+
+    /**
+     * Works through runs until there are none left anywhere.
+     */
+    void work(Worker* w);
+
+    void process(Worker* w, Run run);
+
+    /**
+     * What each pool thread does between traversals.
+     */
+    void threadMain(unsigned int index);
+
+public:
+
+    /**
+     * @param threadCount   How many threads to use, counting the caller. As
+     *                      many as the hardware supports if 0.
+     */
+    ParallelTraversal(unsigned int threadCount = 0);
+
+    ~ParallelTraversal();
+
+    ParallelTraversal(const ParallelTraversal&) = delete;
+    ParallelTraversal& operator=(const ParallelTraversal&) = delete;
+
+    /**
+     * Finds everything below an Ent.
+     * @param tree      The Tree it's in, which gives the range of UIDs.
+     * @param ent       The Ent to start from. It isn't included.
+     * @param version   The version to walk, like TreeSnapshot::getVersion().
+     *                  The latest by default.
+     * @return          Each descendent once, in no particular order.
+     */
+    vector<Ent*> getDescendentList(Tree* tree, Ent* ent,
+            uint64_t version = LATEST_VERSION);
+
+    /**
+     * The same as Ent::getDescendents(), but found in parallel and with no
+     * limit on depth.
+     */
+    unordered_set<Ent*> getDescendents(Tree* tree, Ent* ent,
+            uint64_t version = LATEST_VERSION);
+
+    unsigned int getThreadCount() {
+        return workers.size();
+    }
+
+    /**
+     * Finds everything below an Ent on one thread, the way the pool is
+     * measured against.
+     */
+    static vector<Ent*> getDescendentListSequential(Ent* ent);
+
+    /**
+     * Times walking the descendents of an Ent on one thread against doing it
+     * with a pool of the given size. Nothing is printed.
+     */
+    static TraversalBenchmark benchmark(Tree* tree, Ent* ent, unsigned int threadCount);
+
+    /**
+     * Walks a made up Tree from several Ents, with pools of a few sizes and
+     * again after editing it, and compares with Ent::getDescendents().
+     * @return      "" if they agree, otherwise what went wrong.
+     */
+    static string check();
+
+};
+
+#endif /* PARALLELTRAVERSAL_H */
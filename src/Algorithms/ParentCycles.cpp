@@ -0,0 +1,120 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ParentCycles.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+using namespace std;
+
+vector<pair<Ent*, Ent*> > ParentCycles::findLooping(Tree* tree,
+        const vector<pair<Ent*, Ent*> >& made) {
+
+    vector<pair<Ent*, Ent*> > looping;
+    if (made.empty())
+        return looping;
+
+    //Peel off Ents with no remaining parents.
+    unordered_map<Ent*, size_t> parentsLeft;
+    parentsLeft.reserve(tree->getNameMap()->size());
+    vector<Ent*> ready;
+    for (pair<const string, Ent*>& p : *tree->getNameMap()) {
+        const EntList& parents = p.second->getList(RELATION_PARENT);
+        parentsLeft[p.second] = parents.size();
+        if (parents.empty())
+            ready.push_back(p.second);
+    }
+    while (!ready.empty()) {
+        Ent* ent = ready.back();
+        ready.pop_back();
+        parentsLeft.erase(ent);
+        for (Ent* child : ent->getList(RELATION_CHILD)) {
+            if (--parentsLeft[child] == 0)
+                ready.push_back(child);
+        }
+    }
+
+    //The usual case. No loops.
+    if (parentsLeft.empty())
+        return looping;
+
+    //Find the loops themselves among the leftovers.
+    unordered_map<Ent*, unsigned int> order;
+    unordered_map<Ent*, unsigned int> low;
+    unordered_map<Ent*, unsigned int> component;
+    unordered_set<Ent*> onStack;
+    vector<Ent*> stack;
+    vector<pair<Ent*, EntList::const_iterator> > frames;
+    unsigned int counter = 0;
+
+    for (pair<Ent* const, size_t>& start : parentsLeft) {
+        if (order.count(start.first))
+            continue;
+
+        order[start.first] = low[start.first] = counter++;
+        stack.push_back(start.first);
+        onStack.insert(start.first);
+        frames.push_back(make_pair(start.first, start.first->getList(RELATION_CHILD).begin()));
+
+        while (!frames.empty()) {
+            Ent* ent = frames.back().first;
+            EntList::const_iterator& next = frames.back().second;
+
+            if (next != ent->getList(RELATION_CHILD).end()) {
+                Ent* child = *next;
+                ++next;
+                if (!parentsLeft.count(child))
+                    continue;
+                if (!order.count(child)) {
+                    order[child] = low[child] = counter++;
+                    stack.push_back(child);
+                    onStack.insert(child);
+                    frames.push_back(make_pair(child, child->getList(RELATION_CHILD).begin()));
+                } else if (onStack.count(child)) {
+                    low[ent] = min(low[ent], order[child]);
+                }
+                continue;
+            }
+
+            frames.pop_back();
+            if (!frames.empty()) {
+                Ent* caller = frames.back().first;
+                low[caller] = min(low[caller], low[ent]);
+            }
+            if (low[ent] == order[ent]) {
+                Ent* member;
+                do {
+                    member = stack.back();
+                    stack.pop_back();
+                    onStack.erase(member);
+                    component[member] = order[ent];
+                } while (member != ent);
+            }
+        }
+    }
+
+    //Every loop has at least one of the connections that were made, so
+    //taking back those inside a loop breaks them all.
+    for (const pair<Ent*, Ent*>& connection : made) {
+        unordered_map<Ent*, unsigned int>::iterator a = component.find(connection.first);
+        unordered_map<Ent*, unsigned int>::iterator b = component.find(connection.second);
+        if (a != component.end() && b != component.end() && a->second == b->second)
+            looping.push_back(connection);
+    }
+    return looping;
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PARENTCYCLES_H
+#define PARENTCYCLES_H
+
+#include <vector>
+#include "../Core/Tree.h"
+
+using namespace std;
+
+/**
+ * Finds loops of parents, which a Tree can end up with when connections are
+ * made in bulk without checking each one, like in a merge or an import.
+ *
+ * Ents with no parents left are peeled off first, like a topological sort.
+ * Ents on a loop, or below one, never run out of parents and are left over.
+ * The loops themselves are found among those as strongly connected
+ * components, with Tarjan's algorithm written without recursion so deep
+ * Trees can't overflow the stack. Both steps are linear in the size of the
+ * Tree, and are skipped when there's nothing to check.
+ */
+class ParentCycles {
+
+public:
+
+    /**
+     * Which of some newly made parent connections are on a loop of parents.
+     * Taking them all back out leaves no loops, as long as the Tree had none
+     * before they were made, and any other connection made since was to a
+     * child with no children at the time.
+     * @param tree      The Tree they were made in.
+     * @param made      The connections, as parent then child.
+     * @return          Those on a loop, in the same order.
+     */
+    static vector<pair<Ent*, Ent*> > findLooping(Tree* tree,
+            const vector<pair<Ent*, Ent*> >& made);
+
+};
+
+#endif /* PARENTCYCLES_H */
@@ -0,0 +1,363 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "RelationSearch.h"
+#include <utility>
+#include <climits>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <tuple>
+
+using namespace std;
+
+RelationSearch::Side::Side(Ent* start): ents(1, start), before(1, 0),
+        how(1, RELATION_PARENT), hops(1, 0), level(0) {
+    places[start] = 0;
+}
+
+bool RelationSearch::Side::visit(Ent* ent, unsigned int from, EntRelation relation) {
+    if (!places.insert(make_pair(ent, (unsigned int) ents.size())).second)
+        return false;
+    ents.push_back(ent);
+    before.push_back(from);
+    how.push_back(relation);
+    hops.push_back(hops[from] + 1);
+    return true;
+}
+
+EntRelation RelationSearch::reverse(EntRelation relation) {
+    if (relation == RELATION_PARENT)
+        return RELATION_CHILD;
+    if (relation == RELATION_CHILD)
+        return RELATION_PARENT;
+    return relation;
+}
+
+
+EntPath RelationSearch::findPath(TreeSnapshot& snapshot, Ent* from, Ent* to,
+        unsigned int follow, size_t most) {
+    
+    EntPath path;
+    path.complete = true;
+    path.visited = 1;
+    if (from == to) {
+        path.ents.push_back(from);
+        return path;
+    }
+    
+    uint64_t version = snapshot.getVersion();
+    Side ahead(from);
+    Side back(to);
+    //Where the shortest chain found so far meets, on each side.
+    unsigned int shortest = UINT_MAX;
+    unsigned int metAhead = 0;
+    unsigned int metBack = 0;
+    
+    while (shortest == UINT_MAX && ahead.level < ahead.ents.size()
+            && back.level < back.ents.size()) {
+        
+        bool forward = ahead.ents.size() - ahead.level <= back.ents.size() - back.level;
+        Side& side = forward ? ahead : back;
+        Side& other = forward ? back : ahead;
+        size_t end = side.ents.size();
+        
+        //The whole level is searched, even once they've met, since another
+        //meeting further along it could make a shorter chain.
+        for (size_t place = side.level; place < end; place++) {
+            Ent* at = side.ents[place];
+            EpochGuard guard;
+            for (int r = RELATION_PARENT; r <= RELATION_OVERLAP; r++) {
+                if (!(follow & (1 << r)))
+                    continue;
+                EntRelation relation = EntRelation(r);
+                //Going back from the far end, a parent is found among
+                //children, and a child among parents.
+                const EntList& list = at->getList(forward ? relation : reverse(relation));
+                for (Ent* next : list.view(version)) {
+                    if (!side.visit(next, place, relation))
+                        continue;
+                    long met = other.find(next);
+                    if (met >= 0 && side.hops.back() + other.hops[met] < shortest) {
+                        shortest = side.hops.back() + other.hops[met];
+                        metAhead = forward ? side.ents.size() - 1 : met;
+                        metBack = forward ? met : side.ents.size() - 1;
+                    }
+                }
+            }
+            path.visited = ahead.ents.size() + back.ents.size();
+            if (path.visited > most) {
+                path.complete = false;
+                return path;
+            }
+        }
+        side.level = end;
+    }
+    
+    if (shortest == UINT_MAX)
+        return path;
+    
+    vector<unsigned int> chain;
+    for (unsigned int place = metAhead; place != 0; place = ahead.before[place])
+        chain.push_back(place);
+    path.ents.push_back(from);
+    for (size_t i = chain.size(); i-- > 0;) {
+        path.ents.push_back(ahead.ents[chain[i]]);
+        path.relations.push_back(ahead.how[chain[i]]);
+    }
+    for (unsigned int place = metBack; place != 0; place = back.before[place]) {
+        path.ents.push_back(back.ents[back.before[place]]);
+        path.relations.push_back(back.how[place]);
+    }
+    return path;
+}
+
+
+EntSubgraph RelationSearch::getNeighborhood(TreeSnapshot& snapshot, Ent* ent,
+        unsigned int hops, unsigned int follow, size_t most) {
+    
+    EntSubgraph graph;
+    graph.complete = true;
+    uint64_t version = snapshot.getVersion();
+    unordered_map<Ent*, unsigned int> places;
+    places[ent] = 0;
+    graph.ents.push_back(ent);
+    graph.hops.push_back(0);
+    
+    size_t level = 0;
+    for (unsigned int hop = 1; hop <= hops && graph.complete && level < graph.ents.size(); hop++) {
+        size_t end = graph.ents.size();
+        for (size_t place = level; place < end && graph.complete; place++) {
+            Ent* at = graph.ents[place];
+            EpochGuard guard;
+            for (int r = RELATION_PARENT; r <= RELATION_OVERLAP && graph.complete; r++) {
+                if (!(follow & (1 << r)))
+                    continue;
+                for (Ent* next : at->getList(EntRelation(r)).view(version)) {
+                    if (places.count(next))
+                        continue;
+                    if (graph.ents.size() >= most) {
+                        graph.complete = false;
+                        break;
+                    }
+                    places[next] = graph.ents.size();
+                    graph.ents.push_back(next);
+                    graph.hops.push_back(hop);
+                }
+            }
+        }
+        level = end;
+    }
+    
+    //Every relation between two of them, not just the ones that led from
+    //one to the other. Parent and child relations are listed from the
+    //child's end and the others from the end listed first, so each is
+    //listed once.
+    for (unsigned int place = 0; place < graph.ents.size(); place++) {
+        Ent* at = graph.ents[place];
+        EpochGuard guard;
+        if (follow & FOLLOW_HIERARCHY) {
+            for (Ent* parent : at->getList(RELATION_PARENT).view(version)) {
+                unordered_map<Ent*, unsigned int>::iterator found = places.find(parent);
+                if (found != places.end()) {
+                    SubgraphRelation relation = {RELATION_PARENT, found->second, place};
+                    graph.relations.push_back(relation);
+                }
+            }
+        }
+        for (int r = RELATION_EXCLUSIVE; r <= RELATION_OVERLAP; r++) {
+            if (!(follow & (1 << r)))
+                continue;
+            for (Ent* other : at->getList(EntRelation(r)).view(version)) {
+                unordered_map<Ent*, unsigned int>::iterator found = places.find(other);
+                if (found != places.end() && found->second > place) {
+                    SubgraphRelation relation = {EntRelation(r), place, found->second};
+                    graph.relations.push_back(relation);
+                }
+            }
+        }
+    }
+    return graph;
+}
+
+string RelationSearch::check() {
+    
+    mt19937 random(50);
+    Tree tree("Relation search check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 3000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        tree.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 20 == 0) {
+            Ent::connectUnchecked(tree.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    //Exclusives and overlaps between Ents that aren't parent and child.
+    auto relate = [&](int count) {
+        for (int i = 0; i < count; i++) {
+            Ent* a = ents[random() % ents.size()];
+            Ent* b = ents[random() % ents.size()];
+            if (a == b || a->isChildOf(b) || b->isChildOf(a))
+                continue;
+            if (random() % 2)
+                Ent::setExclusive(a, b);
+            else
+                Ent::setOverlap(a, b);
+        }
+    };
+    relate(300);
+    
+    //A plain search of the snapshot: how many hops each Ent is from ent.
+    auto neighbors = [](TreeSnapshot& snapshot, Ent* ent, unsigned int follow) {
+        vector<Ent*> found;
+        vector<Ent*> lists[4] = {snapshot.getParents(ent), snapshot.getChildren(ent),
+                snapshot.getExclusives(ent), snapshot.getOverlaps(ent)};
+        for (int r = RELATION_PARENT; r <= RELATION_OVERLAP; r++) {
+            if (follow & (1 << r))
+                found.insert(found.end(), lists[r].begin(), lists[r].end());
+        }
+        return found;
+    };
+    auto distances = [&neighbors](TreeSnapshot& snapshot, Ent* ent, unsigned int follow) {
+        unordered_map<Ent*, unsigned int> hops;
+        hops[ent] = 0;
+        vector<Ent*> queue(1, ent);
+        for (size_t at = 0; at < queue.size(); at++) {
+            for (Ent* next : neighbors(snapshot, queue[at], follow)) {
+                if (hops.insert(make_pair(next, hops[queue[at]] + 1)).second)
+                    queue.push_back(next);
+            }
+        }
+        return hops;
+    };
+    auto related = [&neighbors](TreeSnapshot& snapshot, Ent* a, Ent* b, EntRelation relation) {
+        vector<Ent*> list = neighbors(snapshot, a, 1 << relation);
+        return find(list.begin(), list.end(), b) != list.end();
+    };
+    
+    auto compare = [&](TreeSnapshot& snapshot) -> string {
+        const unsigned int follows[] = {FOLLOW_ALL, FOLLOW_HIERARCHY, FOLLOW_PARENTS,
+                FOLLOW_CHILDREN | FOLLOW_EXCLUSIVES, FOLLOW_OVERLAPS};
+        for (int i = 0; i < 40; i++) {
+            unsigned int follow = follows[i % 5];
+            Ent* from = i % 8 == 0 ? snapshot.getTree()->getRoot() : ents[random() % ents.size()];
+            unordered_map<Ent*, unsigned int> hops = distances(snapshot, from, follow);
+            
+            for (int j = 0; j < 10; j++) {
+                Ent* to = ents[random() % ents.size()];
+                EntPath path = findPath(snapshot, from, to, follow);
+                unordered_map<Ent*, unsigned int>::iterator reached = hops.find(to);
+                if (!path.complete)
+                    return "a path search gave up";
+                if (reached == hops.end()) {
+                    if (!path.ents.empty())
+                        return "found a path from " + from->getName() + " to "
+                                + to->getName() + " where there's none";
+                    continue;
+                }
+                if (path.ents.size() != reached->second + 1)
+                    return "the path from " + from->getName() + " to " + to->getName()
+                            + " has " + to_string(path.ents.size() - 1) + " steps, not "
+                            + to_string(reached->second);
+                if (path.ents.front() != from || path.ents.back() != to
+                        || path.relations.size() != reached->second)
+                    return "the path from " + from->getName() + " to " + to->getName()
+                            + " doesn't go from one to the other";
+                for (size_t s = 0; s < path.relations.size(); s++) {
+                    if (!(follow & (1 << path.relations[s]))
+                            || !related(snapshot, path.ents[s], path.ents[s + 1], path.relations[s]))
+                        return "the path from " + from->getName() + " to "
+                                + to->getName() + " has a step that isn't there";
+                }
+            }
+            
+            unsigned int most = 1 + random() % 3;
+            EntSubgraph graph = getNeighborhood(snapshot, from, most, follow);
+            size_t within = 0;
+            for (pair<Ent* const, unsigned int>& hop : hops)
+                within += hop.second <= most;
+            if (!graph.complete || graph.ents.size() != within)
+                return to_string(most) + " hops from " + from->getName() + " found "
+                        + to_string(graph.ents.size()) + " Ents, not " + to_string(within);
+            set<tuple<int, unsigned int, unsigned int> > expected, listed;
+            for (unsigned int a = 0; a < graph.ents.size(); a++) {
+                if (graph.hops[a] != hops[graph.ents[a]]
+                        || (a > 0 && graph.hops[a] < graph.hops[a - 1]))
+                    return to_string(most) + " hops from " + from->getName()
+                            + " has Ents the wrong distance away";
+                for (unsigned int b = 0; b < graph.ents.size(); b++) {
+                    if ((follow & FOLLOW_HIERARCHY)
+                            && related(snapshot, graph.ents[b], graph.ents[a], RELATION_PARENT))
+                        expected.insert(make_tuple(int(RELATION_PARENT), a, b));
+                    for (int r = RELATION_EXCLUSIVE; r <= RELATION_OVERLAP; r++) {
+                        if (a < b && (follow & (1 << r))
+                                && related(snapshot, graph.ents[a], graph.ents[b], EntRelation(r)))
+                            expected.insert(make_tuple(r, a, b));
+                    }
+                }
+            }
+            for (SubgraphRelation& relation : graph.relations) {
+                unsigned int a = relation.a, b = relation.b;
+                if (relation.type != RELATION_PARENT && a > b)
+                    swap(a, b);
+                if (!listed.insert(make_tuple(int(relation.type), a, b)).second)
+                    return to_string(most) + " hops from " + from->getName()
+                            + " lists a relation twice";
+            }
+            if (listed != expected)
+                return to_string(most) + " hops from " + from->getName()
+                        + " has the wrong relations";
+        }
+        return "";
+    };
+    
+    //The snapshot from before the edits has to keep seeing the Tree as it
+    //was, and the one after them the edits.
+    TreeSnapshot before = tree.snapshot();
+    {
+        Tree::Writer writing(&tree);
+        for (int i = 0; i < 500; i++) {
+            //Parents always come before their children in ents, so no loops.
+            size_t c = 1 + random() % (ents.size() - 1);
+            Ent* child = ents[c];
+            vector<Ent*> parents = child->getParents();
+            if (parents.size() > 1)
+                Ent::disconnectUnchecked(parents[random() % parents.size()], child);
+            Ent* parent = ents[random() % c];
+            if (!child->isChildOf(parent))
+                Ent::connectUnchecked(parent, child);
+        }
+        relate(200);
+    }
+    TreeSnapshot after = tree.snapshot();
+    
+    string failure = compare(before);
+    if (!failure.empty())
+        return "before editing, " + failure;
+    failure = compare(after);
+    if (!failure.empty())
+        return "after editing, " + failure;
+    return "";
+}
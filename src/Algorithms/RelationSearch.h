@@ -0,0 +1,190 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RELATIONSEARCH_H
+#define RELATIONSEARCH_H
+
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+#include "../Core/Tree.h"
+
+using namespace std;
+
+/**
+ * Which relations a search goes along, as flags to be or'd together.
+ */
+typedef enum {
+    /** From an Ent to its parents. */
+    FOLLOW_PARENTS = 1 << RELATION_PARENT,
+    /** From an Ent to its children. */
+    FOLLOW_CHILDREN = 1 << RELATION_CHILD,
+    FOLLOW_EXCLUSIVES = 1 << RELATION_EXCLUSIVE,
+    FOLLOW_OVERLAPS = 1 << RELATION_OVERLAP,
+    FOLLOW_HIERARCHY = FOLLOW_PARENTS | FOLLOW_CHILDREN,
+    FOLLOW_ALL = FOLLOW_HIERARCHY | FOLLOW_EXCLUSIVES | FOLLOW_OVERLAPS
+} FollowRelations;
+
+/**
+ * A shortest chain of relations from one Ent to another.
+ */
+struct EntPath {
+    /** From the first Ent to the last, or empty if there's no chain. */
+    vector<Ent*> ents;
+    /**
+     * How each Ent after the first is related to the one before it.
+     * RELATION_PARENT means it's that one's parent.
+     */
+    vector<EntRelation> relations;
+    /**
+     * false if the search gave up after visiting as many Ents as it was
+     * allowed, so there may be a chain after all.
+     */
+    bool complete;
+    /** How many Ents were visited, from both ends. */
+    size_t visited;
+};
+
+/**
+ * A relation in an EntSubgraph. a and b are places in EntSubgraph::ents.
+ * For RELATION_PARENT, a is the parent of b.
+ */
+struct SubgraphRelation {
+    EntRelation type;
+    unsigned int a;
+    unsigned int b;
+};
+
+/**
+ * The Ents within some hops of one, and the relations between them. Each
+ * Ent is listed once, and relations refer to it by its place in that list,
+ * so the whole thing is a few flat lists however tangled it is.
+ */
+struct EntSubgraph {
+    /** Nearest first. The Ent it's around is first. */
+    vector<Ent*> ents;
+    /** How many hops each Ent is from the first. */
+    vector<unsigned int> hops;
+    /**
+     * Every relation being followed between two of the Ents, each listed
+     * once, parent and child relations as RELATION_PARENT.
+     */
+    vector<SubgraphRelation> relations;
+    /**
+     * false if it stopped at the most Ents it was allowed, so some within
+     * reach are missing.
+     */
+    bool complete;
+};
+
+/**
+ * Searches the relations around Ents, as they were at a snapshot's version:
+ * the shortest chain from one Ent to another, and all the Ents a few hops
+ * from one.
+ *
+ * Chains are found by a breadth first search from both ends at once,
+ * always going a level further on whichever side has fewer Ents waiting.
+ * Two searches that meet in the middle each only go half as deep, which in
+ * a wide Tree is a tiny fraction of the Ents one search would look at.
+ * Going up from one end means going down from the other, so a chain
+ * through parents is found by searching children back from where it ends.
+ *
+ * Ents are numbered as they're visited, and everything known about them,
+ * like how they were reached, is kept in flat lists by that number. So
+ * memory only grows with the Ents visited, which is capped by most, not
+ * with the Tree.
+ */
+class RelationSearch {
+
+    /**
+     * One end of a search. Ents are kept in the order visited, so each
+     * level is the stretch after the last.
+     */
+    struct Side {
+        unordered_map<Ent*, unsigned int> places;
+        vector<Ent*> ents;
+        /** The place of the Ent each was reached from. */
+        vector<unsigned int> before;
+        /**
+         * How each is related to the Ent it was reached from, or, going back
+         * from the far end, how that Ent is related to it.
+         */
+        vector<EntRelation> how;
+        vector<unsigned int> hops;
+        /** Where the level being searched starts. */
+        size_t level;
+
+        Side(Ent* start);
+
+        /**
+         * @return          Its place, or -1 if it hasn't been visited.
+         */
+        long find(Ent* ent) const {
+            unordered_map<Ent*, unsigned int>::const_iterator found = places.find(ent);
+            return found == places.end() ? -1 : long(found->second);
+        }
+
+        /**
+         * @return          false if it was already visited.
+         */
+        bool visit(Ent* ent, unsigned int from, EntRelation relation);
+    };
+
+    /**
+     * The relation an Ent has to another when the other has this one to it.
+     */
+    static EntRelation reverse(EntRelation relation);
+
+public:
+
+    /**
+     * How many Ents a search visits at most, unless told otherwise.
+     */
+    static const size_t DEFAULT_MOST = 1 << 20;
+
+    /**
+     * Finds a shortest chain of relations from one Ent to another.
+     * @param snapshot  The version of the Tree to search.
+     * @param follow    The FollowRelations to go along. A chain from a child
+     *                  up to its parent needs FOLLOW_PARENTS.
+     * @param most      How many Ents to visit before giving up.
+     * @return          The chain, which is just from if the two are the same.
+     */
+    static EntPath findPath(TreeSnapshot& snapshot, Ent* from, Ent* to,
+            unsigned int follow = FOLLOW_ALL, size_t most = DEFAULT_MOST);
+
+    /**
+     * Finds the Ents within some hops of one, and how they're related.
+     * @param snapshot  The version of the Tree to search.
+     * @param hops      How far to go. 0 gives just the Ent.
+     * @param follow    The FollowRelations to go along.
+     * @param most      How many Ents to list at most.
+     */
+    static EntSubgraph getNeighborhood(TreeSnapshot& snapshot, Ent* ent, unsigned int hops,
+            unsigned int follow = FOLLOW_ALL, size_t most = DEFAULT_MOST);
+
+    /**
+     * Searches a made up Tree, before and after a Writer edits it, and
+     * compares chains and neighborhoods with a plain breadth first search
+     * of the snapshot.
+     * @return          "" if they agree, otherwise what went wrong.
+     */
+    static string check();
+
+};
+
+#endif /* RELATIONSEARCH_H */
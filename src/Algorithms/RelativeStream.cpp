@@ -0,0 +1,143 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "RelativeStream.h"
+#include <random>
+
+using namespace std;
+
+RelativeStream::RelativeStream(TreeSnapshot&& snap, Ent* ent, bool u):
+        snapshot(std::move(snap)), up(u) {
+    
+    Step start = {ent, EntListPlace()};
+    path.push_back(start);
+    mark(ent);
+}
+
+bool RelativeStream::mark(Ent* ent) {
+    
+    unsigned int uid = ent->getUID();
+    if (uid == 0)
+        return strays.insert(ent).second;
+    return visited.mark(uid);
+}
+
+size_t RelativeStream::next(vector<Ent*>* out, size_t most) {
+    
+    size_t found = 0;
+    uint64_t version = snapshot.getVersion();
+    //Lists can be swapped out for copies whenever this is let go, which is
+    //why places are kept instead of iterators.
+    EpochGuard guard;
+    
+    while (found < most && !path.empty()) {
+        
+        Step& step = path.back();
+        EntListView view = step.ent->getList(up ? RELATION_PARENT : RELATION_CHILD).view(version);
+        EntEdgeIterator it = view.resume(step.place);
+        EntEdgeIterator end = view.end();
+        while (it != end && !mark(*it))
+            ++it;
+        
+        if (it == end) {
+            path.pop_back();
+            continue;
+        }
+        
+        Ent* relative = *it;
+        out->push_back(relative);
+        found++;
+        step.place = view.placeOf(++it);
+        Step below = {relative, EntListPlace()};
+        path.push_back(below);
+    }
+    
+    return found;
+}
+
+string RelativeStream::check() {
+    
+    //Parents always come before their children in ents, so edits can't
+    //make loops.
+    mt19937 random(39);
+    Tree tree("Stream check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 5000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        tree.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 50 == 0) {
+            Ent::connectUnchecked(tree.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    
+    for (int round = 0; round < 20; round++) {
+        Ent* ent = round == 0 ? tree.getRoot() : ents[random() % ents.size()];
+        bool up = round % 2;
+        RelativeStream stream(tree.snapshot(), ent, up);
+        
+        //What the stream's snapshot sees, found before anything changes.
+        unordered_set<Ent*> expected;
+        vector<Ent*> queue(1, ent);
+        for (size_t at = 0; at < queue.size(); at++) {
+            TreeSnapshot& snapshot = stream.snapshot;
+            for (Ent* next : up ? snapshot.getParents(queue[at]) : snapshot.getChildren(queue[at])) {
+                if (expected.insert(next).second)
+                    queue.push_back(next);
+            }
+        }
+        
+        //Edits in between handfuls mustn't show up in the stream.
+        vector<Ent*> found;
+        while (!stream.isDone()) {
+            size_t most = 1 + random() % 300;
+            size_t before = found.size();
+            size_t count = stream.next(&found, most);
+            if (count != found.size() - before || (count < most && !stream.isDone()))
+                return "next() said it found " + to_string(count) + " of " + to_string(most)
+                        + ", but found " + to_string(found.size() - before);
+            Tree::Writer writing(&tree);
+            for (int i = 0; i < 5; i++) {
+                size_t c = 1 + random() % (ents.size() - 1);
+                Ent* child = ents[c];
+                vector<Ent*> parents = child->getParents();
+                if (parents.size() > 1)
+                    Ent::disconnectUnchecked(parents[random() % parents.size()], child);
+                Ent* parent = ents[random() % c];
+                if (!child->isChildOf(parent))
+                    Ent::connectUnchecked(parent, child);
+            }
+        }
+        
+        unordered_set<Ent*> foundSet(found.begin(), found.end());
+        if (foundSet.size() != found.size())
+            return "streamed some of " + ent->getName() + "'s relatives twice";
+        if (foundSet != expected)
+            return "streamed " + to_string(found.size()) + (up ? " ancestors" : " descendents")
+                    + " of " + ent->getName() + ", not " + to_string(expected.size());
+    }
+    
+    return "";
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RELATIVESTREAM_H
+#define RELATIVESTREAM_H
+
+#include <vector>
+#include <unordered_set>
+#include <cstdint>
+#include <string>
+#include "../Core/Tree.h"
+#include "../Core/EntSet.h"
+
+using namespace std;
+
+/**
+ * Walks all the descendents or ancestors of an Ent a few at a time, so they
+ * can be sent on as they're found instead of collected first.
+ *
+ * The walk goes depth first. All it keeps is the path down to where it is,
+ * with its place in each list, and an EntMarks of the UIDs it's been to,
+ * which only takes room for the parts of the Tree the walk reaches. It reads
+ * a snapshot, so however long it's spread out over, it sees the Tree as it
+ * was when it started. Between calls to next() it holds nothing up but the
+ * snapshot.
+ */
+class RelativeStream {
+
+    struct Step {
+        Ent* ent;
+        EntListPlace place;
+    };
+
+    TreeSnapshot snapshot;
+    bool up;
+    vector<Step> path;
+    EntMarks visited;
+    /**
+     * Found Ents with no UID, which can't be marked in visited.
+     */
+    unordered_set<Ent*> strays;
+
+    /**
+     * Marks an Ent found.
+     * @return          false if it already was.
+     */
+    bool mark(Ent* ent);
+
+public:
+
+    /**
+     * @param snapshot  The version of the Tree to walk. The stream keeps it.
+     * @param ent       Where to start. It isn't included.
+     * @param up        Ancestors if true, or else descendents.
+     */
+    RelativeStream(TreeSnapshot&& snapshot, Ent* ent, bool up);
+
+    /**
+     * Finds some more.
+     * @param out       Where to add them.
+     * @param most      How many to find at most.
+     * @return          How many were found. Fewer than most only at the end.
+     */
+    size_t next(vector<Ent*>* out, size_t most);
+
+    bool isDone() const {
+        return path.empty();
+    }
+
+    /**
+     * Streams the relatives of Ents in a made up Tree in odd sized handfuls,
+     * while a Writer edits it, and compares them with a plain search of the
+     * snapshot.
+     * @return          "" if they agree, otherwise what went wrong.
+     */
+    static string check();
+
+};
+
+#endif /* RELATIVESTREAM_H */
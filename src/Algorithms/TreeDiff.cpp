@@ -0,0 +1,510 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TreeDiff.h"
+#include <algorithm>
+#include <unordered_set>
+#include <sstream>
+#include <cstdlib>
+#include <random>
+
+using namespace std;
+
+/**
+ * The text written before a delta, so read() knows it has one.
+ */
+static const string DELTA_HEADER = "ents delta";
+
+
+bool TreeDiff::keyLess(Ent* a, Ent* b) const {
+    //Ents with a UID come first, in UID order. 0 means no UID.
+    unsigned int aKey = key(a);
+    unsigned int bKey = key(b);
+    if (aKey != bKey) {
+        if (aKey == 0)
+            return false;
+        if (bKey == 0)
+            return true;
+        return aKey < bKey;
+    }
+    //Same UID means the same Ent, unless neither has one.
+    if (aKey != 0)
+        return false;
+    return a->getName() < b->getName();
+}
+
+void TreeDiff::sort(vector<Ent*>* ents) const {
+    std::sort(ents->begin(), ents->end(), [this](Ent* a, Ent* b) { return keyLess(a, b); });
+}
+
+vector<Ent*> TreeDiff::sortedEnts(Tree* tree) const {
+    vector<Ent*> ents;
+    ents.reserve(tree->getNameMap()->size());
+    for (pair<const string, Ent*>& p : *tree->getNameMap())
+        ents.push_back(p.second);
+    sort(&ents);
+    return ents;
+}
+
+
+unsigned int TreeDiff::place(Ent* ent, const string& name) {
+
+    //A newer Ent shares its place with the older one it matched, under the
+    //older name.
+    unordered_map<Ent*, Ent*>::iterator match = matches.find(ent);
+    if (match != matches.end())
+        return place(match->second, match->second->getName());
+
+    unordered_map<Ent*, unsigned int>::iterator it = places.find(ent);
+    if (it != places.end())
+        return it->second;
+
+    unsigned int index = delta.ents.size();
+    DeltaEnt entry = {key(ent), name};
+    delta.ents.push_back(entry);
+    places[ent] = index;
+
+    return index;
+}
+
+
+TreeDelta TreeDiff::diff(Tree* before, Tree* after) {
+
+    TreeDiff differ;
+    //Separately made Trees can have different Ents under the same UIDs.
+    differ.byUID = before->sharesUIDsWith(after);
+    if (differ.byUID)
+        differ.delta.origin = before->getOrigin();
+
+    vector<Ent*> older = differ.sortedEnts(before);
+    vector<Ent*> newer = differ.sortedEnts(after);
+
+    unordered_map<Ent*, Ent*>& matches = differ.matches;
+    matches.reserve(newer.size());
+    unordered_set<Ent*>& removed = differ.removed;
+    vector<Ent*> added;
+    vector<pair<Ent*, Ent*> > pairs;
+    pairs.reserve(newer.size());
+
+    //Walk both sorted lists side by side. Whichever is behind holds an Ent
+    //the other Tree doesn't have.
+    size_t i = 0, j = 0;
+    while (i < older.size() || j < newer.size()) {
+        if (j == newer.size() || (i < older.size() && differ.keyLess(older[i], newer[j]))) {
+            removed.insert(older[i]);
+            i++;
+        } else if (i == older.size() || differ.keyLess(newer[j], older[i])) {
+            added.push_back(newer[j]);
+            j++;
+        } else {
+            matches[newer[j]] = older[i];
+            pairs.push_back(make_pair(older[i], newer[j]));
+            i++;
+            j++;
+        }
+    }
+
+    //Now every Ent's status is known, relations can refer to them.
+    for (Ent* ent : removed)
+        differ.delta.removedEnts.push_back(differ.place(ent));
+    for (Ent* ent : added)
+        differ.delta.addedEnts.push_back(differ.place(ent));
+
+    for (pair<Ent*, Ent*>& p : pairs) {
+        Ent* oldEnt = p.first;
+        Ent* newEnt = p.second;
+
+        if (oldEnt->getName() != newEnt->getName()) {
+            DeltaRename rename = {differ.place(oldEnt), newEnt->getName()};
+            differ.delta.renamedEnts.push_back(rename);
+        }
+
+        for (EntRelation type : {RELATION_PARENT, RELATION_EXCLUSIVE, RELATION_OVERLAP})
+            differ.compareRelations(type, oldEnt->getList(type), newEnt->getList(type),
+                    oldEnt, newEnt);
+    }
+    //Added Ents' relations weren't seen above, unless from a matched Ent.
+    for (Ent* ent : added)
+        differ.addAllRelations(ent);
+
+    return differ.delta;
+}
+
+
+void TreeDiff::compareRelations(EntRelation type, const EntList& before,
+        const EntList& after, Ent* oldEnt, Ent* newEnt) {
+
+    vector<Ent*> older(before.begin(), before.end());
+    vector<Ent*> newer(after.begin(), after.end());
+    sort(&older);
+    sort(&newer);
+
+    //Exclusives and overlaps are listed on both Ents. Only the one with the
+    //smaller key reports the pair.
+    bool symmetric = type != RELATION_PARENT;
+
+    size_t i = 0, j = 0;
+    while (i < older.size() || j < newer.size()) {
+        DeltaRelation relation;
+        relation.type = type;
+        if (j == newer.size() || (i < older.size() && keyLess(older[i], newer[j]))) {
+            //Relations to a removed Ent go along with it.
+            if (!removed.count(older[i]) && (!symmetric || keyLess(oldEnt, older[i]))) {
+                //For parents, the parent comes first.
+                relation.a = place(symmetric ? oldEnt : older[i]);
+                relation.b = place(symmetric ? older[i] : oldEnt);
+                delta.removedRelations.push_back(relation);
+            }
+            i++;
+        } else if (i == older.size() || keyLess(newer[j], older[i])) {
+            if (!symmetric || keyLess(newEnt, newer[j])) {
+                relation.a = place(symmetric ? newEnt : newer[j]);
+                relation.b = place(symmetric ? newer[j] : newEnt);
+                delta.addedRelations.push_back(relation);
+            }
+            j++;
+        } else {
+            i++;
+            j++;
+        }
+    }
+}
+
+void TreeDiff::addAllRelations(Ent* ent) {
+
+    for (Ent* parent : ent->getList(RELATION_PARENT)) {
+        DeltaRelation relation = {RELATION_PARENT, place(parent), place(ent)};
+        delta.addedRelations.push_back(relation);
+    }
+    for (Ent* exclusive : ent->getList(RELATION_EXCLUSIVE)) {
+        if (keyLess(ent, exclusive)) {
+            DeltaRelation relation = {RELATION_EXCLUSIVE, place(ent), place(exclusive)};
+            delta.addedRelations.push_back(relation);
+        }
+    }
+    for (Ent* overlap : ent->getList(RELATION_OVERLAP)) {
+        if (keyLess(ent, overlap)) {
+            DeltaRelation relation = {RELATION_OVERLAP, place(ent), place(overlap)};
+            delta.addedRelations.push_back(relation);
+        }
+    }
+}
+
+
+unsigned int TreeDiff::apply(Tree* tree, const TreeDelta& delta) {
+
+    vector<Ent*> resolved(delta.ents.size(), nullptr);
+    vector<bool> isAdded(delta.ents.size(), false);
+    for (unsigned int index : delta.addedEnts)
+        isAdded[index] = true;
+
+    //Find the Ents that should already be there by UID, or by name if they
+    //have none. The delta's UIDs only mean anything to a Tree of its origin.
+    bool byUID = delta.origin != 0 && delta.origin == tree->getOrigin();
+    unsigned int missing = 0;
+    for (unsigned int index = 0; index < delta.ents.size(); index++) {
+        if (isAdded[index])
+            continue;
+        const DeltaEnt& entry = delta.ents[index];
+        if (byUID && entry.uid != 0) {
+            resolved[index] = tree->getEntPtrByUID(entry.uid);
+        } else {
+            resolved[index] = tree->getEntPtrByName(entry.name);
+        }
+        if (resolved[index] == nullptr)
+            missing++;
+    }
+
+    //Renames go before new Ents, which may take an old name. One rename may
+    //also free up the name another one wants, so keep going round until
+    //nothing more can be done.
+    vector<DeltaRename> renames(delta.renamedEnts);
+    bool progress = true;
+    while (!renames.empty() && progress) {
+        progress = false;
+        for (size_t r = 0; r < renames.size(); r++) {
+            Ent* ent = resolved[renames[r].ent];
+            if (ent == nullptr || tree->renameEnt(ent, renames[r].newName)) {
+                renames.erase(renames.begin() + r--);
+                progress = true;
+            }
+        }
+    }
+
+    for (unsigned int index : delta.addedEnts) {
+        const DeltaEnt& entry = delta.ents[index];
+        if (tree->getEntPtrByName(entry.name) != nullptr
+                || (byUID && entry.uid != 0 && tree->getEntPtrByUID(entry.uid) != nullptr)) {
+            missing++;
+            continue;
+        }
+        Ent* ent = new Ent();
+        ent->setName(entry.name);
+        //From elsewhere, it gets a UID of this Tree's own.
+        ent->setUID(byUID ? entry.uid : 0);
+        tree->addEntToNameMapUnattached(ent);
+        resolved[index] = ent;
+    }
+
+    for (const DeltaRelation& relation : delta.removedRelations) {
+        Ent* a = resolved[relation.a];
+        Ent* b = resolved[relation.b];
+        if (a == nullptr || b == nullptr)
+            continue;
+        if (relation.type == RELATION_PARENT)
+            Ent::disconnectUnchecked(a, b);
+        else if (relation.type == RELATION_EXCLUSIVE)
+            Ent::unsetExclusive(a, b);
+        else if (relation.type == RELATION_OVERLAP)
+            Ent::unsetOverlap(a, b);
+    }
+
+    for (const DeltaRelation& relation : delta.addedRelations) {
+        Ent* a = resolved[relation.a];
+        Ent* b = resolved[relation.b];
+        if (a == nullptr || b == nullptr)
+            continue;
+        if (relation.type == RELATION_PARENT) {
+            if (!b->isChildOf(a))
+                Ent::connectUnchecked(a, b);
+        } else if (relation.type == RELATION_EXCLUSIVE) {
+            const EntList& exclusives = a->getList(RELATION_EXCLUSIVE);
+            if (find(exclusives.begin(), exclusives.end(), b) == exclusives.end())
+                Ent::setExclusive(a, b);
+        } else if (relation.type == RELATION_OVERLAP) {
+            const EntList& overlaps = a->getList(RELATION_OVERLAP);
+            if (find(overlaps.begin(), overlaps.end(), b) == overlaps.end())
+                Ent::setOverlap(a, b);
+        }
+    }
+
+    for (unsigned int index : delta.removedEnts) {
+        if (resolved[index] != nullptr)
+            tree->removeEnt(resolved[index]);
+    }
+
+    //A new Ent should have been given a parent above. Just in case.
+    for (unsigned int index : delta.addedEnts) {
+        Ent* ent = resolved[index];
+        if (ent != nullptr && ent->getList(RELATION_PARENT).empty())
+            Ent::connectUnchecked(tree->getRoot(), ent);
+    }
+
+    return missing;
+}
+
+
+/**
+ * How each relation type is written in a delta file.
+ */
+static char relationLetter(EntRelation type) {
+    switch (type) {
+        case RELATION_PARENT:
+            return 'p';
+        case RELATION_CHILD:
+            return 'c';
+        case RELATION_EXCLUSIVE:
+            return 'x';
+        case RELATION_OVERLAP:
+            return 'o';
+    }
+    return '?';
+}
+
+string TreeDiff::write(const TreeDelta& delta) {
+
+    ostringstream stream;
+
+    stream << DELTA_HEADER << endl;
+    if (delta.origin != 0)
+        stream << "origin\t" << delta.origin << endl;
+    stream << delta.ents.size() << endl;
+    for (const DeltaEnt& entry : delta.ents)
+        stream << entry.uid << '\t' << entry.name << endl;
+
+    for (unsigned int index : delta.addedEnts)
+        stream << "+e\t" << index << endl;
+    for (unsigned int index : delta.removedEnts)
+        stream << "-e\t" << index << endl;
+    for (const DeltaRename& rename : delta.renamedEnts)
+        stream << "r\t" << rename.ent << '\t' << rename.newName << endl;
+    for (const DeltaRelation& relation : delta.addedRelations)
+        stream << '+' << relationLetter(relation.type) << '\t' << relation.a << '\t'
+                << relation.b << endl;
+    for (const DeltaRelation& relation : delta.removedRelations)
+        stream << '-' << relationLetter(relation.type) << '\t' << relation.a << '\t'
+                << relation.b << endl;
+
+    return stream.str();
+}
+
+bool TreeDiff::read(const string& text, TreeDelta* delta) {
+
+    istringstream stream(text);
+    string line;
+
+    if (!getline(stream, line) || line != DELTA_HEADER)
+        return false;
+
+    *delta = TreeDelta();
+
+    unsigned int size = 0;
+    //Deltas between Trees that don't share UIDs have no origin.
+    if (getline(stream, line) && line.compare(0, 7, "origin\t") == 0) {
+        delta->origin = strtoull(line.c_str() + 7, nullptr, 10);
+        if (!getline(stream, line))
+            line.clear();
+    }
+    size = strtoul(line.c_str(), nullptr, 10);
+    for (unsigned int i = 0; i < size && getline(stream, line); i++) {
+        size_t tab = line.find('\t');
+        DeltaEnt entry = {(unsigned int) strtoul(line.c_str(), nullptr, 10),
+                tab == string::npos ? string() : line.substr(tab + 1)};
+        delta->ents.push_back(entry);
+    }
+
+    while (getline(stream, line)) {
+        if (line.size() < 3)
+            continue;
+        const char* rest = line.c_str() + 2;
+        char* end;
+        unsigned long a = strtoul(rest, &end, 10);
+        if (a >= delta->ents.size())
+            return false;
+
+        if (line[0] == 'r') {
+            DeltaRename rename = {(unsigned int) a, *end == '\t' ? string(end + 1) : string()};
+            delta->renamedEnts.push_back(rename);
+        } else if (line[1] == 'e') {
+            if (line[0] == '+')
+                delta->addedEnts.push_back(a);
+            else
+                delta->removedEnts.push_back(a);
+        } else {
+            unsigned long b = strtoul(end, nullptr, 10);
+            if (b >= delta->ents.size())
+                return false;
+            DeltaRelation relation;
+            relation.a = a;
+            relation.b = b;
+            switch (line[1]) {
+                case 'p':
+                    relation.type = RELATION_PARENT;
+                    break;
+                case 'x':
+                    relation.type = RELATION_EXCLUSIVE;
+                    break;
+                case 'o':
+                    relation.type = RELATION_OVERLAP;
+                    break;
+                default:
+                    return false;
+            }
+            if (line[0] == '+')
+                delta->addedRelations.push_back(relation);
+            else
+                delta->removedRelations.push_back(relation);
+        }
+    }
+
+    return true;
+}
+
+string TreeDiff::check() {
+
+    //The same Tree each time, where each Ent has up to 3 parents from those
+    //before it. The older version also has some Ents the newer one lost.
+    //UIDs are fixed so the Trees agree whether the diff goes by UID or name.
+    auto build = [](Tree* tree, bool older) {
+        mt19937 random(28);
+        vector<Ent*> ents;
+        for (unsigned int i = 0; i < 1500; i++) {
+            Ent* ent = new Ent();
+            ent->setName("e" + to_string(i));
+            ent->setUID(2 + i);
+            tree->addEntToNameMapUnattached(ent);
+            for (unsigned int n = random() % 3; n < 3 && !ents.empty(); n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+            if (ents.empty())
+                Ent::connectUnchecked(tree->getRoot(), ent);
+            ents.push_back(ent);
+        }
+        for (unsigned int i = 0; older && i < 50; i++) {
+            Ent* ent = new Ent();
+            ent->setName("gone" + to_string(i));
+            ent->setUID(5000 + i);
+            tree->addEntToNameMapUnattached(ent);
+            Ent::connectUnchecked(ents[i * 7], ent);
+        }
+        return ents;
+    };
+
+    Tree before("Diff check");
+    build(&before, true);
+    Tree after("Diff check");
+    vector<Ent*> ents = build(&after, false);
+    //New Ents, parents taken away and added, and exclusives and overlaps.
+    mt19937 random(128);
+    for (unsigned int i = 0; i < 200; i++) {
+        Ent* ent = new Ent();
+        ent->setName("new" + to_string(i));
+        ent->setUID(10000 + i);
+        after.addEntToNameMapUnattached(ent);
+        Ent::connectUnchecked(ents[random() % ents.size()], ent);
+    }
+    for (unsigned int i = 0; i < 300; i++) {
+        Ent* child = ents[1 + random() % (ents.size() - 1)];
+        vector<Ent*> parents = child->getParents();
+        if (parents.size() > 1)
+            Ent::disconnectUnchecked(parents[random() % parents.size()], child);
+    }
+    for (unsigned int i = 0; i + 1 < ents.size(); i += 3) {
+        Ent* parent = ents[i];
+        Ent* child = ents[i + 1 + random() % (ents.size() - i - 1)];
+        if (!child->isChildOf(parent))
+            Ent::connectUnchecked(parent, child);
+    }
+    for (unsigned int i = 0; i + 1000 < ents.size(); i += 11) {
+        if (ents[i + 1000]->isChildOf(ents[i]))
+            continue;
+        if (i % 2)
+            Ent::setExclusive(ents[i], ents[i + 1000]);
+        else
+            Ent::setOverlap(ents[i], ents[i + 1000]);
+    }
+
+    TreeDelta delta = diff(&before, &after);
+    if (delta.addedEnts.size() != 200 || delta.removedEnts.size() != 50)
+        return "found " + to_string(delta.addedEnts.size()) + " Ents added and "
+                + to_string(delta.removedEnts.size()) + " removed, not 200 and 50";
+    TreeDelta written;
+    if (!read(write(delta), &written))
+        return "couldn't read back the delta it wrote";
+    Tree patched("Diff check");
+    build(&patched, true);
+    unsigned int missing = apply(&patched, written);
+    if (missing != 0)
+        return to_string(missing) + " of the delta's Ents couldn't be found";
+    TreeDelta left = diff(&patched, &after);
+    if (!left.isEmpty())
+        return "the patched Tree still differs from the newer one";
+    return "";
+}
@@ -0,0 +1,206 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TREEDIFF_H
+#define TREEDIFF_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "../Core/Tree.h"
+
+using namespace std;
+
+/**
+ * How a delta refers to an Ent: by UID, or by name when it has no UID or
+ * the delta's UIDs can't be trusted (see TreeDelta::origin). For an Ent that already existed this is its old name, so the delta can
+ * find it in the old version of the Tree.
+ */
+struct DeltaEnt {
+    unsigned int uid;
+    string name;
+};
+
+/**
+ * A relation which was added or removed. a and b are places in
+ * TreeDelta::ents. For RELATION_PARENT, a is the parent of b. Exclusives
+ * and overlaps are only listed once per pair.
+ */
+struct DeltaRelation {
+    EntRelation type;
+    unsigned int a;
+    unsigned int b;
+};
+
+/**
+ * A rename. ent is a place in TreeDelta::ents, which holds the old name.
+ */
+struct DeltaRename {
+    unsigned int ent;
+    string newName;
+};
+
+/**
+ * Everything that changed between two versions of a Tree. Each Ent that
+ * shows up is listed once in ents, and everything else refers to it by its
+ * place in that list, so the delta stays small.
+ *
+ * Relations of removed Ents aren't listed. They go along with the Ent.
+ */
+struct TreeDelta {
+    /**
+     * The origin of the Trees it was made from (see Tree::getOrigin()). Its
+     * UIDs are only used on a Tree with the same origin. 0 if the two Trees
+     * didn't share one, in which case every Ent is listed with UID 0.
+     */
+    uint64_t origin;
+    vector<DeltaEnt> ents;
+    vector<unsigned int> addedEnts;
+    vector<unsigned int> removedEnts;
+    vector<DeltaRename> renamedEnts;
+    vector<DeltaRelation> addedRelations;
+    vector<DeltaRelation> removedRelations;
+
+    TreeDelta(): origin(0) {}
+
+    bool isEmpty() const {
+        return addedEnts.empty() && removedEnts.empty() && renamedEnts.empty()
+                && addedRelations.empty() && removedRelations.empty();
+    }
+};
+
+/**
+ * Compares two versions of a Tree and produces a TreeDelta, which can be
+ * saved and applied to the old version to get the new one.
+ *
+ * Ents are matched by UID, or by name when they have none or the Trees
+ * don't share UIDs (see Tree::sharesUIDsWith()). Both Trees are
+ * listed once and sorted by that key, then walked side by side, so each Ent
+ * is looked at once instead of being searched for in the other Tree. The
+ * relations of each matched pair are compared the same way. Apart from the
+ * sorting, the work is linear in the size of both Trees.
+ */
+class TreeDiff {
+
+    /**
+     * Where each Ent was put in the delta's list of Ents.
+     */
+    unordered_map<Ent*, unsigned int> places;
+    /**
+     * The older Ent each newer Ent was matched with.
+     */
+    unordered_map<Ent*, Ent*> matches;
+    /**
+     * Ents of the older Tree with no match in the newer one.
+     */
+    unordered_set<Ent*> removed;
+
+    TreeDelta delta;
+    /**
+     * Whether the two Trees share UIDs, so Ents can be matched by them.
+     */
+    bool byUID;
+
+    /**
+     * Adds an Ent to the delta's list, if it isn't there yet.
+     * @param ent       The Ent.
+     * @param name      The name to record. Usually the Ent's own.
+     * @return          Its place in the list.
+     */
+    unsigned int place(Ent* ent, const string& name);
+
+    unsigned int place(Ent* ent) {
+        return place(ent, ent->getName());
+    }
+
+    /**
+     * Compares one of the relation lists of a matched pair of Ents.
+     */
+    void compareRelations(EntRelation type, const EntList& before,
+            const EntList& after, Ent* oldEnt, Ent* newEnt);
+
+    /**
+     * Lists the relations of an Ent that is new in the later Tree.
+     */
+    void addAllRelations(Ent* ent);
+
+    /**
+     * The UID to match an Ent by, or 0 if it's matched by name.
+     */
+    unsigned int key(Ent* ent) const {
+        return byUID ? ent->getUID() : 0;
+    }
+
+    /**
+     * Orders Ents by key, and Ents without one by name after those.
+     */
+    bool keyLess(Ent* a, Ent* b) const;
+
+    /**
+     * Sorts Ents by keyLess.
+     */
+    void sort(vector<Ent*>* ents) const;
+
+    /**
+     * Lists all of a Tree's Ents, sorted by keyLess.
+     */
+    vector<Ent*> sortedEnts(Tree* tree) const;
+
+public:
+
+    /**
+     * Finds what changed from one version of a Tree to the next.
+     * @param before    The older version.
+     * @param after     The newer version.
+     * @return          The changes, which turn before into after.
+     */
+    static TreeDelta diff(Tree* before, Tree* after);
+
+    /**
+     * Applies a delta to a Tree, which should be the older version it was
+     * made from.
+     * @param tree      The Tree to change.
+     * @param delta     The changes.
+     * @return          How many of the delta's Ents couldn't be found. If it
+     *                  isn't 0 the changes that needed them were skipped.
+     */
+    static unsigned int apply(Tree* tree, const TreeDelta& delta);
+
+    /**
+     * Writes a delta out as text, one change per line.
+     */
+    static string write(const TreeDelta& delta);
+
+    /**
+     * Reads a delta back in from text made by write().
+     * @return          false if the text isn't a delta.
+     */
+    static bool read(const string& text, TreeDelta* delta);
+
+    /**
+     * Diffs two made-up versions of a Tree, writes the delta out and reads
+     * it back, applies it to a third copy of the older one, and checks that
+     * leaves nothing to diff against the newer one.
+     * @return          What went wrong, or nothing if it all matched.
+     */
+    static string check();
+
+};
+
+#endif /* TREEDIFF_H */
@@ -0,0 +1,338 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TreeMerge.h"
+#include "ParentCycles.h"
+#include <algorithm>
+#include <unordered_set>
+#include <functional>
+#include <random>
+#include <set>
+
+using namespace std;
+
+/**
+ * Answers "is this Ent in the list?" in constant time. Short lists are just
+ * scanned, long ones like root's children are hashed once up front.
+ */
+class Membership {
+
+    const EntList& list;
+    unordered_set<Ent*> set;
+    bool hashed;
+
+public:
+
+    Membership(const EntList& l): list(l), hashed(l.size() > 16) {
+        if (hashed)
+            set.insert(list.begin(), list.end());
+    }
+
+    bool contains(Ent* ent) {
+        if (hashed)
+            return set.count(ent) > 0;
+        return std::find(list.begin(), list.end(), ent) != list.end();
+    }
+
+    /**
+     * Call after pushing onto the list, so the hashed copy keeps up.
+     */
+    void added(Ent* ent) {
+        if (hashed)
+            set.insert(ent);
+    }
+
+};
+
+
+TreeMerge::TreeMerge(Tree* tr): into(tr) {
+}
+
+MergeReport TreeMerge::merge(Tree* into, Tree* from) {
+
+    TreeMerge merger(into);
+
+    //Nothing to do when merging a Tree into itself.
+    if (into == from)
+        return merger.report;
+
+    merger.matchEnts(from);
+    merger.unionRelations(from);
+    merger.breakCycles();
+    merger.tidyRoot();
+
+    return merger.report;
+}
+
+
+void TreeMerge::matchEnts(Tree* from) {
+
+    //The receiving Tree's UID index is the build side of the hash join.
+    counterparts.reserve(from->getNameMap()->size());
+    into->reserve(into->getNameMap()->size() + from->getNameMap()->size());
+
+    //UIDs from Trees with different origins were handed out separately,
+    //so the same number says nothing about whether two Ents are the same.
+    bool sharedUIDs = into->sharesUIDsWith(from);
+
+    //Probe side.
+    for (pair<const string, Ent*>& p : *from->getNameMap()) {
+
+        Ent* incoming = p.second;
+        Ent* match = nullptr;
+
+        if (sharedUIDs && incoming->getUID() != 0) {
+            match = into->getEntPtrByUID(incoming->getUID());
+            if (match != nullptr) {
+                report.matchedByUID++;
+                //One side renamed it. It keeps the name it has here.
+                if (match->getName() != incoming->getName())
+                    addConflict(RENAMED, match, incoming);
+            }
+        }
+
+        if (match == nullptr) {
+            Ent* named = into->getEntPtrByName(incoming->getName());
+            //A name only counts as a match when the incoming Tree doesn't
+            //have some other Ent with the named one's UID.
+            if (named != nullptr && (!sharedUIDs || named->getUID() == 0
+                    || from->getEntPtrByUID(named->getUID()) == nullptr)) {
+                match = named;
+                report.matchedByName++;
+            } else {
+                //Copy it over. It gets its relations in unionRelations().
+                match = new Ent();
+                match->setName(incoming->getName());
+                //Keeps its UID when it means the same thing here, so it's
+                //matched by UID next time. Otherwise it gets a new one.
+                if (sharedUIDs && into->getEntPtrByUID(incoming->getUID()) == nullptr)
+                    match->setUID(incoming->getUID());
+                if (named != nullptr) {
+                    //Same name for a different Ent. Names must stay unique.
+                    match->setName(uniqueName(incoming->getName(), incoming->getUID(), from));
+                    addConflict(NAME_CLASH, named, match);
+                }
+                into->addEntToNameMapUnattached(match);
+                report.entsAdded++;
+            }
+        }
+
+        counterparts[incoming] = match;
+    }
+}
+
+
+void TreeMerge::unionRelations(Tree* from) {
+
+    //Parents and children first, so the exclusives and overlaps below are
+    //checked against the merged hierarchy.
+    for (pair<const string, Ent*>& p : *from->getNameMap()) {
+
+        Ent* ent = counterparts[p.second];
+        Membership children(ent->getList(RELATION_CHILD));
+        Membership parents(ent->getList(RELATION_PARENT));
+        Membership exclusives(ent->getList(RELATION_EXCLUSIVE));
+
+        for (Ent* incomingChild : p.second->getList(RELATION_CHILD)) {
+            Ent* child = counterparts[incomingChild];
+            if (child == ent || children.contains(child))
+                continue;
+
+            if (parents.contains(child)) {
+                addConflict(REVERSED_PARENT, ent, child);
+            } else if (exclusives.contains(child)) {
+                addConflict(PARENT_AND_EXCLUSIVE, ent, child);
+            } else {
+                Ent::connectUnchecked(ent, child);
+                children.added(child);
+                addedParents.push_back(make_pair(ent, child));
+                report.parentsAdded++;
+            }
+        }
+    }
+
+    less<Ent*> before;
+
+    for (pair<const string, Ent*>& p : *from->getNameMap()) {
+
+        Ent* incoming = p.second;
+        Ent* ent = counterparts[incoming];
+        Membership children(ent->getList(RELATION_CHILD));
+        Membership parents(ent->getList(RELATION_PARENT));
+        Membership exclusives(ent->getList(RELATION_EXCLUSIVE));
+        Membership overlaps(ent->getList(RELATION_OVERLAP));
+
+        //Each pair is listed on both of its Ents. Only look at it once.
+        for (Ent* incomingOther : incoming->getList(RELATION_EXCLUSIVE)) {
+            if (before(incomingOther, incoming))
+                continue;
+            Ent* other = counterparts[incomingOther];
+            if (other == ent || exclusives.contains(other))
+                continue;
+
+            if (parents.contains(other) || children.contains(other)) {
+                addConflict(PARENT_AND_EXCLUSIVE, ent, other);
+            } else if (overlaps.contains(other)) {
+                addConflict(OVERLAP_AND_EXCLUSIVE, ent, other);
+            } else {
+                Ent::setExclusive(ent, other);
+                exclusives.added(other);
+                report.exclusivesAdded++;
+            }
+        }
+
+        for (Ent* incomingOther : incoming->getList(RELATION_OVERLAP)) {
+            if (before(incomingOther, incoming))
+                continue;
+            Ent* other = counterparts[incomingOther];
+            if (other == ent || overlaps.contains(other))
+                continue;
+
+            if (exclusives.contains(other)) {
+                addConflict(OVERLAP_AND_EXCLUSIVE, ent, other);
+            } else {
+                Ent::setOverlap(ent, other);
+                overlaps.added(other);
+                report.overlapsAdded++;
+            }
+        }
+    }
+}
+
+
+void TreeMerge::breakCycles() {
+
+    //Every loop has at least one connection the merge added, since the
+    //receiving Tree had none. Take back the added ones inside a loop.
+    for (pair<Ent*, Ent*>& added : ParentCycles::findLooping(into, addedParents)) {
+        Ent::disconnectUnchecked(added.first, added.second);
+        addConflict(PARENT_CYCLE, added.first, added.second);
+        report.parentsAdded--;
+    }
+}
+
+
+void TreeMerge::tidyRoot() {
+
+    Ent* root = into->getRoot();
+    //Ents to take out from under root. Done all at once at the end, since
+    //root may have a huge number of children to search through.
+    unordered_set<Ent*> leaving;
+
+    for (pair<Ent* const, Ent*>& p : counterparts) {
+        Ent* ent = p.second;
+        if (ent == root)
+            continue;
+
+        const EntList& parents = ent->getList(RELATION_PARENT);
+        if (parents.empty()) {
+            //Lost its only parent to a conflict. Keep it from being an orphan.
+            Ent::connectUnchecked(root, ent);
+        } else if (parents.size() > 1 && contains(parents, root)) {
+            //root is already an ancestor through the other parent.
+            leaving.insert(ent);
+        }
+    }
+
+    if (leaving.empty())
+        return;
+
+    Ent::disconnectUnchecked(root, leaving);
+}
+
+
+string TreeMerge::check() {
+
+    //Each Ent gets up to 3 parents from those before it, or just root.
+    mt19937 random(27);
+    Tree from("Merge check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 2000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        from.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 10 == 0) {
+            Ent::connectUnchecked(from.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 3; n < 3; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    //Some pairs which aren't parent and child are exclusive or overlap.
+    for (unsigned int i = 0; i + 1000 < ents.size(); i += 7) {
+        if (ents[i + 1000]->isChildOf(ents[i]))
+            continue;
+        if (i % 2)
+            Ent::setExclusive(ents[i], ents[i + 1000]);
+        else
+            Ent::setOverlap(ents[i], ents[i + 1000]);
+    }
+
+    Tree into("Merged");
+    MergeReport report = merge(&into, &from);
+    if (!report.conflicts.empty())
+        return to_string(report.conflicts.size()) + " conflicts merging into an empty Tree";
+    if (report.entsAdded != ents.size())
+        return "added " + to_string(report.entsAdded) + " Ents, not " + to_string(ents.size());
+
+    auto names = [](const vector<Ent*>& list) {
+        set<string> found;
+        for (Ent* ent : list)
+            found.insert(ent->getName());
+        return found;
+    };
+    for (Ent* ent : ents) {
+        Ent* merged = into.getEntPtrByName(ent->getName());
+        if (merged == nullptr)
+            return ent->getName() + " is missing";
+        if (names(merged->getParents()) != names(ent->getParents()))
+            return ent->getName() + " has the wrong parents";
+        if (names(merged->getExclusives()) != names(ent->getExclusives()))
+            return ent->getName() + " has the wrong exclusives";
+        if (names(merged->getOverlaps()) != names(ent->getOverlaps()))
+            return ent->getName() + " has the wrong overlaps";
+    }
+
+    report = merge(&into, &from);
+    if (report.entsAdded + report.parentsAdded + report.exclusivesAdded
+            + report.overlapsAdded != 0 || !report.conflicts.empty())
+        return "merging the same Tree again changed it";
+    return "";
+}
+
+string TreeMerge::uniqueName(const string& name, unsigned int uid, Tree* from) {
+    string renamed = name + " (" + to_string(uid) + ")";
+    //Either Tree may already have an Ent called that, so keep counting up.
+    for (unsigned int n = 2; into->getEntPtrByName(renamed) != nullptr
+            || from->getEntPtrByName(renamed) != nullptr; n++)
+        renamed = name + " (" + to_string(uid) + " " + to_string(n) + ")";
+    return renamed;
+}
+
+void TreeMerge::addConflict(MergeConflictType type, Ent* a, Ent* b) {
+    MergeConflict conflict = {type, a->getName(), b->getName()};
+    report.conflicts.push_back(conflict);
+}
+
+bool TreeMerge::contains(const EntList& list, Ent* ent) {
+    return std::find(list.begin(), list.end(), ent) != list.end();
+}
@@ -0,0 +1,160 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TREEMERGE_H
+#define TREEMERGE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "../Core/Tree.h"
+
+using namespace std;
+
+/**
+ * The kinds of disagreement two Trees can have about the same pair of Ents.
+ */
+typedef enum {
+    /** Each Tree says the other Ent is the parent. */
+    REVERSED_PARENT,
+    /** One Tree says parent and child, the other says exclusive. */
+    PARENT_AND_EXCLUSIVE,
+    /** One Tree says they overlap, the other says exclusive. */
+    OVERLAP_AND_EXCLUSIVE,
+    /** The parent connections of both Trees together form a loop. */
+    PARENT_CYCLE,
+    /** Same name, but different UIDs. The incoming Ent was renamed. */
+    NAME_CLASH,
+    /** Same UID, but different names. Matched, keeping the receiving name. */
+    RENAMED
+} MergeConflictType;
+
+/**
+ * One relation from the incoming Tree which was not merged, and why.
+ * Names are copied so the conflict can be shown after either Tree is gone.
+ */
+struct MergeConflict {
+    MergeConflictType type;
+    string a;
+    string b;
+};
+
+/**
+ * What a merge did.
+ */
+struct MergeReport {
+    unsigned int matchedByUID;
+    unsigned int matchedByName;
+    unsigned int entsAdded;
+    unsigned int parentsAdded;
+    unsigned int exclusivesAdded;
+    unsigned int overlapsAdded;
+    vector<MergeConflict> conflicts;
+
+    MergeReport(): matchedByUID(0), matchedByName(0), entsAdded(0),
+            parentsAdded(0), exclusivesAdded(0), overlapsAdded(0) {}
+};
+
+/**
+ * Merges the Ents and relations of one Tree into another.
+ *
+ * Ents are matched with a hash join: each incoming Ent is probed against the
+ * receiving Tree's UID index, or its name index when the UID isn't found.
+ * UIDs are only used when both Trees share an origin. An Ent renamed on one
+ * side is still matched by its UID, and keeps the receiving Tree's name.
+ * Ents with no match are copied over.
+ * Relations are then unioned. Anything that contradicts what the receiving
+ * Tree already says is left out and reported instead. Loops of parents are
+ * found afterwards with a single pass over the merged Tree.
+ *
+ * Every step touches each Ent and relation a constant number of times, so
+ * the whole merge is linear in the combined size of both Trees.
+ *
+ * The incoming Tree is left as it was.
+ */
+class TreeMerge {
+
+    /**
+     * The Tree receiving the merge.
+     */
+    Tree* into;
+    /**
+     * The receiving Ent each incoming Ent was matched with or copied to.
+     */
+    unordered_map<Ent*, Ent*> counterparts;
+    /**
+     * Parent connections the merge added, as parent then child.
+     * Kept so connections that close a loop can be taken back out.
+     */
+    vector<pair<Ent*, Ent*> > addedParents;
+
+    MergeReport report;
+
+    TreeMerge(Tree* tr);
+
+    /**
+     * Finds or creates the receiving Ent for every incoming Ent.
+     */
+    void matchEnts(Tree* from);
+
+    /**
+     * Adds the incoming Tree's relations between matched Ents.
+     */
+    void unionRelations(Tree* from);
+
+    /**
+     * Takes back any added parent connections which closed a loop.
+     */
+    void breakCycles();
+
+    /**
+     * Removes root as a parent of Ents which now have a more specific one,
+     * and puts any Ent left with no parents back under root.
+     */
+    void tidyRoot();
+
+    /**
+     * A name for an Ent whose name is taken, which isn't taken either.
+     */
+    string uniqueName(const string& name, unsigned int uid, Tree* from);
+
+    void addConflict(MergeConflictType type, Ent* a, Ent* b);
+
+    static bool contains(const EntList& list, Ent* ent);
+
+public:
+
+    /**
+     * Merges everything in from into into.
+     * @param into  The Tree which receives the Ents and relations.
+     * @param from  The Tree being merged in. It isn't changed.
+     * @return      Counts of what was matched and added, and any conflicts.
+     */
+    static MergeReport merge(Tree* into, Tree* from);
+
+    /**
+     * Merges a made-up Tree into an empty one, and checks every Ent came out
+     * with the same parents, exclusives and overlaps. Then merges it again,
+     * which should add nothing.
+     * @return      What went wrong, or nothing if it all matched.
+     */
+    static string check();
+
+};
+
+#endif /* TREEMERGE_H */
@@ -169,7 +169,7 @@ void CLI::parseCommand(string str) {
             EntX newFocus = tree.getEntByName(argument);
             //did we find one with that name? If so, the EntInstance won't be empty.
             if (newFocus.isEmpty()) {
-                cout << "No Ent found with that name.\n";
+                printNotFound(argument);
             } else {
                 if (focus.equals(newFocus)) {
                     cout << "That Ent is already the focus.\n";
@@ -184,15 +184,28 @@ void CLI::parseCommand(string str) {
             //Retrieve a pointer to the given Ent.
             EntX potentialChild = tree.getEntByName(argument);
             if (potentialChild.isEmpty()) {
-                cout << "No Ent found with that name.\n";
+                printNotFound(argument);
             } else if (potentialChild.equals(focus)) {
                 cout << "Can't add the focus Ent as its own parent.\n";
             } else {
                 //OK, request the superclass to handle it.
-                EntsInterface::requestParentChildConnection(focus, potentialChild);
+                EntsInterface::requestParentChildConnection(tree, focus, potentialChild);
             }
             
         } //end "p"
+        else if (isCommand("search", str, &argument)) {
+            vector<EntX> found = tree.getEntsNamedLike(argument, 10);
+            if (found.empty())
+                cout << "No Ents are named anything like that.\n";
+            else
+                printEntList("Ents named like \"" + argument + "\":", found);
+        }
+        else if (isCommand("query", str, &argument)) {
+            requestQuery(tree, argument, false);
+        }
+        else if (isCommand("explain", str, &argument)) {
+            requestQuery(tree, argument, true);
+        }
         else if (str == "desc") {
             //listDescendents(focusPtr);
         }
@@ -200,7 +213,82 @@ void CLI::parseCommand(string str) {
             //listAncestors(focusPtr);
         }
         else if (str == "save") {
-            //saveTree(tree);
+            requestToSaveTree(tree);
+        }
+        else if (str == "merge") {
+            requestTreeMerge(tree);
+        }
+        else if (str == "diff") {
+            requestTreeDiff(tree);
+        }
+        else if (str == "patch") {
+            requestToApplyPatch(tree);
+        }
+        else if (str == "bench primes") {
+            requestPrimeBenchmark();
+        }
+        else if (str == "bench edits") {
+            requestEditBenchmark();
+        }
+        else if (str == "bench descendents") {
+            requestTraversalBenchmark(tree, focus);
+        }
+        else if (str == "bench server") {
+            requestServerBenchmark(tree);
+        }
+        else if (str == "bench client") {
+            requestClientBenchmark(tree);
+        }
+        else if (str == "bench shards") {
+            requestShardBenchmark(tree);
+        }
+        else if (str == "bench cores") {
+            requestCoreBenchmark(tree);
+        }
+        else if (str == "bench overload") {
+            requestOverloadBenchmark(tree);
+        }
+        else if (str == "bench names") {
+            requestNameBenchmark(tree);
+        }
+        else if (str == "bench sets") {
+            requestSetBenchmark(tree);
+        }
+        else if (str == "serve") {
+            requestToStartServer(tree);
+        }
+        else if (str == "stop serving") {
+            requestToStopServer();
+        }
+        else if (str == "follow") {
+            requestToFollow(tree);
+        }
+        else if (str == "stop following") {
+            requestToStopFollowing();
+        }
+        else if (str == "replication status") {
+            requestReplicationStatus();
+        }
+        else if (str == "path") {
+            requestPath(tree);
+        }
+        else if (str == "neighborhood") {
+            requestNeighborhood(tree);
+        }
+        else if (str == "watch") {
+            requestToWatch();
+        }
+        else if (str == "cache stats") {
+            requestCacheStats();
+        }
+        else if (str == "latency") {
+            requestLatencyStats();
+        }
+        else if (str == "import") {
+            requestToImportFile(tree);
+        }
+        else if (str == "check") {
+            requestChecks();
         }
         else if (str == "rename tree") {
             requestToRenameTree(tree);
@@ -417,11 +505,40 @@ void CLI::printHelp() {
             << "\t>help\t\t\tPrints this help section.\n"
             << "\t>print tree name\tPrints the current tree's name.\n"
             << "\t>rename tree\t\tAllows you to rename the tree.\n"
+            << "\t>import\t\t\tImports Ents from a CSV, TSV or NCBI taxonomy file.\n"
+            << "\t>save\t\t\tSaves the tree to a file.\n"
+            << "\t>merge\t\t\tMerges another tree or saved file into this one.\n"
+            << "\t>diff\t\t\tShows what changed since an older tree or saved file.\n"
+            << "\t>patch\t\t\tApplies a patch saved by diff.\n"
+            << "\t>bench primes\t\tTimes the prime sieve against trial division.\n"
+            << "\t>bench edits\t\tTimes threads editing separate subtrees of a new tree at once.\n"
+            << "\t>bench descendents\tTimes finding the focus's descendents on many threads.\n"
+            << "\t>bench server\t\tTimes many clients making requests of a local server.\n"
+            << "\t>bench client\t\tTimes a client's calls, one at a time and in batches.\n"
+            << "\t>bench shards\t\tTimes traversals of the tree split between shard processes.\n"
+            << "\t>bench cores\t\tTimes a server with a copy of the tree per core against a shared one.\n"
+            << "\t>bench overload\t\tShows a local server's memory and latency under far too many requests.\n"
+            << "\t>bench names\t\tTimes finding Ents by part of their name, in any case and with typos.\n"
+            << "\t>bench sets\t\tTimes walking, combining and caching descendents as compressed sets.\n"
+            << "\t>path\t\t\tShows the shortest chain of relations between two Ents.\n"
+            << "\t>neighborhood\t\tShows the Ents a few hops from one, and their relations.\n"
+            << "\t>serve\t\t\tStarts a server clients can use to query and edit the tree.\n"
+            << "\t>stop serving\t\tStops the server.\n"
+            << "\t>follow\t\t\tMakes this empty tree a read-only copy of a server's.\n"
+            << "\t>stop following\t\tStops copying the server's changes.\n"
+            << "\t>replication status\tShows how far behind a follower is, and a server's followers.\n"
+            << "\t>watch\t\t\tShows the changes a server's tree has under an Ent for a while.\n"
+            << "\t>cache stats\t\tShows how often the server's query cache has the answer.\n"
+            << "\t>latency\t\tShows how long the server takes over lookups, traversals and edits.\n"
+            << "\t>check\t\t\tChecks the algorithms' answers against plainer ways of finding them.\n"
             << "\t>clear\t\t\tPrints out blank lines, clearing the window.\n"
             << "\t>exit\t\t\tExits this program.\n"
             /*<< "\t>b\t\t\tUsed to bring up an optional breakpoint if desired.\n"*/
             << "Commands with one argument:\n"
-            << "\t>f [Ent name]\t\tChanges focus to the Ent with the given name.\n";
+            << "\t>f [Ent name]\t\tChanges focus to the Ent with the given name.\n"
+            << "\t>search [text]\t\tLists Ents named like the text, in any case or with typos.\n"
+            << "\t>query [query]\t\tLists the Ents a query finds, like descendents(A) & children(B) - ent(C).\n"
+            << "\t>explain [query]\tShows how a query is planned, and how many Ents each part found.\n";
 } //end of printHelp()
 
 void CLI::printEntList(string listDescription, vector<EntX> list) {
@@ -432,6 +549,13 @@ void CLI::printEntList(string listDescription, vector<EntX> list) {
         cout << "\t" << ent.getName() << endl;
 }
 
+void CLI::printNotFound(string name) {
+    cout << "No Ent found with that name.\n";
+    vector<EntX> similar = tree.getEntsNamedLike(name, 5);
+    if (!similar.empty())
+        printEntList("Did you mean one of these?", similar);
+}
+
 void CLI::printParents(EntX ent) {
     //Each Ent must have at least one parent. Except for root of course!
     if (ent.equals(tree.getRoot())) {
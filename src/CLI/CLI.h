@@ -86,6 +86,11 @@ class CLI : public EntsInterface {
     
     void printEntList(string listDescription, vector<EntX> list);
     
+    /**
+     * Says there's no Ent with the name, and lists those it might have been.
+     */
+    void printNotFound(string name);
+    
     void printParents(EntX ent);
     
     void printChildren(EntX ent);
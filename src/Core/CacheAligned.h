@@ -0,0 +1,56 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CACHEALIGNED_H
+#define CACHEALIGNED_H
+
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+/**
+ * Base for things that sit on cache lines of their own. C++11's new ignores
+ * alignas past what malloc gives, so this hands out properly aligned memory
+ * instead. Derived types still need their own alignas(64).
+ */
+struct CacheAligned {
+
+    static const size_t LINE = 64;
+
+    static void* operator new(size_t size) {
+        void* p;
+        if (posix_memalign(&p, LINE, size) != 0)
+            throw bad_alloc();
+        return p;
+    }
+
+    static void* operator new[](size_t size) {
+        return operator new(size);
+    }
+
+    static void operator delete(void* p) {
+        free(p);
+    }
+
+    static void operator delete[](void* p) {
+        free(p);
+    }
+};
+
+#endif /* CACHEALIGNED_H */
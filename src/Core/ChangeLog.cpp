@@ -0,0 +1,118 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ChangeLog.h"
+#include "Ent.h"
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+ChangeLog::ChangeLog(size_t cap): first(0), capacity(max<size_t>(cap, 1)) {
+}
+
+void ChangeLog::record(ChangeType type, Ent* a, Ent* b) {
+    
+    EntList::WriteContext* context = EntList::writing;
+    if (context == nullptr || context->log == nullptr)
+        return;
+    
+    TreeChange change = {type, a->getUID(), b != nullptr ? b->getUID() : 0, string()};
+    if (type == CHANGE_ADD_ENT || type == CHANGE_RENAME)
+        change.name = a->getName();
+    context->log->add(std::move(change), a, b);
+}
+
+void ChangeLog::add(TreeChange change, Ent* a, Ent* b) {
+    
+    //Taken before the lock, so the time is never behind the one before by
+    //more than it took to get the lock.
+    int64_t time = now();
+    lock_guard<mutex> hold(lock);
+    entries.push_back(LoggedChange{std::move(change), EntList::writing->version, time});
+    if (entries.size() > capacity) {
+        entries.pop_front();
+        first++;
+    }
+    for (ChangeWatcher* watcher : watchers)
+        watcher->changed(entries.back(), first + entries.size() - 1, a, b);
+    for (pair<const void*, function<void()> >& listener : listeners)
+        listener.second();
+}
+
+uint64_t ChangeLog::getStart() const {
+    lock_guard<mutex> hold(lock);
+    return first;
+}
+
+uint64_t ChangeLog::getEnd() const {
+    lock_guard<mutex> hold(lock);
+    return first + entries.size();
+}
+
+bool ChangeLog::read(uint64_t from, size_t most, vector<LoggedChange>* out) const {
+    
+    lock_guard<mutex> hold(lock);
+    if (from < first || from > first + entries.size())
+        return false;
+    
+    deque<LoggedChange>::const_iterator begin = entries.begin() + (from - first);
+    deque<LoggedChange>::const_iterator end = begin
+            + min<size_t>(most, entries.end() - begin);
+    out->insert(out->end(), begin, end);
+    return true;
+}
+
+uint64_t ChangeLog::findAfter(uint64_t version) const {
+    
+    lock_guard<mutex> hold(lock);
+    //Versions are only roughly in order, so look at all of them.
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].version > version)
+            return first + i;
+    }
+    return first + entries.size();
+}
+
+void ChangeLog::listen(const void* key, function<void()> listener) {
+    lock_guard<mutex> hold(lock);
+    listeners.push_back(make_pair(key, std::move(listener)));
+}
+
+void ChangeLog::unlisten(const void* key) {
+    lock_guard<mutex> hold(lock);
+    listeners.erase(remove_if(listeners.begin(), listeners.end(),
+            [key](const pair<const void*, function<void()> >& listener) {
+                return listener.first == key;
+            }), listeners.end());
+}
+
+void ChangeLog::addWatcher(ChangeWatcher* watcher) {
+    lock_guard<mutex> hold(lock);
+    watchers.push_back(watcher);
+}
+
+void ChangeLog::removeWatcher(ChangeWatcher* watcher) {
+    lock_guard<mutex> hold(lock);
+    watchers.erase(remove(watchers.begin(), watchers.end(), watcher), watchers.end());
+}
+
+int64_t ChangeLog::now() {
+    return chrono::duration_cast<chrono::milliseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,202 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHANGELOG_H
+#define CHANGELOG_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+#include "EntList.h"
+
+using namespace std;
+
+class Ent;
+
+/**
+ * The kinds of change a Tree's log records. These are sent to followers as
+ * numbers, so new ones go at the end.
+ */
+typedef enum {
+    /** a is the new Ent's UID, and name its name. It has no relations yet. */
+    CHANGE_ADD_ENT,
+    /** a is gone. Its relations were all taken away first. */
+    CHANGE_REMOVE_ENT,
+    /** a is now called name. */
+    CHANGE_RENAME,
+    /** a is now the parent of b. */
+    CHANGE_CONNECT,
+    CHANGE_DISCONNECT,
+    CHANGE_SET_EXCLUSIVE,
+    CHANGE_UNSET_EXCLUSIVE,
+    CHANGE_SET_OVERLAP,
+    CHANGE_UNSET_OVERLAP
+} ChangeType;
+
+/**
+ * One change to a Tree. Ents are named by UID, which is the same wherever
+ * the change is applied.
+ */
+struct TreeChange {
+    ChangeType type;
+    unsigned int a;
+    unsigned int b;
+    /** Only for CHANGE_ADD_ENT and CHANGE_RENAME. */
+    string name;
+};
+
+/**
+ * A change as the log keeps it.
+ */
+struct LoggedChange {
+    TreeChange change;
+    /** The version of the Writer or Editor that made it. */
+    uint64_t version;
+    /** When it was made, in milliseconds since the epoch. */
+    int64_t time;
+};
+
+/**
+ * Told about each change as it's logged, along with the Ents it touched.
+ */
+class ChangeWatcher {
+
+public:
+
+    virtual ~ChangeWatcher() {}
+
+    /**
+     * Called on the thread making the change, while its Ents and the log are
+     * locked, so it must be quick and mustn't touch the log. The Ents'
+     * relations can be read, as they are with the change made.
+     * @param offset    Where the change is in the log.
+     * @param b         nullptr when the change only has one Ent.
+     */
+    virtual void changed(const LoggedChange& change, uint64_t offset, Ent* a, Ent* b) = 0;
+
+};
+
+/**
+ * Every change made to a Tree within a Writer or Editor, in the order they
+ * were made, so it can be shipped to other processes and played back there.
+ * Changes are counted from 0, and the count of one is its offset.
+ *
+ * Changes are added as they're made, while the Ents they touch are locked,
+ * so two changes to the same Ents are always logged in the order they
+ * happened. Changes from different Editors can be interleaved, which is
+ * why each carries its version.
+ *
+ * Only so many are kept. Once the log is full the oldest are dropped, and a
+ * follower that hasn't read them yet has to start again from a snapshot.
+ *
+ * Edits made outside a Writer or Editor, like loading a file, aren't
+ * versioned and aren't logged either.
+ */
+class ChangeLog {
+
+    mutable mutex lock;
+    deque<LoggedChange> entries;
+    /**
+     * The offset of entries.front().
+     */
+    uint64_t first;
+    size_t capacity;
+    /**
+     * Told about each change as it's added, while the log is locked. They
+     * must be quick and mustn't touch the log.
+     */
+    vector<pair<const void*, function<void()> > > listeners;
+    vector<ChangeWatcher*> watchers;
+
+    void add(TreeChange change, Ent* a, Ent* b);
+
+public:
+
+    static const size_t DEFAULT_CAPACITY = 1 << 18;
+
+    /**
+     * @param capacity  How many changes to keep.
+     */
+    ChangeLog(size_t capacity = DEFAULT_CAPACITY);
+
+    /**
+     * Logs a change to the current thread's Tree, if a Writer or Editor is
+     * held and its Tree has a log. Called by the Ent and Tree methods that
+     * make the changes.
+     */
+    static void record(ChangeType type, Ent* a, Ent* b = nullptr);
+
+    /**
+     * The offset of the oldest change still kept.
+     */
+    uint64_t getStart() const;
+
+    /**
+     * The offset the next change will get.
+     */
+    uint64_t getEnd() const;
+
+    /**
+     * Copies out changes, starting at an offset.
+     * @param from      The offset of the first one.
+     * @param most      How many to copy at most.
+     * @param out       Where to add them.
+     * @return          false if from is no longer kept, or hasn't been
+     *                  reached yet.
+     */
+    bool read(uint64_t from, size_t most, vector<LoggedChange>* out) const;
+
+    /**
+     * Where to start playing back after a snapshot at the given version: the
+     * first change with a later version. Changes after it with an earlier
+     * one are already in the snapshot.
+     */
+    uint64_t findAfter(uint64_t version) const;
+
+    /**
+     * Has a function called each time a change is added, until unlisten()
+     * with the same key. It's called on the thread making the change.
+     */
+    void listen(const void* key, function<void()> listener);
+
+    /**
+     * Once this returns, the listener won't be called again.
+     */
+    void unlisten(const void* key);
+
+    /**
+     * Has a ChangeWatcher told about each change, until removeWatcher().
+     */
+    void addWatcher(ChangeWatcher* watcher);
+
+    /**
+     * Once this returns, the watcher won't be called again.
+     */
+    void removeWatcher(ChangeWatcher* watcher);
+
+    /**
+     * The time changes are stamped with, now.
+     */
+    static int64_t now();
+
+};
+
+#endif /* CHANGELOG_H */
@@ -17,15 +17,17 @@
  */
 
 #include "Ent.h"
+#include "ChangeLog.h"
 #include <string>
 #include <algorithm>
+#include <functional>
 
 using namespace std;
 
-Ent::Ent() {
+Ent::Ent() : uid(0), addedVersion(0) {
 }
 
-Ent::Ent(string name) : name(name) {
+Ent::Ent(string name) : name(name), uid(0), addedVersion(0) {
     //Useful in debugging, and generally good info for the CLI user.
     cout << "An Ent has been created with the name \"" << name << "\".\n";
 }
@@ -43,6 +45,7 @@ int Ent::connectUnchecked(Ent* parent, Ent* child) {
     //Add references to the vectors holding the lists.
     parent->addChildUnchecked(child);
     child->addParentUnchecked(parent);
+    ChangeLog::record(CHANGE_CONNECT, parent, child);
     return 0;
 }
 
@@ -95,11 +98,15 @@ int Ent::disconnectUnchecked(Ent* parent, Ent* child) {
     if (itC != child->parents.end())
         child->parents.erase(itC);
     
+    if (itP != parent->children.end() || itC != child->parents.end())
+        ChangeLog::record(CHANGE_DISCONNECT, parent, child);
+    return 0;
 }
 
 int Ent::setOverlap(Ent* a, Ent* b) {
     a->addOverlaps(b);
     b->addOverlaps(a);
+    ChangeLog::record(CHANGE_SET_OVERLAP, a, b);
 
     return 0;
 }
@@ -107,6 +114,42 @@ int Ent::setOverlap(Ent* a, Ent* b) {
 int Ent::setExclusive(Ent* a, Ent* b) {
     a->addExclusive(b);
     b->addExclusive(a);
+    ChangeLog::record(CHANGE_SET_EXCLUSIVE, a, b);
+
+    return 0;
+}
+
+/**
+ * Removes the first appearance of an Ent from one of the lists, if it's there.
+ */
+static void eraseFrom(EntList* list, Ent* ent) {
+    auto it = std::find(list->begin(), list->end(), ent);
+    if (it != list->end())
+        list->erase(it);
+}
+
+int Ent::disconnectUnchecked(Ent* parent, const unordered_set<Ent*>& children) {
+    
+    parent->children.removeIf([&children](Ent* child) { return children.count(child) > 0; });
+    for (Ent* child : children) {
+        eraseFrom(&child->parents, parent);
+        ChangeLog::record(CHANGE_DISCONNECT, parent, child);
+    }
+    return 0;
+}
+
+int Ent::unsetOverlap(Ent* a, Ent* b) {
+    eraseFrom(&a->overlaps, b);
+    eraseFrom(&b->overlaps, a);
+    ChangeLog::record(CHANGE_UNSET_OVERLAP, a, b);
+
+    return 0;
+}
+
+int Ent::unsetExclusive(Ent* a, Ent* b) {
+    eraseFrom(&a->exclusives, b);
+    eraseFrom(&b->exclusives, a);
+    ChangeLog::record(CHANGE_UNSET_EXCLUSIVE, a, b);
 
     return 0;
 }
@@ -167,7 +210,7 @@ void Ent::getAncestors(unordered_set<Ent*>* list, int depth)
         return;
     }
     //We need to get each parent, add it to the list, and call in recursion.
-    for (Ent* parent : parents) {
+    for (Ent* parent : parents.view()) {
         list->insert(parent);
         //We need to go deeper...
         parent->getAncestors(list, depth+1);
@@ -195,7 +238,7 @@ void Ent::getDescendents(unordered_set<Ent*>* list, int depth)
         return;
     }
     //We need to get each parent, add it to the list, and call in recursion.
-    for (Ent* child : children) {
+    for (Ent* child : children.view()) {
         list->insert(child);
         //We need to go deeper...
         child->getDescendents(list, depth+1);
@@ -208,8 +251,8 @@ const unordered_set<Ent*> Ent::getSiblings() {
     //Create an empty unordered_set to fill up.
     unordered_set<Ent*> siblings;
     //Go through each parent.
-    for (Ent* parent : parents) {
-        for (Ent* sibling : parent->children) {
+    for (Ent* parent : parents.view()) {
+        for (Ent* sibling : parent->children.view()) {
             siblings.insert(sibling);
         }
     }
@@ -220,6 +263,12 @@ const unordered_set<Ent*> Ent::getSiblings() {
 }
 
 
+bool Ent::isChildOf(Ent* parentPtr) {
+    EntListView view = parents.view();
+    return std::find(view.begin(), view.end(), parentPtr) != view.end();
+}
+
+
 void Ent::addParentUnchecked(Ent* parentPtr) {
     assert(parentPtr != nullptr);
     parents.push_back(parentPtr);
@@ -229,4 +278,58 @@ void Ent::addParentUnchecked(Ent* parentPtr) {
 void Ent::addChildUnchecked(Ent* childPtr) {
     assert(childPtr != nullptr);
     children.push_back(childPtr);
-}
\ No newline at end of file
+}
+
+EntLocks::EntLocks(vector<Ent*> toLock): ents(toLock) {
+    
+    std::sort(ents.begin(), ents.end(), [](Ent* a, Ent* b) {
+        return a->uid != b->uid ? a->uid < b->uid : std::less<Ent*>()(a, b);
+    });
+    ents.erase(std::unique(ents.begin(), ents.end()), ents.end());
+    for (Ent* ent : ents)
+        ent->editLock.lock();
+}
+
+EntLocks::~EntLocks() {
+    for (EntList* list : changing)
+        list->endChange();
+    for (auto it = ents.rbegin(); it != ents.rend(); ++it)
+        (*it)->editLock.unlock();
+}
+
+bool EntLocks::holds(Ent* ent) const {
+    return std::find(ents.begin(), ents.end(), ent) != ents.end();
+}
+
+void EntLocks::willChange(EntList& list) {
+    if (std::find(changing.begin(), changing.end(), &list) != changing.end())
+        return;
+    changing.push_back(&list);
+    list.beginChange();
+}
+
+bool EntLocks::validate(const vector<Read>& reads) const {
+    
+    //Like a seqlock: the list reads must be done before the stamps are
+    //looked at again. It's a full fence so that of two Editors each marking
+    //a list the other read, at least one sees the other's mark.
+    atomic_thread_fence(memory_order_seq_cst);
+    for (const Read& read : reads) {
+        uint64_t now = read.first->currentStamp();
+        //Marking it here added one.
+        if (std::find(changing.begin(), changing.end(), read.first) != changing.end())
+            now--;
+        if (now != read.second)
+            return false;
+    }
+    return true;
+}
+
+Ent* EntLocks::ownerOf(const EntList* list) const {
+    for (Ent* ent : ents) {
+        if (list == &ent->parents || list == &ent->children
+                || list == &ent->exclusives || list == &ent->overlaps)
+            return ent;
+    }
+    return nullptr;
+}
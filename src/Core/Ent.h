@@ -25,10 +25,23 @@
 #include <vector>
 #include <assert.h>
 #include <unordered_set>
+#include "EntList.h"
+#include "VersionLock.h"
 //Not dependent on the class Tree. Ents are 
 
 using namespace std;
 
+/**
+ * The four ways two Ents can be directly related. A parent/child connection
+ * is one relation seen from either end.
+ */
+typedef enum {
+    RELATION_PARENT,
+    RELATION_CHILD,
+    RELATION_EXCLUSIVE,
+    RELATION_OVERLAP
+} EntRelation;
+
 /**
  * An Ent object instance represents and Ent node within a Tree.
  * Ent nodes represent things which satisfy a condition.
@@ -63,35 +76,48 @@ class Ent {
     
     
     friend class Tree;
+    friend class EntLocks;
     /**
      * The name of the given Ent. Should ideally be unique.
      */
     string name;
     /**
-     * The unique identifier of the Ent. UIDs not implemented yet.
-     * Will be useful when writing Hierarchies to file, but not as useful
-     * when all Ents are just stored in heap memory like as of now.
+     * The unique identifier of the Ent. Handed out by the Tree's UIDAllocator
+     * when the Ent is added, unless it already has one from a file or another
+     * Tree. 0 means "no UID", 1 is always root.
      */
     unsigned int uid;
+    /**
+     * The version of the Tree the Ent was added in, so older snapshots can't
+     * find it by name. 0 if it wasn't added by a Tree::Writer.
+     */
+    uint64_t addedVersion;
     
     //TODO Change the following 4 containers to unordered_sets for efficiency.
+    //They're EntLists so other threads can read them while they change.
     
     /**
      * Vector of pointers to the Ent's parents.
      */
-    vector<Ent*> parents;
+    EntList parents;
     /**
      * Vector of pointers to the Ent's children.
      */
-    vector<Ent*> children;
+    EntList children;
     /**
      * Vector of pointers to the Ents which are directly exclusive to this one.
      */
-    vector<Ent*> exclusives;
+    EntList exclusives;
     /**
      * Vector of pointers to the Ents which overlap with this one.
      */
-    vector<Ent*> overlaps;
+    EntList overlaps;
+    /**
+     * Held while the four lists above are edited through EntLocks, so
+     * threads editing unrelated Ents don't wait on each other. Each list's
+     * own stamp tells readers whether it changed while they looked.
+     */
+    VersionLock editLock;
 
     /**
      * Adds an Ent as a parent of this one, but doesn't check anything.
@@ -169,6 +195,13 @@ public:
      */
     static int disconnectUnchecked(Ent* parent, Ent* child);
     
+    /**
+     * Disconnects a parent from many of its children at once, going through
+     * its list of children only once. For Ents like root, which can have a
+     * huge number of them. Doesn't check anything either.
+     */
+    static int disconnectUnchecked(Ent* parent, const unordered_set<Ent*>& children);
+    
     /**
      * TODO Test for consistency somewhere.
      * @param a
@@ -179,6 +212,16 @@ public:
     
     static int setExclusive(Ent* a, Ent* b);
     
+    /**
+     * Takes back setOverlap. Does nothing if they didn't overlap.
+     */
+    static int unsetOverlap(Ent* a, Ent* b);
+    
+    /**
+     * Takes back setExclusive. Does nothing if they weren't exclusive.
+     */
+    static int unsetExclusive(Ent* a, Ent* b);
+    
     /**
      * The set of this Ent's ancestors can't overlap at all with the set of the
      * given Ent's descendents.
@@ -223,23 +266,58 @@ public:
     }
 
     /**
-     * Gets the Ent's unique identifier. UIDs not implemented yet.
-     * @return 
+     * Gets the Ent's unique identifier.
+     * @return      The UID, or 0 if it hasn't been given one yet.
      */
     const unsigned int getUID() {
         return uid;
     }
     
+    /**
+     * The version of the Tree the Ent was added in, or 0.
+     */
+    uint64_t getAddedVersion() const {
+        return addedVersion;
+    }
+    
+    /**
+     * Only for Ents not yet in a Tree. Once added, use Tree::setEntUID() so
+     * the Tree can still find it by UID.
+     */
     void setUID(unsigned int n) {
         uid = n;
     }
 
+    /**
+     * Tells if the given Ent is one of this Ent's direct parents, without
+     * copying the parents vector.
+     */
+    bool isChildOf(Ent* parentPtr);
+
+    /**
+     * One of the Ent's four lists, to read without copying it. Other threads
+     * read it through EntList::view(), at the latest version or a snapshot's.
+     * Only the thread editing the Tree may go through it directly.
+     */
+    const EntList& getList(EntRelation relation) const {
+        switch (relation) {
+            case RELATION_PARENT:
+                return parents;
+            case RELATION_CHILD:
+                return children;
+            case RELATION_EXCLUSIVE:
+                return exclusives;
+            default:
+                return overlaps;
+        }
+    }
+
     const vector<Ent*> getParents() {
-        return parents;
+        return parents.toVector();
     }
 
     vector<Ent*> getChildren() {
-        return children;
+        return children.toVector();
     }
     
     /**
@@ -251,7 +329,7 @@ public:
     }
     
     const vector<Ent*> getExclusives() {
-        return exclusives;
+        return exclusives.toVector();
     }
     
     /**
@@ -263,13 +341,79 @@ public:
     }
     
     const vector<Ent*> getOverlaps() {
-        return overlaps;
+        return overlaps.toVector();
     }
 
 
 };
 
 
+/**
+ * Locks a few Ents at once so their lists can be edited while other threads
+ * edit other Ents. They're always locked in order of UID, or of address for
+ * Ents with the same UID, so two threads locking overlapping sets can't end
+ * up each waiting on the other. They're let go when it goes out of scope.
+ */
+class EntLocks {
+
+    /**
+     * The locked Ents, in the order they were locked.
+     */
+    vector<Ent*> ents;
+    /**
+     * Lists of the locked Ents that are being changed.
+     */
+    vector<EntList*> changing;
+
+public:
+
+    /**
+     * A list that was read, and its stamp from before reading it.
+     */
+    typedef pair<const EntList*, uint64_t> Read;
+
+    /**
+     * Locks the given Ents. Duplicates are fine.
+     */
+    EntLocks(vector<Ent*> toLock);
+
+    ~EntLocks();
+
+    EntLocks(const EntLocks&) = delete;
+    EntLocks& operator=(const EntLocks&) = delete;
+
+    /**
+     * Records that a list is about to be read. Call before reading it, then
+     * check with validate() once the Ents being changed are locked.
+     */
+    static Read read(const EntList& list) {
+        return Read(&list, list.stamp());
+    }
+
+    bool holds(Ent* ent) const;
+
+    /**
+     * Says a list of one of the locked Ents is about to change, so Editors
+     * that read it find out. Call for every list that will change, before
+     * validate().
+     */
+    void willChange(EntList& list);
+
+    /**
+     * Checks that none of the lists that were read have changed since, apart
+     * from being marked here with willChange(). If so, decisions made from
+     * those reads still hold while the locks are.
+     */
+    bool validate(const vector<Read>& reads) const;
+
+    /**
+     * Which of the locked Ents a list belongs to.
+     * @return      The Ent, or nullptr if it isn't one of theirs.
+     */
+    Ent* ownerOf(const EntList* list) const;
+
+};
+
 
 #endif /* ENT_H */
 
@@ -0,0 +1,492 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENTINDEX_H
+#define ENTINDEX_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <utility>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include "Epoch.h"
+#include "CacheAligned.h"
+
+using namespace std;
+
+class Ent;
+
+/**
+ * A hash index from a key, like a name or a UID, to an Ent, which many
+ * threads can look things up in and add to at the same time.
+ *
+ * It uses open addressing: every entry sits in one big array of slots, and a
+ * lookup checks the slot the key hashes to and the ones after it until it
+ * finds the key or an empty slot. Each slot is an atomic pointer to an entry
+ * which never changes once written, so a lookup is only a few atomic loads
+ * and never waits. A removed entry leaves a marker behind, so lookups for
+ * keys further along still get past it.
+ *
+ * Writers claim an empty slot with a compare-and-swap. On top of that, every
+ * key hashes to one of a few dozen stripe locks, and adding or removing a key
+ * holds its stripe, so two threads adding the same key can't both succeed.
+ * Threads adding different keys rarely share a stripe.
+ *
+ * When the array gets half full a bigger one is linked on behind it, and new
+ * entries go there. The old entries are moved over a chunk at a time by the
+ * threads adding and removing, so no one thread has to stop and copy them
+ * all. Until that's done, lookups check both arrays. Old arrays and removed
+ * entries are retired through Epoch, so readers must hold an EpochGuard
+ * while looking things up, unless no thread is changing it.
+ */
+template<typename Key>
+class EntIndex {
+
+public:
+
+    typedef pair<const Key, Ent*> value_type;
+
+private:
+
+    /**
+     * How many slots one thread moves to a new array at a time.
+     */
+    static const size_t MIGRATE_CHUNK = 256;
+    static const size_t STRIPES = 64;
+
+    struct Table {
+        size_t mask;
+        atomic<value_type*>* slots;
+        /**
+         * How many slots are taken, counting markers.
+         */
+        atomic<size_t> used;
+        /**
+         * The array the entries are being moved to, if any.
+         */
+        atomic<Table*> next;
+        /**
+         * The next chunk to be moved, and how many chunks are done.
+         */
+        atomic<size_t> claimed;
+        atomic<size_t> finished;
+
+        Table(size_t capacity): mask(capacity - 1),
+                slots(new atomic<value_type*>[capacity]), used(0),
+                next(nullptr), claimed(0), finished(0) {
+            for (size_t i = 0; i < capacity; i++)
+                slots[i].store(nullptr, memory_order_relaxed);
+        }
+
+        ~Table() {
+            delete[] slots;
+        }
+
+        size_t chunks() const {
+            return (mask + MIGRATE_CHUNK) / MIGRATE_CHUNK;
+        }
+    };
+
+    struct alignas(64) Stripe : CacheAligned {
+        mutex lock;
+    };
+
+    /**
+     * The oldest array still in use. Newer ones hang off its next.
+     */
+    atomic<Table*> table;
+    /**
+     * How many entries there are.
+     */
+    atomic<size_t> count;
+    /**
+     * Held while linking on a new array, so only one gets built.
+     */
+    mutex growing;
+    /**
+     * Kept out of line, so holding an EntIndex doesn't make its owner
+     * over-aligned too.
+     */
+    Stripe* stripes;
+
+    static value_type* removedMarker() {
+        return reinterpret_cast<value_type*>(uintptr_t(1));
+    }
+
+    /**
+     * Left in a slot whose entry, if it had one, has been moved to the next
+     * array.
+     */
+    static value_type* movedMarker() {
+        return reinterpret_cast<value_type*>(uintptr_t(2));
+    }
+
+    /**
+     * Left in a slot that was empty when it was moved. A run of slots ended
+     * there, so lookups can still stop at it.
+     */
+    static value_type* closedMarker() {
+        return reinterpret_cast<value_type*>(uintptr_t(3));
+    }
+
+    static bool isEntry(value_type* e) {
+        return uintptr_t(e) > 3;
+    }
+
+    static size_t hashOf(const Key& key) {
+        //Mix the bits, since UIDs hash to themselves and would pile up in
+        //runs of neighbouring slots.
+        uint64_t h = hash<Key>()(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    mutex& stripeFor(size_t h) {
+        return stripes[(h >> 40) % STRIPES].lock;
+    }
+
+    /**
+     * The array new entries go into.
+     */
+    Table* newest() const {
+        Table* t = table.load(memory_order_acquire);
+        Table* n;
+        while ((n = t->next.load(memory_order_acquire)) != nullptr)
+            t = n;
+        return t;
+    }
+
+    /**
+     * Finds the slot holding key in one array.
+     * @return      The slot, or nullptr if the key isn't in that array.
+     */
+    static atomic<value_type*>* find(Table* t, const Key& key, size_t h) {
+        size_t at = h & t->mask;
+        //Once every slot of an old array is moved there is no empty slot to
+        //stop at, so give up after going all the way around.
+        for (size_t i = 0; i <= t->mask; i++, at = (at + 1) & t->mask) {
+            value_type* e = t->slots[at].load(memory_order_acquire);
+            if (e == nullptr || e == closedMarker())
+                return nullptr;
+            if (isEntry(e) && e->first == key)
+                return &t->slots[at];
+        }
+        return nullptr;
+    }
+
+    /**
+     * Puts an entry in the first empty slot along its run.
+     * @return      false if the array started moving before a slot was
+     *              claimed. The entry wasn't put anywhere then.
+     */
+    static bool place(Table* t, value_type* entry, size_t h) {
+        for (size_t at = h & t->mask;; at = (at + 1) & t->mask) {
+            value_type* e = t->slots[at].load(memory_order_acquire);
+            if (e == movedMarker() || e == closedMarker())
+                return false;
+            if (e == nullptr) {
+                if (t->slots[at].compare_exchange_strong(e, entry,
+                        memory_order_acq_rel, memory_order_acquire)) {
+                    t->used.fetch_add(1, memory_order_relaxed);
+                    return true;
+                }
+                //Lost the slot to another writer or a move. Look again.
+                if (e == closedMarker())
+                    return false;
+            }
+        }
+    }
+
+    static size_t capacityFor(size_t n) {
+        size_t capacity = 16;
+        while (capacity < n * 2)
+            capacity *= 2;
+        return capacity;
+    }
+
+    /**
+     * Links a new array with the given number of slots behind the oldest
+     * one, unless entries are already being moved.
+     */
+    void grow(size_t capacity) {
+        lock_guard<mutex> hold(growing);
+        Table* t = table.load(memory_order_acquire);
+        if (t->next.load(memory_order_acquire) == nullptr)
+            t->next.store(new Table(capacity), memory_order_release);
+    }
+
+    /**
+     * Moves one chunk of slots from the oldest array to the next one, if
+     * there's a move going on. Whoever finishes the last chunk retires the
+     * old array.
+     * @return      false if there was no chunk left to take.
+     */
+    bool helpMove() {
+        Table* t = table.load(memory_order_acquire);
+        Table* n = t->next.load(memory_order_acquire);
+        if (n == nullptr)
+            return false;
+        size_t chunk = t->claimed.fetch_add(1, memory_order_relaxed);
+        if (chunk >= t->chunks())
+            return false;
+
+        size_t end = min((chunk + 1) * MIGRATE_CHUNK, t->mask + 1);
+        for (size_t at = chunk * MIGRATE_CHUNK; at < end; at++) {
+            value_type* e = t->slots[at].load(memory_order_acquire);
+            //Close empty slots, so no writer can fill them after this.
+            while (e == nullptr && !t->slots[at].compare_exchange_weak(e,
+                    closedMarker(), memory_order_acq_rel, memory_order_acquire));
+            if (e == nullptr)
+                continue;
+            if (!isEntry(e)) {
+                t->slots[at].store(movedMarker(), memory_order_release);
+                continue;
+            }
+            //Hold the key's stripe, so it isn't removed or added again
+            //while it's in neither array or both.
+            size_t h = hashOf(e->first);
+            lock_guard<mutex> hold(stripeFor(h));
+            e = t->slots[at].load(memory_order_acquire);
+            if (isEntry(e))
+                place(n, e, h);
+            t->slots[at].store(movedMarker(), memory_order_release);
+        }
+
+        if (t->finished.fetch_add(1, memory_order_acq_rel) + 1 == t->chunks()) {
+            table.store(n, memory_order_release);
+            //The entries now belong to the new array, so only the old array goes.
+            Epoch::retire(t);
+        }
+        return true;
+    }
+
+    /**
+     * Finishes any move that's going on. Other threads may still be moving
+     * their last chunks, so this waits for them.
+     */
+    void finishMove() {
+        Table* t;
+        while ((t = table.load(memory_order_acquire))->next.load(memory_order_acquire) != nullptr) {
+            if (!helpMove())
+                this_thread::yield();
+        }
+    }
+
+public:
+
+    /**
+     * Goes through every entry. Only when nothing is changing the index.
+     */
+    class iterator {
+
+        Table* t;
+        size_t at;
+
+        void skip() {
+            for (;;) {
+                while (at <= t->mask && !isEntry(t->slots[at].load(memory_order_relaxed)))
+                    at++;
+                Table* n;
+                if (at <= t->mask || (n = t->next.load(memory_order_relaxed)) == nullptr)
+                    return;
+                t = n;
+                at = 0;
+            }
+        }
+
+    public:
+
+        typedef forward_iterator_tag iterator_category;
+        typedef typename EntIndex::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        iterator(Table* table, size_t start): t(table), at(start) {
+            if (t != nullptr)
+                skip();
+        }
+
+        value_type& operator*() const {
+            return *t->slots[at].load(memory_order_relaxed);
+        }
+
+        value_type* operator->() const {
+            return t->slots[at].load(memory_order_relaxed);
+        }
+
+        iterator& operator++() {
+            at++;
+            skip();
+            return *this;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+
+        bool operator==(const iterator& other) const {
+            return t == other.t && at == other.at;
+        }
+
+    };
+
+    EntIndex(): table(new Table(16)), count(0), stripes(new Stripe[STRIPES]) {}
+
+    ~EntIndex() {
+        Table* t = table.load(memory_order_relaxed);
+        while (t != nullptr) {
+            for (size_t i = 0; i <= t->mask; i++) {
+                value_type* e = t->slots[i].load(memory_order_relaxed);
+                if (isEntry(e))
+                    delete e;
+            }
+            Table* n = t->next.load(memory_order_relaxed);
+            delete t;
+            t = n;
+        }
+        delete[] stripes;
+    }
+
+    EntIndex(const EntIndex&) = delete;
+    EntIndex& operator=(const EntIndex&) = delete;
+
+    /**
+     * Finds the Ent with the given key. Safe from any thread holding an
+     * EpochGuard.
+     * @return      The Ent, or nullptr if there is none.
+     */
+    Ent* get(const Key& key) const {
+        size_t h = hashOf(key);
+        //An entry that isn't in the older array has either been moved to
+        //the newer one or was added there.
+        for (Table* t = table.load(memory_order_acquire); t != nullptr;
+                t = t->next.load(memory_order_acquire)) {
+            atomic<value_type*>* slot = find(t, key, h);
+            if (slot != nullptr) {
+                value_type* e = slot->load(memory_order_acquire);
+                //It may have been removed or moved on since find() saw it.
+                if (isEntry(e))
+                    return e->second;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Adds an entry, unless the key is already there. Checking and adding
+     * happen as one step, so of several threads adding the same key only
+     * one succeeds.
+     * @return      false if the key was already there. Nothing changes then.
+     */
+    bool insert(const Key& key, Ent* ent) {
+        size_t h = hashOf(key);
+        for (;;) {
+            {
+                lock_guard<mutex> hold(stripeFor(h));
+                for (Table* t = table.load(memory_order_acquire); t != nullptr;
+                        t = t->next.load(memory_order_acquire)) {
+                    if (find(t, key, h) != nullptr)
+                        return false;
+                }
+                Table* t = newest();
+                if ((t->used.load(memory_order_relaxed) + 1) * 2 <= t->mask + 1) {
+                    value_type* entry = new value_type(key, ent);
+                    if (place(t, entry, h)) {
+                        count.fetch_add(1, memory_order_relaxed);
+                    } else {
+                        //Started moving under us. Try the newer array.
+                        delete entry;
+                        continue;
+                    }
+                    break;
+                }
+            }
+            //Out of room. Moving entries takes other stripes, so it's done
+            //without holding this one.
+            finishMove();
+            grow(capacityFor(2 * (count.load(memory_order_relaxed) + 1)));
+        }
+        //Each insert pays for moving a chunk, so a move finishes well before
+        //the new array fills up.
+        helpMove();
+        return true;
+    }
+
+    /**
+     * Removes the entry with the given key, if there is one.
+     * @return      false if there wasn't one.
+     */
+    bool erase(const Key& key) {
+        size_t h = hashOf(key);
+        value_type* e = nullptr;
+        {
+            lock_guard<mutex> hold(stripeFor(h));
+            for (Table* t = table.load(memory_order_acquire); t != nullptr;
+                    t = t->next.load(memory_order_acquire)) {
+                atomic<value_type*>* slot = find(t, key, h);
+                if (slot != nullptr) {
+                    //Only writers holding this stripe change a slot with an
+                    //entry in it, so it's still there.
+                    e = slot->exchange(removedMarker(), memory_order_acq_rel);
+                    break;
+                }
+            }
+        }
+        if (e == nullptr)
+            return false;
+        count.fetch_sub(1, memory_order_relaxed);
+        Epoch::retire(e);
+        helpMove();
+        return true;
+    }
+
+    /**
+     * Makes room for n entries in total, so adding that many doesn't build
+     * new arrays over and over.
+     */
+    void reserve(size_t n) {
+        finishMove();
+        if (capacityFor(n) > newest()->mask + 1) {
+            grow(capacityFor(n));
+            finishMove();
+        }
+    }
+
+    size_t size() const {
+        return count.load(memory_order_relaxed);
+    }
+
+    iterator begin() const {
+        return iterator(table.load(memory_order_acquire), 0);
+    }
+
+    iterator end() const {
+        Table* t = newest();
+        return iterator(t, t->mask + 1);
+    }
+
+};
+
+#endif /* ENTINDEX_H */
@@ -0,0 +1,156 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EntList.h"
+#include <new>
+
+using namespace std;
+
+thread_local EntList::WriteContext* EntList::writing = nullptr;
+
+size_t EntListView::size() const {
+    size_t n = 0;
+    for (EntEdgeIterator it = begin(); it != end(); ++it)
+        n++;
+    return n;
+}
+
+EntList::EntList(const EntList& other): block(nullptr), live(0), queued(false),
+        changes(0) {
+    *this = other;
+}
+
+EntList& EntList::operator=(const EntList& other) {
+    
+    if (this == &other)
+        return *this;
+    
+    Block* from = other.block.load(memory_order_acquire);
+    size_t n = from != nullptr ? from->size.load(memory_order_acquire) : 0;
+    Block* copy = allocate(n);
+    for (size_t i = 0; i < n; i++)
+        copyEdge(from->items()[i], &copy->items()[i]);
+    copy->size.store(n, memory_order_relaxed);
+    live = other.live;
+    
+    Block* old = current();
+    block.store(copy, memory_order_release);
+    if (old != nullptr)
+        Epoch::retire(old, &destroy);
+    
+    return *this;
+}
+
+EntList::~EntList() {
+    //The Ent holding this list is being deleted, so nobody can reach it.
+    Block* b = current();
+    if (b != nullptr)
+        destroy(b);
+}
+
+EntList::Block* EntList::allocate(size_t capacity) {
+    //The items follow the header in the same allocation.
+    void* memory = ::operator new(sizeof(Block) + capacity * sizeof(EntEdge));
+    Block* b = new (memory) Block();
+    b->size.store(0, memory_order_relaxed);
+    b->capacity = capacity;
+    //Entries are filled in as they're used, nothing to set up here.
+    return b;
+}
+
+void EntList::destroy(void* p) {
+    Block* b = static_cast<Block*>(p);
+    b->~Block();
+    ::operator delete(b);
+}
+
+EntListView EntList::view(uint64_t version) const {
+    Block* b = block.load(memory_order_acquire);
+    if (b == nullptr)
+        return EntListView(nullptr, 0, version);
+    return EntListView(b->items(), b->size.load(memory_order_acquire), version);
+}
+
+void EntList::push_back(Ent* ent) {
+
+    Block* b = current();
+    size_t n = b != nullptr ? b->size.load(memory_order_relaxed) : 0;
+
+    if (b == nullptr || n == b->capacity) {
+        b = replace(n < 2 ? 4 : n * 2, [](const EntEdge&) { return true; });
+        n = b->size.load(memory_order_relaxed);
+    }
+
+    //Readers can't see past size, so the entry can be written in place.
+    EntEdge& edge = b->items()[n];
+    edge.ent = ent;
+    edge.begin = writing != nullptr ? writing->version : 0;
+    edge.end.store(0, memory_order_relaxed);
+    b->size.store(n + 1, memory_order_release);
+    live++;
+}
+
+void EntList::remove(EntEdge* edge) {
+
+    live--;
+
+    if (writing != nullptr) {
+        //Snapshots older than this Writer can still see it.
+        edge->end.store(writing->version, memory_order_release);
+        if (!queued) {
+            queued = true;
+            writing->ended.push_back(this);
+        }
+        return;
+    }
+
+    //Shifting in place would let readers see an entry twice or not at all.
+    replace(current()->capacity, [edge](const EntEdge& e) {
+        return &e != edge;
+    });
+}
+
+void EntList::erase(const_iterator position) {
+    remove(const_cast<EntEdge*>(position.getEdge()));
+}
+
+uint64_t EntList::collect(uint64_t horizon) {
+
+    replace(current()->capacity, [horizon](const EntEdge& edge) {
+        uint64_t end = edge.end.load(memory_order_relaxed);
+        return end == 0 || end > horizon;
+    });
+
+    //Some may have to wait for an older snapshot to end.
+    uint64_t latest = 0;
+    for (const EntEdge* edge = first(); edge != last(); edge++) {
+        uint64_t end = edge->end.load(memory_order_relaxed);
+        if (end > latest)
+            latest = end;
+    }
+    queued = latest != 0;
+
+    return latest;
+}
+
+void EntList::reserve(size_t n) {
+
+    Block* b = current();
+    if (b == nullptr || n > b->capacity)
+        replace(n, [](const EntEdge&) { return true; });
+}
@@ -0,0 +1,420 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENTLIST_H
+#define ENTLIST_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include "Epoch.h"
+
+using namespace std;
+
+class Ent;
+class EntList;
+class ChangeLog;
+
+/**
+ * One entry in an EntList. It was added at version begin, and removed at
+ * version end, or is still there if end is 0. Versions come from Tree::Writer.
+ * Edits made outside a Writer are version 0, which every snapshot sees.
+ */
+struct EntEdge {
+    Ent* ent;
+    uint64_t begin;
+    atomic<uint64_t> end;
+};
+
+/**
+ * Reads at this version see the latest of everything, but nothing removed.
+ */
+static const uint64_t LATEST_VERSION = UINT64_MAX;
+
+/**
+ * Goes through the entries of an EntList, skipping those that can't be seen
+ * at the given version.
+ */
+class EntEdgeIterator {
+
+    const EntEdge* at;
+    const EntEdge* stop;
+    uint64_t version;
+
+    void skip() {
+        while (at != stop && !isVisible(*at, version))
+            at++;
+    }
+
+public:
+
+    typedef forward_iterator_tag iterator_category;
+    typedef Ent* value_type;
+    typedef ptrdiff_t difference_type;
+    typedef Ent* const* pointer;
+    typedef Ent* const& reference;
+
+    EntEdgeIterator(const EntEdge* start, const EntEdge* end, uint64_t v):
+            at(start), stop(end), version(v) {
+        skip();
+    }
+
+    static bool isVisible(const EntEdge& edge, uint64_t version) {
+        uint64_t end = edge.end.load(memory_order_acquire);
+        return edge.begin <= version && (end == 0 || end > version);
+    }
+
+    Ent* const& operator*() const {
+        return at->ent;
+    }
+
+    EntEdgeIterator& operator++() {
+        at++;
+        skip();
+        return *this;
+    }
+
+    bool operator==(const EntEdgeIterator& other) const {
+        return at == other.at;
+    }
+
+    bool operator!=(const EntEdgeIterator& other) const {
+        return at != other.at;
+    }
+
+    const EntEdge* getEdge() const {
+        return at;
+    }
+
+};
+
+/**
+ * How far a reader got through an EntList, so it can let go of its
+ * EpochGuard and carry on later. last is the entry just before, to check the
+ * list hasn't been tidied up in between.
+ */
+struct EntListPlace {
+    size_t offset;
+    Ent* last;
+    uint64_t lastBegin;
+
+    EntListPlace(): offset(0), last(nullptr), lastBegin(0) {}
+};
+
+/**
+ * A consistent look at an EntList at one moment and version, for readers. It
+ * stays valid, and doesn't change, for as long as the reader holds its
+ * EpochGuard.
+ */
+class EntListView {
+
+    const EntEdge* items;
+    size_t count;
+    uint64_t version;
+
+public:
+
+    EntListView(const EntEdge* i, size_t n, uint64_t v): items(i), count(n), version(v) {}
+
+    EntEdgeIterator begin() const {
+        return EntEdgeIterator(items, items + count, version);
+    }
+
+    EntEdgeIterator end() const {
+        return EntEdgeIterator(items + count, items + count, version);
+    }
+
+    /**
+     * Counts the Ents that can be seen, so it goes through them all.
+     */
+    size_t size() const;
+
+    /**
+     * Where an iterator of this view has got to, for picking up from later.
+     */
+    EntListPlace placeOf(const EntEdgeIterator& it) const {
+        EntListPlace place;
+        place.offset = it.getEdge() - items;
+        if (place.offset > 0) {
+            place.last = items[place.offset - 1].ent;
+            place.lastBegin = items[place.offset - 1].begin;
+        }
+        return place;
+    }
+
+    /**
+     * Picks up from a place in an earlier view of the same list. If the list
+     * has dropped removed entries since, the place can't be trusted, and it
+     * starts over from the beginning.
+     */
+    EntEdgeIterator resume(const EntListPlace& place) const {
+        if (place.offset == 0 || place.offset > count || items[place.offset - 1].ent != place.last
+                || items[place.offset - 1].begin != place.lastBegin)
+            return begin();
+        return EntEdgeIterator(items + place.offset, items + count, version);
+    }
+
+    bool empty() const {
+        return begin() == end();
+    }
+
+};
+
+/**
+ * The list an Ent keeps of its parents, children, exclusives or overlaps.
+ *
+ * It works like a vector<Ent*> for the thread editing the Tree, while other
+ * threads read it through view() at the same time without locking. Adding an
+ * Ent writes it past the end readers can see, then moves the end. Growing the
+ * list makes a new copy and swaps it in. The old copy is retired through
+ * Epoch, so a reader in the middle of it can finish.
+ *
+ * Each entry records the versions it was added and removed at, so a snapshot
+ * of the Tree can still see the list as it was. Within a Tree::Writer a
+ * removed entry is only marked with its version and stays in place. Once no
+ * snapshot is old enough to see it, the Tree collects it with collect().
+ * Outside a Writer there are no versions, and removed entries are dropped
+ * straight away.
+ *
+ * Only one thread may edit a list at a time.
+ */
+class EntList {
+
+public:
+
+    /**
+     * What the current thread's Tree::Writer is doing. Set for as long as it
+     * is held, so lists know which version edits belong to.
+     */
+    struct WriteContext {
+        uint64_t version;
+        /**
+         * Lists with entries this Writer marked removed.
+         */
+        vector<EntList*> ended;
+        /**
+         * Where the Tree logs its changes, if it does.
+         */
+        ChangeLog* log;
+    };
+
+    static thread_local WriteContext* writing;
+
+private:
+
+    struct Block {
+        atomic<size_t> size;
+        size_t capacity;
+
+        EntEdge* items() {
+            return reinterpret_cast<EntEdge*>(this + 1);
+        }
+    };
+
+    atomic<Block*> block;
+    /**
+     * How many entries haven't been removed. Only the editing thread uses it.
+     */
+    size_t live;
+    /**
+     * Whether the list is waiting to be collected already, so it's only
+     * queued once.
+     */
+    bool queued;
+    /**
+     * Odd while an Editor has said it's about to change the list, and moved
+     * on each time one has. Tells Editors that read the list without locking
+     * it whether it has changed since.
+     */
+    atomic<uint64_t> changes;
+
+    static Block* allocate(size_t capacity);
+
+    static void destroy(void* p);
+
+    /**
+     * Copies the entries of the current block which keep() is true for into
+     * a new block, swaps it in and retires the old one.
+     */
+    template<typename Keep>
+    Block* replace(size_t capacity, Keep keep) {
+        Block* old = current();
+        Block* copy = allocate(capacity);
+        size_t n = 0;
+        if (old != nullptr) {
+            size_t size = old->size.load(memory_order_relaxed);
+            for (size_t i = 0; i < size; i++) {
+                EntEdge& edge = old->items()[i];
+                if (keep(edge))
+                    copyEdge(edge, &copy->items()[n++]);
+            }
+        }
+        copy->size.store(n, memory_order_relaxed);
+        block.store(copy, memory_order_release);
+        if (old != nullptr)
+            Epoch::retire(old, &destroy);
+        return copy;
+    }
+
+    static void copyEdge(const EntEdge& from, EntEdge* to) {
+        to->ent = from.ent;
+        to->begin = from.begin;
+        to->end.store(from.end.load(memory_order_relaxed), memory_order_relaxed);
+    }
+
+    /**
+     * Marks an entry removed, or drops it outside a Writer.
+     */
+    void remove(EntEdge* edge);
+
+    Block* current() const {
+        return block.load(memory_order_relaxed);
+    }
+
+    const EntEdge* first() const {
+        Block* b = current();
+        return b != nullptr ? b->items() : nullptr;
+    }
+
+    const EntEdge* last() const {
+        Block* b = current();
+        return b != nullptr ? b->items() + b->size.load(memory_order_relaxed) : nullptr;
+    }
+
+public:
+
+    typedef EntEdgeIterator const_iterator;
+
+    EntList(): block(nullptr), live(0), queued(false), changes(0) {}
+
+    ~EntList();
+
+    /**
+     * Copies the entries, like copying a vector would.
+     */
+    EntList(const EntList& other);
+
+    EntList& operator=(const EntList& other);
+
+    /**
+     * What readers on other threads should use.
+     * @param version   The version to see the list at. The latest by default.
+     */
+    EntListView view(uint64_t version = LATEST_VERSION) const;
+
+    /**
+     * A copy, for handing out of an Ent's getters.
+     */
+    vector<Ent*> toVector(uint64_t version = LATEST_VERSION) const {
+        EntListView v = view(version);
+        return vector<Ent*>(v.begin(), v.end());
+    }
+
+    /**
+     * Drops entries removed at or before the given version, which no
+     * snapshot can see any more.
+     * @return          The latest version a remaining entry was removed at,
+     *                  or 0 if none are left to collect later.
+     */
+    uint64_t collect(uint64_t horizon);
+
+    /**
+     * The stamp to compare against later, taken before reading the list.
+     * Waits out an Editor changing it, so it's always even.
+     */
+    uint64_t stamp() const {
+        uint64_t c;
+        while ((c = changes.load(memory_order_acquire)) & 1)
+            this_thread::yield();
+        return c;
+    }
+
+    /**
+     * The stamp as it is right now, odd if an Editor is changing the list.
+     */
+    uint64_t currentStamp() const {
+        return changes.load(memory_order_acquire);
+    }
+
+    /**
+     * Called by EntLocks, holding the owning Ent's lock, before and after
+     * changing the list.
+     */
+    void beginChange() {
+        changes.fetch_add(1, memory_order_seq_cst);
+    }
+
+    void endChange() {
+        changes.fetch_add(1, memory_order_release);
+    }
+
+    /*
+     * The rest is for the thread editing the Tree. It only sees entries that
+     * haven't been removed.
+     */
+
+    const_iterator begin() const {
+        return const_iterator(first(), last(), LATEST_VERSION);
+    }
+
+    const_iterator end() const {
+        return const_iterator(last(), last(), LATEST_VERSION);
+    }
+
+    size_t size() const {
+        return live;
+    }
+
+    bool empty() const {
+        return live == 0;
+    }
+
+    void push_back(Ent* ent);
+
+    void erase(const_iterator position);
+
+    void reserve(size_t n);
+
+    /**
+     * Removes every Ent the predicate is true for.
+     */
+    template<typename Predicate>
+    void removeIf(Predicate shouldRemove) {
+        if (writing != nullptr) {
+            for (const_iterator it = begin(); it != end(); ++it) {
+                if (shouldRemove(*it))
+                    remove(const_cast<EntEdge*>(it.getEdge()));
+            }
+        } else {
+            //One copy for the lot, instead of one per Ent.
+            replace(current() != nullptr ? current()->capacity : 0,
+                    [&shouldRemove](const EntEdge& edge) {
+                        return edge.end.load(memory_order_relaxed) != 0
+                                || !shouldRemove(edge.ent);
+                    });
+            live = 0;
+            for (const_iterator it = begin(); it != end(); ++it)
+                live++;
+        }
+    }
+
+};
+
+#endif /* ENTLIST_H */
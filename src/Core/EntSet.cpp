@@ -0,0 +1,429 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "EntSet.h"
+#include <algorithm>
+#include <random>
+#include <set>
+
+using namespace std;
+
+bool EntSet::Container::contains(uint16_t low) const {
+    if (isBitmap())
+        return (bits[low / 64] >> (low % 64)) & 1;
+    return binary_search(array.begin(), array.end(), low);
+}
+
+bool EntSet::Container::insert(uint16_t low) {
+    
+    if (isBitmap()) {
+        uint64_t bit = uint64_t(1) << (low % 64);
+        if (bits[low / 64] & bit)
+            return false;
+        bits[low / 64] |= bit;
+        count++;
+        return true;
+    }
+    
+    //UIDs often come in order, which just go on the end.
+    vector<uint16_t>::iterator at = array.empty() || array.back() < low ? array.end()
+            : lower_bound(array.begin(), array.end(), low);
+    if (at != array.end() && *at == low)
+        return false;
+    array.insert(at, low);
+    count++;
+    tidy();
+    return true;
+}
+
+void EntSet::Container::tidy() {
+    
+    if (!isBitmap() && count > ARRAY_MOST) {
+        bits.assign(BITMAP_WORDS, 0);
+        for (uint16_t low : array)
+            bits[low / 64] |= uint64_t(1) << (low % 64);
+        vector<uint16_t>().swap(array);
+    } else if (isBitmap() && count <= ARRAY_MOST) {
+        array.reserve(count);
+        for (size_t w = 0; w < BITMAP_WORDS; w++) {
+            for (uint64_t word = bits[w]; word != 0; word &= word - 1)
+                array.push_back(uint16_t(w * 64 + __builtin_ctzll(word)));
+        }
+        vector<uint64_t>().swap(bits);
+    }
+}
+
+void EntSet::Container::recount() {
+    count = 0;
+    for (uint64_t word : bits)
+        count += __builtin_popcountll(word);
+}
+
+
+size_t EntSet::place(uint16_t key) const {
+    if (!containers.empty() && containers.back().key < key)
+        return containers.size();
+    size_t low = 0, high = containers.size();
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (containers[middle].key < key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+bool EntSet::insert(unsigned int uid) {
+    
+    uint16_t key = uint16_t(uid >> 16);
+    size_t at = place(key);
+    if (at == containers.size() || containers[at].key != key)
+        containers.insert(containers.begin() + at, Container(key));
+    if (!containers[at].insert(uint16_t(uid)))
+        return false;
+    count++;
+    return true;
+}
+
+bool EntSet::contains(unsigned int uid) const {
+    uint16_t key = uint16_t(uid >> 16);
+    size_t at = place(key);
+    return at < containers.size() && containers[at].key == key
+            && containers[at].contains(uint16_t(uid));
+}
+
+
+EntSet::Container EntSet::unite(const Container& a, const Container& b) {
+    
+    Container out(a.key);
+    if (a.isBitmap() || b.isBitmap()) {
+        const Container& bitmap = a.isBitmap() ? a : b;
+        const Container& other = a.isBitmap() ? b : a;
+        out.bits = bitmap.bits;
+        if (other.isBitmap()) {
+            for (size_t w = 0; w < BITMAP_WORDS; w++)
+                out.bits[w] |= other.bits[w];
+        } else {
+            for (uint16_t low : other.array)
+                out.bits[low / 64] |= uint64_t(1) << (low % 64);
+        }
+        out.recount();
+        return out;
+    }
+    
+    out.array.resize(a.count + b.count);
+    out.array.erase(set_union(a.array.begin(), a.array.end(), b.array.begin(),
+            b.array.end(), out.array.begin()), out.array.end());
+    out.count = out.array.size();
+    out.tidy();
+    return out;
+}
+
+EntSet::Container EntSet::intersect(const Container& a, const Container& b) {
+    
+    Container out(a.key);
+    if (a.isBitmap() && b.isBitmap()) {
+        out.bits.resize(BITMAP_WORDS);
+        for (size_t w = 0; w < BITMAP_WORDS; w++)
+            out.bits[w] = a.bits[w] & b.bits[w];
+        out.recount();
+        out.tidy();
+        return out;
+    }
+    
+    const Container& small = a.count <= b.count ? a : b;
+    const Container& large = a.count <= b.count ? b : a;
+    if (large.isBitmap() || small.count * 32 < large.count) {
+        //Looking each one up beats going through both.
+        for (uint16_t low : small.array) {
+            if (large.contains(low))
+                out.array.push_back(low);
+        }
+    } else {
+        out.array.resize(small.count);
+        out.array.erase(set_intersection(a.array.begin(), a.array.end(),
+                b.array.begin(), b.array.end(), out.array.begin()), out.array.end());
+    }
+    out.count = out.array.size();
+    return out;
+}
+
+EntSet::Container EntSet::subtract(const Container& a, const Container& b) {
+    
+    Container out(a.key);
+    if (a.isBitmap()) {
+        out.bits = a.bits;
+        if (b.isBitmap()) {
+            for (size_t w = 0; w < BITMAP_WORDS; w++)
+                out.bits[w] &= ~b.bits[w];
+        } else {
+            for (uint16_t low : b.array)
+                out.bits[low / 64] &= ~(uint64_t(1) << (low % 64));
+        }
+        out.recount();
+        out.tidy();
+        return out;
+    }
+    
+    if (b.isBitmap()) {
+        for (uint16_t low : a.array) {
+            if (!b.contains(low))
+                out.array.push_back(low);
+        }
+    } else {
+        out.array.resize(a.count);
+        out.array.erase(set_difference(a.array.begin(), a.array.end(),
+                b.array.begin(), b.array.end(), out.array.begin()), out.array.end());
+    }
+    out.count = out.array.size();
+    return out;
+}
+
+size_t EntSet::countShared(const Container& a, const Container& b) {
+    
+    size_t shared = 0;
+    if (a.isBitmap() && b.isBitmap()) {
+        for (size_t w = 0; w < BITMAP_WORDS; w++)
+            shared += __builtin_popcountll(a.bits[w] & b.bits[w]);
+        return shared;
+    }
+    
+    const Container& small = a.count <= b.count ? a : b;
+    const Container& large = a.count <= b.count ? b : a;
+    if (large.isBitmap() || small.count * 32 < large.count) {
+        for (uint16_t low : small.array)
+            shared += large.contains(low);
+        return shared;
+    }
+    //Both arrays of about the same size.
+    vector<uint16_t>::const_iterator i = a.array.begin(), j = b.array.begin();
+    while (i != a.array.end() && j != b.array.end()) {
+        if (*i < *j) {
+            ++i;
+        } else if (*j < *i) {
+            ++j;
+        } else {
+            shared++;
+            ++i;
+            ++j;
+        }
+    }
+    return shared;
+}
+
+
+EntSet& EntSet::operator|=(const EntSet& other) {
+    
+    vector<Container> merged;
+    merged.reserve(containers.size() + other.containers.size());
+    size_t i = 0, j = 0;
+    while (i < containers.size() || j < other.containers.size()) {
+        if (j == other.containers.size()
+                || (i < containers.size() && containers[i].key < other.containers[j].key))
+            merged.push_back(std::move(containers[i++]));
+        else if (i == containers.size() || other.containers[j].key < containers[i].key)
+            merged.push_back(other.containers[j++]);
+        else
+            merged.push_back(unite(containers[i++], other.containers[j++]));
+    }
+    
+    containers.swap(merged);
+    count = 0;
+    for (const Container& container : containers)
+        count += container.count;
+    return *this;
+}
+
+EntSet& EntSet::operator&=(const EntSet& other) {
+    
+    vector<Container> kept;
+    size_t i = 0, j = 0;
+    while (i < containers.size() && j < other.containers.size()) {
+        if (containers[i].key < other.containers[j].key) {
+            i++;
+        } else if (other.containers[j].key < containers[i].key) {
+            j++;
+        } else {
+            Container both = intersect(containers[i++], other.containers[j++]);
+            if (both.count > 0)
+                kept.push_back(std::move(both));
+        }
+    }
+    
+    containers.swap(kept);
+    count = 0;
+    for (const Container& container : containers)
+        count += container.count;
+    return *this;
+}
+
+EntSet& EntSet::operator-=(const EntSet& other) {
+    
+    vector<Container> kept;
+    kept.reserve(containers.size());
+    size_t j = 0;
+    for (Container& container : containers) {
+        while (j < other.containers.size() && other.containers[j].key < container.key)
+            j++;
+        if (j == other.containers.size() || other.containers[j].key != container.key) {
+            kept.push_back(std::move(container));
+            continue;
+        }
+        Container left = subtract(container, other.containers[j]);
+        if (left.count > 0)
+            kept.push_back(std::move(left));
+    }
+    
+    containers.swap(kept);
+    count = 0;
+    for (const Container& container : containers)
+        count += container.count;
+    return *this;
+}
+
+size_t EntSet::countShared(const EntSet& a, const EntSet& b) {
+    
+    size_t shared = 0;
+    size_t i = 0, j = 0;
+    while (i < a.containers.size() && j < b.containers.size()) {
+        if (a.containers[i].key < b.containers[j].key)
+            i++;
+        else if (b.containers[j].key < a.containers[i].key)
+            j++;
+        else
+            shared += countShared(a.containers[i++], b.containers[j++]);
+    }
+    return shared;
+}
+
+bool EntSet::operator==(const EntSet& other) const {
+    return count == other.count && countShared(*this, other) == count;
+}
+
+vector<unsigned int> EntSet::toVector() const {
+    vector<unsigned int> uids;
+    uids.reserve(count);
+    forEach([&uids](unsigned int uid) { uids.push_back(uid); });
+    return uids;
+}
+
+size_t EntSet::getMemoryUsage() const {
+    size_t bytes = sizeof(EntSet) + containers.capacity() * sizeof(Container);
+    for (const Container& container : containers)
+        bytes += container.getMemoryUsage();
+    return bytes;
+}
+
+
+bool EntMarks::mark(unsigned int uid) {
+    
+    size_t page = uid >> 16;
+    if (page >= pages.size())
+        pages.resize(page + 1);
+    if (pages[page].empty())
+        pages[page].resize(65536 / 64);
+    uint64_t& word = pages[page][(uid & 0xFFFF) / 64];
+    uint64_t bit = uint64_t(1) << (uid % 64);
+    if (word & bit)
+        return false;
+    word |= bit;
+    return true;
+}
+
+EntSet EntMarks::toSet() const {
+    
+    EntSet set;
+    for (size_t page = 0; page < pages.size(); page++) {
+        for (size_t w = 0; w < pages[page].size(); w++) {
+            for (uint64_t word = pages[page][w]; word != 0; word &= word - 1)
+                set.insert(unsigned((page << 16) + w * 64 + __builtin_ctzll(word)));
+        }
+    }
+    return set;
+}
+
+string EntSet::check() {
+    
+    mt19937 random(49);
+    //Each container is empty, sparse, right around ARRAY_MOST, or dense,
+    //so every pairing of arrays and bitmaps gets combined.
+    auto make = [&random](EntSet* entSet, set<unsigned int>* plain) {
+        for (unsigned int key = 0; key < 6; key++) {
+            size_t sizes[] = {0, 1 + random() % 200, ARRAY_MOST - 100 + random() % 200,
+                    20000 + random() % 30000};
+            size_t size = sizes[random() % 4];
+            for (size_t i = 0; i < size; i++) {
+                unsigned int uid = (key << 16) | (random() % 65536);
+                if (entSet->insert(uid) != plain->insert(uid).second)
+                    return false;
+            }
+        }
+        return true;
+    };
+    auto same = [](const EntSet& entSet, const set<unsigned int>& plain) {
+        vector<unsigned int> listed;
+        entSet.forEach([&listed](unsigned int uid) {
+            listed.push_back(uid);
+        });
+        return entSet.size() == plain.size() && entSet.toVector() == listed
+                && listed == vector<unsigned int>(plain.begin(), plain.end());
+    };
+    
+    for (int round = 0; round < 12; round++) {
+        EntSet a, b;
+        set<unsigned int> plainA, plainB;
+        if (!make(&a, &plainA) || !make(&b, &plainB))
+            return "insert() said a UID was new when it wasn't, or the other way";
+        if (!same(a, plainA) || !same(b, plainB))
+            return "a set doesn't hold what was put in it";
+        for (int i = 0; i < 1000; i++) {
+            unsigned int uid = random() % (7 << 16);
+            if (a.contains(uid) != (plainA.count(uid) == 1))
+                return "contains(" + to_string(uid) + ") is wrong";
+        }
+        
+        set<unsigned int> plainUnion = plainA, plainBoth, plainLeft;
+        plainUnion.insert(plainB.begin(), plainB.end());
+        for (unsigned int uid : plainA) {
+            if (plainB.count(uid))
+                plainBoth.insert(uid);
+            else
+                plainLeft.insert(uid);
+        }
+        if (!same(a | b, plainUnion))
+            return "a union is wrong";
+        if (!same(a & b, plainBoth))
+            return "an intersection is wrong";
+        if (!same(a - b, plainLeft))
+            return "a difference is wrong";
+        if (countShared(a, b) != plainBoth.size())
+            return "countShared() is wrong";
+        if (!((a - b) == (a - (a & b))) || ((a | b) == (a & b)) != (plainUnion == plainBoth))
+            return "== is wrong";
+        
+        EntMarks marks;
+        for (unsigned int uid : plainB) {
+            if (!marks.mark(uid) || marks.mark(uid))
+                return "EntMarks::mark() is wrong";
+        }
+        if (!(marks.toSet() == b))
+            return "EntMarks::toSet() is wrong";
+    }
+    
+    return "";
+}
@@ -0,0 +1,216 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ENTSET_H
+#define ENTSET_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+/**
+ * A set of Ents, kept as their UIDs in a compressed bitmap (a Roaring
+ * bitmap). UIDs are handed out densely, so sets like all the descendents of
+ * an Ent pack far tighter than a hash set of pointers, and two of them can
+ * be combined a 64-bit word at a time.
+ *
+ * UIDs are split up by their top 16 bits into containers of up to 65536.
+ * A container with few UIDs keeps them as a sorted array of their low 16
+ * bits. Once it has more than ARRAY_MOST, which is where an array would
+ * take more room, it becomes a plain 8KB bitmap. Operations on two sets go
+ * through their containers side by side, and only containers both have are
+ * worked on a UID at a time or a word at a time.
+ *
+ * Only Ents with a UID can be in one, which is every Ent in a Tree. Turning
+ * UIDs back into Ents is done with TreeSnapshot::getEnts().
+ */
+class EntSet {
+
+    struct Container {
+        /** The top 16 bits of its UIDs. */
+        uint16_t key;
+        uint32_t count;
+        /** The low 16 bits of its UIDs, in order, while it's an array. */
+        vector<uint16_t> array;
+        /** BITMAP_WORDS words once it's a bitmap, or else empty. */
+        vector<uint64_t> bits;
+
+        Container(uint16_t k = 0): key(k), count(0) {}
+
+        bool isBitmap() const {
+            return !bits.empty();
+        }
+
+        bool contains(uint16_t low) const;
+
+        bool insert(uint16_t low);
+
+        /**
+         * Makes it an array or a bitmap, whichever its count calls for.
+         */
+        void tidy();
+
+        /**
+         * Counts the bits of a bitmap.
+         */
+        void recount();
+
+        size_t getMemoryUsage() const {
+            return array.capacity() * sizeof(uint16_t) + bits.capacity() * sizeof(uint64_t);
+        }
+    };
+
+    static const size_t BITMAP_WORDS = 65536 / 64;
+
+    /** In order of key. */
+    vector<Container> containers;
+    size_t count;
+
+    /**
+     * Finds the container for a key.
+     * @return          Its place, or where it would go.
+     */
+    size_t place(uint16_t key) const;
+
+    static Container unite(const Container& a, const Container& b);
+    static Container intersect(const Container& a, const Container& b);
+    static Container subtract(const Container& a, const Container& b);
+    static size_t countShared(const Container& a, const Container& b);
+
+public:
+
+    /**
+     * The most UIDs a container keeps as an array.
+     */
+    static const size_t ARRAY_MOST = 4096;
+
+    EntSet(): count(0) {}
+
+    /**
+     * @return          false if it was already there.
+     */
+    bool insert(unsigned int uid);
+
+    bool contains(unsigned int uid) const;
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    /**
+     * Adds all of another set's UIDs.
+     */
+    EntSet& operator|=(const EntSet& other);
+
+    /**
+     * Keeps only the UIDs both have.
+     */
+    EntSet& operator&=(const EntSet& other);
+
+    /**
+     * Takes out the other set's UIDs.
+     */
+    EntSet& operator-=(const EntSet& other);
+
+    /**
+     * How many UIDs two sets share, without making the set of them.
+     */
+    static size_t countShared(const EntSet& a, const EntSet& b);
+
+    bool operator==(const EntSet& other) const;
+
+    /**
+     * Lists the UIDs, in order.
+     */
+    vector<unsigned int> toVector() const;
+
+    /**
+     * Calls a function with each UID, in order.
+     */
+    template<typename Function>
+    void forEach(Function function) const {
+        for (const Container& container : containers) {
+            unsigned int high = unsigned(container.key) << 16;
+            if (!container.isBitmap()) {
+                for (uint16_t low : container.array)
+                    function(high | low);
+                continue;
+            }
+            for (size_t w = 0; w < BITMAP_WORDS; w++) {
+                for (uint64_t word = container.bits[w]; word != 0; word &= word - 1)
+                    function(high | unsigned(w * 64 + __builtin_ctzll(word)));
+            }
+        }
+    }
+
+    /**
+     * Roughly how many bytes it takes up.
+     */
+    size_t getMemoryUsage() const;
+
+    /**
+     * Makes sets with sparse, borderline and dense containers, and compares
+     * what they and EntMarks give with std::set.
+     * @return          "" if they agree, otherwise what went wrong.
+     */
+    static string check();
+
+};
+
+inline EntSet operator|(EntSet a, const EntSet& b) {
+    return a |= b;
+}
+
+inline EntSet operator&(EntSet a, const EntSet& b) {
+    return a &= b;
+}
+
+inline EntSet operator-(EntSet a, const EntSet& b) {
+    return a -= b;
+}
+
+/**
+ * Marks UIDs as a walk finds them. Like an EntSet's bitmaps, but an 8KB
+ * page for each 65536 UIDs is only made once the walk reaches one of them,
+ * so a walk only takes room for the parts of the Tree it goes through.
+ * Marking is a single bit test, quicker than adding to an EntSet out of
+ * order, and the marks are read off into one in order at the end.
+ */
+class EntMarks {
+
+    /** By the top 16 bits of their UIDs, and empty until one is marked. */
+    vector<vector<uint64_t> > pages;
+
+public:
+
+    /**
+     * @return          false if it was already marked.
+     */
+    bool mark(unsigned int uid);
+
+    EntSet toSet() const;
+
+};
+
+#endif /* ENTSET_H */
@@ -0,0 +1,257 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "EntSetCache.h"
+#include "Tree.h"
+#include "Epoch.h"
+#include <unordered_set>
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+EntSetCache::EntSetCache(Tree* tr, size_t cap): tree(tr), capacity(cap), edited(0),
+        bytes(0) {
+    
+    stats = EntSetCacheStats();
+    stats.capacity = capacity;
+    log = tree->startChangeLog();
+    log->addWatcher(this);
+}
+
+EntSetCache::~EntSetCache() {
+    log->removeWatcher(this);
+}
+
+shared_ptr<const EntSet> EntSetCache::getDescendents(TreeSnapshot& snapshot, Ent* ent,
+        const function<bool()>& stop) {
+    
+    unsigned int uid = ent->getUID();
+    bool hot;
+    {
+        lock_guard<mutex> hold(lock);
+        unordered_map<unsigned int, Entry>::iterator found = entries.find(uid);
+        //A set from after the snapshot may have changes it shouldn't see.
+        if (found != entries.end() && found->second.version <= snapshot.getVersion()) {
+            stats.hits++;
+            order.splice(order.begin(), order, found->second.used);
+            return found->second.set;
+        }
+        stats.misses++;
+        //Forget old popularity, rather than keep count of everything.
+        if (asked.size() >= 65536)
+            asked.clear();
+        hot = found == entries.end() && ++asked[uid] >= HOT;
+    }
+    
+    shared_ptr<const EntSet> set = make_shared<EntSet>(snapshot.getDescendentSet(ent, stop));
+    if (!hot || set->size() < SMALLEST || (stop && stop()))
+        return set;
+    
+    lock_guard<mutex> hold(lock);
+    //An edit since the snapshot could already have made it out of date,
+    //with nothing in the cache yet to throw away.
+    if (snapshot.getVersion() < edited || entries.count(uid) > 0)
+        return set;
+    size_t size = set->getMemoryUsage();
+    if (size > capacity)
+        return set;
+    while (bytes + size > capacity) {
+        drop(entries.find(order.back()));
+        stats.evictions++;
+    }
+    order.push_front(uid);
+    Entry entry = {set, snapshot.getVersion(), size, order.begin()};
+    entries[uid] = entry;
+    asked.erase(uid);
+    bytes += size;
+    stats.admissions++;
+    return set;
+}
+
+shared_ptr<const EntSet> EntSetCache::peek(TreeSnapshot& snapshot, Ent* ent) {
+    lock_guard<mutex> hold(lock);
+    unordered_map<unsigned int, Entry>::iterator found = entries.find(ent->getUID());
+    if (found == entries.end() || found->second.version > snapshot.getVersion())
+        return nullptr;
+    stats.hits++;
+    order.splice(order.begin(), order, found->second.used);
+    return found->second.set;
+}
+
+void EntSetCache::drop(unordered_map<unsigned int, Entry>::iterator entry) {
+    bytes -= entry->second.bytes;
+    order.erase(entry->second.used);
+    entries.erase(entry);
+}
+
+void EntSetCache::changed(const LoggedChange& change, uint64_t, Ent* a, Ent*) {
+    
+    const TreeChange& made = change.change;
+    if (made.type != CHANGE_CONNECT && made.type != CHANGE_DISCONNECT
+            && made.type != CHANGE_REMOVE_ENT)
+        return;
+    
+    lock_guard<mutex> hold(lock);
+    edited = max(edited, change.version);
+    if (entries.empty())
+        return;
+    
+    unordered_map<unsigned int, Entry>::iterator found = entries.find(made.a);
+    if (found != entries.end()) {
+        drop(found);
+        stats.invalidations++;
+    }
+    if (made.type == CHANGE_REMOVE_ENT)
+        return;
+    
+    //The parent's ancestors have it among their descendents too.
+    unordered_set<Ent*> seen;
+    vector<Ent*> climbing(1, a);
+    EpochGuard guard;
+    while (!climbing.empty()) {
+        Ent* at = climbing.back();
+        climbing.pop_back();
+        for (Ent* parent : at->getList(RELATION_PARENT).view()) {
+            if (!seen.insert(parent).second)
+                continue;
+            found = entries.find(parent->getUID());
+            if (found != entries.end()) {
+                drop(found);
+                stats.invalidations++;
+            }
+            climbing.push_back(parent);
+        }
+    }
+}
+
+EntSetCacheStats EntSetCache::getStats() {
+    lock_guard<mutex> hold(lock);
+    EntSetCacheStats now = stats;
+    now.entries = entries.size();
+    now.bytes = bytes;
+    return now;
+}
+
+EntSetBenchmark EntSetCache::benchmark(Tree* tree, size_t count) {
+    
+    EntSetBenchmark result = EntSetBenchmark();
+    EntSetCache* cache = tree->startSetCache();
+    vector<string> sample = tree->sampleNames(count * 8);
+    Tree::Reader reading;
+    TreeSnapshot snapshot = tree->snapshot();
+    
+    //Ents with big subtrees are the ones worth it, and most Ents are leaves,
+    //so look above the sample.
+    EntSet candidates;
+    for (string& name : sample) {
+        Ent* ent = tree->getEntPtrByName(name);
+        if (ent != nullptr)
+            candidates |= snapshot.getAncestorSet(ent);
+        if (candidates.size() >= count * 8)
+            break;
+    }
+    vector<pair<size_t, Ent*> > sizes;
+    for (Ent* ent : snapshot.getEnts(candidates)) {
+        if (ent != tree->getRoot())
+            sizes.push_back(make_pair(snapshot.getDescendentSet(ent).size(), ent));
+    }
+    sort(sizes.rbegin(), sizes.rend());
+    vector<Ent*> ents;
+    for (size_t i = 0; i < sizes.size() && i < count; i++)
+        ents.push_back(sizes[i].second);
+    result.ents = ents.size();
+    if (ents.empty())
+        return result;
+    
+    auto time = [](function<void()> work, size_t times) {
+        chrono::steady_clock::time_point from = chrono::steady_clock::now();
+        work();
+        double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - from).count();
+        return micros / times;
+    };
+    
+    vector<unordered_set<Ent*> > hashes;
+    vector<EntSet> sets;
+    result.hashWalk = time([&]() {
+        for (Ent* ent : ents)
+            hashes.push_back(snapshot.getDescendents(ent));
+    }, ents.size());
+    result.setWalk = time([&]() {
+        for (Ent* ent : ents)
+            sets.push_back(snapshot.getDescendentSet(ent));
+    }, ents.size());
+    for (size_t i = 0; i < ents.size(); i++) {
+        result.averageSize += sets[i].size();
+        //Each node of a hash set holds the pointer and the next node's, and
+        //has a bucket pointing to it.
+        result.hashBytes += hashes[i].size() * 3 * sizeof(void*)
+                + hashes[i].bucket_count() * sizeof(void*);
+        result.setBytes += sets[i].getMemoryUsage();
+    }
+    result.averageSize /= ents.size();
+    result.hashBytes /= ents.size();
+    result.setBytes /= ents.size();
+    
+    //Each set with the next one along.
+    size_t pairs = ents.size();
+    size_t kept = 0;
+    result.hashIntersect = time([&]() {
+        for (size_t i = 0; i < pairs; i++) {
+            const unordered_set<Ent*>& a = hashes[i];
+            const unordered_set<Ent*>& b = hashes[(i + 1) % pairs];
+            const unordered_set<Ent*>& smaller = a.size() < b.size() ? a : b;
+            const unordered_set<Ent*>& larger = a.size() < b.size() ? b : a;
+            unordered_set<Ent*> both;
+            for (Ent* ent : smaller) {
+                if (larger.count(ent))
+                    both.insert(ent);
+            }
+            kept += both.size();
+        }
+    }, pairs);
+    result.unite = time([&]() {
+        for (size_t i = 0; i < pairs; i++)
+            kept += (sets[i] | sets[(i + 1) % pairs]).size();
+    }, pairs);
+    result.intersect = time([&]() {
+        for (size_t i = 0; i < pairs; i++)
+            kept += (sets[i] & sets[(i + 1) % pairs]).size();
+    }, pairs);
+    result.subtract = time([&]() {
+        for (size_t i = 0; i < pairs; i++)
+            kept += (sets[i] - sets[(i + 1) % pairs]).size();
+    }, pairs);
+    result.countShared = time([&]() {
+        for (size_t i = 0; i < pairs; i++)
+            kept += EntSet::countShared(sets[i], sets[(i + 1) % pairs]);
+    }, pairs);
+    
+    //Ask for each enough times to be let in, then time asking again.
+    for (unsigned int i = 0; i < HOT; i++) {
+        for (Ent* ent : ents)
+            cache->getDescendents(snapshot, ent);
+    }
+    result.cached = time([&]() {
+        for (Ent* ent : ents)
+            kept += cache->getDescendents(snapshot, ent)->size();
+    }, ents.size());
+    //So the work isn't optimized away.
+    if (kept == 0)
+        result.averageSize = 0;
+    return result;
+}
@@ -0,0 +1,171 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ENTSETCACHE_H
+#define ENTSETCACHE_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+#include "ChangeLog.h"
+#include "EntSet.h"
+#include "TreeSnapshot.h"
+
+using namespace std;
+
+class Tree;
+
+/**
+ * How an EntSetCache has done so far.
+ */
+struct EntSetCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t admissions;
+    uint64_t evictions;
+    /** Sets thrown away because an edit changed them. */
+    uint64_t invalidations;
+    size_t entries;
+    size_t bytes;
+    size_t capacity;
+};
+
+/**
+ * Results from EntSetCache::benchmark(). Times are in microseconds each.
+ */
+struct EntSetBenchmark {
+    /** How many Ents' descendents were tried, and how many each had. */
+    size_t ents;
+    double averageSize;
+    /** Walking as a hash set of Ents, and as an EntSet. */
+    double hashWalk;
+    double setWalk;
+    /** Bytes for one, on average. */
+    double hashBytes;
+    double setBytes;
+    /** Of pairs of the sets. */
+    double hashIntersect;
+    double unite;
+    double intersect;
+    double subtract;
+    double countShared;
+    /** Asking the cache for sets it's kept. */
+    double cached;
+};
+
+/**
+ * Keeps the descendents of popular Ents as EntSets, so questions about big
+ * subtrees don't walk them each time.
+ *
+ * A set is only kept once its Ent has been asked about HOT times, and if it
+ * has at least SMALLEST Ents, since small ones are quick to walk anyway. Once
+ * the sets take up capacity bytes, the least recently used go.
+ *
+ * The cache watches the Tree's log. Connecting or disconnecting a child
+ * changes the descendents of the parent and all its ancestors, so their sets
+ * are thrown away. Everything else leaves descendents as they were, apart
+ * from removing an Ent, which takes its own set with it.
+ *
+ * A set is worked out at some snapshot's version and is good for any later
+ * one, until it's thrown away. One is only kept if no edit has come along
+ * since that version, so a set is never older than what's in the cache.
+ * Only edits made within a Writer or Editor are seen. Any number of threads
+ * can use it at once.
+ */
+class EntSetCache : public ChangeWatcher {
+
+    struct Entry {
+        shared_ptr<const EntSet> set;
+        /** The version it was worked out at. */
+        uint64_t version;
+        size_t bytes;
+        /** Its place in the LRU order. */
+        list<unsigned int>::iterator used;
+    };
+
+    Tree* tree;
+    ChangeLog* log;
+    size_t capacity;
+
+    mutex lock;
+    /** By UID. */
+    unordered_map<unsigned int, Entry> entries;
+    /** Most recently used first. */
+    list<unsigned int> order;
+    /** How often each Ent not in the cache has been asked about lately. */
+    unordered_map<unsigned int, unsigned int> asked;
+    /** The version of the latest edit which changed descendents. */
+    uint64_t edited;
+    size_t bytes;
+    EntSetCacheStats stats;
+
+    /**
+     * Takes an entry out. The lock must be held.
+     */
+    void drop(unordered_map<unsigned int, Entry>::iterator entry);
+
+public:
+
+    static const size_t DEFAULT_CAPACITY = 64 * 1024 * 1024;
+    static const unsigned int HOT = 2;
+    static const size_t SMALLEST = 256;
+
+    /**
+     * Starts the Tree's log, if it hasn't been, and watches it. Usually made
+     * through Tree::startSetCache(). Don't call it within a Tree::Reader.
+     * @param capacity  How many bytes of sets to keep at most.
+     */
+    EntSetCache(Tree* tree, size_t capacity = DEFAULT_CAPACITY);
+
+    ~EntSetCache();
+
+    EntSetCache(const EntSetCache&) = delete;
+    EntSetCache& operator=(const EntSetCache&) = delete;
+
+    /**
+     * All the descendents of an Ent, as they were at a snapshot's version.
+     * From the cache if it can, or else walked, and kept if it's popular.
+     * @param stop      Passed on to the walk. A walk it stops isn't kept.
+     */
+    shared_ptr<const EntSet> getDescendents(TreeSnapshot& snapshot, Ent* ent,
+            const function<bool()>& stop = nullptr);
+
+    /**
+     * The set getDescendents() would find in the cache, without walking if
+     * it isn't there. Doesn't count towards making the Ent popular.
+     * @return          The set, or nullptr.
+     */
+    shared_ptr<const EntSet> peek(TreeSnapshot& snapshot, Ent* ent);
+
+    EntSetCacheStats getStats();
+
+    /**
+     * Starts a Tree's cache if need be, then finds the Ents with the most
+     * descendents among a sample of count and times working with their
+     * descendents, as hash sets, as EntSets and from the cache. Nothing is
+     * printed. Don't call it within a Tree::Reader.
+     */
+    static EntSetBenchmark benchmark(Tree* tree, size_t count);
+
+    void changed(const LoggedChange& change, uint64_t offset, Ent* a, Ent* b) override;
+
+};
+
+#endif /* ENTSETCACHE_H */
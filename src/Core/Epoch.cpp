@@ -0,0 +1,183 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Epoch.h"
+#include "CacheAligned.h"
+#include <vector>
+#include <mutex>
+
+using namespace std;
+
+/**
+ * What each thread publishes about itself. Records are never freed, only
+ * handed to a new thread when the old one exits, so walking the list is
+ * always safe. Each sits on its own cache line, so readers on different
+ * cores don't slow each other down.
+ */
+struct alignas(64) EpochRecord : CacheAligned {
+    /**
+     * The epoch the thread entered when it started reading, or 0 if it isn't.
+     */
+    atomic<uint64_t> pinned;
+    atomic<bool> inUse;
+    /**
+     * How many guards the thread holds. Only the thread itself touches it.
+     */
+    unsigned int depth;
+    EpochRecord* next;
+};
+
+/**
+ * Something retired, and the epoch it was retired in.
+ */
+struct RetiredItem {
+    void* p;
+    void (*destroy)(void*);
+    uint64_t epoch;
+};
+
+static atomic<uint64_t> globalEpoch(1);
+static atomic<EpochRecord*> records(nullptr);
+
+static mutex retiredLock;
+static vector<RetiredItem> retired;
+
+/**
+ * Past this many retired things, retire() reclaims on its own, so memory
+ * doesn't pile up when a writer never calls reclaim().
+ */
+static const size_t RECLAIM_THRESHOLD = 1024;
+
+/**
+ * Gives the thread's record back when the thread exits.
+ */
+struct EpochRecordHolder {
+    EpochRecord* record;
+
+    ~EpochRecordHolder() {
+        if (record != nullptr)
+            record->inUse.store(false);
+    }
+};
+
+static thread_local EpochRecordHolder holder = {nullptr};
+
+
+EpochRecord* Epoch::getRecord() {
+
+    if (holder.record != nullptr)
+        return holder.record;
+
+    //Reuse the record of a thread that has exited, if there is one.
+    for (EpochRecord* r = records.load(); r != nullptr; r = r->next) {
+        bool free = false;
+        if (r->inUse.compare_exchange_strong(free, true))
+            return holder.record = r;
+    }
+
+    EpochRecord* r = new EpochRecord();
+    r->pinned.store(0);
+    r->inUse.store(true);
+    r->depth = 0;
+    r->next = records.load();
+    while (!records.compare_exchange_weak(r->next, r));
+
+    return holder.record = r;
+}
+
+uint64_t Epoch::getOldestReader() {
+
+    uint64_t oldest = UINT64_MAX;
+    for (EpochRecord* r = records.load(); r != nullptr; r = r->next) {
+        uint64_t pinned = r->pinned.load();
+        if (pinned != 0 && pinned < oldest)
+            oldest = pinned;
+    }
+    return oldest;
+}
+
+void Epoch::retire(void* p, void (*destroy)(void*)) {
+
+    //Whoever called this already made p unreachable. Once that is visible to
+    //everyone, a reader that isn't in an epoch yet can't find p.
+    atomic_thread_fence(memory_order_seq_cst);
+
+    //The usual case when nobody else is reading. Nothing to wait for.
+    if (getOldestReader() == UINT64_MAX) {
+        destroy(p);
+        return;
+    }
+
+    size_t pending;
+    {
+        lock_guard<mutex> lock(retiredLock);
+        RetiredItem item = {p, destroy, globalEpoch.load()};
+        retired.push_back(item);
+        pending = retired.size();
+    }
+
+    if (pending >= RECLAIM_THRESHOLD)
+        reclaim();
+}
+
+void Epoch::reclaim() {
+
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t oldest = getOldestReader();
+
+    //Anything retired before the oldest reader's epoch began was out of
+    //reach before that reader started, and every later reader too.
+    vector<RetiredItem> done;
+    {
+        lock_guard<mutex> lock(retiredLock);
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); i++) {
+            if (retired[i].epoch < oldest)
+                done.push_back(retired[i]);
+            else
+                retired[kept++] = retired[i];
+        }
+        retired.resize(kept);
+    }
+
+    globalEpoch.fetch_add(1);
+
+    for (RetiredItem& item : done)
+        item.destroy(item.p);
+}
+
+size_t Epoch::getPendingCount() {
+    lock_guard<mutex> lock(retiredLock);
+    return retired.size();
+}
+
+
+EpochGuard::EpochGuard(): record(Epoch::getRecord()) {
+
+    if (record->depth++ == 0) {
+        record->pinned.store(globalEpoch.load(), memory_order_relaxed);
+        //The epoch must be visible before anything is read under it.
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+EpochGuard::~EpochGuard() {
+
+    if (--record->depth == 0)
+        record->pinned.store(0, memory_order_release);
+}
@@ -0,0 +1,110 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+struct EpochRecord;
+
+/**
+ * Epoch-based reclamation, so threads can read a Tree while another thread
+ * edits it, without any locks on the reading side.
+ *
+ * A reader announces it is reading by holding an EpochGuard, which records
+ * the current epoch for its thread. When a writer takes something out of a
+ * Tree that a reader might still be looking at, like an old copy of an Ent's
+ * list or a removed Ent, it doesn't delete it. It retires it instead. Retired
+ * things are deleted once every reader has moved on to a later epoch, so no
+ * reader can still be holding them.
+ *
+ * Readers never wait on writers, and writers never wait on readers. A reader
+ * that holds its guard for a long time only delays when memory is freed.
+ */
+class Epoch {
+
+    friend class EpochGuard;
+
+    /**
+     * The record for the calling thread, created the first time it's needed.
+     */
+    static EpochRecord* getRecord();
+
+    /**
+     * The oldest epoch any reader is in, or UINT64_MAX if none are reading.
+     */
+    static uint64_t getOldestReader();
+
+    template<typename T>
+    static void destroy(void* p) {
+        delete static_cast<T*>(p);
+    }
+
+public:
+
+    /**
+     * Deletes something once no reader can be looking at it. It must already
+     * be out of reach, so that readers arriving from now on can't find it.
+     * @param p         What to delete.
+     * @param destroy   How to delete it.
+     */
+    static void retire(void* p, void (*destroy)(void*));
+
+    template<typename T>
+    static void retire(T* p) {
+        retire(p, &destroy<T>);
+    }
+
+    /**
+     * Deletes whatever has been retired that no reader can still see, and
+     * moves on to the next epoch. Writers call this when they're done.
+     */
+    static void reclaim();
+
+    /**
+     * How many retired things are still waiting to be deleted.
+     */
+    static size_t getPendingCount();
+
+};
+
+/**
+ * Hold one of these while reading anything other threads might be changing.
+ * Guards can be nested. Only the outermost one does anything.
+ */
+class EpochGuard {
+
+    EpochRecord* record;
+
+public:
+
+    EpochGuard();
+
+    ~EpochGuard();
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+};
+
+#endif /* EPOCH_H */
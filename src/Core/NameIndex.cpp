@@ -0,0 +1,525 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "NameIndex.h"
+#include "Tree.h"
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <functional>
+
+using namespace std;
+
+bool NameIndex::keyLess(const char* a, size_t aSize, const char* b, size_t bSize) {
+    int order = memcmp(a, b, min(aSize, bSize));
+    return order < 0 || (order == 0 && aSize < bSize);
+}
+
+bool NameIndex::Candidate::operator<(const Candidate& other) const {
+    if (distance != other.distance)
+        return distance < other.distance;
+    return keyLess(key, size, other.key, other.size);
+}
+
+string NameIndex::fold(const string& name) {
+    string key(name);
+    for (char& c : key) {
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+    }
+    return key;
+}
+
+size_t NameIndex::Run::lowerBound(const char* key, size_t size) const {
+    
+    size_t low = 0;
+    size_t high = entries.size();
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const Entry& entry = entries[middle];
+        if (keyLess(keyOf(entry), entry.size, key, size))
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+size_t NameIndex::Run::prefixEnd(const char* prefix, size_t size, size_t from) const {
+    
+    auto starts = [&](size_t i) {
+        return entries[i].size >= size && memcmp(keyOf(entries[i]), prefix, size) == 0;
+    };
+    //Gallop first, since most runs of names with the same start are short.
+    size_t step = 1;
+    size_t low = from;
+    size_t high = from;
+    while (high < entries.size() && starts(high)) {
+        low = high + 1;
+        high += step;
+        step *= 2;
+    }
+    high = min(high, entries.size());
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (starts(middle))
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+void NameIndex::Run::insert(const string& key, Ent* ent) {
+    
+    //After any with the same key.
+    size_t place = lowerBound(key.data(), key.size());
+    while (place < entries.size() && !keyLess(key.data(), key.size(),
+            keyOf(entries[place]), entries[place].size))
+        place++;
+    Entry entry = {uint32_t(pool.size()), uint32_t(key.size()), ent};
+    pool += key;
+    entries.insert(entries.begin() + place, entry);
+}
+
+size_t NameIndex::Run::find(const string& key, Ent* ent) const {
+    
+    for (size_t i = lowerBound(key.data(), key.size()); i < entries.size(); i++) {
+        const Entry& entry = entries[i];
+        if (entry.size != key.size() || memcmp(keyOf(entry), key.data(), key.size()) != 0)
+            break;
+        if (entry.ent == ent)
+            return i;
+    }
+    return entries.size();
+}
+
+
+NameIndex::NameIndex(Tree* tree): removed(0) {
+    
+    size_t count = tree->getNameMap()->size();
+    base.entries.reserve(count);
+    for (pair<const string, Ent*>& p : *tree->getNameMap()) {
+        Entry entry = {uint32_t(base.pool.size()), uint32_t(p.first.size()), p.second};
+        base.pool += fold(p.first);
+        base.entries.push_back(entry);
+    }
+    const string& pool = base.pool;
+    sort(base.entries.begin(), base.entries.end(), [&pool](const Entry& a, const Entry& b) {
+        return keyLess(pool.data() + a.at, a.size, pool.data() + b.at, b.size);
+    });
+    //Packs the keys in the same order, so searches read them in order.
+    merge();
+}
+
+void NameIndex::add(Ent* ent) {
+    
+    lock_guard<mutex> hold(lock);
+    recent.insert(fold(ent->getName()), ent);
+    if (recent.entries.size() > max(MERGE_AT, base.entries.size() / 16))
+        merge();
+}
+
+void NameIndex::remove(Ent* ent) {
+    
+    lock_guard<mutex> hold(lock);
+    string key = fold(ent->getName());
+    size_t place = recent.find(key, ent);
+    if (place < recent.entries.size()) {
+        //Its key is left in the pool until the next merge.
+        recent.entries.erase(recent.entries.begin() + place);
+        return;
+    }
+    place = base.find(key, ent);
+    if (place == base.entries.size())
+        return;
+    base.entries[place].ent = nullptr;
+    removed++;
+    if (removed > max(MERGE_AT, base.entries.size() / 4))
+        merge();
+}
+
+void NameIndex::merge() {
+    
+    Run merged;
+    merged.entries.reserve(base.entries.size() - removed + recent.entries.size());
+    merged.pool.reserve(base.pool.size() + recent.pool.size());
+    
+    size_t i = 0;
+    size_t j = 0;
+    while (i < base.entries.size() || j < recent.entries.size()) {
+        const Run* from;
+        const Entry* entry;
+        if (j == recent.entries.size() || (i < base.entries.size()
+                && !keyLess(recent.keyOf(recent.entries[j]), recent.entries[j].size,
+                        base.keyOf(base.entries[i]), base.entries[i].size))) {
+            from = &base;
+            entry = &base.entries[i++];
+        } else {
+            from = &recent;
+            entry = &recent.entries[j++];
+        }
+        if (entry->ent == nullptr)
+            continue;
+        Entry copy = {uint32_t(merged.pool.size()), entry->size, entry->ent};
+        merged.pool.append(from->keyOf(*entry), entry->size);
+        merged.entries.push_back(copy);
+    }
+    
+    swap(base, merged);
+    recent = Run();
+    removed = 0;
+}
+
+vector<NameMatch> NameIndex::starting(const string& key, bool whole, size_t k) {
+    
+    vector<NameMatch> found;
+    lock_guard<mutex> hold(lock);
+    
+    const Run* runs[2] = {&base, &recent};
+    size_t at[2];
+    for (int r = 0; r < 2; r++)
+        at[r] = runs[r]->lowerBound(key.data(), key.size());
+    
+    while (found.size() < k) {
+        //The head of each Run, if it still starts with key.
+        const Entry* heads[2] = {nullptr, nullptr};
+        for (int r = 0; r < 2; r++) {
+            const vector<Entry>& entries = runs[r]->entries;
+            while (at[r] < entries.size()) {
+                const Entry& entry = entries[at[r]];
+                if (entry.size < key.size() || (whole && entry.size != key.size())
+                        || memcmp(runs[r]->keyOf(entry), key.data(), key.size()) != 0) {
+                    at[r] = entries.size();
+                } else if (entry.ent == nullptr) {
+                    at[r]++;
+                } else {
+                    heads[r] = &entry;
+                    break;
+                }
+            }
+        }
+        if (heads[0] == nullptr && heads[1] == nullptr)
+            break;
+        int r = heads[1] == nullptr || (heads[0] != nullptr
+                && !keyLess(recent.keyOf(*heads[1]), heads[1]->size,
+                        base.keyOf(*heads[0]), heads[0]->size)) ? 0 : 1;
+        NameMatch match = {heads[r]->ent, unsigned(heads[r]->size - key.size())};
+        found.push_back(match);
+        at[r]++;
+    }
+    return found;
+}
+
+vector<NameMatch> NameIndex::complete(const string& prefix, size_t k) {
+    return starting(fold(prefix), false, k);
+}
+
+vector<NameMatch> NameIndex::findIgnoringCase(const string& name, size_t k) {
+    return starting(fold(name), true, k);
+}
+
+void NameIndex::gatherSimilar(const Run& run, const string& key, unsigned int most,
+        size_t k, vector<Candidate>* best) {
+    
+    size_t width = key.size() + 1;
+    //Row d holds the edit distance from key's beginning to the first d
+    //characters of the name being looked at.
+    vector<unsigned int> rows(width);
+    for (size_t j = 0; j < width; j++)
+        rows[j] = j;
+    
+    const char* previous = nullptr;
+    size_t valid = 0;
+    size_t i = 0;
+    while (i < run.entries.size()) {
+        
+        const Entry& entry = run.entries[i];
+        if (entry.ent == nullptr) {
+            i++;
+            continue;
+        }
+        const char* name = run.keyOf(entry);
+        unsigned int bound = best->size() < k ? most : (*best)[0].distance;
+        
+        size_t shared = 0;
+        while (shared < valid && shared < entry.size && name[shared] == previous[shared])
+            shared++;
+        if (rows.size() < (entry.size + 1) * width)
+            rows.resize((entry.size + 1) * width);
+        
+        size_t cut = 0;
+        for (size_t d = shared + 1; d <= entry.size; d++) {
+            unsigned int* above = &rows[(d - 1) * width];
+            unsigned int* row = &rows[d * width];
+            row[0] = d;
+            unsigned int least = row[0];
+            for (size_t j = 1; j < width; j++) {
+                row[j] = min(min(above[j], row[j - 1]) + 1,
+                        above[j - 1] + (name[d - 1] != key[j - 1]));
+                least = min(least, row[j]);
+            }
+            if (least > bound) {
+                cut = d;
+                break;
+            }
+        }
+        
+        previous = name;
+        if (cut > 0) {
+            //No name starting this way can be close enough.
+            valid = cut;
+            i = run.prefixEnd(name, cut, i + 1);
+            continue;
+        }
+        valid = entry.size;
+        i++;
+        
+        Candidate candidate = {rows[entry.size * width + key.size()], name, entry.size, entry.ent};
+        if (candidate.distance > bound)
+            continue;
+        if (best->size() < k) {
+            best->push_back(candidate);
+            push_heap(best->begin(), best->end());
+        } else if (candidate < (*best)[0]) {
+            pop_heap(best->begin(), best->end());
+            best->back() = candidate;
+            push_heap(best->begin(), best->end());
+        }
+    }
+}
+
+vector<NameMatch> NameIndex::findSimilar(const string& name, unsigned int most, size_t k) {
+    
+    vector<NameMatch> found;
+    if (k == 0)
+        return found;
+    
+    string key = fold(name);
+    vector<Candidate> best;
+    {
+        lock_guard<mutex> hold(lock);
+        //Each extra edit allowed has far more names to look at, so only go
+        //as far as it takes to find k.
+        for (unsigned int within = 0; within <= most && best.size() < k; within++) {
+            best.clear();
+            gatherSimilar(base, key, within, k, &best);
+            gatherSimilar(recent, key, within, k, &best);
+        }
+        sort_heap(best.begin(), best.end());
+        for (Candidate& candidate : best) {
+            NameMatch match = {candidate.ent, candidate.distance};
+            found.push_back(match);
+        }
+    }
+    return found;
+}
+
+vector<NameMatch> NameIndex::suggest(const string& text, size_t k) {
+    
+    vector<NameMatch> found = findIgnoringCase(text, k);
+    for (vector<NameMatch> more : {complete(text, k), findSimilar(text, 2, k)}) {
+        for (NameMatch& match : more) {
+            if (found.size() == k)
+                return found;
+            bool seen = false;
+            for (NameMatch& already : found)
+                seen = seen || already.ent == match.ent;
+            if (!seen)
+                found.push_back(match);
+        }
+    }
+    return found;
+}
+
+size_t NameIndex::size() {
+    lock_guard<mutex> hold(lock);
+    return base.entries.size() - removed + recent.entries.size();
+}
+
+size_t NameIndex::getMemoryUsage() {
+    lock_guard<mutex> hold(lock);
+    return base.pool.capacity() + recent.pool.capacity()
+            + (base.entries.capacity() + recent.entries.capacity()) * sizeof(Entry);
+}
+
+NameIndexBenchmark NameIndex::benchmark(Tree* tree, size_t k) {
+    
+    NameIndexBenchmark result;
+    result.buildSeconds = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool building = tree->getNameIndex() == nullptr;
+    NameIndex* index = tree->startNameIndex();
+    if (building)
+        result.buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    result.names = index->size();
+    result.bytes = index->getMemoryUsage();
+    
+    vector<string> sample = tree->sampleNames(1000);
+    vector<string> prefixes;
+    vector<string> upper;
+    vector<string> typos;
+    mt19937 random(1);
+    for (string& name : sample) {
+        prefixes.push_back(name.substr(0, 3));
+        string shouted(name);
+        for (char& c : shouted)
+            c = toupper(c);
+        upper.push_back(shouted);
+        string typo(name);
+        typo[random() % typo.size()] = 'z';
+        typos.push_back(typo);
+    }
+    
+    auto time = [&](function<void(const string&)> search, const vector<string>& texts) {
+        Tree::Reader reading;
+        chrono::steady_clock::time_point from = chrono::steady_clock::now();
+        for (const string& text : texts)
+            search(text);
+        double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - from).count();
+        return texts.empty() ? 0 : micros / texts.size();
+    };
+    result.complete = time([&](const string& text) { index->complete(text, k); }, prefixes);
+    result.ignoringCase = time([&](const string& text) { index->findIgnoringCase(text, k); }, upper);
+    result.similar = time([&](const string& text) { index->findSimilar(text, 2, k); }, typos);
+    return result;
+}
+
+string NameIndex::check() {
+    
+    //Short names from a few letters, so plenty share beginnings, differ
+    //only by case, or are an edit or two apart.
+    mt19937 random(47);
+    auto makeName = [&random]() {
+        const char letters[] = "abcABC-";
+        string name(1 + random() % 7, ' ');
+        for (char& c : name)
+            c = letters[random() % 7];
+        return name;
+    };
+    auto distance = [](const string& a, const string& b) {
+        vector<unsigned int> row(b.size() + 1);
+        for (size_t j = 0; j <= b.size(); j++)
+            row[j] = j;
+        for (size_t i = 1; i <= a.size(); i++) {
+            unsigned int diagonal = row[0];
+            row[0] = i;
+            for (size_t j = 1; j <= b.size(); j++) {
+                unsigned int above = row[j];
+                row[j] = min(min(row[j] + 1, row[j - 1] + 1),
+                        diagonal + (a[i - 1] == b[j - 1] ? 0 : 1));
+                diagonal = above;
+            }
+        }
+        return row[b.size()];
+    };
+    
+    //Names already taken are just skipped.
+    Tree tree("Name index check");
+    for (int i = 0; i < 3000; i++)
+        tree.tryToCreateNewEnt(makeName());
+    NameIndex* index = tree.startNameIndex();
+    //Enough new names for recent to be merged in at least once.
+    for (int i = 0; i < 3000; i++)
+        tree.tryToCreateNewEnt(makeName());
+    vector<Ent*> ents;
+    for (pair<const string, Ent*>& p : *tree.getNameMap()) {
+        if (p.second != tree.getRoot())
+            ents.push_back(p.second);
+    }
+    for (int i = 0; i < 300 && !ents.empty(); i++) {
+        size_t at = random() % ents.size();
+        tree.removeEnt(ents[at]);
+        ents[at] = ents.back();
+        ents.pop_back();
+    }
+    for (int i = 0; i < 300; i++)
+        tree.renameEnt(ents[random() % ents.size()], makeName());
+    ents.push_back(tree.getRoot());
+    
+    if (index->size() != ents.size())
+        return "holds " + to_string(index->size()) + " names, not " + to_string(ents.size());
+    
+    auto keyOf = [](Ent* ent) {
+        return fold(ent->getName());
+    };
+    auto keyOrder = [](const string& a, const string& b) {
+        return keyLess(a.data(), a.size(), b.data(), b.size());
+    };
+    
+    for (int i = 0; i < 300; i++) {
+        string text = i % 2 ? makeName() : ents[random() % ents.size()]->getName();
+        string key = fold(text);
+        const size_t k = 10;
+        
+        //Every name starting with it, and every name it is, in any case.
+        vector<string> starting;
+        unordered_set<Ent*> same;
+        for (Ent* ent : ents) {
+            string entKey = keyOf(ent);
+            if (entKey.compare(0, key.size(), key) == 0)
+                starting.push_back(entKey);
+            if (entKey == key)
+                same.insert(ent);
+        }
+        sort(starting.begin(), starting.end(), keyOrder);
+        starting.resize(min(starting.size(), k));
+        vector<NameMatch> completed = index->complete(text, k);
+        if (completed.size() != starting.size())
+            return "completing \"" + text + "\" found " + to_string(completed.size())
+                    + " names, not " + to_string(starting.size());
+        for (size_t m = 0; m < completed.size(); m++) {
+            if (keyOf(completed[m].ent) != starting[m]
+                    || completed[m].distance != starting[m].size() - key.size())
+                return "completing \"" + text + "\" found the wrong names";
+        }
+        
+        vector<NameMatch> found = index->findIgnoringCase(text, ents.size());
+        unordered_set<Ent*> foundSet;
+        for (NameMatch& match : found)
+            foundSet.insert(match.ent);
+        if (foundSet != same || found.size() != same.size())
+            return "\"" + text + "\" in any case found the wrong Ents";
+        
+        //The closest, as distance then key, since Ents with the same key
+        //can come in either order.
+        vector<pair<unsigned int, string> > close;
+        for (Ent* ent : ents) {
+            unsigned int d = distance(key, keyOf(ent));
+            if (d <= 2)
+                close.push_back(make_pair(d, keyOf(ent)));
+        }
+        sort(close.begin(), close.end(), [&keyOrder](const pair<unsigned int, string>& a,
+                const pair<unsigned int, string>& b) {
+            return a.first != b.first ? a.first < b.first : keyOrder(a.second, b.second);
+        });
+        close.resize(min(close.size(), k));
+        vector<NameMatch> similar = index->findSimilar(text, 2, k);
+        if (similar.size() != close.size())
+            return "similar to \"" + text + "\" found " + to_string(similar.size())
+                    + " names, not " + to_string(close.size());
+        for (size_t m = 0; m < similar.size(); m++) {
+            if (similar[m].distance != close[m].first || keyOf(similar[m].ent) != close[m].second
+                    || distance(key, keyOf(similar[m].ent)) != similar[m].distance)
+                return "similar to \"" + text + "\" found the wrong names";
+        }
+    }
+    
+    return "";
+}
@@ -0,0 +1,236 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NAMEINDEX_H
+#define NAMEINDEX_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+using namespace std;
+
+class Ent;
+class Tree;
+
+/**
+ * An Ent found by NameIndex, and how many single character edits its name
+ * is from what was asked for, ignoring case.
+ */
+struct NameMatch {
+    Ent* ent;
+    unsigned int distance;
+};
+
+/**
+ * Results from NameIndex::benchmark(). Searches are timed in microseconds
+ * each.
+ */
+struct NameIndexBenchmark {
+    size_t names;
+    /** 0 if the Tree already had an index. */
+    double buildSeconds;
+    size_t bytes;
+    double complete;
+    double ignoringCase;
+    /** Of names with one typo, for matches within 2 edits. */
+    double similar;
+};
+
+/**
+ * Finds Ents by part of their name, by their name in any case, or by a name
+ * close to theirs, for when the exact name isn't known.
+ *
+ * Names are kept lower cased (ASCII only) and sorted, packed one after
+ * another in one big string, with a small entry pointing into it for each.
+ * The sorted list works like a trie: all the names starting with something
+ * are next to each other, so completing a prefix is a binary search and
+ * reading off the first few. Similar names are found by walking the list
+ * with an edit distance table, one row per character, as if going down a
+ * trie. Names sharing a beginning with the one before reuse its rows, and
+ * once a row has nothing close enough, every name starting the same way is
+ * jumped over at once.
+ *
+ * New names go in a second, smaller list, which is merged into the big one
+ * once it's grown to a sixteenth of its size. Removed names are only marked
+ * until then. So keeping up with edits costs a little each time, not a
+ * rebuild.
+ *
+ * Searches and changes are serialized by a lock, since both are short. The
+ * Ents found are only safe to use while holding a Tree::Reader.
+ */
+class NameIndex {
+
+    struct Entry {
+        uint32_t at;
+        uint32_t size;
+        /** nullptr once removed. */
+        Ent* ent;
+    };
+
+    /**
+     * Names sorted by their lower cased form, which is kept in pool.
+     */
+    struct Run {
+        string pool;
+        vector<Entry> entries;
+
+        const char* keyOf(const Entry& entry) const {
+            return pool.data() + entry.at;
+        }
+
+        /**
+         * The first entry whose key isn't less than the given one.
+         */
+        size_t lowerBound(const char* key, size_t size) const;
+
+        /**
+         * The first entry from from on whose key doesn't start with prefix.
+         */
+        size_t prefixEnd(const char* prefix, size_t size, size_t from) const;
+
+        void insert(const string& key, Ent* ent);
+
+        /**
+         * Finds the entry for an Ent by its key.
+         * @return          Its place, or entries.size() if it isn't there.
+         */
+        size_t find(const string& key, Ent* ent) const;
+    };
+
+    /**
+     * A name on its way into the results of findSimilar().
+     */
+    struct Candidate {
+        unsigned int distance;
+        const char* key;
+        size_t size;
+        Ent* ent;
+
+        bool operator<(const Candidate& other) const;
+    };
+
+    /**
+     * How many new names are let pile up before merging, at the least.
+     */
+    static const size_t MERGE_AT = 1024;
+
+    Run base;
+    Run recent;
+    /**
+     * How many of base's entries are only marked removed.
+     */
+    size_t removed;
+    mutex lock;
+
+    static string fold(const string& name);
+
+    static bool keyLess(const char* a, size_t aSize, const char* b, size_t bSize);
+
+    /**
+     * Ents whose keys start with key, or are key if whole is set, from both
+     * Runs in order.
+     */
+    vector<NameMatch> starting(const string& key, bool whole, size_t k);
+
+    /**
+     * Puts recent and base together, without the removed entries.
+     */
+    void merge();
+
+    /**
+     * Adds one Run's names within most edits of key to best, keeping only
+     * the k best. most shrinks once best is full.
+     */
+    static void gatherSimilar(const Run& run, const string& key, unsigned int most,
+            size_t k, vector<Candidate>* best);
+
+    /**
+     * Indexes every Ent of a Tree. Only made by Tree::startNameIndex(),
+     * within a Writer, since the name map can't be walked while other
+     * threads add to it.
+     */
+    NameIndex(Tree* tree);
+
+    friend class Tree;
+
+public:
+
+    NameIndex(const NameIndex&) = delete;
+    NameIndex& operator=(const NameIndex&) = delete;
+
+    /**
+     * Indexes an Ent under its name.
+     */
+    void add(Ent* ent);
+
+    /**
+     * Forgets an Ent. Call before it loses its name.
+     */
+    void remove(Ent* ent);
+
+    /**
+     * Ents whose names start with prefix, ignoring case, in alphabetical
+     * order.
+     * @param k         The most to return.
+     */
+    vector<NameMatch> complete(const string& prefix, size_t k);
+
+    /**
+     * Ents with the name, ignoring case.
+     */
+    vector<NameMatch> findIgnoringCase(const string& name, size_t k);
+
+    /**
+     * The k Ents with names fewest edits away from name, ignoring case, and
+     * in alphabetical order when as close. Nothing more than most edits
+     * away is returned.
+     */
+    vector<NameMatch> findSimilar(const string& name, unsigned int most, size_t k);
+
+    /**
+     * What someone who typed text might have meant: Ents with that name in
+     * any case, then names starting with it, then similar names.
+     */
+    vector<NameMatch> suggest(const string& text, size_t k);
+
+    size_t size();
+
+    /**
+     * Roughly how many bytes the index takes up.
+     */
+    size_t getMemoryUsage();
+
+    /**
+     * Starts a Tree's index if need be, then times finding k Ents by the
+     * first few letters, by the name in upper case, and by the name with a
+     * typo, for a sample of its names. Nothing is printed.
+     */
+    static NameIndexBenchmark benchmark(Tree* tree, size_t k);
+
+    /**
+     * Indexes a made up Tree, then adds, removes and renames Ents, and
+     * compares every kind of search with going through all the names.
+     * @return      "" if they agree, otherwise what went wrong.
+     */
+    static string check();
+
+};
+
+#endif /* NAMEINDEX_H */
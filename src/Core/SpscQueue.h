@@ -0,0 +1,97 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+using namespace std;
+
+/**
+ * A fixed-size queue between exactly one producing thread and one consuming
+ * thread, with no locks.
+ *
+ * It's a ring of slots. The producer only ever moves the tail and the
+ * consumer the head, each publishing its move with a release store, so
+ * neither waits on the other. A line's worth of padding keeps the two off
+ * each other's cache line, so they don't slow each other down either.
+ */
+template<typename T>
+class SpscQueue {
+
+    vector<T> slots;
+    size_t mask;
+    /** The next slot to take from. Only the consumer moves it. */
+    atomic<size_t> head;
+    char padding[64];
+    /** The next slot to fill. Only the producer moves it. */
+    atomic<size_t> tail;
+
+public:
+
+    /**
+     * @param capacity  How many items it can hold, rounded up to a power of 2.
+     */
+    SpscQueue(size_t capacity): head(0), tail(0) {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /**
+     * Only call from the producing thread.
+     * @return          false if it's full, in which case item is left alone.
+     */
+    bool push(T& item) {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t - head.load(memory_order_acquire) == slots.size())
+            return false;
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    /**
+     * Only call from the consuming thread.
+     * @return          false if it's empty.
+     */
+    bool pop(T* item) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h == tail.load(memory_order_acquire))
+            return false;
+        *item = std::move(slots[h & mask]);
+        //Don't hold on to anything the item owns.
+        slots[h & mask] = T();
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    bool isEmpty() const {
+        return head.load(memory_order_acquire) == tail.load(memory_order_acquire);
+    }
+
+};
+
+#endif /* SPSCQUEUE_H */
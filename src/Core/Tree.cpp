@@ -17,12 +17,20 @@
  */
 
 #include "Tree.h"
+#include "EntSetCache.h"
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
 
 using namespace std;
 
-Tree::Tree(string name): name(name) {
+Tree::Tree(string name, UIDAllocator* allocator): name(name), uidAllocator(allocator),
+        origin(allocator->getOrigin()), excluding(false), editors(0), version(0), allocated(0),
+        changeLog(nullptr), nameIndex(nullptr), setCache(nullptr) {
     //Add root to the nameMap.
-    entNameMap.insert({root.getName(), &root});
+    entNameMap.insert(root.getName(), &root);
+    entUIDMap.insert(root.getUID(), &root);
     //Useful for debugging to tell the user now when construction is done.
     cout << "New Tree created named \"" << name << "\".\n";
 }
@@ -31,9 +39,16 @@ Tree::~Tree() {
     //Remove root's pointer from the nameMap, so we don't delete it twice.
     entNameMap.erase(root.getName());
     //Deallocate each Ent in the nameMap.
-    for (pair<string, Ent*> i : entNameMap) {
+    for (pair<const string, Ent*>& i : entNameMap) {
         delete i.second;
     }
+    //And those removed, but kept for snapshots.
+    for (pair<uint64_t, Ent*>& removed : removedEnts)
+        delete removed.second;
+    //It stops watching the log as it goes.
+    delete setCache.load();
+    delete changeLog.load();
+    delete nameIndex.load();
     //Useful for debugging.
     cout << "Tree destructor completed.\n";
 }
@@ -42,40 +57,689 @@ Tree::~Tree() {
 void Tree::addEntToNameMap(Ent* entPtr, Ent* parentPtr) {
     //If no parent is given, make its parent root to prevent orphan Ents.
     if (parentPtr == 0) parentPtr = &root;
-    entNameMap.insert({entPtr->getName(), entPtr});
+    //Snapshots from before now shouldn't find it.
+    if (EntList::writing != nullptr)
+        entPtr->addedVersion = EntList::writing->version;
+    if (entNameMap.insert(entPtr->getName(), entPtr))
+        indexName(entPtr);
+    indexUID(entPtr);
+    ChangeLog::record(CHANGE_ADD_ENT, entPtr);
     //Connect the new ent and its new parent. Adds references for each other.
     Ent::connectUnchecked(parentPtr, entPtr);
 }
 
-NewEntStatus Tree::tryToCreateNewEnt(const string name) {
+bool Tree::addEntToNameMapUnattached(Ent* entPtr) {
+    if (EntList::writing != nullptr)
+        entPtr->addedVersion = EntList::writing->version;
+    if (!entNameMap.insert(entPtr->getName(), entPtr))
+        return false;
+    indexName(entPtr);
+    indexUID(entPtr);
+    ChangeLog::record(CHANGE_ADD_ENT, entPtr);
+    return true;
+}
+
+void Tree::indexName(Ent* entPtr) {
+    NameIndex* index = getNameIndex();
+    if (index != nullptr)
+        index->add(entPtr);
+}
+
+void Tree::indexUID(Ent* entPtr) {
+    
+    if (entPtr->uid != 0) {
+        //Came with a UID. Make sure it's never handed out again.
+        uidAllocator->raiseTo((uint64_t) entPtr->uid + 1);
+        if (entUIDMap.insert(entPtr->uid, entPtr))
+            return;
+    }
+    //Another thread may still hold a block from before a load raised the
+    //high-water mark, so keep drawing until one is free here.
+    do {
+        entPtr->uid = uidAllocator->allocate();
+    } while (entPtr->uid != 0 && !entUIDMap.insert(entPtr->uid, entPtr));
+}
+
+bool Tree::setEntUID(Ent* entPtr, unsigned int uid) {
+    
+    if (uid == 0 || !entUIDMap.insert(uid, entPtr))
+        return uid == entPtr->uid && uid != 0;
+    
+    entUIDMap.erase(entPtr->uid);
+    entPtr->uid = uid;
+    uidAllocator->raiseTo((uint64_t) uid + 1);
+    
+    return true;
+}
+
+void Tree::removeEnt(Ent* entPtr) {
+    
+    if (entPtr == &root)
+        return;
+    
+    //Take copies, since disconnecting changes the lists.
+    vector<Ent*> parents = entPtr->getParents();
+    vector<Ent*> children = entPtr->getChildren();
+    
+    for (Ent* parent : parents)
+        Ent::disconnectUnchecked(parent, entPtr);
+    for (Ent* child : children) {
+        Ent::disconnectUnchecked(entPtr, child);
+        //A child that only had this parent moves up to the grandparents.
+        //They contained the removed Ent, so they contain its children too.
+        if (child->getParents().empty()) {
+            for (Ent* parent : parents)
+                Ent::connectUnchecked(parent, child);
+        }
+    }
+    for (Ent* exclusive : entPtr->getExclusives())
+        Ent::unsetExclusive(entPtr, exclusive);
+    for (Ent* overlap : entPtr->getOverlaps())
+        Ent::unsetOverlap(entPtr, overlap);
+    ChangeLog::record(CHANGE_REMOVE_ENT, entPtr);
+    
+    NameIndex* index = getNameIndex();
+    if (index != nullptr)
+        index->remove(entPtr);
+    entNameMap.erase(entPtr->getName());
+    entUIDMap.erase(entPtr->getUID());
+    //Readers may still be looking at it, and snapshots from before a Writer
+    //removed it still can.
+    if (EntList::writing != nullptr)
+        removedEnts.push_back(make_pair(EntList::writing->version, entPtr));
+    else
+        Epoch::retire(entPtr);
+}
+
+bool Tree::renameEnt(Ent* entPtr, const string& newName) {
+    
+    if (getEntPtrByName(newName) != nullptr)
+        return false;
+    
+    NameIndex* index = getNameIndex();
+    if (index != nullptr)
+        index->remove(entPtr);
+    entNameMap.erase(entPtr->getName());
+    entPtr->setName(newName);
+    entNameMap.insert(newName, entPtr);
+    if (index != nullptr)
+        index->add(entPtr);
+    ChangeLog::record(CHANGE_RENAME, entPtr);
+    
+    return true;
+}
+
+NewEntStatus Tree::tryToCreateNewEnt(const string name, unsigned int uid) {
+    
+    Editor edit(this);
+    //Build it first and claim the name in one step, so two threads asking
+    //for the same name can't both get it.
+    Ent* newEnt = new Ent();
+    newEnt->name = name;
+    newEnt->uid = uid;
+    newEnt->addedVersion = EntList::writing->version;
+    {
+        //Locked before anyone can find it, so no one can change it before
+        //it's been logged and given its parent. root is locked too, since
+        //its children really do change.
+        EntLocks locks({&root, newEnt});
+        locks.willChange(root.children);
+        locks.willChange(newEnt->parents);
+        if (entNameMap.insert(name, newEnt)) {
+            indexName(newEnt);
+            indexUID(newEnt);
+            ChangeLog::record(CHANGE_ADD_ENT, newEnt);
+            //Make it root's child for now, to prevent an orphan Ent.
+            Ent::connectUnchecked(&root, newEnt);
+            edit.release(locks);
+            return SUCCESS;
+        }
+    }
+    //name has been taken. No one else has seen this one.
+    delete newEnt;
+    return NAME_TAKEN;
+
+}
+
+unordered_set<Ent*> Tree::gatherRelatives(Ent* from, bool up,
+        vector<EntLocks::Read>* reads) {
+    
+    unordered_set<Ent*> found;
+    vector<Ent*> pending;
+    found.insert(from);
+    pending.push_back(from);
+    while (!pending.empty()) {
+        Ent* ent = pending.back();
+        pending.pop_back();
+        EntList& list = up ? ent->parents : ent->children;
+        reads->push_back(EntLocks::read(list));
+        for (Ent* next : list.view()) {
+            if (found.insert(next).second)
+                pending.push_back(next);
+        }
+    }
+    return found;
+}
+
+bool Tree::connectAndPrune(Ent* parent, Ent* child, unordered_set<Ent*>* conflicts) {
+    
+    Editor edit(this);
+    
+    for (;;) {
+        Reader reading;
+        //Only the lists actually looked at are checked afterwards, so edits
+        //elsewhere, like new Ents going under root, don't force a retry.
+        vector<EntLocks::Read> reads;
+        //Both include the Ent itself, so connecting an Ent to itself is
+        //caught too.
+        unordered_set<Ent*> above = gatherRelatives(parent, true, &reads);
+        unordered_set<Ent*> below = gatherRelatives(child, false, &reads);
+        
+        //The same check as Ent::getParentalConflicts().
+        unordered_set<Ent*> overlap;
+        for (Ent* ent : above.size() < below.size() ? above : below) {
+            if ((above.size() < below.size() ? below : above).count(ent))
+                overlap.insert(ent);
+        }
+        //child's parents already above parent are implied by the new
+        //connection. So are parent's children already below child.
+        vector<Ent*> toLock = {parent, child};
+        vector<Ent*> redundantParents;
+        vector<Ent*> redundantChildren;
+        bool connected = false;
+        if (overlap.empty()) {
+            reads.push_back(EntLocks::read(child->parents));
+            reads.push_back(EntLocks::read(parent->children));
+            for (Ent* existingParent : child->parents.view()) {
+                if (existingParent == parent) {
+                    //Already connected, which isn't a loop but leaves nothing to do.
+                    connected = true;
+                } else if (above.count(existingParent)) {
+                    redundantParents.push_back(existingParent);
+                    toLock.push_back(existingParent);
+                }
+            }
+            for (Ent* existingChild : parent->children.view()) {
+                if (below.count(existingChild)) {
+                    redundantChildren.push_back(existingChild);
+                    toLock.push_back(existingChild);
+                }
+            }
+        }
+        
+        EntLocks locks(toLock);
+        if (overlap.empty() && !connected) {
+            locks.willChange(parent->children);
+            locks.willChange(child->parents);
+            for (Ent* existingParent : redundantParents)
+                locks.willChange(existingParent->children);
+            for (Ent* existingChild : redundantChildren)
+                locks.willChange(existingChild->parents);
+        }
+        if (!locks.validate(reads))
+            continue;
+        
+        if (!overlap.empty()) {
+            if (conflicts != nullptr)
+                *conflicts = overlap;
+            return false;
+        }
+        if (connected)
+            return true;
+        //Connect before pruning, so readers walking down never find child
+        //missing from between the two.
+        Ent::connectUnchecked(parent, child);
+        for (Ent* existingParent : redundantParents)
+            Ent::disconnectUnchecked(existingParent, child);
+        for (Ent* existingChild : redundantChildren)
+            Ent::disconnectUnchecked(parent, existingChild);
+        edit.release(locks);
+        return true;
+    }
+}
+
+bool Tree::disconnect(Ent* parent, Ent* child) {
+    
+    Editor edit(this);
+    //root is only locked when child is about to lose its last parent and
+    //go back under it, which can only be known once child is locked.
+    bool lockRoot = false;
+    
+    for (;;) {
+        EntLocks locks(lockRoot ? vector<Ent*>{parent, child, &root}
+                : vector<Ent*>{parent, child});
+        
+        bool onlyParent = child->parents.size() == 1 && *child->parents.begin() == parent;
+        //root's children can't be left with no parent at all.
+        if (onlyParent && parent == &root)
+            return false;
+        if (onlyParent && !lockRoot) {
+            lockRoot = true;
+            continue;
+        }
+        
+        locks.willChange(parent->children);
+        locks.willChange(child->parents);
+        if (onlyParent) {
+            //Like a merge, an Ent that loses its only parent goes back under root.
+            locks.willChange(root.children);
+            Ent::disconnectUnchecked(parent, child);
+            Ent::connectUnchecked(&root, child);
+        } else {
+            Ent::disconnectUnchecked(parent, child);
+        }
+        edit.release(locks);
+        return true;
+    }
+}
+
+Ent* Tree::getEntPtrByName(const string& name) {
+    //Safe to call while another thread edits the Tree, within a Reader.
+    return entNameMap.get(name);
+}
+
+Ent* Tree::getEntPtrByUID(unsigned int uid) {
+    return entUIDMap.get(uid);
+}
+
+vector<string> Tree::sampleNames(size_t count) {
+    
+    vector<string> names;
+    Writer writing(this);
+    for (pair<const string, Ent*>& p : entNameMap) {
+        if (names.size() == count)
+            break;
+        names.push_back(p.first);
+    }
+    return names;
+}
+
+Tree::Writer::Writer(Tree* tr): tree(tr), lock(tr->writeLock), previous(EntList::writing) {
+    
+    //Keep new Editors out, and let those going finish.
+    tree->excluding.store(true);
+    while (tree->editors.load() != 0)
+        this_thread::yield();
+    
+    context.version = tree->allocated.fetch_add(1) + 1;
+    context.log = tree->changeLog.load(memory_order_acquire);
+    EntList::writing = &context;
+}
+
+Tree::Writer::~Writer() {
     
-    Ent* existingEntPtr;
+    EntList::writing = previous;
     
-    if ((existingEntPtr = getEntPtrByName(name)) == 0) {
-        //Name is free, create the new Ent as a dynamic variable.
-        Ent* newEnt = new Ent(name);
-        //Add it to the nameMap.
-        addEntToNameMap(newEnt);
-        return SUCCESS;
-    } else {
-        //name has been taken
-        return NAME_TAKEN;
+    //Snapshots taken from now on see everything this Writer did.
+    tree->version.store(context.version, memory_order_release);
+    
+    {
+        lock_guard<mutex> hold(tree->garbageLock);
+        for (EntList* list : context.ended)
+            tree->endedLists.push(EndedList{context.version, list, nullptr});
+    }
+    tree->collectGarbage(true);
+    
+    tree->excluding.store(false);
+    lock.unlock();
+    Epoch::reclaim();
+}
+
+Tree::Editor::Editor(Tree* tr): tree(tr), previous(EntList::writing),
+        nested(previous != nullptr) {
+    
+    if (nested)
+        return;
+    
+    //Checked after counting this one in, so a Writer starting at the same
+    //moment either sees it or is seen.
+    for (;;) {
+        tree->editors.fetch_add(1);
+        if (!tree->excluding.load())
+            break;
+        tree->editors.fetch_sub(1);
+        //Wait for the Writer to finish.
+        lock_guard<mutex> wait(tree->writeLock);
+    }
+    
+    context.version = tree->allocated.fetch_add(1) + 1;
+    context.log = tree->changeLog.load(memory_order_acquire);
+    EntList::writing = &context;
+}
+
+ChangeLog* Tree::startChangeLog(size_t capacity) {
+    
+    ChangeLog* log = changeLog.load(memory_order_acquire);
+    if (log != nullptr)
+        return log;
+    
+    //Editors only look for the log when they start, and none can start
+    //while this is held.
+    Writer writing(this);
+    log = changeLog.load();
+    if (log == nullptr) {
+        log = new ChangeLog(capacity);
+        changeLog.store(log, memory_order_release);
+    }
+    return log;
+}
+
+NameIndex* Tree::startNameIndex() {
+    
+    NameIndex* index = nameIndex.load(memory_order_acquire);
+    if (index != nullptr)
+        return index;
+    
+    //Nothing is added while it's built, so nothing is missed.
+    Writer writing(this);
+    index = nameIndex.load();
+    if (index == nullptr) {
+        index = new NameIndex(this);
+        nameIndex.store(index, memory_order_release);
+    }
+    return index;
+}
+
+EntSetCache* Tree::startSetCache() {
+    
+    EntSetCache* cache = setCache.load(memory_order_acquire);
+    if (cache != nullptr)
+        return cache;
+    
+    //Made outside a Writer, since it starts the log. If two threads get here
+    //at once, the second one's is thrown away.
+    EntSetCache* made = new EntSetCache(this);
+    if (setCache.compare_exchange_strong(cache, made))
+        return made;
+    delete made;
+    return cache;
+}
+
+void Tree::Editor::release(const EntLocks& locks) {
+    
+    if (nested)
+        return;
+    
+    for (EntList* list : context.ended)
+        ended.push_back(make_pair(list, locks.ownerOf(list)));
+    context.ended.clear();
+}
+
+Tree::Editor::~Editor() {
+    
+    if (nested)
+        return;
+    
+    EntList::writing = previous;
+    
+    //Wait for the Editors started before this one to commit first. None of
+    //them wait on this one, since its Ents are unlocked by now.
+    while (tree->version.load(memory_order_acquire) != context.version - 1)
+        this_thread::yield();
+    tree->version.store(context.version, memory_order_release);
+    
+    if (!ended.empty() || !context.ended.empty()) {
+        lock_guard<mutex> hold(tree->garbageLock);
+        for (pair<EntList*, Ent*>& list : ended)
+            tree->endedLists.push(EndedList{context.version, list.first, list.second});
+        for (EntList* list : context.ended)
+            tree->endedLists.push(EndedList{context.version, list, nullptr});
+    }
+    tree->collectGarbage(false);
+    
+    tree->editors.fetch_sub(1);
+    Epoch::reclaim();
+}
+
+void Tree::collectGarbage(bool exclusive) {
+    
+    unique_lock<mutex> hold(garbageLock, try_to_lock);
+    if (!hold.owns_lock())
+        return;
+    
+    if (endedLists.empty() && removedEnts.empty())
+        return;
+    
+    if (!snapshotLock.try_lock())
+        return;
+    uint64_t horizon = version.load();
+    if (!snapshots.empty() && *snapshots.begin() < horizon)
+        horizon = *snapshots.begin();
+    snapshotLock.unlock();
+    
+    //Lists first, since some may belong to the Ents deleted below.
+    vector<EndedList> skipped;
+    while (!endedLists.empty() && endedLists.top().version <= horizon) {
+        EndedList ended = endedLists.top();
+        endedLists.pop();
+        //An Editor may be changing the list. Only a Writer can be sure
+        //none is, unless the list's Ent can be locked.
+        if (!exclusive && (ended.owner == nullptr || !ended.owner->editLock.tryLock())) {
+            skipped.push_back(ended);
+            continue;
+        }
+        uint64_t remaining = ended.list->collect(horizon);
+        if (!exclusive)
+            ended.owner->editLock.unlock();
+        if (remaining != 0)
+            endedLists.push(EndedList{remaining, ended.list, ended.owner});
+    }
+    //Ents holding skipped lists must stay until those lists are done.
+    for (EndedList& ended : skipped) {
+        horizon = min(horizon, ended.version - 1);
+        endedLists.push(ended);
     }
-    //Why not...
-    return UNDEFINED_ERROR;
+    
+    while (!removedEnts.empty() && removedEnts.front().first <= horizon) {
+        Epoch::retire(removedEnts.front().second);
+        removedEnts.pop_front();
+    }
+}
+
+string Tree::checkNames() {
+    
+    //Every thread tries every name, in its own order, so most attempts
+    //race with others for the same name.
+    Tree tree("Name check");
+    const unsigned int threads = 8;
+    const unsigned int names = 10000;
+    vector<vector<string> > created(threads);
+    vector<string> failures(threads);
+    vector<thread> running;
+    for (unsigned int t = 0; t < threads; t++) {
+        running.push_back(thread([&, t]() {
+            mt19937 random(33 + t);
+            vector<unsigned int> order(names);
+            for (unsigned int i = 0; i < names; i++)
+                order[i] = i;
+            shuffle(order.begin(), order.end(), random);
+            for (unsigned int i : order) {
+                string name = "n" + to_string(i);
+                if (tree.tryToCreateNewEnt(name) == SUCCESS)
+                    created[t].push_back(name);
+                //Found whoever made it, and the same by UID, while the
+                //maps grow around it.
+                Reader reading;
+                Ent* ent = tree.getEntPtrByName(name);
+                if (ent == nullptr || ent->getName() != name
+                        || tree.getEntPtrByUID(ent->getUID()) != ent) {
+                    failures[t] = name + " couldn't be found once it was made";
+                    return;
+                }
+                Ent* other = tree.getEntPtrByName("n" + to_string(random() % names));
+                if (other != nullptr && tree.getEntPtrByUID(other->getUID()) != other) {
+                    failures[t] = other->getName() + " isn't found by its UID";
+                    return;
+                }
+            }
+        }));
+    }
+    for (thread& worker : running)
+        worker.join();
+    for (string& failure : failures) {
+        if (!failure.empty())
+            return failure;
+    }
+    
+    vector<string> all;
+    for (vector<string>& list : created)
+        all.insert(all.end(), list.begin(), list.end());
+    sort(all.begin(), all.end());
+    vector<string>::iterator twice = adjacent_find(all.begin(), all.end());
+    if (twice != all.end())
+        return *twice + " was made twice";
+    if (all.size() != names)
+        return to_string(all.size()) + " names were made, not " + to_string(names);
+    if (tree.getNameMap()->size() != names + 1)
+        return "the name map holds " + to_string(tree.getNameMap()->size())
+                + " Ents, not " + to_string(names + 1);
+    if (tree.getRoot()->getChildren().size() != names)
+        return "root has " + to_string(tree.getRoot()->getChildren().size())
+                + " children, not " + to_string(names);
+    return "";
+}
 
+EditBenchmark Tree::benchmarkEdits(unsigned int maxThreads, double seconds) {
+    
+    if (maxThreads == 0)
+        maxThreads = max(1u, thread::hardware_concurrency());
+    
+    EditBenchmark result;
+    for (unsigned int threads = 1; ; threads = min(threads * 2, maxThreads)) {
+        
+        //Each thread gets its own little family under root: a top with two
+        //children, and a grandchild under one of them. The grandchild is
+        //connected to and disconnected from the other child, so it never
+        //loses its last parent and nothing it does touches root.
+        Tree tree("Edit Benchmark");
+        vector<Ent*> others;
+        vector<Ent*> grandchildren;
+        for (unsigned int i = 0; i < threads; i++) {
+            string n = to_string(i);
+            tree.tryToCreateNewEnt("top " + n);
+            tree.tryToCreateNewEnt("one " + n);
+            tree.tryToCreateNewEnt("other " + n);
+            tree.tryToCreateNewEnt("grandchild " + n);
+            tree.connectAndPrune(tree.getEntPtrByName("top " + n), tree.getEntPtrByName("one " + n));
+            tree.connectAndPrune(tree.getEntPtrByName("top " + n), tree.getEntPtrByName("other " + n));
+            tree.connectAndPrune(tree.getEntPtrByName("one " + n), tree.getEntPtrByName("grandchild " + n));
+            others.push_back(tree.getEntPtrByName("other " + n));
+            grandchildren.push_back(tree.getEntPtrByName("grandchild " + n));
+        }
+        
+        atomic<bool> stop(false);
+        vector<unsigned long> counts(threads, 0);
+        vector<thread> workers;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < threads; i++) {
+            workers.push_back(thread([&, i]() {
+                unsigned long count = 0;
+                while (!stop.load(memory_order_relaxed)) {
+                    tree.connectAndPrune(others[i], grandchildren[i]);
+                    tree.disconnect(others[i], grandchildren[i]);
+                    count += 2;
+                }
+                counts[i] = count;
+            }));
+        }
+        this_thread::sleep_for(chrono::duration<double>(seconds));
+        stop.store(true);
+        for (thread& worker : workers)
+            worker.join();
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        unsigned long total = 0;
+        for (unsigned long count : counts)
+            total += count;
+        result.rates.push_back(make_pair(threads, total / elapsed));
+        
+        if (threads == maxThreads)
+            break;
+    }
+    return result;
 }
 
-Ent* Tree::getEntPtrByName(const string name) {
-    //Get an iterator wrapping the pair which holds the desired Ent, or the end
-    //of the map if not found. Since each pair is unique, it should hold at most one pair.
-    EntNameMap::iterator it = entNameMap.find(name);
+string Tree::checkEditors() {
+    
+    //The same Tree twice: a part for each thread, each under its own Ent
+    //under root, with Ents only taking parents from earlier in their part.
+    const unsigned int parts = 8;
+    const unsigned int size = 400;
+    auto build = [](Tree* tree) {
+        mt19937 random(34);
+        for (unsigned int p = 0; p < parts; p++) {
+            vector<Ent*> part;
+            for (unsigned int i = 0; i < size; i++) {
+                Ent* ent = new Ent();
+                ent->setName("p" + to_string(p) + "_" + to_string(i));
+                tree->addEntToNameMapUnattached(ent);
+                if (part.empty()) {
+                    Ent::connectUnchecked(tree->getRoot(), ent);
+                } else {
+                    for (unsigned int n = random() % 2; n < 2; n++) {
+                        Ent* parent = part[random() % part.size()];
+                        if (!ent->isChildOf(parent))
+                            Ent::connectUnchecked(parent, ent);
+                    }
+                }
+                part.push_back(ent);
+            }
+        }
+    };
+    Tree together("Editors check");
+    Tree alone("Editors check, one at a time");
+    build(&together);
+    build(&alone);
+    
+    //A part's edits only depend on that part, and on root, whose children
+    //are only ever added to or taken from, so they come out the same
+    //whatever the other parts are doing. Some connections would make loops,
+    //and are turned down either way.
+    auto edit = [](Tree* tree, unsigned int p) {
+        mt19937 random(340 + p);
+        string prefix = "p" + to_string(p) + "_";
+        for (int i = 0; i < 500; i++) {
+            unsigned int a = random() % size;
+            unsigned int b = random() % size;
+            Ent* first = tree->getEntPtrByName(prefix + to_string(min(a, b)));
+            Ent* second = tree->getEntPtrByName(prefix + to_string(max(a, b)));
+            if (random() % 3 != 0) {
+                if (random() % 10 == 0)
+                    tree->connectAndPrune(second, first);
+                else
+                    tree->connectAndPrune(first, second);
+                continue;
+            }
+            vector<Ent*> parents = second->getParents();
+            sort(parents.begin(), parents.end(), [](Ent* x, Ent* y) {
+                return x->getName() < y->getName();
+            });
+            tree->disconnect(parents[random() % parents.size()], second);
+        }
+    };
+    vector<thread> running;
+    for (unsigned int p = 0; p < parts; p++)
+        running.push_back(thread(edit, &together, p));
+    for (thread& worker : running)
+        worker.join();
+    for (unsigned int p = 0; p < parts; p++)
+        edit(&alone, p);
     
-    if (it != entNameMap.end()) {
-        //Iterator wasn't the "end" of the map iterator, so, we found something.
-        return it->second;
-    } else {
-        //Nothing found, return null pointer.
-        return nullptr;
+    auto names = [](const vector<Ent*>& list) {
+        set<string> found;
+        for (Ent* ent : list)
+            found.insert(ent->getName());
+        return found;
+    };
+    for (pair<const string, Ent*>& p : *alone.getNameMap()) {
+        Ent* ent = together.getEntPtrByName(p.first);
+        if (names(ent->getParents()) != names(p.second->getParents())
+                || names(ent->getChildren()) != names(p.second->getChildren()))
+            return p.first + " has different relations when edited at the same time";
+        for (Ent* parent : ent->getParents()) {
+            if (!ent->isChildOf(parent) || !names(parent->getChildren()).count(p.first))
+                return p.first + "'s parent " + parent->getName() + " doesn't have it as a child";
+        }
     }
+    return "";
 }
@@ -21,17 +21,34 @@
 
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <iterator>
 #include <string>
+#include <mutex>
+#include <set>
+#include <queue>
+#include <deque>
+#include <atomic>
 #include "Ent.h"
 #include "Root.h"
+#include "UIDAllocator.h"
+#include "EntIndex.h"
+#include "Epoch.h"
+#include "TreeSnapshot.h"
+#include "ChangeLog.h"
+#include "NameIndex.h"
 
 using namespace std;
 /**
- * EntNameMap is an unordered_map which retrieves pointers to Ent instances
- * given the input of their names. Alias is made to make it pretty.
+ * EntNameMap retrieves pointers to Ent instances given the input of their
+ * names. It can be read from other threads while it changes. Alias is made
+ * to make it pretty.
  */
-typedef std::unordered_map<string, Ent*> EntNameMap;
+typedef EntIndex<string> EntNameMap;
+/**
+ * EntUIDMap finds Ents by their UID, the same way EntNameMap does by name.
+ */
+typedef EntIndex<unsigned int> EntUIDMap;
 
 /** Used to represent the success of adding a new Ent
  * to the Tree by name.*/
@@ -41,6 +58,14 @@ typedef enum {
     NAME_TAKEN
 } NewEntStatus;
 
+/**
+ * Results from Tree::benchmarkEdits(): how many connects and disconnects a
+ * second were made by each number of threads, all editing at once.
+ */
+struct EditBenchmark {
+    vector<pair<unsigned int, double> > rates;
+};
+
 /**
  * Class holding a hierarchy of Ent objects. Uses an unorganized hashmap to organize
  * all the Ents via their names for easy lookup. Each Ent holds vector lists pointing
@@ -48,7 +73,28 @@ typedef enum {
  * Each Tree contains on Root Ent, pointed to by root_.
  * Logical organization is not yet implemented, for instance the preventing of
  * illegal operations which would create an invalid state.
+ *
+ * Any number of threads can read a Tree while one thread edits it. Readers
+ * hold a Tree::Reader while they look up Ents and walk their relations, and
+ * the editing thread holds a Tree::Writer, which keeps other writers out.
+ * Readers never take a lock. Small edits, like connecting a parent and child
+ * with connectAndPrune(), can also be made by many threads at once. Each only
+ * locks the Ents it changes (see Tree::Editor). What the writer removes is only deleted once no
+ * reader can still see it (see Epoch). Renaming an Ent, or changing its UID,
+ * isn't covered yet and still needs readers to be stopped.
+ * A Tree only used by one thread needs neither.
+ *
+ * Each Writer commits a new version of the Tree. A TreeSnapshot, from
+ * snapshot(), keeps seeing the version that was committed when it was taken,
+ * however long it's held, while newer versions keep being written. Relations
+ * and Ents removed since are kept around until the oldest snapshot that can
+ * see them is gone. Only edits made within a Writer are versioned.
+ *
+ * Versioned edits can also be logged, once startChangeLog() is called, so
+ * another process can keep a copy of the Tree by playing them back.
  */
+class EntSetCache;
+
 class Tree {
     
     /**
@@ -61,14 +107,199 @@ class Tree {
      * keys being the Ent names and the values being pointers to the Ents.
      */
     EntNameMap entNameMap;
+    /**
+     * The same Ents, keyed by UID. Every Ent in the Tree has a UID, which is
+     * given to it when it's added if it didn't already have one.
+     */
+    EntUIDMap entUIDMap;
+    /**
+     * Where new UIDs come from. Shared by all Trees unless given otherwise.
+     */
+    UIDAllocator* uidAllocator;
+    /**
+     * Where its Ents' UIDs come from. Two Trees' UIDs name the same Ents only
+     * when their origins are the same. 0 if it isn't known.
+     */
+    uint64_t origin;
+    /**
+     * Held by the Writer, so there's only one at a time.
+     */
+    mutex writeLock;
+    /**
+     * Set while a Writer is waiting for Editors to finish or is writing, so
+     * no new ones start.
+     */
+    atomic<bool> excluding;
+    /**
+     * How many Editors are going.
+     */
+    atomic<unsigned int> editors;
+    /**
+     * The latest version a Writer or Editor has committed.
+     */
+    atomic<uint64_t> version;
+    /**
+     * The latest version handed out to a Writer or Editor. Ahead of version
+     * while Editors are still at work.
+     */
+    atomic<uint64_t> allocated;
+    /**
+     * Where changes are logged, once startChangeLog() has been called.
+     */
+    atomic<ChangeLog*> changeLog;
+    /**
+     * Finds Ents by partial or misspelled names, once startNameIndex() has
+     * been called.
+     */
+    atomic<NameIndex*> nameIndex;
+    /**
+     * Keeps the descendents of popular Ents, once startSetCache() has been
+     * called.
+     */
+    atomic<EntSetCache*> setCache;
+    /**
+     * The versions live snapshots are looking at, oldest first.
+     */
+    multiset<uint64_t> snapshots;
+    mutex snapshotLock;
+    /**
+     * A list with removed entries, the version it can be collected at, and
+     * the Ent it belongs to, if known. Lists of unknown Ents can only be
+     * collected while a Writer keeps Editors out.
+     */
+    struct EndedList {
+        uint64_t version;
+        EntList* list;
+        Ent* owner;
+
+        bool operator>(const EndedList& other) const {
+            return version > other.version;
+        }
+    };
+    /**
+     * Lists some snapshot might still see the removed entries of, soonest
+     * collected first.
+     */
+    priority_queue<EndedList, vector<EndedList>, greater<EndedList> > endedLists;
+    /**
+     * Guards endedLists and removedEnts.
+     */
+    mutex garbageLock;
+    /**
+     * Ents removed by a Writer, in the order of the version they were removed
+     * at. They're deleted once no snapshot can see them.
+     */
+    deque<pair<uint64_t, Ent*> > removedEnts;
     /**
      * Pointer to the root of the hierarchy. No need to make a setter method
      * because the root never needs to change.
      */
     Root root;
     
+    /**
+     * Adds an Ent to entUIDMap. Ents without a UID, or with one another Ent
+     * in this Tree already has, are given a new one.
+     */
+    void indexUID(Ent* entPtr);
+    
+    /**
+     * Adds an Ent to the NameIndex, if there is one.
+     */
+    void indexName(Ent* entPtr);
+    
+    /**
+     * Cleans up after Writers and Editors: drops removed relations and
+     * deletes removed Ents that no snapshot can see any more. Skipped if
+     * another thread is already at it, or a snapshot is being taken, so no
+     * one waits for it.
+     * @param exclusive     Whether a Writer is keeping Editors out. If not,
+     *                      lists are only collected while their Ent can be
+     *                      locked.
+     */
+    void collectGarbage(bool exclusive);
+    
+    /**
+     * Gathers an Ent and all its ancestors, or all its descendents, noting
+     * the stamp of each parent or child list before it's read.
+     */
+    static unordered_set<Ent*> gatherRelatives(Ent* from, bool up,
+            vector<EntLocks::Read>* reads);
+    
+    friend class TreeSnapshot;
+    
 public:
 
+    /**
+     * Hold one while reading a Tree other threads may be editing. The Ents
+     * found, and their lists seen through EntList::view(), stay valid until
+     * it's let go.
+     */
+    typedef EpochGuard Reader;
+
+    /**
+     * Hold one while editing a Tree other threads may be reading. Only one
+     * can be held on a Tree at a time, and it waits for Editors to finish. Everything done while it's held is
+     * committed as one new version when it's let go, and memory freed up by
+     * the edits is reclaimed.
+     */
+    class Writer {
+
+        Tree* tree;
+        unique_lock<mutex> lock;
+        EntList::WriteContext context;
+        EntList::WriteContext* previous;
+
+    public:
+
+        Writer(Tree* tree);
+
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+    };
+
+    /**
+     * Like a Writer, but any number can be held at once, by threads making
+     * small edits. Each edit locks the Ents it changes with EntLocks, so
+     * edits to unrelated Ents don't wait on each other. Each Editor commits
+     * its own version, in the order they were started, so a snapshot never
+     * sees one edit without the ones before it.
+     *
+     * A Writer waits for Editors to finish and keeps new ones out. Within a
+     * Writer, or another Editor, it does nothing and the edits go into that
+     * one's version instead.
+     */
+    class Editor {
+
+        Tree* tree;
+        EntList::WriteContext context;
+        EntList::WriteContext* previous;
+        /**
+         * Lists the edits removed entries from, and the Ents they belong to.
+         */
+        vector<pair<EntList*, Ent*> > ended;
+        bool nested;
+
+    public:
+
+        Editor(Tree* tree);
+
+        ~Editor();
+
+        /**
+         * Notes which of the locked Ents the lists edited so far belong to,
+         * so they can be cleaned up later without a Writer. Call before the
+         * locks are let go.
+         */
+        void release(const EntLocks& locks);
+
+        Editor(const Editor&) = delete;
+        Editor& operator=(const Editor&) = delete;
+
+    };
+
     /**
     * Adds an Ent to entNameMap_ and sets its only parent as parentPtr.
     * If we add an Ent to the Tree, it will always need a parent,
@@ -78,19 +309,86 @@ public:
     * @param parentPtr Pointer to the parent of the Ent being added.
     */
     void addEntToNameMap(Ent* entPtr, Ent* parentPtr = nullptr);
+    /**
+     * Adds an Ent to entNameMap_ without giving it a parent. Only for loaders
+     * which connect it themselves before they are done, since every Ent but
+     * root needs a parent.
+     * @param entPtr    Pointer to the Ent being added.
+     * @return          false if the name is taken, in which case the Tree
+     *                  doesn't hold on to it and it's the caller's to delete.
+     */
+    bool addEntToNameMapUnattached(Ent* entPtr);
     /**
      * If the name is not already taken, create a new one and add it to the map.
-     * Set the new Ent as root's child for now.
+     * Set the new Ent as root's child for now. Taking the name is a single
+     * insert-if-absent, so of several threads creating the same name at once
+     * exactly one gets it. Safe while other threads edit, like
+     * connectAndPrune().
      * @param name  Desired name.
+     * @param uid   The UID to give it, such as one it has elsewhere, or 0 for
+     *              a new one. It gets a new one anyway if the UID is taken.
      * @return      Returns and enum value: UNDEFINED_ERROR, SUCCESS, NAME_TAKEN
      */
-    NewEntStatus tryToCreateNewEnt(const string name);
+    NewEntStatus tryToCreateNewEnt(const string name, unsigned int uid = 0);
+    /**
+     * Connects parent and child, then prunes connections made redundant by
+     * it, like Ent::connectUncheckedAndPrune(), but safe while other threads
+     * do the same. Only the two Ents and those losing a redundant connection
+     * are locked. Everything above parent and below child is read without
+     * locks, then checked again once the locks are held, and the whole thing
+     * is retried if any of the lists it read changed in between.
+     * @param parent    The new parent.
+     * @param child     The new child.
+     * @param conflicts If given, filled with the Ents which are both above
+     *                  parent and below child, when there are any.
+     * @return          false if connecting them would make a loop. Nothing
+     *                  changes then.
+     */
+    bool connectAndPrune(Ent* parent, Ent* child,
+            unordered_set<Ent*>* conflicts = nullptr);
+    /**
+     * Disconnects a parent and child like Ent::disconnectUnchecked(), but
+     * only locks the two of them, so it's safe while other threads edit. A
+     * child left with no parents is put under root, and only then is root
+     * locked too.
+     * @return          false if parent is root and child's only parent, so
+     *                  nothing changed.
+     */
+    bool disconnect(Ent* parent, Ent* child);
+    /**
+     * Takes an Ent out of the Tree and deletes it, along with all of its
+     * relations. Its children stay under its parents, so nothing is orphaned.
+     * root can't be removed.
+     * @param entPtr    Pointer to the Ent being removed.
+     */
+    void removeEnt(Ent* entPtr);
+    /**
+     * Renames an Ent and keeps the nameMap up to date.
+     * @param entPtr    Pointer to the Ent being renamed.
+     * @param newName   Its new name.
+     * @return          false if the name is taken, in which case nothing changes.
+     */
+    bool renameEnt(Ent* entPtr, const string& newName);
     /**
      * Retrieves a pointer to an Ent of the given name, if one exists.
      * @param name  Name being searched for.
      * @return      Returns pointer to Ent if found, 0 if not.
      */
-    Ent* getEntPtrByName(const string name);
+    Ent* getEntPtrByName(const string& name);
+    /**
+     * Retrieves a pointer to the Ent with the given UID, if one exists.
+     * @param uid   UID being searched for.
+     * @return      Returns pointer to Ent if found, nullptr if not.
+     */
+    Ent* getEntPtrByUID(unsigned int uid);
+    /**
+     * Changes the UID of an Ent in this Tree and keeps entUIDMap up to date.
+     * @param entPtr    Pointer to the Ent.
+     * @param uid       Its new UID, which must not be 0.
+     * @return          false if another Ent has that UID, in which case
+     *                  nothing changes.
+     */
+    bool setEntUID(Ent* entPtr, unsigned int uid);
     
     void setName(string newName) {
         name = newName;
@@ -102,15 +400,132 @@ public:
      * constructor to use, so we can't make arrays of Trees. May need to change
      * later.
      */
-    Tree(string name);
+    Tree(string name, UIDAllocator* allocator = &UIDAllocator::shared);
+
+    /**
+     * Makes room in the nameMap for n Ents in total, so a large batch of new
+     * Ents doesn't rehash it over and over.
+     */
+    void reserve(size_t n) {
+        entNameMap.reserve(n);
+        entUIDMap.reserve(n);
+    }
 
     EntNameMap* getNameMap() {
         return &entNameMap;
     }
     
+    /**
+     * The names of up to count of the Tree's Ents, in no particular order.
+     * Takes a Writer, since the name map can't be walked safely while
+     * Editors add to it, so don't call it within a Reader.
+     */
+    vector<string> sampleNames(size_t count);
+    
+    UIDAllocator* getUIDAllocator() {
+        return uidAllocator;
+    }
+    
+    /**
+     * Where its Ents' UIDs come from. A new Tree's origin is its allocator's.
+     * A loaded or copied one takes the origin of what it was loaded or copied
+     * from, since its Ents keep their UIDs.
+     */
+    uint64_t getOrigin() {
+        return origin;
+    }
+    
+    /**
+     * Only for loaders and copies, before the Tree is shared.
+     */
+    void setOrigin(uint64_t o) {
+        origin = o;
+    }
+    
+    /**
+     * Whether UIDs mean the same Ents in this Tree and another. Otherwise
+     * Ents can only be matched by name.
+     */
+    bool sharesUIDsWith(Tree* other) {
+        return origin != 0 && origin == other->origin;
+    }
+    
+    /**
+     * Takes a snapshot of the latest committed version, which doesn't change
+     * as Writers carry on.
+     */
+    TreeSnapshot snapshot() {
+        return TreeSnapshot(this);
+    }
+    
+    uint64_t getVersion() {
+        return version.load(memory_order_acquire);
+    }
+    
+    /**
+     * Starts logging every change made within a Writer or Editor, if that
+     * isn't already happening, so they can be shipped elsewhere (see
+     * ChangeLog). Waits for Editors going now to finish first, like a Writer,
+     * so snapshots taken after it returns never miss an unlogged change.
+     * @param capacity  How many changes to keep, if a log is made.
+     * @return          The Tree's log, which lasts as long as the Tree.
+     */
+    ChangeLog* startChangeLog(size_t capacity = ChangeLog::DEFAULT_CAPACITY);
+    
+    /**
+     * The Tree's log, or nullptr if it isn't logging.
+     */
+    ChangeLog* getChangeLog() {
+        return changeLog.load(memory_order_acquire);
+    }
+    
+    /**
+     * Builds a NameIndex of the Tree's Ents, if there isn't one yet, and
+     * keeps it up to date with every Ent added, removed or renamed from then
+     * on. Waits for Editors going now to finish first, like a Writer, so none
+     * of their new Ents are missed.
+     * @return          The Tree's index, which lasts as long as the Tree.
+     */
+    NameIndex* startNameIndex();
+    
+    /**
+     * The Tree's NameIndex, or nullptr if it hasn't been started.
+     */
+    NameIndex* getNameIndex() {
+        return nameIndex.load(memory_order_acquire);
+    }
+    
+    /**
+     * Makes an EntSetCache for the Tree, if there isn't one yet. Starts the
+     * log too, so don't call it within a Reader.
+     * @return          The Tree's cache, which lasts as long as the Tree.
+     */
+    EntSetCache* startSetCache();
+    
+    /**
+     * The Tree's EntSetCache, or nullptr if it hasn't been started.
+     */
+    EntSetCache* getSetCache() {
+        return setCache.load(memory_order_acquire);
+    }
+    
     const string getName() {
         return name;
     }
+    /**
+     * Has threads create the same names at once, looking each up as they
+     * go, and makes sure each name went to exactly one Ent, found the same
+     * way by name and by UID.
+     * @return      "" if so, otherwise what went wrong.
+     */
+    static string checkNames();
+    /**
+     * Has threads connect and disconnect Ents in separate parts of a Tree
+     * at once, and compares the result with making the same edits one at a
+     * time on a copy.
+     * @return      "" if they agree, otherwise what went wrong.
+     */
+    static string checkEditors();
     /**
      * What do do when the Tree is removed from memory. Maybe save to file?
      * For now we delete entNameMap and all the Ents it points to.
@@ -121,6 +536,14 @@ public:
         return &root;
     }
     
+    /**
+     * Times Editors on 1, 2, 4... up to the given number of threads, each
+     * connecting and disconnecting Ents in its own part of a new Tree, to
+     * show how well edits to unrelated Ents run side by side.
+     * @param maxThreads    The most threads to try. All cores if 0.
+     * @param seconds       How long to time each number of threads for.
+     */
+    static EditBenchmark benchmarkEdits(unsigned int maxThreads, double seconds);
     
 
 }; //end class Tree
@@ -0,0 +1,291 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TreeSnapshot.h"
+#include "Tree.h"
+#include <random>
+#include <algorithm>
+
+using namespace std;
+
+TreeSnapshot::TreeSnapshot(Tree* tr): tree(tr) {
+    //Registered under the lock, so a Writer can't clean up what this version
+    //needs between reading the version and registering it.
+    lock_guard<mutex> lock(tree->snapshotLock);
+    version = tree->version.load(memory_order_acquire);
+    tree->snapshots.insert(version);
+}
+
+TreeSnapshot::TreeSnapshot(TreeSnapshot&& other): tree(other.tree), version(other.version) {
+    other.tree = nullptr;
+}
+
+TreeSnapshot::~TreeSnapshot() {
+    if (tree == nullptr)
+        return;
+    lock_guard<mutex> lock(tree->snapshotLock);
+    tree->snapshots.erase(tree->snapshots.find(version));
+}
+
+Ent* TreeSnapshot::getEntPtrByName(const string& name) {
+    EpochGuard guard;
+    Ent* ent = tree->getEntPtrByName(name);
+    return ent != nullptr && ent->getAddedVersion() <= version ? ent : nullptr;
+}
+
+Ent* TreeSnapshot::getEntPtrByUID(unsigned int uid) {
+    EpochGuard guard;
+    Ent* ent = tree->getEntPtrByUID(uid);
+    return ent != nullptr && ent->getAddedVersion() <= version ? ent : nullptr;
+}
+
+vector<Ent*> TreeSnapshot::getParents(Ent* ent) {
+    EpochGuard guard;
+    return ent->getList(RELATION_PARENT).toVector(version);
+}
+
+vector<Ent*> TreeSnapshot::getChildren(Ent* ent) {
+    EpochGuard guard;
+    return ent->getList(RELATION_CHILD).toVector(version);
+}
+
+vector<Ent*> TreeSnapshot::getExclusives(Ent* ent) {
+    EpochGuard guard;
+    return ent->getList(RELATION_EXCLUSIVE).toVector(version);
+}
+
+vector<Ent*> TreeSnapshot::getOverlaps(Ent* ent) {
+    EpochGuard guard;
+    return ent->getList(RELATION_OVERLAP).toVector(version);
+}
+
+unordered_set<Ent*> TreeSnapshot::getAncestors(Ent* ent) {
+    
+    unordered_set<Ent*> found;
+    vector<Ent*> next(1, ent);
+    
+    while (!next.empty()) {
+        Ent* at = next.back();
+        next.pop_back();
+        //Only guard one Ent at a time, so a long walk doesn't hold up the
+        //freeing of memory. The Ents themselves are kept for the snapshot.
+        EpochGuard guard;
+        for (Ent* parent : at->getList(RELATION_PARENT).view(version)) {
+            if (found.insert(parent).second)
+                next.push_back(parent);
+        }
+    }
+    
+    return found;
+}
+
+unordered_set<Ent*> TreeSnapshot::getDescendents(Ent* ent) {
+    
+    unordered_set<Ent*> found;
+    vector<Ent*> next(1, ent);
+    
+    while (!next.empty()) {
+        Ent* at = next.back();
+        next.pop_back();
+        EpochGuard guard;
+        for (Ent* child : at->getList(RELATION_CHILD).view(version)) {
+            if (found.insert(child).second)
+                next.push_back(child);
+        }
+    }
+    
+    return found;
+}
+
+EntSet TreeSnapshot::getAncestorSet(Ent* ent, const function<bool()>& stop) {
+    return walk(ent, true, stop);
+}
+
+EntSet TreeSnapshot::getDescendentSet(Ent* ent, const function<bool()>& stop) {
+    return walk(ent, false, stop);
+}
+
+EntSet TreeSnapshot::walk(Ent* ent, bool up, const function<bool()>& stop) {
+    
+    //Marked as they're found, then read off in order into the set, so it's
+    //only ever added to at the end. Only the parts of the UID range the
+    //walk reaches take any room.
+    EntMarks found;
+    vector<Ent*> next(1, ent);
+    size_t steps = 0;
+    
+    while (!next.empty()) {
+        if (stop && ++steps % 1024 == 0 && stop())
+            break;
+        Ent* at = next.back();
+        next.pop_back();
+        EpochGuard guard;
+        for (Ent* relative : at->getList(up ? RELATION_PARENT : RELATION_CHILD).view(version)) {
+            if (found.mark(relative->getUID()))
+                next.push_back(relative);
+        }
+    }
+    
+    return found.toSet();
+}
+
+vector<Ent*> TreeSnapshot::getEnts(const EntSet& set) {
+    
+    vector<Ent*> ents;
+    ents.reserve(set.size());
+    //UID lookups don't wait for anything, so a long list can go under one
+    //guard. Going in order of UID also keeps them near each other.
+    EpochGuard guard;
+    uint64_t v = version;
+    Tree* t = tree;
+    set.forEach([&ents, v, t](unsigned int uid) {
+        Ent* ent = t->getEntPtrByUID(uid);
+        if (ent != nullptr && ent->getAddedVersion() <= v)
+            ents.push_back(ent);
+    });
+    return ents;
+}
+
+string TreeSnapshot::check() {
+    
+    //Parents always come before their children in ents, so edits can't
+    //make loops.
+    mt19937 random(32);
+    Tree tree("Snapshot check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 2000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        tree.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 20 == 0) {
+            Ent::connectUnchecked(tree.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    
+    //Each Ent's lists, sorted, as they were when a snapshot was taken.
+    typedef unordered_map<Ent*, vector<vector<Ent*> > > Lists;
+    auto record = [&tree]() {
+        Lists lists;
+        for (pair<const string, Ent*>& p : *tree.getNameMap()) {
+            Ent* ent = p.second;
+            vector<vector<Ent*> >& entLists = lists[ent];
+            entLists.push_back(ent->getParents());
+            entLists.push_back(ent->getChildren());
+            entLists.push_back(ent->getExclusives());
+            entLists.push_back(ent->getOverlaps());
+            for (vector<Ent*>& list : entLists)
+                sort(list.begin(), list.end());
+        }
+        return lists;
+    };
+    
+    vector<TreeSnapshot> snapshots;
+    vector<Lists> recorded;
+    vector<string> added;
+    for (int round = 0; round < 10; round++) {
+        snapshots.push_back(tree.snapshot());
+        recorded.push_back(record());
+        
+        Tree::Writer writing(&tree);
+        for (int i = 0; i < 100; i++) {
+            size_t c = 1 + random() % (ents.size() - 1);
+            Ent* child = ents[c];
+            Ent* other = ents[random() % c];
+            vector<Ent*> parents = child->getParents();
+            switch (random() % 6) {
+                case 0:
+                    if (!child->isChildOf(other))
+                        Ent::connectUnchecked(other, child);
+                    break;
+                case 1:
+                    if (parents.size() > 1)
+                        Ent::disconnectUnchecked(parents[random() % parents.size()], child);
+                    break;
+                case 2:
+                    if (!child->isChildOf(other) && !other->isChildOf(child))
+                        random() % 2 ? Ent::setExclusive(child, other) : Ent::setOverlap(child, other);
+                    break;
+                case 3:
+                    Ent::unsetExclusive(child, other);
+                    Ent::unsetOverlap(child, other);
+                    break;
+                case 4:
+                    added.push_back("added" + to_string(added.size()));
+                    tree.tryToCreateNewEnt(added.back());
+                    break;
+                default:
+                    tree.removeEnt(child);
+                    ents.erase(ents.begin() + c);
+            }
+        }
+    }
+    
+    for (size_t s = 0; s < snapshots.size(); s++) {
+        TreeSnapshot& snapshot = snapshots[s];
+        string which = "snapshot " + to_string(s);
+        for (pair<Ent* const, vector<vector<Ent*> > >& p : recorded[s]) {
+            Ent* ent = p.first;
+            vector<vector<Ent*> > lists = {snapshot.getParents(ent), snapshot.getChildren(ent),
+                    snapshot.getExclusives(ent), snapshot.getOverlaps(ent)};
+            for (vector<Ent*>& list : lists)
+                sort(list.begin(), list.end());
+            if (lists != p.second)
+                return which + " sees " + ent->getName() + "'s relations as they are now";
+        }
+        
+        //Relatives, as found by going through the lists recorded.
+        Ent* ent = s == 0 ? tree.getRoot() : ents[random() % ents.size()];
+        unordered_set<Ent*> expected;
+        vector<Ent*> queue(1, ent);
+        for (size_t at = 0; at < queue.size(); at++) {
+            for (Ent* child : recorded[s][queue[at]][1]) {
+                if (expected.insert(child).second)
+                    queue.push_back(child);
+            }
+        }
+        if (snapshot.getDescendents(ent) != expected)
+            return which + " finds the wrong descendents of " + ent->getName();
+        //getEnts() only finds those the Tree still has.
+        EntSet set = snapshot.getDescendentSet(ent);
+        vector<Ent*> fromSet = snapshot.getEnts(set);
+        unordered_set<Ent*> stillThere;
+        for (Ent* descendent : expected) {
+            if (tree.getEntPtrByUID(descendent->getUID()) == descendent)
+                stillThere.insert(descendent);
+        }
+        if (set.size() != expected.size()
+                || unordered_set<Ent*>(fromSet.begin(), fromSet.end()) != stillThere)
+            return which + " finds the wrong descendent set of " + ent->getName();
+        
+        //Ents added since can't be found by name in it.
+        for (const string& name : added) {
+            Ent* found = snapshot.getEntPtrByName(name);
+            if (found != nullptr && recorded[s].count(found) == 0)
+                return which + " finds " + name + ", added after it was taken";
+        }
+    }
+    
+    return "";
+}
@@ -0,0 +1,132 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TREESNAPSHOT_H
+#define TREESNAPSHOT_H
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <functional>
+#include <cstdint>
+#include "EntSet.h"
+
+using namespace std;
+
+class Tree;
+class Ent;
+
+/**
+ * A look at a Tree as it was at one committed version. Writers carry on while
+ * it's held, but nothing they do shows up in it, so a long walk over a big
+ * subtree sees one consistent hierarchy from start to end.
+ *
+ * Relations and Ents removed after the snapshot was taken are kept until it's
+ * gone, so it's best not to hold on to one longer than needed. Holding it
+ * never holds up a Writer.
+ *
+ * Name and UID lookups only find Ents the Tree still has. An Ent removed since
+ * the snapshot was taken can still be reached through its relations.
+ */
+class TreeSnapshot {
+
+    Tree* tree;
+    uint64_t version;
+
+public:
+
+    /**
+     * Takes a snapshot of the latest version of the Tree. Usually made
+     * through Tree::snapshot().
+     */
+    TreeSnapshot(Tree* tr);
+
+    TreeSnapshot(TreeSnapshot&& other);
+
+    ~TreeSnapshot();
+
+    TreeSnapshot(const TreeSnapshot&) = delete;
+    TreeSnapshot& operator=(const TreeSnapshot&) = delete;
+
+    uint64_t getVersion() {
+        return version;
+    }
+
+    Tree* getTree() {
+        return tree;
+    }
+
+    /**
+     * Finds an Ent by name, if it was in the Tree at this version and still is.
+     */
+    Ent* getEntPtrByName(const string& name);
+
+    /**
+     * Same as above, by UID.
+     */
+    Ent* getEntPtrByUID(unsigned int uid);
+
+    vector<Ent*> getParents(Ent* ent);
+
+    vector<Ent*> getChildren(Ent* ent);
+
+    vector<Ent*> getExclusives(Ent* ent);
+
+    vector<Ent*> getOverlaps(Ent* ent);
+
+    /**
+     * All the ancestors of an Ent at this version, however many levels up.
+     */
+    unordered_set<Ent*> getAncestors(Ent* ent);
+
+    /**
+     * All the descendents of an Ent at this version, however many levels down.
+     */
+    unordered_set<Ent*> getDescendents(Ent* ent);
+
+    /**
+     * The same as getAncestors() and getDescendents(), as an EntSet, which
+     * is quicker to make and far smaller.
+     * @param stop      Called now and then. Once it returns true the walk
+     *                  gives up, with what it's found so far.
+     */
+    EntSet getAncestorSet(Ent* ent, const function<bool()>& stop = nullptr);
+
+    EntSet getDescendentSet(Ent* ent, const function<bool()>& stop = nullptr);
+
+    /**
+     * Finds the Ents in a set, in order of UID. Like getEntPtrByUID(), it
+     * only finds the ones the Tree still has.
+     */
+    vector<Ent*> getEnts(const EntSet& set);
+
+    /**
+     * Takes a snapshot of a made up Tree after each of a run of Writers
+     * edits it, then makes sure every one still sees the Tree exactly as it
+     * was when it was taken.
+     * @return      "" if they do, otherwise what went wrong.
+     */
+    static string check();
+
+private:
+
+    EntSet walk(Ent* ent, bool up, const function<bool()>& stop);
+
+};
+
+#endif /* TREESNAPSHOT_H */
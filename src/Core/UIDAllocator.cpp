@@ -0,0 +1,167 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "UIDAllocator.h"
+#include <climits>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * The block of UIDs the current thread is handing out. Only one is kept, so a
+ * thread switching between allocators throws away the rest of its block.
+ */
+struct UIDBlock {
+    uint64_t allocator;
+    uint64_t next;
+    uint64_t end;
+};
+
+static thread_local UIDBlock currentBlock = {0, 0, 0};
+
+static atomic<uint64_t> nextSerial(1);
+
+/**
+ * Picks an origin. The clock is mixed in in case random_device isn't random
+ * on this platform.
+ */
+static uint64_t pickOrigin() {
+    random_device device;
+    uint64_t origin = (uint64_t(device()) << 32 | device())
+            ^ (uint64_t) chrono::high_resolution_clock::now().time_since_epoch().count();
+    return origin != 0 ? origin : 1;
+}
+
+UIDAllocator UIDAllocator::shared;
+
+UIDAllocator::UIDAllocator(): highWater(2), serial(nextSerial++), stride(1), remainder(0),
+        origin(pickOrigin()) {
+}
+
+UIDAllocator::UIDAllocator(unsigned int s, unsigned int r): highWater(2),
+        serial(nextSerial++), stride(s > 0 ? s : 1), remainder(r % (s > 0 ? s : 1)),
+        origin(pickOrigin()) {
+}
+
+unsigned int UIDAllocator::allocate() {
+    
+    UIDBlock& block = currentBlock;
+    
+    for (;;) {
+        if (block.allocator != serial || block.next >= block.end) {
+            //Blocks hold BLOCK_SIZE UIDs of this allocator's own, whatever
+            //the stride.
+            uint64_t start = highWater.fetch_add((uint64_t) BLOCK_SIZE * stride);
+            block.allocator = serial;
+            block.next = start;
+            block.end = start + (uint64_t) BLOCK_SIZE * stride;
+        }
+        //Up to the next one with the right remainder.
+        block.next += (remainder + stride - block.next % stride) % stride;
+        if (block.next < block.end)
+            break;
+    }
+    
+    if (block.next > UINT_MAX)
+        return 0;
+    
+    uint64_t uid = block.next;
+    block.next += stride;
+    return uid;
+}
+
+void UIDAllocator::raiseTo(uint64_t mark) {
+    
+    uint64_t current = highWater.load();
+    while (current < mark && !highWater.compare_exchange_weak(current, mark));
+    
+    //This thread's own block may now hold UIDs that are taken. Other threads'
+    //blocks can't be reached, so the Tree still checks for clashes.
+    UIDBlock& block = currentBlock;
+    if (block.allocator == serial && block.next < mark)
+        block.next = mark < block.end ? mark : block.end;
+}
+
+string UIDAllocator::check() {
+    
+    //A plain allocator, and three which split the numbers up between them
+    //by their remainder mod 3, so none of the three should clash either.
+    UIDAllocator plain;
+    UIDAllocator thirds[3] = {{3, 0}, {3, 1}, {3, 2}};
+    const unsigned int threads = 8;
+    const unsigned int each = 20000;
+    vector<vector<unsigned int> > fromPlain(threads), fromThirds(threads);
+    vector<thread> running;
+    for (unsigned int t = 0; t < threads; t++) {
+        running.push_back(thread([&, t]() {
+            mt19937 random(30 + t);
+            for (unsigned int i = 0; i < each; i++) {
+                //Switching throws away the rest of a block now and then.
+                unsigned int third = random() % 4;
+                if (third == 3) {
+                    fromPlain[t].push_back(plain.allocate());
+                    continue;
+                }
+                unsigned int uid = thirds[third].allocate();
+                //Put out of place, to be caught below.
+                fromThirds[t].push_back(uid % 3 == third ? uid : 0);
+            }
+        }));
+    }
+    for (thread& worker : running)
+        worker.join();
+    
+    vector<unsigned int> lists[2];
+    for (unsigned int t = 0; t < threads; t++) {
+        lists[0].insert(lists[0].end(), fromPlain[t].begin(), fromPlain[t].end());
+        lists[1].insert(lists[1].end(), fromThirds[t].begin(), fromThirds[t].end());
+    }
+    for (vector<unsigned int>& list : lists) {
+        sort(list.begin(), list.end());
+        if (list.front() < 2)
+            return "handed out " + to_string(list.front())
+                    + ", or a UID with the wrong remainder";
+        vector<unsigned int>::iterator twice = adjacent_find(list.begin(), list.end());
+        if (twice != list.end())
+            return "handed out " + to_string(*twice) + " twice";
+    }
+    if (lists[0].back() >= plain.getHighWater())
+        return "handed out " + to_string(lists[0].back()) + ", past the high-water mark";
+    
+    //Once raised, nothing lower, even from the block this thread has.
+    unsigned int before = plain.allocate();
+    plain.raiseTo((uint64_t) before + 1000);
+    if (plain.allocate() < before + 1000)
+        return "handed out a UID below the mark it was raised to";
+    
+    //And once they run out, only 0.
+    UIDAllocator last;
+    last.raiseTo((uint64_t) UINT_MAX - 10);
+    for (unsigned int i = 0; i < 20; i++) {
+        unsigned int uid = last.allocate();
+        unsigned int expected = i <= 10 ? UINT_MAX - 10 + i : 0;
+        if (uid != expected)
+            return "handed out " + to_string(uid) + " near the end, not " + to_string(expected);
+    }
+    
+    return "";
+}
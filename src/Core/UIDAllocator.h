@@ -0,0 +1,129 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UIDALLOCATOR_H
+#define UIDALLOCATOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+/**
+ * Hands out unique identifiers for Ents.
+ *
+ * UIDs are taken from a single counter, the high-water mark, but not one at a
+ * time. Each thread grabs a block of them with one atomic add and then hands
+ * them out from its block without touching the counter again, so threads
+ * creating Ents in parallel hardly ever contend. A thread that stops before
+ * using up its block leaves a gap, which is fine since UIDs only need to be
+ * unique, not consecutive.
+ *
+ * All Trees share one allocator by default, so an Ent keeps its UID when it's
+ * merged into or compared with another Tree. The high-water mark is saved with
+ * each Tree and raised again when it's loaded, so UIDs aren't reused.
+ *
+ * Every allocator counts up from 2, so the same numbers come up in every
+ * process. A UID on its own only names an Ent among others of the same
+ * origin, which is picked at random for each allocator and kept by each Tree
+ * (see Tree::getOrigin()). Anything matching Ents of two Trees by UID checks
+ * that their origins are the same first.
+ */
+class UIDAllocator {
+    
+    /**
+     * The lowest UID not yet handed out or sitting in some thread's block.
+     * Kept as 64 bits so running past the last unsigned int can be noticed.
+     */
+    atomic<uint64_t> highWater;
+    /**
+     * Tells this allocator's blocks apart from those of allocators that used
+     * to live at the same address.
+     */
+    const uint64_t serial;
+    /**
+     * Only UIDs which leave remainder when divided by stride are handed out,
+     * so allocators with the same stride and different remainders never
+     * clash. Shards of one hierarchy use this.
+     */
+    const unsigned int stride;
+    const unsigned int remainder;
+    /**
+     * Tells its UIDs apart from the same numbers handed out by allocators
+     * anywhere else. Never 0.
+     */
+    const uint64_t origin;
+    
+public:
+    
+    /**
+     * How many UIDs a thread takes at a time.
+     */
+    static const unsigned int BLOCK_SIZE = 256;
+    
+    /**
+     * The allocator Trees use unless given their own.
+     */
+    static UIDAllocator shared;
+    
+    /**
+     * Starts handing out from 2, since 1 is root.
+     */
+    UIDAllocator();
+    
+    /**
+     * Only hands out UIDs with the given remainder, when divided by stride.
+     */
+    UIDAllocator(unsigned int stride, unsigned int remainder);
+    
+    /**
+     * Hands out a UID nobody else has been given.
+     * @return      The UID, or 0 if they have run out.
+     */
+    unsigned int allocate();
+    
+    /**
+     * Makes sure nothing below the given UID is handed out from now on, such
+     * as after loading a Tree whose Ents already have UIDs.
+     * @param mark  The lowest UID that may still be handed out.
+     */
+    void raiseTo(uint64_t mark);
+    
+    /**
+     * The lowest UID that may still be handed out. Saved along with a Tree.
+     */
+    uint64_t getHighWater() {
+        return highWater.load();
+    }
+    
+    uint64_t getOrigin() const {
+        return origin;
+    }
+    
+    /**
+     * Has threads take UIDs from a few allocators at once, switching between
+     * them, and makes sure none is handed out twice or with the wrong
+     * remainder, and none below a raised mark or past the last.
+     * @return      "" if so, otherwise what went wrong.
+     */
+    static string check();
+    
+};
+
+#endif /* UIDALLOCATOR_H */
@@ -0,0 +1,87 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VERSIONLOCK_H
+#define VERSIONLOCK_H
+
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * A small lock which also tells readers whether what it guards has changed.
+ *
+ * It's a single counter, odd while held. Locking and unlocking both add one,
+ * so a reader who sees the same even stamp before and after looking at
+ * something knows no one changed it in between, without taking the lock.
+ *
+ * Waiting threads spin and yield, since it's only held for a few edits.
+ * Copies start out unlocked, so whatever holds one can still be copied.
+ */
+class VersionLock {
+
+    atomic<uint64_t> word;
+
+public:
+
+    VersionLock(): word(0) {}
+
+    VersionLock(const VersionLock&): word(0) {}
+
+    VersionLock& operator=(const VersionLock&) {
+        return *this;
+    }
+
+    bool tryLock() {
+        uint64_t w = word.load(memory_order_relaxed);
+        return (w & 1) == 0 && word.compare_exchange_strong(w, w + 1,
+                memory_order_acquire, memory_order_relaxed);
+    }
+
+    void lock() {
+        while (!tryLock())
+            this_thread::yield();
+    }
+
+    void unlock() {
+        word.fetch_add(1, memory_order_release);
+    }
+
+    /**
+     * The stamp to compare against later. Waits out a holder, so it's always
+     * even.
+     */
+    uint64_t stamp() const {
+        uint64_t w;
+        while ((w = word.load(memory_order_acquire)) & 1)
+            this_thread::yield();
+        return w;
+    }
+
+    /**
+     * The stamp as it is right now, odd if held.
+     */
+    uint64_t current() const {
+        return word.load(memory_order_acquire);
+    }
+
+};
+
+#endif /* VERSIONLOCK_H */
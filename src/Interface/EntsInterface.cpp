@@ -19,14 +19,38 @@
 #include "EntsInterface.h"
 #include "TreeInstance.h"
 #include "Tests.h"
+#include "../Util/Importer.h"
+#include "../Util/EntsFile.h"
+#include "../Algorithms/TreeMerge.h"
+#include "../Algorithms/TreeDiff.h"
+#include "../Util/IO.h"
+#include "../Util/Prime.h"
+#include "../Algorithms/ParallelTraversal.h"
+#include "../Algorithms/EntQuery.h"
+#include "../Algorithms/RelationSearch.h"
+#include "../Algorithms/RelativeStream.h"
+#include "../Core/EntSetCache.h"
+#include "../Network/EntsProtocol.h"
+#include "../Network/QueryCache.h"
+#include "../Network/EntsClient.h"
+#include "../Network/ShardCluster.h"
+#include "../Network/CoreServer.h"
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
 
 class TreeInstance;
 
-EntsInterface::EntsInterface() {
+EntsInterface::EntsInterface(): server(nullptr), follower(nullptr) {
 }
 
 EntsInterface::~EntsInterface() {
     
+    //The server and follower use the trees, so they have to go first.
+    delete server;
+    delete follower;
+    
     //Because this class holds a vector of Tree pointers, we need to release
     //those trees manually. Down the road, we may wish to do something
     //different, allowing the user to pass a tree from one program to another
@@ -37,6 +61,21 @@ EntsInterface::~EntsInterface() {
     
 }
 
+Tree* EntsInterface::findTreeOrFile(const string name, Tree* except, bool* loaded) {
+    
+    //Open Trees are looked for first.
+    *loaded = false;
+    for (Tree* open : trees) {
+        if (open->getName() == name && open != except)
+            return open;
+    }
+    //Otherwise it should be a file.
+    Tree* tree = EntsFile::load(name);
+    *loaded = tree != nullptr;
+    
+    return tree;
+}
+
 inline EntX EntsInterface::getEmptyEntInstance() {
     return EntX();
 }
@@ -78,15 +117,12 @@ const EntX EntsInterface::requestToCreateNewEnt(TreeInstance tree) {
         queryUserForText(&potentialName, message);
         if (Tests::isValidEntName(potentialName, &message)) {
             //Valid name!
-            //Is it free?
-            if (tree.isEntNameFree(potentialName)) {
-                //Hey, it's available!
-                //Make the new Ent. On the heap and everything!
-                Ent* newEnt = new Ent(potentialName);
-                //Add it to the tree.
-                tree.addEnt(newEnt);
+            //Make it, if the name is free. Other threads may be adding
+            //Ents too, so checking first and adding after isn't enough.
+            Ent* newEnt = tree.createEnt(potentialName);
+            if (newEnt != nullptr) {
                 //Return a copy of an EntX containing a pointer to the Ent.
-                return EntX(newEnt);;
+                return EntX(newEnt);
             } else {
                 message = "That name is already taken!";
             }
@@ -122,18 +158,19 @@ void EntsInterface::requestToRenameTree(TreeInstance tree) {
 }
 
 
-void EntsInterface::requestParentChildConnection(EntX parent, EntX child) {
+void EntsInterface::requestParentChildConnection(TreeInstance tree, EntX parent, EntX child) {
     
     //Check to make sure they both aren't the same.
     if (parent.equals(child)) {
         displayMessageToUser("Can't connect parent and child because they are the same Ent.");
         return;
     } else {
-        unordered_set<Ent*> problemEnts = parent.ent->getParentalConflicts(child.ent);
+        //Checked and connected in one go, so it's safe while a server is
+        //editing the same Tree.
+        unordered_set<Ent*> problemEnts;
         
-        if (problemEnts.empty()) {
+        if (tree.getTree()->connectAndPrune(parent.ent, child.ent, &problemEnts)) {
             //Yup, they are compatible.
-            Ent::connectUncheckedAndPrune(parent.ent, child.ent);
             displayMessageToUser("\"" + parent.getName() + "\" is now the parent of \"" + child.getName() + "\".");
         } else {
             
@@ -143,4 +180,938 @@ void EntsInterface::requestParentChildConnection(EntX parent, EntX child) {
         }
     }
     
-}
\ No newline at end of file
+}
+
+
+void EntsInterface::requestToImportFile(TreeInstance tree) {
+    
+    string format;
+    queryUserForText(&format, "Enter the file format: csv, tsv or ncbi.");
+    
+    Importer importer(tree.getTree());
+    ImportStats stats;
+    
+    if (format == "csv" || format == "tsv") {
+        string path;
+        queryUserForText(&path, "Enter the path of the \"name,parent\" file.");
+        //A server may be reading or editing the Tree too.
+        Tree::Writer writing(tree.getTree());
+        stats = importer.importEdgeList(path, format == "csv" ? ',' : '\t');
+    } else if (format == "ncbi") {
+        string nodesPath, namesPath;
+        queryUserForText(&nodesPath, "Enter the path of nodes.dmp.");
+        queryUserForText(&namesPath, "Enter the path of names.dmp.");
+        Tree::Writer writing(tree.getTree());
+        stats = importer.importNcbiTaxonomy(nodesPath, namesPath);
+    } else {
+        displayMessageToUser("Unknown file format. Nothing was imported.");
+        return;
+    }
+    
+    //Let the user know how it went, and how fast.
+    ostringstream report;
+    report << "Imported " << stats.rows << " rows and created " << stats.entsCreated
+            << " Ents in " << stats.seconds << " seconds ("
+            << (unsigned long long) stats.getRowsPerSecond() << " rows/sec, "
+            << importer.getThreadCount() << " parsing threads).";
+    if (stats.loopsSkipped > 0)
+        report << "\n" << stats.loopsSkipped << " lines were left out, since they would have made"
+                << " an Ent its own ancestor.";
+    displayMessageToUser(report.str());
+}
+
+
+void EntsInterface::requestChecks() {
+    
+    //Each returns what went wrong, or nothing if the answers agreed.
+    vector<pair<string, function<string()> > > checks = {
+        {"Importer", Importer::check},
+        {"TreeMerge", TreeMerge::check},
+        {"TreeDiff", TreeDiff::check},
+        {"Prime", Prime::check},
+        {"UIDAllocator", UIDAllocator::check},
+        {"TreeSnapshot", TreeSnapshot::check},
+        {"Tree names", Tree::checkNames},
+        {"Tree editors", Tree::checkEditors},
+        {"ParallelTraversal", ParallelTraversal::check},
+        {"EntsServer", EntsServer::check},
+        {"EntsProtocol", EntsFrame::check},
+        {"EntsClient", EntsClient::check},
+        {"RelativeStream", RelativeStream::check},
+        {"EntsFollower", EntsFollower::check},
+        {"ShardRouter", ShardRouter::check},
+        {"WatchHub", WatchHub::check},
+        {"QueryCache", QueryCache::check},
+        {"CoreServer", CoreServer::check},
+        {"LatencyHistogram", LatencyHistogram::check},
+        {"Overload", EntsServer::checkOverload},
+        {"NameIndex", NameIndex::check},
+        {"EntQuery", EntQuery::check},
+        {"EntSet", EntSet::check},
+        {"RelationSearch", RelationSearch::check}
+    };
+    
+    ostringstream message;
+    unsigned int passed = 0;
+    for (pair<string, function<string()> >& check : checks) {
+        string failure = check.second();
+        if (failure.empty())
+            passed++;
+        message << "\n\t" << check.first << ":\t" << (failure.empty() ? "agrees" : failure);
+    }
+    displayMessageToUser(to_string(passed) + " of " + to_string(checks.size())
+            + " checks passed." + message.str());
+}
+
+
+void EntsInterface::requestToSaveTree(TreeInstance tree) {
+    
+    string fileName;
+    queryUserForText(&fileName, "Enter a file name to save the Tree as.");
+    
+    if (fileName.empty()) {
+        displayMessageToUser("Tree was not saved.");
+        return;
+    }
+    
+    EntsFile file(tree.getTree());
+    file.setFileName(fileName);
+    {
+        //Saving walks the name map, which a server's edits may be growing.
+        Tree::Writer writing(tree.getTree());
+        file.save();
+    }
+}
+
+
+void EntsInterface::requestTreeMerge(TreeInstance tree) {
+    
+    string name;
+    queryUserForText(&name, "Enter the name of an open Tree, or a saved file, to merge in.");
+    
+    //A Tree loaded from a file only lives as long as the merge.
+    bool loaded;
+    Tree* from = findTreeOrFile(name, tree.getTree(), &loaded);
+    if (from == nullptr) {
+        displayMessageToUser("No open Tree or saved file found by that name.");
+        return;
+    }
+    
+    MergeReport report;
+    {
+        //Either Tree may be being served. Walking from's name map needs its
+        //edits kept out too, not just a Reader.
+        Tree::Writer writing(tree.getTree());
+        Tree::Writer reading(from);
+        report = TreeMerge::merge(tree.getTree(), from);
+    }
+    
+    ostringstream message;
+    message << "Merged \"" << from->getName() << "\" into \"" << tree.getName() << "\".\n"
+            << "\t" << report.matchedByUID << " Ents matched by UID, "
+            << report.matchedByName << " by name, " << report.entsAdded << " added.\n"
+            << "\t" << report.parentsAdded << " parents, " << report.exclusivesAdded
+            << " exclusives and " << report.overlapsAdded << " overlaps added.\n"
+            << "\t" << report.conflicts.size() << " conflicts.";
+    for (MergeConflict& conflict : report.conflicts) {
+        message << "\n\t\"" << conflict.a << "\" and \"" << conflict.b << "\": ";
+        switch (conflict.type) {
+            case REVERSED_PARENT:
+                message << "each is the other's parent.";
+                break;
+            case PARENT_AND_EXCLUSIVE:
+                message << "parent and child, but also exclusive.";
+                break;
+            case OVERLAP_AND_EXCLUSIVE:
+                message << "overlapping, but also exclusive.";
+                break;
+            case PARENT_CYCLE:
+                message << "connecting them would make a loop of parents.";
+                break;
+            case NAME_CLASH:
+                message << "same name, different UIDs. Renamed the second.";
+                break;
+            case RENAMED:
+                message << "the same Ent, renamed. Kept the first name.";
+                break;
+        }
+    }
+    displayMessageToUser(message.str());
+    
+    if (loaded)
+        delete from;
+}
+
+
+void EntsInterface::requestTreeDiff(TreeInstance tree) {
+    
+    string name;
+    queryUserForText(&name, "Enter the name of the older Tree, open or saved, to compare with.");
+    
+    bool loaded;
+    Tree* before = findTreeOrFile(name, tree.getTree(), &loaded);
+    if (before == nullptr) {
+        displayMessageToUser("No open Tree or saved file found by that name.");
+        return;
+    }
+    
+    TreeDelta delta;
+    {
+        //Both name maps are walked, and either Tree may be being served.
+        Tree::Writer writingBefore(before);
+        Tree::Writer writing(tree.getTree());
+        delta = TreeDiff::diff(before, tree.getTree());
+    }
+    
+    if (loaded)
+        delete before;
+    
+    if (delta.isEmpty()) {
+        displayMessageToUser("Nothing has changed.");
+        return;
+    }
+    
+    ostringstream message;
+    message << "Changes since \"" << name << "\":\n"
+            << "\t" << delta.addedEnts.size() << " Ents added, "
+            << delta.removedEnts.size() << " removed, "
+            << delta.renamedEnts.size() << " renamed.\n"
+            << "\t" << delta.addedRelations.size() << " relations added, "
+            << delta.removedRelations.size() << " removed.";
+    for (unsigned int index : delta.addedEnts)
+        message << "\n\t+ \"" << delta.ents[index].name << "\"";
+    for (unsigned int index : delta.removedEnts)
+        message << "\n\t- \"" << delta.ents[index].name << "\"";
+    for (DeltaRename& rename : delta.renamedEnts)
+        message << "\n\t\"" << delta.ents[rename.ent].name << "\" is now \""
+                << rename.newName << "\"";
+    displayMessageToUser(message.str());
+    
+    string fileName;
+    queryUserForText(&fileName, "Enter a file name to save these changes as a patch, or nothing to skip.");
+    if (!fileName.empty())
+        IO::saveFile(fileName + ".delta", new string(TreeDiff::write(delta)));
+}
+
+
+void EntsInterface::requestToApplyPatch(TreeInstance tree) {
+    
+    string fileName;
+    queryUserForText(&fileName, "Enter the name of the patch to apply.");
+    
+    string text;
+    TreeDelta delta;
+    if (!IO::loadFile(fileName + ".delta", &text) || !TreeDiff::read(text, &delta)) {
+        displayMessageToUser("That file isn't a patch. Nothing was changed.");
+        return;
+    }
+    
+    unsigned int missing;
+    {
+        //A server may be reading or editing the Tree too.
+        Tree::Writer writing(tree.getTree());
+        missing = TreeDiff::apply(tree.getTree(), delta);
+    }
+    
+    if (missing == 0) {
+        displayMessageToUser("Patch applied.");
+    } else {
+        displayMessageToUser("Patch applied, but " + to_string(missing)
+                + " Ents it refers to couldn't be found. Changes to them were skipped.");
+    }
+}
+
+
+void EntsInterface::requestPrimeBenchmark() {
+    
+    string text;
+    queryUserForText(&text, "How many primes should be found? (1000000 if blank)");
+    
+    unsigned int count = 1000000;
+    if (!text.empty()) {
+        count = strtoul(text.c_str(), nullptr, 10);
+        if (count == 0) {
+            displayMessageToUser("That isn't a number of primes.");
+            return;
+        }
+    }
+    
+    PrimeBenchmark result = Prime::benchmark(count);
+    
+    ostringstream message;
+    message << "Found the first " << result.count << " primes.\n"
+            << "\tTrial division:\t" << result.trialDivisionSeconds << " seconds\n"
+            << "\tSieve:\t\t" << result.sieveSeconds << " seconds";
+    if (result.sieveSeconds > 0)
+        message << " (" << result.trialDivisionSeconds / result.sieveSeconds << "x faster)";
+    if (!result.agree)
+        message << "\nThe two didn't find the same primes!";
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestEditBenchmark() {
+    
+    EditBenchmark result = Tree::benchmarkEdits(0, 1);
+    
+    ostringstream message;
+    message << "Connects and disconnects a second, each thread in its own subtree:";
+    for (pair<unsigned int, double>& rate : result.rates) {
+        message << "\n\t" << rate.first << (rate.first == 1 ? " thread:\t" : " threads:\t")
+                << (size_t) rate.second;
+        if (rate.first > 1 && result.rates[0].second > 0)
+            message << " (" << rate.second / result.rates[0].second << "x one thread)";
+    }
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestTraversalBenchmark(TreeInstance tree, EntX ent) {
+    
+    string text;
+    queryUserForText(&text, "How many threads should be used? (all of them if blank)");
+    
+    unsigned int threads = 0;
+    if (!text.empty()) {
+        threads = strtoul(text.c_str(), nullptr, 10);
+        if (threads == 0) {
+            displayMessageToUser("That isn't a number of threads.");
+            return;
+        }
+    }
+    
+    TraversalBenchmark result = ParallelTraversal::benchmark(tree.getTree(), ent.ent, threads);
+    
+    ostringstream message;
+    message << "Found " << result.found << " descendents of \"" << ent.getName() << "\".\n"
+            << "\tOne thread:\t" << result.sequentialSeconds << " seconds\n"
+            << "\t" << result.threads << " threads:\t" << result.parallelSeconds << " seconds";
+    if (result.parallelSeconds > 0)
+        message << " (" << result.sequentialSeconds / result.parallelSeconds << "x faster)";
+    if (!result.agree)
+        message << "\nThe two didn't find the same Ents!";
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestToStartServer(TreeInstance tree) {
+    
+    if (server != nullptr) {
+        displayMessageToUser("A server is already running on port "
+                + to_string(server->getPort()) + ".");
+        return;
+    }
+    
+    string text;
+    queryUserForText(&text, "Which port? (1037 if blank)");
+    unsigned long port = 1037;
+    if (!text.empty()) {
+        port = strtoul(text.c_str(), nullptr, 10);
+        if (port == 0 || port > 65535) {
+            displayMessageToUser("That isn't a port.");
+            return;
+        }
+    }
+    
+    queryUserForText(&text, "How many threads should be used? (all of them if blank)");
+    unsigned int threads = 0;
+    if (!text.empty()) {
+        threads = strtoul(text.c_str(), nullptr, 10);
+        if (threads == 0) {
+            displayMessageToUser("That isn't a number of threads.");
+            return;
+        }
+    }
+    
+    try {
+        server = new EntsServer(tree.getTree(), port, threads);
+        //Edits to a follower's Tree would be overwritten, or lost.
+        if (follower != nullptr && follower->getTree() == tree.getTree())
+            server->setReadOnly(true);
+        server->start();
+    } catch (exception& e) {
+        delete server;
+        server = nullptr;
+        displayMessageToUser(string("Couldn't start the server: ") + e.what());
+        return;
+    }
+    displayMessageToUser("Serving \"" + tree.getName() + "\" on port "
+            + to_string(server->getPort()) + ".");
+}
+
+void EntsInterface::requestToStopServer() {
+    
+    if (server == nullptr) {
+        displayMessageToUser("No server is running.");
+        return;
+    }
+    
+    uint64_t answered = server->getRequestCount();
+    delete server;
+    server = nullptr;
+    displayMessageToUser("Server stopped after answering " + to_string(answered) + " requests.");
+}
+
+void EntsInterface::requestToFollow(TreeInstance tree) {
+    
+    if (follower != nullptr) {
+        displayMessageToUser("Already following a primary.");
+        return;
+    }
+    {
+        Tree::Reader reading;
+        if (tree.getTree()->getNameMap()->size() > 1) {
+            displayMessageToUser("Only an empty Tree can follow a primary.");
+            return;
+        }
+    }
+    
+    string host;
+    queryUserForText(&host, "Enter the primary's address. (127.0.0.1 if blank)");
+    if (host.empty())
+        host = "127.0.0.1";
+    string text;
+    queryUserForText(&text, "Which port? (1037 if blank)");
+    unsigned long port = 1037;
+    if (!text.empty()) {
+        port = strtoul(text.c_str(), nullptr, 10);
+        if (port == 0 || port > 65535) {
+            displayMessageToUser("That isn't a port.");
+            return;
+        }
+    }
+    
+    follower = new EntsFollower(tree.getTree(), host, port);
+    follower->start();
+    if (server != nullptr && server->getTree() == tree.getTree())
+        server->setReadOnly(true);
+    displayMessageToUser("Following " + host + ":" + to_string(port) + ". Edits to \""
+            + tree.getName() + "\" are left to the primary from now on.");
+}
+
+void EntsInterface::requestToWatch() {
+    
+    string host;
+    queryUserForText(&host, "Enter the server's address. (127.0.0.1 if blank)");
+    if (host.empty())
+        host = "127.0.0.1";
+    string text;
+    queryUserForText(&text, "Which port? (1037 if blank)");
+    unsigned long port = 1037;
+    if (!text.empty()) {
+        port = strtoul(text.c_str(), nullptr, 10);
+        if (port == 0 || port > 65535) {
+            displayMessageToUser("That isn't a port.");
+            return;
+        }
+    }
+    EntKey key;
+    queryUserForText(&key.name, "Which Ent? (root if blank)");
+    if (key.name.empty())
+        key.name = "root";
+    queryUserForText(&text, "For how many seconds? (10 if blank)");
+    unsigned long seconds = text.empty() ? 10 : strtoul(text.c_str(), nullptr, 10);
+    
+    static const char* changes[] = {"Added", "Removed", "Renamed", "Connected",
+            "Disconnected", "Set exclusive", "Unset exclusive", "Set overlap", "Unset overlap"};
+    
+    ostringstream shown;
+    size_t count = 0;
+    try {
+        EntsClient client(host, port, 1);
+        EntsWatch watch = client.watch(key);
+        if (watch.getStatus() != STATUS_MORE) {
+            displayMessageToUser("There's no Ent called \"" + key.name + "\" there.");
+            return;
+        }
+        chrono::steady_clock::time_point end = chrono::steady_clock::now()
+                + chrono::seconds(seconds);
+        ChangeBatch batch;
+        while (chrono::steady_clock::now() < end && watch.getStatus() == STATUS_MORE) {
+            chrono::milliseconds left = chrono::duration_cast<chrono::milliseconds>(
+                    end - chrono::steady_clock::now());
+            if (!watch.next(&batch, left))
+                continue;
+            if (batch.snapshot)
+                shown << "\t(Some changes were missed.)\n";
+            for (const TreeChange& change : batch.changes) {
+                shown << "\t" << changes[change.type] << " " << change.a;
+                if (change.b != 0)
+                    shown << " and " << change.b;
+                if (!change.name.empty())
+                    shown << " \"" << change.name << "\"";
+                shown << "\n";
+                count++;
+            }
+        }
+        if (watch.getStatus() == STATUS_NOT_FOUND)
+            shown << "\t" << key.name << " was removed.\n";
+    } catch (exception& e) {
+        displayMessageToUser(string("Couldn't watch it: ") + e.what());
+        return;
+    }
+    
+    displayMessageToUser(to_string(count) + " changes under " + key.name + ":\n" + shown.str());
+}
+
+void EntsInterface::requestToStopFollowing() {
+    
+    if (follower == nullptr) {
+        displayMessageToUser("Not following a primary.");
+        return;
+    }
+    
+    string last = EntsFollower::describe(follower->getStatus());
+    delete follower;
+    follower = nullptr;
+    if (server != nullptr)
+        server->setReadOnly(false);
+    displayMessageToUser("Stopped following. " + last);
+}
+
+void EntsInterface::requestReplicationStatus() {
+    
+    if (follower != nullptr)
+        displayMessageToUser(EntsFollower::describe(follower->getStatus()));
+    
+    if (server != nullptr) {
+        ChangeLog* log = server->getTree()->getChangeLog();
+        ostringstream message;
+        message << server->getFollowerCount() << " followers are connected to the server.";
+        if (log != nullptr)
+            message << " Its log is at " << log->getEnd() << ", and keeps changes from "
+                    << log->getStart() << " on.";
+        displayMessageToUser(message.str());
+    } else if (follower == nullptr) {
+        displayMessageToUser("Not following or serving.");
+    }
+}
+
+void EntsInterface::requestCacheStats() {
+    
+    if (server == nullptr) {
+        displayMessageToUser("No server is running.");
+        return;
+    }
+    
+    QueryCacheStats stats = server->getCacheStats();
+    uint64_t asked = stats.hits + stats.misses;
+    ostringstream message;
+    message << stats.entries << " of " << stats.capacity << " answers are cached. "
+            << stats.hits << " hits and " << stats.misses << " misses";
+    if (asked > 0)
+        message << " (" << (100 * stats.hits / asked) << "% hits)";
+    message << ". " << stats.admissions << " answers were let in and "
+            << stats.rejections << " turned away, " << stats.evictions
+            << " evicted and " << stats.invalidations << " dropped by edits.";
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestLatencyStats() {
+    
+    if (server == nullptr) {
+        displayMessageToUser("No server is running.");
+        return;
+    }
+    
+    static const char* lanes[] = {"Lookups", "Traversals", "Edits"};
+    ostringstream message;
+    message << "Microseconds taken, from reading a request to answering it.";
+    for (int lane = LANE_LOOKUP; lane < LANE_CONTROL; lane++) {
+        LatencySummary latency = server->getLatency(EntsLane(lane));
+        message << "\n\t" << lanes[lane] << ":\t" << latency.count << " requests";
+        if (latency.count > 0)
+            message << ", 50% " << latency.p50 << ", 90% " << latency.p90
+                    << ", 99% " << latency.p99 << ", 99.9% " << latency.p999
+                    << ", most " << latency.max;
+    }
+    message << "\n\t" << server->getOverloadCount() << " requests were turned away as too many.";
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestServerBenchmark(TreeInstance tree) {
+    
+    string text;
+    queryUserForText(&text, "How many threads should the server use? (all of them if blank)");
+    unsigned int threads = 0;
+    if (!text.empty()) {
+        threads = strtoul(text.c_str(), nullptr, 10);
+        if (threads == 0) {
+            displayMessageToUser("That isn't a number of threads.");
+            return;
+        }
+    }
+    
+    queryUserForText(&text, "How many clients? (8 if blank)");
+    unsigned int clients = 8;
+    if (!text.empty()) {
+        clients = strtoul(text.c_str(), nullptr, 10);
+        if (clients == 0) {
+            displayMessageToUser("That isn't a number of clients.");
+            return;
+        }
+    }
+    
+    ServerBenchmark result;
+    try {
+        result = EntsServer::benchmark(tree.getTree(), threads, clients, 3);
+    } catch (exception& e) {
+        displayMessageToUser(string("Couldn't start the server: ") + e.what());
+        return;
+    }
+    
+    ostringstream message;
+    message << result.clients << " clients made " << result.requests << " requests of "
+            << result.threads << " server threads in " << result.seconds << " seconds.\n"
+            << "\t" << (uint64_t) result.getRequestsPerSecond() << " requests per second";
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestCoreBenchmark(TreeInstance tree) {
+    
+    string text;
+    queryUserForText(&text, "How many cores? (all of them if blank)");
+    unsigned int cores = 0;
+    if (!text.empty()) {
+        cores = strtoul(text.c_str(), nullptr, 10);
+        if (cores == 0) {
+            displayMessageToUser("That isn't a number of cores.");
+            return;
+        }
+    }
+    
+    queryUserForText(&text, "How many clients? (8 if blank)");
+    unsigned int clients = 8;
+    if (!text.empty()) {
+        clients = strtoul(text.c_str(), nullptr, 10);
+        if (clients == 0) {
+            displayMessageToUser("That isn't a number of clients.");
+            return;
+        }
+    }
+    
+    pair<ServerBenchmark, ServerBenchmark> results;
+    try {
+        results = CoreServer::benchmark(tree.getTree(), cores, clients, 3);
+    } catch (exception& e) {
+        displayMessageToUser(string("Couldn't start the server: ") + e.what());
+        return;
+    }
+    
+    ostringstream message;
+    message << clients << " clients, " << results.first.threads << " cores.\n"
+            << "\tA copy of the tree per core:\t" << (uint64_t) results.first.getRequestsPerSecond()
+            << " requests per second\n"
+            << "\tOne tree shared by threads:\t" << (uint64_t) results.second.getRequestsPerSecond()
+            << " requests per second";
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestOverloadBenchmark(TreeInstance tree) {
+    
+    string text;
+    queryUserForText(&text, "How many clients? (64 if blank)");
+    unsigned int clients = 64;
+    if (!text.empty()) {
+        clients = strtoul(text.c_str(), nullptr, 10);
+        if (clients == 0) {
+            displayMessageToUser("That isn't a number of clients.");
+            return;
+        }
+    }
+    
+    queryUserForText(&text, "How many requests should the server take at once? (1024 if blank)");
+    unsigned int most = 1024;
+    if (!text.empty()) {
+        most = strtoul(text.c_str(), nullptr, 10);
+        if (most == 0) {
+            displayMessageToUser("That isn't a number of requests.");
+            return;
+        }
+    }
+    
+    vector<OverloadSample> samples;
+    try {
+        samples = EntsServer::overload(tree.getTree(), 0, clients, most, 5);
+    } catch (exception& e) {
+        displayMessageToUser(string("Couldn't start the server: ") + e.what());
+        return;
+    }
+    
+    ostringstream message;
+    message << clients << " clients with " << CONNECTION_WINDOW << " requests each in flight, "
+            << "against a server taking " << most << ".";
+    for (size_t i = 0; i < samples.size(); i++) {
+        message << "\n\t" << (i + 1) << "s:\t" << samples[i].answered << " answered, "
+                << samples[i].overloaded << " turned away, 99% in "
+                << samples[i].latency.p99 << "us, " << samples[i].memory / 1024 << "MB resident";
+    }
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestNameBenchmark(TreeInstance tree) {
+    
+    NameIndexBenchmark result = NameIndex::benchmark(tree.getTree(), 10);
+    
+    ostringstream message;
+    message << result.names << " names indexed in " << result.bytes / 1024 << "KB";
+    if (result.buildSeconds > 0)
+        message << ", built in " << result.buildSeconds << " seconds";
+    message << ". Microseconds to find 10 Ents:\n"
+            << "\tBy the first 3 letters:\t" << result.complete << "\n"
+            << "\tIn any case:\t\t" << result.ignoringCase << "\n"
+            << "\tWith a typo:\t\t" << result.similar;
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestSetBenchmark(TreeInstance tree) {
+    
+    EntSetBenchmark result = EntSetCache::benchmark(tree.getTree(), 64);
+    if (result.ents == 0) {
+        displayMessageToUser("The tree has no Ents with children.");
+        return;
+    }
+    
+    ostringstream message;
+    message << "The " << result.ents << " biggest Ents sampled have " << (size_t) result.averageSize
+            << " descendents on average, taking " << (size_t) result.hashBytes / 1024
+            << "KB as a hash set or " << (size_t) result.setBytes / 1024 << "KB as an EntSet.\n"
+            << "Microseconds for each:\n"
+            << "\tWalk to a hash set:\t" << result.hashWalk << "\n"
+            << "\tWalk to an EntSet:\t" << result.setWalk << "\n"
+            << "\tRead from the cache:\t" << result.cached << "\n"
+            << "\tIntersect hash sets:\t" << result.hashIntersect << "\n"
+            << "\tUnite EntSets:\t\t" << result.unite << "\n"
+            << "\tIntersect EntSets:\t" << result.intersect << "\n"
+            << "\tSubtract EntSets:\t" << result.subtract << "\n"
+            << "\tCount shared:\t\t" << result.countShared;
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestQuery(TreeInstance tree, const string& text, bool explain) {
+    
+    tree.getTree()->startSetCache();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    EntQuery query(tree.getTree()->snapshot(), text);
+    if (!query.isValid()) {
+        displayMessageToUser(query.getError());
+        return;
+    }
+    vector<Ent*> found;
+    query.run(&found);
+    double milliseconds = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+    
+    ostringstream message;
+    if (explain)
+        message << query.explain();
+    message << "Found " << found.size() << " Ents in " << milliseconds << "ms.";
+    if (!explain && !found.empty()) {
+        const size_t shown = 20;
+        vector<string> names;
+        for (Ent* ent : found)
+            names.push_back(ent->getName());
+        sort(names.begin(), names.end());
+        for (size_t i = 0; i < names.size() && i < shown; i++)
+            message << "\n\t" << names[i];
+        if (names.size() > shown)
+            message << "\n\t...and " << names.size() - shown << " more.";
+    }
+    displayMessageToUser(message.str());
+}
+
+/**
+ * Reads which relations to follow from the user's words, like "parents and
+ * exclusives". Blank means all of them.
+ * @return          The FollowRelations, or 0 if none were named.
+ */
+static unsigned int readFollow(const string& text) {
+    if (text.empty() || text.find("all") != string::npos)
+        return FOLLOW_ALL;
+    unsigned int follow = 0;
+    if (text.find("parent") != string::npos)
+        follow |= FOLLOW_PARENTS;
+    if (text.find("child") != string::npos)
+        follow |= FOLLOW_CHILDREN;
+    if (text.find("exclusive") != string::npos)
+        follow |= FOLLOW_EXCLUSIVES;
+    if (text.find("overlap") != string::npos)
+        follow |= FOLLOW_OVERLAPS;
+    return follow;
+}
+
+void EntsInterface::requestPath(TreeInstance tree) {
+    
+    TreeSnapshot snapshot = tree.getTree()->snapshot();
+    string name;
+    queryUserForText(&name, "From which Ent?");
+    Ent* from = snapshot.getEntPtrByName(name);
+    if (from == nullptr) {
+        displayMessageToUser("There's no Ent called \"" + name + "\".");
+        return;
+    }
+    queryUserForText(&name, "To which Ent?");
+    Ent* to = snapshot.getEntPtrByName(name);
+    if (to == nullptr) {
+        displayMessageToUser("There's no Ent called \"" + name + "\".");
+        return;
+    }
+    string text;
+    queryUserForText(&text, "Through parents, children, exclusives or overlaps? (all if blank)");
+    unsigned int follow = readFollow(text);
+    if (follow == 0) {
+        displayMessageToUser("That isn't any of them.");
+        return;
+    }
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    EntPath path = RelationSearch::findPath(snapshot, from, to, follow);
+    double milliseconds = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+    
+    ostringstream message;
+    if (path.ents.empty()) {
+        message << (path.complete ? "They aren't related that way"
+                : "Gave up looking, with no chain found");
+    } else {
+        //How each Ent reads next to the one before it.
+        static const char* related[] = {"is a child of", "is a parent of",
+                "is exclusive with", "overlaps"};
+        message << path.ents[0]->getName();
+        for (size_t i = 0; i < path.relations.size(); i++)
+            message << "\n\t" << (i == 0 ? "" : "which ") << related[path.relations[i]]
+                    << " " << path.ents[i + 1]->getName();
+        message << "\n" << path.relations.size() << " steps";
+    }
+    message << ", after visiting " << path.visited << " Ents in " << milliseconds << "ms.";
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestNeighborhood(TreeInstance tree) {
+    
+    TreeSnapshot snapshot = tree.getTree()->snapshot();
+    string name;
+    queryUserForText(&name, "Around which Ent?");
+    Ent* ent = snapshot.getEntPtrByName(name);
+    if (ent == nullptr) {
+        displayMessageToUser("There's no Ent called \"" + name + "\".");
+        return;
+    }
+    string text;
+    queryUserForText(&text, "How many hops? (1 if blank)");
+    unsigned long hops = text.empty() ? 1 : strtoul(text.c_str(), nullptr, 10);
+    //Past that they'd have stopped at most anyway.
+    const size_t most = 1000;
+    hops = min<unsigned long>(hops, most);
+    queryUserForText(&text, "Through parents, children, exclusives or overlaps? (all if blank)");
+    unsigned int follow = readFollow(text);
+    if (follow == 0) {
+        displayMessageToUser("That isn't any of them.");
+        return;
+    }
+    
+    const size_t shown = 40;
+    EntSubgraph graph = RelationSearch::getNeighborhood(snapshot, ent, hops, follow, most);
+    
+    vector<size_t> perHop(hops + 1);
+    for (unsigned int hop : graph.hops)
+        perHop[hop]++;
+    ostringstream message;
+    message << graph.ents.size() << " Ents";
+    if (!graph.complete)
+        message << " (stopped at " << most << ")";
+    message << ", " << graph.relations.size() << " relations among them.";
+    for (size_t hop = 1; hop < perHop.size(); hop++)
+        message << "\n\t" << perHop[hop] << " at " << hop << (hop == 1 ? " hop" : " hops");
+    static const char* arrows[] = {" > ", " < ", " x ", " o "};
+    for (size_t i = 0; i < graph.relations.size() && i < shown; i++) {
+        const SubgraphRelation& relation = graph.relations[i];
+        message << "\n\t" << graph.ents[relation.a]->getName() << arrows[relation.type]
+                << graph.ents[relation.b]->getName();
+    }
+    if (graph.relations.size() > shown)
+        message << "\n\t...and " << graph.relations.size() - shown << " more.";
+    if (!graph.relations.empty())
+        message << "\n(> is parent of, x is exclusive with, o overlaps.)";
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestClientBenchmark(TreeInstance tree) {
+    
+    string text;
+    queryUserForText(&text, "How many connections should the client pool? (4 if blank)");
+    unsigned int connections = 4;
+    if (!text.empty()) {
+        connections = strtoul(text.c_str(), nullptr, 10);
+        if (connections == 0) {
+            displayMessageToUser("That isn't a number of connections.");
+            return;
+        }
+    }
+    
+    ClientBenchmark result;
+    try {
+        result = EntsClient::benchmark(tree.getTree(), connections, 3);
+    } catch (exception& e) {
+        displayMessageToUser(string("Couldn't run the benchmark: ") + e.what());
+        return;
+    }
+    
+    ostringstream message;
+    message << "Requests per second over " << result.connections << " connections:\n"
+            << "\tOne at a time:\t" << (uint64_t) result.oneAtATime << "\n"
+            << "\tMany at once:\t" << (uint64_t) result.pipelined << "\n"
+            << "\tBatches of " << result.batchSize << ":\t" << (uint64_t) result.batched << "\n"
+            << "Streamed " << result.streamedEnts << " descendents of root at "
+            << (uint64_t) result.streamed << " per second.";
+    displayMessageToUser(message.str());
+}
+
+void EntsInterface::requestShardBenchmark(TreeInstance tree) {
+    
+    string text;
+    queryUserForText(&text, "How many shards at most? (4 if blank)");
+    unsigned int shards = 4;
+    if (!text.empty()) {
+        shards = strtoul(text.c_str(), nullptr, 10);
+        if (shards == 0) {
+            displayMessageToUser("That isn't a number of shards.");
+            return;
+        }
+    }
+    queryUserForText(&text, "Which port should the first shard use? (7100 if blank)");
+    unsigned long port = 7100;
+    if (!text.empty())
+        port = strtoul(text.c_str(), nullptr, 10);
+    if (port == 0 || port + shards > 65536) {
+        displayMessageToUser("That port won't do.");
+        return;
+    }
+    
+    ShardBenchmark result;
+    try {
+        result = ShardCluster::benchmark(tree.getTree(), shards, port);
+    } catch (exception& e) {
+        displayMessageToUser(string("Couldn't run the shards: ") + e.what());
+        return;
+    }
+    
+    ostringstream message;
+    message << "Copied " << result.ents << " Ents into each cluster. Sampled the ancestors and"
+            << " descendents of " << result.samples << " of them.\n"
+            << "\tShards\tLoad s\tAll ms\tRounds\tSent on\tSample ms\tRounds\tSent on\n";
+    message.setf(ios::fixed);
+    message.precision(2);
+    for (ShardRun& run : result.runs) {
+        message << "\t" << run.shards << "\t" << run.loadSeconds
+                << "\t" << run.everythingSeconds * 1000 << "\t" << run.everything.rounds
+                << "\t" << run.everything.exchanged
+                << "\t" << run.sampleSeconds * 1000 << "\t\t" << run.sampleRounds
+                << "\t" << run.sampleExchanged;
+        if (!run.agrees)
+            message << "\tfound the wrong number of Ents";
+        if (run.refused > 0)
+            message << "\t" << run.refused << " connects refused";
+        message << "\n";
+    }
+    message << "Rounds are trips out to the shards. Sent on counts the Ents passed from one"
+            << " shard to another.";
+    displayMessageToUser(message.str());
+}
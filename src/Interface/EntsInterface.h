@@ -25,6 +25,8 @@
 #include "InterfaceExceptions.h"
 #include "../Core/Tree.h"
 #include "Tests.h"
+#include "../Network/EntsServer.h"
+#include "../Network/EntsFollower.h"
 
 using namespace std;
 
@@ -55,11 +57,31 @@ class EntsInterface {
      */
     vector<Tree*> trees;
     
+    /**
+     * The server answering clients, if one has been started.
+     */
+    EntsServer* server;
+    
+    /**
+     * Keeps one of the trees a copy of another server's, if started.
+     */
+    EntsFollower* follower;
+    
     
     /*********************************************************************
      * Private methods for internal use.
      *********************************************************************/
     
+    /**
+     * Finds an open Tree by name, other than the one given, or else loads a
+     * saved file of that name.
+     * @param name          Name of the open Tree or the saved file.
+     * @param except        An open Tree not to pick, usually the one in use.
+     * @param loaded        Set to true if the Tree came from a file, in which
+     *                      case the caller must delete it.
+     * @return              The Tree, or nullptr if there is none.
+     */
+    Tree* findTreeOrFile(const string name, Tree* except, bool* loaded);
     
     
     /*********************************************************************
@@ -93,7 +115,168 @@ protected:
     
     void requestToRenameTree(TreeInstance tree);
     
-    void requestParentChildConnection(EntX parent, EntX child);
+    void requestParentChildConnection(TreeInstance tree, EntX parent, EntX child);
+    
+    /*
+     * Asks the user for a file format and path(s), then streams that file
+     * into the given Tree and reports how fast it went.
+     */
+    void requestToImportFile(TreeInstance tree);
+    
+    /*
+     * Asks the user for a file name and saves the given Tree to it.
+     */
+    void requestToSaveTree(TreeInstance tree);
+    
+    /*
+     * Asks the user which Tree to merge into the given one. It may be another
+     * open Tree, or the name of a saved file.
+     */
+    void requestTreeMerge(TreeInstance tree);
+    
+    /*
+     * Asks the user for an older version of the given Tree, open or saved,
+     * and shows what changed since. The changes can be saved as a patch.
+     */
+    void requestTreeDiff(TreeInstance tree);
+    
+    /*
+     * Asks the user for a saved patch and applies it to the given Tree.
+     */
+    void requestToApplyPatch(TreeInstance tree);
+    
+    /*
+     * Asks the user how many primes to find, then times the prime sieve
+     * against the old trial division and shows the results.
+     */
+    void requestPrimeBenchmark();
+    
+    /*
+     * Times threads connecting and disconnecting Ents in separate parts of
+     * a Tree at once, to show whether they get in each other's way.
+     */
+    void requestEditBenchmark();
+    
+    /*
+     * Asks the user how many threads to use, then times finding everything
+     * below the given Ent on one thread against the parallel traversal.
+     */
+    void requestTraversalBenchmark(TreeInstance tree, EntX ent);
+    
+    /*
+     * Asks the user for a port and how many threads to use, then starts a
+     * server in the background which lets clients query and edit the Tree.
+     */
+    void requestToStartServer(TreeInstance tree);
+    
+    /*
+     * Stops the server, if one is running.
+     */
+    void requestToStopServer();
+    
+    /*
+     * Asks the user for a primary server's address and port, then makes the
+     * Tree, which must be empty, a read-only copy of the primary's.
+     */
+    void requestToFollow(TreeInstance tree);
+    
+    /*
+     * Stops following the primary. The Tree keeps what it has.
+     */
+    void requestToStopFollowing();
+    
+    /*
+     * Shows how far behind the primary a follower is, or how many followers
+     * the server has.
+     */
+    void requestReplicationStatus();
+    
+    /*
+     * Asks the user for a server, an Ent and how long to watch it, then
+     * shows the changes made at or under the Ent in that time.
+     */
+    void requestToWatch();
+    
+    /*
+     * Shows the hits, misses and evictions of the server's query cache.
+     */
+    void requestCacheStats();
+    
+    /*
+     * Shows percentiles of how long the server has taken over each kind of
+     * request.
+     */
+    void requestLatencyStats();
+    
+    /*
+     * Asks the user how many threads and clients to use, then times a server
+     * for the Tree answering clients on this machine.
+     */
+    void requestServerBenchmark(TreeInstance tree);
+    
+    /*
+     * Asks the user how many connections to pool, then times a client looking
+     * up Ents one at a time, many at once, and in batches.
+     */
+    void requestClientBenchmark(TreeInstance tree);
+    
+    /*
+     * Asks the user for the most shards to try and a port to start from, then
+     * copies the Tree into more and more shard processes on this machine and
+     * times finding descendents and ancestors in each.
+     */
+    void requestShardBenchmark(TreeInstance tree);
+    
+    /*
+     * Asks the user how many cores and clients to use, then times a server
+     * with a copy of the Tree on each core against one sharing the Tree
+     * between as many threads.
+     */
+    void requestCoreBenchmark(TreeInstance tree);
+    
+    /*
+     * Asks the user how many clients to use and how many requests the server
+     * should take at once, then has far more than that thrown at a server on
+     * this machine, and shows its memory and latency each second.
+     */
+    void requestOverloadBenchmark(TreeInstance tree);
+    
+    /*
+     * Times finding Ents of the Tree by part of their name, in any case, and
+     * with typos.
+     */
+    void requestNameBenchmark(TreeInstance tree);
+    
+    /*
+     * Times finding the descendents of the Tree's biggest Ents as hash sets
+     * and as EntSets, combining them, and reading them from the set cache.
+     */
+    void requestSetBenchmark(TreeInstance tree);
+    
+    /*
+     * Answers a query, like "descendents(Dogs) & descendents(Pets)", and
+     * shows the Ents it found, or its plan if explain is true. Starts the
+     * Tree's set cache, so popular descendents are kept.
+     */
+    void requestQuery(TreeInstance tree, const string& text, bool explain);
+    
+    /*
+     * Asks the user for two Ents and which relations to go along, then
+     * shows the shortest chain of relations between them.
+     */
+    void requestPath(TreeInstance tree);
+    
+    /*
+     * Asks the user for an Ent, how many hops and which relations to go
+     * along, then shows the Ents that near it and the relations among them.
+     */
+    void requestNeighborhood(TreeInstance tree);
+    
+    /*
+     * Runs each algorithm's check, which compares its answers with a plainer
+     * way of finding them, and shows which agree.
+     */
+    void requestChecks();
     
     
     /*********************************************************************
@@ -31,6 +31,7 @@ using namespace std;
 class Tests {
     
     friend class EntsInterface;
+    friend class EntsService;
     
     static bool isValidTreeName(const string name, string* failureMessage);
     
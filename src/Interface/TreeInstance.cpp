@@ -50,6 +50,16 @@ const EntX TreeInstance::getEntByName(const string name) {
 
 }
 
+const vector<EntX> TreeInstance::getEntsNamedLike(const string text, size_t count) {
+    
+    NameIndex* index = tree->startNameIndex();
+    Tree::Reader reading;
+    vector<EntX> ents;
+    for (NameMatch& match : index->suggest(text, count))
+        ents.push_back(EntX(match.ent));
+    return ents;
+}
+
 const bool TreeInstance::isEntNameFree(const string name) {
     
     return tree->getEntPtrByName(name) == nullptr;
@@ -61,9 +71,17 @@ void TreeInstance::addEnt(Ent* ent, Ent* givenParent) {
     Ent* parent = tree->getRoot();
     if (givenParent != nullptr)
         parent = givenParent;
+    //A server may be reading or editing the Tree too.
+    Tree::Writer writing(tree);
     tree->addEntToNameMap(ent, parent);
 }
 
+Ent* TreeInstance::createEnt(const string name) {
+    if (tree->tryToCreateNewEnt(name) != SUCCESS)
+        return nullptr;
+    return tree->getEntPtrByName(name);
+}
+
 void TreeInstance::addEnt(EntX ent, EntX parent) {
     
     throw EntsInterfaceException();
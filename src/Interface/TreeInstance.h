@@ -74,6 +74,14 @@ class TreeInstance {
      */
     void addEnt(Ent* ent, Ent* parent = nullptr);
     
+    /**
+     * Makes a new Ent called name under root, unless the name is taken.
+     * Claiming the name and adding the Ent are one step, so no one else
+     * can take the name in between.
+     * @return  The new Ent, or nullptr if the name was taken.
+     */
+    Ent* createEnt(const string name);
+    
     void rename(string newName);
     
 public:
@@ -122,6 +130,13 @@ public:
     
     const EntX getEntByName(const string name);
     
+    /**
+     * Ents someone who typed text might have meant: those with the name in
+     * any case, then names starting with it, then names a couple of typos
+     * away. Names are indexed the first time it's called.
+     */
+    const vector<EntX> getEntsNamedLike(const string text, size_t count);
+    
     const bool isEntNameFree(const string name);
     
     const string getName();
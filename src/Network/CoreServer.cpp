@@ -0,0 +1,328 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "CoreServer.h"
+#include "EntsClient.h"
+#include "../Algorithms/TreeDiff.h"
+#include <thread>
+#include <random>
+
+using namespace std;
+
+CoreServer::CoreServer(Tree* tr, unsigned short port, unsigned int count,
+        const string& address): tree(tr), owner(tr), log(nullptr), listening(false) {
+    
+    unsigned int hardware = max(1u, thread::hardware_concurrency());
+    if (count == 0)
+        count = hardware;
+    
+    //Replicas pick up from the log where their snapshots leave off.
+    log = tree->startChangeLog();
+    
+    for (unsigned int i = 0; i < count; i++) {
+        cores.push_back(unique_ptr<Core>(new Core()));
+        Core* core = cores.back().get();
+        Tree* served = tree;
+        if (i > 0) {
+            core->replica.reset(new Tree(tree->getName() + " on core " + to_string(i)));
+            core->source.reset(new ReplicationSource(tree, FOLLOW_SNAPSHOT));
+            core->status.connected = true;
+            catchUp(core);
+            served = core->replica.get();
+        }
+        //The first picks the port if it's 0, and the rest join it.
+        core->server.reset(new EntsServer(served, i == 0 ? port : getPort(), 1, address, true));
+        core->server->pin(i % hardware);
+        if (i > 0) {
+            core->server->setForwarder([this, core](const EntsRequest& request,
+                    function<void(EntsResponse)> reply) {
+                forward(core, request, reply);
+            });
+            core->server->setFollowed(tree);
+        }
+    }
+}
+
+CoreServer::~CoreServer() {
+    stop();
+}
+
+void CoreServer::start() {
+    
+    if (!listening) {
+        listening = true;
+        //Called with the log locked, on whatever thread made the change, so
+        //it only hands off to the cores, and only once each until they
+        //catch up.
+        log->listen(this, [this] {
+            for (size_t i = 1; i < cores.size(); i++) {
+                Core* core = cores[i].get();
+                if (!core->behind.exchange(true))
+                    core->server->post([this, core] { catchUp(core); });
+            }
+        });
+        //Anything changed since the replicas were made.
+        for (size_t i = 1; i < cores.size(); i++) {
+            Core* core = cores[i].get();
+            core->behind.store(true);
+            core->server->post([this, core] { catchUp(core); });
+        }
+    }
+    for (unique_ptr<Core>& core : cores)
+        core->server->start();
+}
+
+void CoreServer::stop() {
+    
+    if (listening) {
+        log->unlisten(this);
+        listening = false;
+    }
+    //The owner goes last. A core waiting on a full queue needs it to empty
+    //the queue before it can stop.
+    for (size_t i = cores.size(); i-- > 0;)
+        cores[i]->server->stop();
+    //Nothing is running now, so the queues can be emptied from here.
+    Forwarded left;
+    for (unique_ptr<Core>& core : cores) {
+        while (core->edits.pop(&left))
+            left = Forwarded();
+    }
+}
+
+void CoreServer::forward(Core* from, const EntsRequest& request,
+        function<void(EntsResponse)> reply) {
+    
+    Forwarded edit = {request, reply};
+    //The owner never waits on other cores, so it will make room.
+    while (!from->edits.push(edit))
+        this_thread::yield();
+    if (!from->draining.exchange(true))
+        cores[0]->server->post([this, from] { drain(from); });
+}
+
+void CoreServer::drain(Core* from) {
+    
+    //Cleared first, so an edit queued from here on asks again.
+    from->draining.store(false);
+    Forwarded edit;
+    while (from->edits.pop(&edit)) {
+        EntsResponse response = owner.execute(edit.request);
+        function<void(EntsResponse)> reply = edit.reply;
+        //The edit is in the log by now, so once the core has caught up its
+        //client can see it.
+        from->server->post([this, from, reply, response] {
+            catchUp(from);
+            reply(response);
+        });
+    }
+}
+
+void CoreServer::catchUp(Core* core) {
+    
+    core->behind.store(false);
+    Tree* replica = core->replica.get();
+    for (;;) {
+        ChangeBatch batch;
+        if (!core->source->next(BATCH_SIZE, &batch))
+            return;
+        if (batch.status != STATUS_MORE) {
+            //Only if the core was held up while the log's whole capacity of
+            //changes were made. The replica stays as it is.
+            lock_guard<mutex> hold(core->statusLock);
+            core->status.connected = false;
+            core->status.error = "Fell too far behind the log to catch up.";
+            return;
+        }
+        
+        uint64_t skipped = 0;
+        {
+            Tree::Writer writing(replica);
+            if (batch.snapshot)
+                replica->setOrigin(batch.origin);
+            for (const TreeChange& change : batch.changes) {
+                if (!EntsFollower::apply(replica, change))
+                    skipped++;
+            }
+        }
+        
+        lock_guard<mutex> hold(core->statusLock);
+        core->status.changes += batch.changes.size() - skipped;
+        core->status.skipped += skipped;
+        core->status.end = batch.end;
+        if (!batch.snapshot) {
+            core->status.caughtUp = true;
+            core->status.applied = batch.offset;
+            if (!batch.changes.empty())
+                core->status.lag = ChangeLog::now() - batch.time;
+        }
+    }
+}
+
+uint64_t CoreServer::getRequestCount() {
+    uint64_t count = 0;
+    for (unique_ptr<Core>& core : cores)
+        count += core->server->getRequestCount();
+    return count;
+}
+
+ReplicationStatus CoreServer::getReplicaStatus(unsigned int index) {
+    
+    ReplicationStatus status;
+    if (index == 0 || index >= cores.size()) {
+        status.connected = status.caughtUp = true;
+        status.applied = status.end = log->getEnd();
+        return status;
+    }
+    Core* core = cores[index].get();
+    {
+        lock_guard<mutex> hold(core->statusLock);
+        status = core->status;
+    }
+    status.end = max(status.end, log->getEnd());
+    return status;
+}
+
+pair<ServerBenchmark, ServerBenchmark> CoreServer::benchmark(Tree* tree,
+        unsigned int cores, unsigned int clients, double seconds) {
+    
+    pair<ServerBenchmark, ServerBenchmark> results;
+    {
+        CoreServer server(tree, 0, cores, "127.0.0.1");
+        server.start();
+        results.first = EntsServer::measure(tree, server.getPort(), clients, seconds);
+        results.first.threads = server.getCoreCount();
+    }
+    results.second = EntsServer::benchmark(tree, results.first.threads, clients, seconds);
+    return results;
+}
+
+string CoreServer::check() {
+    
+    const unsigned int CLIENTS = 6;
+    
+    mt19937 random(44);
+    Tree tree("Core check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 2000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        tree.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 50 == 0) {
+            Ent::connectUnchecked(tree.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    vector<unsigned int> uids;
+    for (Ent* ent : ents)
+        uids.push_back(ent->getUID());
+    
+    CoreServer server(&tree, 0, 3, "127.0.0.1");
+    server.start();
+    
+    //Each client puts new Ents under old ones, and asks after each straight
+    //away, from whichever core it was given.
+    vector<string> failures(CLIENTS);
+    vector<thread> clients;
+    for (unsigned int c = 0; c < CLIENTS; c++) {
+        clients.push_back(thread([&, c] {
+            mt19937 picking(440 + c);
+            try {
+                EntsClient client("127.0.0.1", server.getPort(), 1);
+                for (int i = 0; i < 100; i++) {
+                    EntsRequest create;
+                    create.op = OP_CREATE_ENT;
+                    create.a.name = "core " + to_string(c) + " " + to_string(i);
+                    EntsResponse created = client.call(create).get();
+                    if (created.status != STATUS_OK || created.ents.size() != 1) {
+                        failures[c] = "couldn't create " + create.a.name;
+                        return;
+                    }
+                    EntsRequest connect;
+                    connect.op = OP_CONNECT;
+                    connect.a.uid = uids[picking() % uids.size()];
+                    connect.b.uid = created.ents[0].uid;
+                    if (client.call(connect).get().status != STATUS_OK) {
+                        failures[c] = "couldn't connect " + create.a.name;
+                        return;
+                    }
+                    EntsRequest parents;
+                    parents.op = OP_GET_PARENTS;
+                    parents.a.name = create.a.name;
+                    EntsResponse answer = client.call(parents).get();
+                    if (answer.status != STATUS_OK || answer.ents.size() != 1
+                            || answer.ents[0].uid != connect.a.uid) {
+                        failures[c] = "client " + to_string(c) + " didn't see its own edit";
+                        return;
+                    }
+                }
+            } catch (exception& e) {
+                failures[c] = e.what();
+            }
+        }));
+    }
+    
+    //Meanwhile the Tree is edited directly. Parents always come before
+    //their children in ents, so these can't make loops.
+    for (int round = 0; round < 50; round++) {
+        Tree::Writer writing(&tree);
+        for (int i = 0; i < 20; i++) {
+            size_t c = 1 + random() % (ents.size() - 1);
+            Ent* child = ents[c];
+            vector<Ent*> parents = child->getParents();
+            if (parents.size() > 1)
+                Ent::disconnectUnchecked(parents[random() % parents.size()], child);
+            Ent* parent = ents[random() % c];
+            if (!child->isChildOf(parent))
+                Ent::connectUnchecked(parent, child);
+        }
+    }
+    for (thread& t : clients)
+        t.join();
+    for (string& failure : failures) {
+        if (!failure.empty())
+            return failure;
+    }
+    
+    //Every replica catches up in the end.
+    for (unsigned int i = 1; i < server.getCoreCount(); i++) {
+        for (int tries = 0;; tries++) {
+            ReplicationStatus status = server.getReplicaStatus(i);
+            if (status.applied == server.log->getEnd())
+                break;
+            if (tries == 1000)
+                return "core " + to_string(i) + " didn't catch up";
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+    }
+    server.stop();
+    for (unsigned int i = 1; i < server.getCoreCount(); i++) {
+        if (server.getReplicaStatus(i).skipped != 0)
+            return "core " + to_string(i) + " skipped changes";
+        TreeDelta left = TreeDiff::diff(&tree, server.cores[i]->replica.get());
+        if (!left.isEmpty())
+            return "core " + to_string(i) + "'s replica differs from the Tree: "
+                    + TreeDiff::write(left);
+    }
+    return "";
+}
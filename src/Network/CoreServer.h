@@ -0,0 +1,182 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CORESERVER_H
+#define CORESERVER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include "EntsServer.h"
+#include "EntsFollower.h"
+#include "ReplicationSource.h"
+#include "../Core/SpscQueue.h"
+
+using namespace std;
+
+/**
+ * Serves a Tree with one thread per core, each with its own copy of the
+ * Tree, so lookups on different cores share nothing and scale with them.
+ *
+ * Every core runs an EntsServer of one thread, kept on that core, and all of
+ * them listen on the same port (SO_REUSEPORT), so the system spreads new
+ * clients between them. The first core, the owner, serves the Tree itself.
+ * Each of the others serves a read-only replica, copied from a snapshot at
+ * the start and kept up with the Tree's log, like a follower in the same
+ * process.
+ *
+ * Edits all go to the owner. A core hands each of its edits over through a
+ * lock-free queue of its own, which only it fills and only the owner empties.
+ * Once the owner has made the edit, the core catches its replica up before
+ * answering, so a client always sees its own edits. Other clients see them
+ * a moment later, when their core next catches up.
+ *
+ * The Tree can still be edited directly while it's served. Its replicas
+ * catch up all the same.
+ */
+class CoreServer {
+
+    /**
+     * An edit on its way to the owner, and where its answer goes.
+     */
+    struct Forwarded {
+        EntsRequest request;
+        function<void(EntsResponse)> reply;
+    };
+
+    struct Core {
+        /** nullptr on the owner, which serves the Tree itself. */
+        unique_ptr<Tree> replica;
+        unique_ptr<ReplicationSource> source;
+        unique_ptr<EntsServer> server;
+        /** Edits for the owner. */
+        SpscQueue<Forwarded> edits;
+        /** Set while the owner has been asked to empty edits. */
+        atomic<bool> draining;
+        /** Set while the core has been asked to catch up. */
+        atomic<bool> behind;
+        mutex statusLock;
+        ReplicationStatus status;
+
+        Core(): edits(QUEUE_SIZE), draining(false), behind(false) {}
+    };
+
+    static const size_t QUEUE_SIZE = 1024;
+    /**
+     * The most changes a replica plays back in one Writer.
+     */
+    static const size_t BATCH_SIZE = 4096;
+
+    Tree* tree;
+    /**
+     * Makes forwarded edits on the owner's thread.
+     */
+    EntsService owner;
+    ChangeLog* log;
+    vector<unique_ptr<Core> > cores;
+    bool listening;
+
+    /**
+     * Hands an edit from a core to the owner. Called on that core's thread.
+     */
+    void forward(Core* from, const EntsRequest& request, function<void(EntsResponse)> reply);
+
+    /**
+     * Makes the edits waiting from a core. Called on the owner's thread.
+     */
+    void drain(Core* from);
+
+    /**
+     * Plays back the Tree's changes on a core's replica, up to the end of
+     * the log. Called on that core's thread.
+     */
+    void catchUp(Core* core);
+
+public:
+
+    /**
+     * Copies the Tree for each core and starts listening, but doesn't answer
+     * anyone until start().
+     * @param tree      The Tree to serve.
+     * @param port      The TCP port. 0 picks a free one.
+     * @param count     How many cores to use. All of them if 0.
+     * @param address   Where to listen. Everywhere by default.
+     * @throws boost::system::system_error if the port can't be opened.
+     */
+    CoreServer(Tree* tree, unsigned short port = 1037, unsigned int count = 0,
+            const string& address = "0.0.0.0");
+
+    /**
+     * Stops the server if it's running.
+     */
+    ~CoreServer();
+
+    CoreServer(const CoreServer&) = delete;
+    CoreServer& operator=(const CoreServer&) = delete;
+
+    /**
+     * Starts a thread on each core. Returns straight away.
+     */
+    void start();
+
+    /**
+     * Stops every core's thread. A stopped server can't be started again.
+     */
+    void stop();
+
+    unsigned short getPort() {
+        return cores[0]->server->getPort();
+    }
+
+    unsigned int getCoreCount() {
+        return cores.size();
+    }
+
+    uint64_t getRequestCount();
+
+    /**
+     * How a core's replica is keeping up with the Tree. The owner's is
+     * always caught up.
+     */
+    ReplicationStatus getReplicaStatus(unsigned int core);
+
+    /**
+     * Starts a server of each kind for the Tree on free localhost ports, one
+     * with a thread per core and one sharing the Tree between as many
+     * threads, and has a number of clients look up Ents as fast as they can
+     * for a while, as in EntsServer::benchmark().
+     * @return          The thread per core server's results, then the
+     *                  shared one's.
+     */
+    static pair<ServerBenchmark, ServerBenchmark> benchmark(Tree* tree,
+            unsigned int cores, unsigned int clients, double seconds);
+
+    /**
+     * Serves a made up Tree from three cores to clients which each create
+     * and connect Ents, and read them straight back, while the Tree is also
+     * edited directly.
+     * @return          "" if every client sees its own edits, and every
+     *                  replica ends up the same as the Tree, otherwise what
+     *                  went wrong.
+     */
+    static string check();
+
+};
+
+#endif /* CORESERVER_H */
@@ -17,28 +17,800 @@
  */
 
 #include "EntsClient.h"
+#include "EntsProtocol.h"
+#include "EntsServer.h"
+#include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdexcept>
+#include <random>
 
 using boost::asio::ip::tcp;
 
 using namespace std;
 
-int EntsClient::connect() {
+/**
+ * The answers to a batch, filled in as they arrive.
+ */
+struct EntsBatch {
+    promise<vector<EntsResponse> > answers;
+    vector<EntsResponse> responses;
+    size_t left;
+    bool failed;
 
-    try {
+    EntsBatch(size_t size): responses(size), left(size), failed(false) {}
+};
+
+/**
+ * The chunks of a stream that have arrived and not been read yet.
+ */
+struct EntsStreamState {
+    mutex lock;
+    condition_variable arrived;
+    deque<EntsResponse> chunks;
+    exception_ptr error;
+    /**
+     * The stream's request ID. Only used on the io thread.
+     */
+    uint32_t id;
+};
+
+/**
+ * The batches of a watch that have arrived and not been read yet.
+ */
+struct EntsWatchState {
+    mutex lock;
+    condition_variable arrived;
+    deque<ChangeBatch> batches;
+    exception_ptr error;
+    /**
+     * The watch's request ID. Only used on the io thread.
+     */
+    uint32_t id;
+};
+
+/**
+ * Where the answer to one request goes: its own promise, a place in a
+ * batch, a stream, or a watch. counted is set until the request's first
+ * answer frees up its place in the connection's window.
+ */
+struct EntsPending {
+    shared_ptr<promise<EntsResponse> > single;
+    shared_ptr<EntsBatch> batch;
+    size_t place;
+    shared_ptr<EntsStreamState> stream;
+    shared_ptr<EntsWatchState> watch;
+    bool counted;
+
+    /**
+     * Passes on a watch's batch.
+     * @return          false if the watch goes on.
+     */
+    bool watched(ChangeBatch changes) {
+        bool last = changes.status != STATUS_MORE;
+        lock_guard<mutex> hold(watch->lock);
+        watch->batches.push_back(std::move(changes));
+        watch->arrived.notify_one();
+        return last;
+    }
+
+    /**
+     * @return          false if there's more to come for the same request.
+     */
+    bool answer(EntsResponse response) {
+        if (stream != nullptr) {
+            bool last = response.status != STATUS_MORE;
+            lock_guard<mutex> hold(stream->lock);
+            stream->chunks.push_back(std::move(response));
+            stream->arrived.notify_one();
+            return last;
+        }
+        if (single != nullptr) {
+            single->set_value(std::move(response));
+        } else if (!batch->failed) {
+            batch->responses[place] = std::move(response);
+            if (--batch->left == 0)
+                batch->answers.set_value(std::move(batch->responses));
+        }
+        return true;
+    }
+
+    void fail(exception_ptr error) {
+        if (watch != nullptr) {
+            lock_guard<mutex> hold(watch->lock);
+            watch->error = error;
+            watch->arrived.notify_one();
+        } else if (stream != nullptr) {
+            lock_guard<mutex> hold(stream->lock);
+            stream->error = error;
+            stream->arrived.notify_one();
+        } else if (single != nullptr) {
+            single->set_exception(error);
+        } else if (!batch->failed) {
+            batch->failed = true;
+            batch->answers.set_exception(error);
+        }
+    }
+};
+
+/**
+ * Requests waiting to be written, and their frames. Kept until the write is
+ * done, since the frames point into the requests. counted is how many of
+ * them take up a place in the connection's window.
+ */
+struct EntsOutgoing {
+    vector<EntsRequest> requests;
+    vector<EntsFrame> frames;
+    unsigned int counted;
+
+    EntsOutgoing(): counted(0) {}
+};
+
+/**
+ * One connection of a client's pool. Everything here runs on the client's
+ * io thread, so nothing needs locking.
+ *
+ * Requests are held back once the server's window (CONNECTION_WINDOW) is
+ * full, and go out as answers come in. Control requests always go straight
+ * out, so a stream can carry on however much else is waiting. A batch goes
+ * whole once there's any room, and the server holds back what doesn't fit.
+ */
+class EntsConnection : public enable_shared_from_this<EntsConnection> {
+
+    boost::asio::io_context& io;
+    const string& host;
+    const string& port;
+    tcp::resolver resolver;
+    tcp::socket socket;
+    bool connected;
+    bool connecting;
+    /**
+     * Goes up each time the connection is opened, so handlers from a
+     * connection that failed can tell they're out of date.
+     */
+    unsigned int generation;
+    uint32_t nextID;
+    FrameBuffer input;
+    unordered_map<uint32_t, EntsPending> pending;
+    vector<shared_ptr<EntsOutgoing> > waiting;
+    vector<shared_ptr<EntsOutgoing> > sending;
+    vector<boost::asio::const_buffer> buffers;
+    bool writing;
+    /**
+     * How many requests written haven't had an answer yet.
+     */
+    unsigned int unanswered;
+
+    /**
+     * Frees up an answered request's place in the window.
+     */
+    void answered(EntsPending& pending) {
+        if (pending.counted) {
+            pending.counted = false;
+            unanswered--;
+        }
+    }
+
+    void open() {
+        
+        connecting = true;
+        generation++;
+        unsigned int mine = generation;
+        shared_ptr<EntsConnection> self = shared_from_this();
+        resolver.async_resolve(host, port, [self, mine](const boost::system::error_code& error,
+                tcp::resolver::results_type endpoints) {
+            if (mine != self->generation)
+                return;
+            if (error) {
+                self->failAll(error);
+                return;
+            }
+            boost::asio::async_connect(self->socket, endpoints, [self, mine](
+                    const boost::system::error_code& error, const tcp::endpoint&) {
+                if (mine != self->generation)
+                    return;
+                if (error) {
+                    self->failAll(error);
+                    return;
+                }
+                boost::system::error_code ignored;
+                self->socket.set_option(tcp::no_delay(true), ignored);
+                self->connecting = false;
+                self->connected = true;
+                self->read();
+                self->write();
+            });
+        });
+    }
+
+    void read() {
+        
+        unsigned int mine = generation;
+        shared_ptr<EntsConnection> self = shared_from_this();
+        socket.async_read_some(input.space(), [self, mine](const boost::system::error_code& error,
+                size_t bytes) {
+            if (mine != self->generation)
+                return;
+            if (error) {
+                self->failAll(error);
+                return;
+            }
+            
+            self->input.filled(bytes);
+            const char* body;
+            size_t size;
+            while (self->input.next(&body, &size)) {
+                uint32_t id;
+                //Watches are answered with batches of changes, not responses.
+                unordered_map<uint32_t, EntsPending>::iterator found = self->pending.end();
+                if (EntsFrame::readID(body, size, &id))
+                    found = self->pending.find(id);
+                bool last;
+                if (found != self->pending.end() && found->second.watch != nullptr) {
+                    ChangeBatch changes;
+                    if (!EntsFrame::readBatch(body, size, &id, &changes)) {
+                        self->failAll(boost::asio::error::invalid_argument);
+                        return;
+                    }
+                    last = found->second.watched(std::move(changes));
+                } else {
+                    EntsResponse response;
+                    if (!EntsFrame::readResponse(body, size, &id, &response)) {
+                        self->failAll(boost::asio::error::invalid_argument);
+                        return;
+                    }
+                    if (found != self->pending.end())
+                        self->answered(found->second);
+                    last = found != self->pending.end() && found->second.answer(std::move(response));
+                }
+                if (last)
+                    self->pending.erase(found);
+            }
+            if (self->input.isBroken()) {
+                self->failAll(boost::asio::error::message_size);
+                return;
+            }
+            self->write();
+            self->read();
+        });
+    }
+
+    void write() {
+        
+        if (writing || !connected || waiting.empty())
+            return;
+        
+        //Whatever the window has room for, in order, but with control
+        //requests let past the rest.
+        vector<shared_ptr<EntsOutgoing> > held;
+        for (shared_ptr<EntsOutgoing>& outgoing : waiting) {
+            if (outgoing->counted == 0 || unanswered < CONNECTION_WINDOW) {
+                unanswered += outgoing->counted;
+                sending.push_back(outgoing);
+            } else {
+                held.push_back(outgoing);
+            }
+        }
+        waiting.swap(held);
+        if (sending.empty())
+            return;
+        
+        writing = true;
+        buffers.clear();
+        for (shared_ptr<EntsOutgoing>& outgoing : sending) {
+            for (EntsFrame& frame : outgoing->frames)
+                frame.addBuffers(&buffers);
+        }
+        
+        unsigned int mine = generation;
+        shared_ptr<EntsConnection> self = shared_from_this();
+        boost::asio::async_write(socket, buffers, [self, mine](const boost::system::error_code& error,
+                size_t) {
+            if (mine != self->generation)
+                return;
+            self->writing = false;
+            self->sending.clear();
+            if (error) {
+                self->failAll(error);
+                return;
+            }
+            self->write();
+        });
+    }
+
+    /**
+     * Closes the connection and passes the error on to every call waiting
+     * on it. The next call opens it again.
+     */
+    void failAll(const boost::system::error_code& error) {
+        
+        generation++;
+        connected = false;
+        connecting = false;
+        writing = false;
+        boost::system::error_code ignored;
+        socket.close(ignored);
+        input = FrameBuffer();
+        waiting.clear();
+        sending.clear();
+        unanswered = 0;
+        
+        exception_ptr failure = make_exception_ptr(boost::system::system_error(error));
+        for (pair<const uint32_t, EntsPending>& p : pending)
+            p.second.fail(failure);
+        pending.clear();
+    }
+
+public:
+
+    EntsConnection(boost::asio::io_context& context, const string& h, const string& p):
+            io(context), host(h), port(p), resolver(context), socket(context),
+            connected(false), connecting(false), generation(0), nextID(0), writing(false),
+            unanswered(0) {}
+
+    /**
+     * Queues requests to be written, and where their answers go.
+     */
+    void send(shared_ptr<EntsOutgoing> outgoing, vector<EntsPending>& answers) {
+        
+        outgoing->frames.reserve(outgoing->requests.size());
+        for (size_t i = 0; i < outgoing->requests.size(); i++) {
+            uint32_t id = nextID++;
+            outgoing->frames.push_back(EntsFrame(id, outgoing->requests[i]));
+            answers[i].counted = EntsService::laneFor(outgoing->requests[i].op) != LANE_CONTROL;
+            if (answers[i].counted)
+                outgoing->counted++;
+            pending[id] = answers[i];
+            if (answers[i].stream != nullptr)
+                answers[i].stream->id = id;
+            if (answers[i].watch != nullptr)
+                answers[i].watch->id = id;
+        }
+        waiting.push_back(outgoing);
+        
+        if (connected)
+            write();
+        else if (!connecting)
+            open();
+    }
+
+    /**
+     * Sends OP_MORE or OP_CANCEL for a stream. Nothing's sent if the stream
+     * has finished, or its connection failed.
+     */
+    void control(shared_ptr<EntsStreamState> stream, EntsOp op) {
+        
+        unordered_map<uint32_t, EntsPending>::iterator found = pending.find(stream->id);
+        if (found == pending.end() || found->second.stream != stream)
+            return;
+        if (op == OP_CANCEL) {
+            answered(found->second);
+            pending.erase(found);
+        }
+        sendControl(stream->id, op);
+    }
+
+    /**
+     * Cancels a watch. Nothing's sent if it's over, or its connection failed.
+     */
+    void unwatch(shared_ptr<EntsWatchState> watch) {
+        
+        unordered_map<uint32_t, EntsPending>::iterator found = pending.find(watch->id);
+        if (found == pending.end() || found->second.watch != watch)
+            return;
+        pending.erase(found);
+        sendControl(watch->id, OP_CANCEL);
+    }
+
+    void sendControl(uint32_t id, EntsOp op) {
+        shared_ptr<EntsOutgoing> outgoing = make_shared<EntsOutgoing>();
+        outgoing->requests.resize(1);
+        outgoing->requests[0].op = op;
+        outgoing->frames.push_back(EntsFrame(id, outgoing->requests[0]));
+        waiting.push_back(outgoing);
+        write();
+    }
+
+    void close() {
+        generation++;
+        boost::system::error_code ignored;
+        resolver.cancel();
+        socket.close(ignored);
+    }
+
+};
+
+
+EntsClient::EntsClient(const string& h, unsigned short p, unsigned int poolSize):
+        host(h), port(to_string(p)), work(boost::asio::make_work_guard(io)),
+        nextConnection(0) {
+    
+    for (unsigned int i = 0; i < max(1u, poolSize); i++)
+        connections.push_back(make_shared<EntsConnection>(io, host, port));
+    ioThread = thread([this] { io.run(); });
+}
 
-        tcp::iostream s("35.160.222.230:1307", "tcp");
-        if (!s) {
-            cout << "Unable to connect: " << s.error().message() << endl;
-            return 1;
+EntsClient::~EntsClient() {
+    
+    io.stop();
+    ioThread.join();
+    //Nothing else is touching them now.
+    for (shared_ptr<EntsConnection>& connection : connections)
+        connection->close();
+}
+
+future<EntsResponse> EntsClient::call(const EntsRequest& request) {
+    
+    shared_ptr<promise<EntsResponse> > answer = make_shared<promise<EntsResponse> >();
+    future<EntsResponse> result = answer->get_future();
+    
+    shared_ptr<EntsOutgoing> outgoing = make_shared<EntsOutgoing>();
+    outgoing->requests.push_back(request);
+    shared_ptr<EntsConnection> connection = pick();
+    boost::asio::post(io, [connection, outgoing, answer] {
+        vector<EntsPending> answers(1);
+        answers[0].single = answer;
+        connection->send(outgoing, answers);
+    });
+    return result;
+}
+
+future<vector<EntsResponse> > EntsClient::callBatch(vector<EntsRequest> requests) {
+    
+    shared_ptr<EntsBatch> batch = make_shared<EntsBatch>(requests.size());
+    future<vector<EntsResponse> > result = batch->answers.get_future();
+    if (requests.empty()) {
+        batch->answers.set_value(vector<EntsResponse>());
+        return result;
+    }
+    
+    shared_ptr<EntsOutgoing> outgoing = make_shared<EntsOutgoing>();
+    outgoing->requests = std::move(requests);
+    shared_ptr<EntsConnection> connection = pick();
+    boost::asio::post(io, [connection, outgoing, batch] {
+        vector<EntsPending> answers(outgoing->requests.size());
+        for (size_t i = 0; i < answers.size(); i++) {
+            answers[i].batch = batch;
+            answers[i].place = i;
         }
+        connection->send(outgoing, answers);
+    });
+    return result;
+}
+
+EntsStream EntsClient::stream(const EntsRequest& request) {
+    
+    shared_ptr<EntsStreamState> state = make_shared<EntsStreamState>();
+    shared_ptr<EntsOutgoing> outgoing = make_shared<EntsOutgoing>();
+    outgoing->requests.push_back(request);
+    shared_ptr<EntsConnection> connection = pick();
+    boost::asio::post(io, [connection, outgoing, state] {
+        vector<EntsPending> answers(1);
+        answers[0].stream = state;
+        connection->send(outgoing, answers);
+    });
+    return EntsStream(&io, connection, state);
+}
+
+EntsWatch EntsClient::watch(const EntKey& key) {
+    
+    shared_ptr<EntsWatchState> state = make_shared<EntsWatchState>();
+    shared_ptr<EntsOutgoing> outgoing = make_shared<EntsOutgoing>();
+    outgoing->requests.resize(1);
+    outgoing->requests[0].op = OP_WATCH;
+    outgoing->requests[0].a = key;
+    shared_ptr<EntsConnection> connection = pick();
+    boost::asio::post(io, [connection, outgoing, state] {
+        vector<EntsPending> answers(1);
+        answers[0].watch = state;
+        connection->send(outgoing, answers);
+    });
+    
+    EntsWatch watch(&io, connection, state);
+    //The first batch only says whether it took.
+    ChangeBatch taken;
+    watch.next(&taken);
+    return watch;
+}
+
+void EntsClient::connect() {
 
-        string line;
-        getline(s, line);
-        cout << line << endl;
+    EntsRequest ping;
+    ping.op = OP_PING;
+    vector<future<vector<EntsResponse> > > answers;
+    //One ping down each connection.
+    for (size_t i = 0; i < connections.size(); i++)
+        answers.push_back(callBatch(vector<EntsRequest>(1, ping)));
 
+    try {
+        for (future<vector<EntsResponse> >& answer : answers)
+            answer.get();
     } catch (exception& e) {
-        cout << "Exception: " << e.what() << endl;
+        throw runtime_error(string("Unable to connect: ") + e.what());
     }
+}
+
+EntsStream::EntsStream(boost::asio::io_context* context, shared_ptr<EntsConnection> c,
+        shared_ptr<EntsStreamState> s): io(context), connection(c), state(s), at(0) {
+    //Nothing's been read, so there's more to come.
+    chunk.status = STATUS_MORE;
+}
+
+EntsStream::EntsStream(EntsStream&& other): io(other.io), connection(std::move(other.connection)),
+        state(std::move(other.state)), chunk(std::move(other.chunk)), at(other.at) {
+}
+
+EntsStream::~EntsStream() {
+    
+    if (state == nullptr || chunk.status != STATUS_MORE)
+        return;
+    //Stopped early. Let the server know so it can stop too.
+    shared_ptr<EntsConnection> c = connection;
+    shared_ptr<EntsStreamState> s = state;
+    boost::asio::post(*io, [c, s] { c->control(s, OP_CANCEL); });
+}
+
+EntsWatch::EntsWatch(boost::asio::io_context* context, shared_ptr<EntsConnection> c,
+        shared_ptr<EntsWatchState> s): io(context), connection(c), state(s), status(STATUS_MORE) {
+}
 
-    return 0;
-}
\ No newline at end of file
+EntsWatch::EntsWatch(EntsWatch&& other): io(other.io), connection(std::move(other.connection)),
+        state(std::move(other.state)), status(other.status) {
+}
+
+EntsWatch::~EntsWatch() {
+    
+    if (state == nullptr || status != STATUS_MORE)
+        return;
+    shared_ptr<EntsConnection> c = connection;
+    shared_ptr<EntsWatchState> s = state;
+    boost::asio::post(*io, [c, s] { c->unwatch(s); });
+}
+
+bool EntsWatch::next(ChangeBatch* batch, chrono::milliseconds wait) {
+    
+    if (status != STATUS_MORE)
+        return false;
+    
+    unique_lock<mutex> hold(state->lock);
+    function<bool()> arrived = [this] {
+        return !state->batches.empty() || state->error != nullptr;
+    };
+    if (wait.count() < 0)
+        state->arrived.wait(hold, arrived);
+    else if (!state->arrived.wait_for(hold, wait, arrived))
+        return false;
+    if (state->batches.empty())
+        rethrow_exception(state->error);
+    
+    *batch = std::move(state->batches.front());
+    state->batches.pop_front();
+    status = batch->status;
+    return true;
+}
+
+bool EntsStream::next(EntRef* ent) {
+    
+    while (at == chunk.ents.size()) {
+        if (chunk.status != STATUS_MORE)
+            return false;
+        
+        {
+            unique_lock<mutex> hold(state->lock);
+            state->arrived.wait(hold, [this] {
+                return !state->chunks.empty() || state->error != nullptr;
+            });
+            if (state->chunks.empty())
+                rethrow_exception(state->error);
+            chunk = std::move(state->chunks.front());
+            state->chunks.pop_front();
+        }
+        at = 0;
+        
+        //Taking a chunk makes room for another.
+        if (chunk.status == STATUS_MORE) {
+            shared_ptr<EntsConnection> c = connection;
+            shared_ptr<EntsStreamState> s = state;
+            boost::asio::post(*io, [c, s] { c->control(s, OP_MORE); });
+        }
+    }
+    
+    *ent = std::move(chunk.ents[at++]);
+    return true;
+}
+
+ClientBenchmark EntsClient::benchmark(Tree* tree, unsigned int poolSize, double seconds) {
+    
+    const unsigned int BATCH = 64;
+    
+    vector<EntsRequest> batch;
+    for (string& name : tree->sampleNames(BATCH)) {
+        EntsRequest request;
+        request.op = OP_FIND;
+        request.a.name = name;
+        batch.push_back(request);
+    }
+    //Small Trees repeat names to make up a full batch.
+    size_t names = batch.size();
+    while (batch.size() < BATCH)
+        batch.push_back(batch[batch.size() % names]);
+    
+    EntsServer server(tree, 0, 0, "127.0.0.1");
+    server.start();
+    EntsClient client("127.0.0.1", server.getPort(), poolSize);
+    client.connect();
+    
+    ClientBenchmark result;
+    result.connections = poolSize;
+    result.batchSize = BATCH;
+    
+    //Each way gets a third of the time.
+    chrono::duration<double> share(seconds / 3);
+    chrono::steady_clock::time_point start;
+    uint64_t count;
+    
+    start = chrono::steady_clock::now();
+    for (count = 0; chrono::steady_clock::now() - start < share; count++)
+        client.call(batch[count % BATCH]).get();
+    result.oneAtATime = count / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    start = chrono::steady_clock::now();
+    vector<future<EntsResponse> > answers;
+    for (count = 0; chrono::steady_clock::now() - start < share; count += BATCH) {
+        answers.clear();
+        for (EntsRequest& request : batch)
+            answers.push_back(client.call(request));
+        for (future<EntsResponse>& answer : answers)
+            answer.get();
+    }
+    result.pipelined = count / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    start = chrono::steady_clock::now();
+    for (count = 0; chrono::steady_clock::now() - start < share; count += BATCH)
+        client.callBatch(batch).get();
+    result.batched = count / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    EntsRequest everything;
+    everything.op = OP_GET_DESCENDENTS;
+    everything.a.uid = tree->getRoot()->getUID();
+    everything.a.name = tree->getRoot()->getName();
+    start = chrono::steady_clock::now();
+    EntsStream stream = client.stream(everything);
+    EntRef ent;
+    for (result.streamedEnts = 0; stream.next(&ent); result.streamedEnts++);
+    result.streamed = result.streamedEnts
+            / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    return result;
+}
+
+string EntsClient::check() {
+    
+    const unsigned int THREADS = 4;
+    
+    mt19937 random(38);
+    Tree tree("Client check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 3000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        tree.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 50 == 0) {
+            Ent::connectUnchecked(tree.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    
+    //Lookups mixed with creates, which can be answered out of order. New
+    //Ents go under root, which isn't looked up, so the answers the Tree
+    //gives now still hold.
+    EntsService direct(&tree);
+    vector<vector<EntsRequest> > requests(THREADS);
+    vector<vector<EntsResponse> > expected(THREADS);
+    for (unsigned int t = 0; t < THREADS; t++) {
+        for (int i = 0; i < 2000; i++) {
+            EntsRequest request;
+            if (random() % 10 == 0) {
+                request.op = OP_CREATE_ENT;
+                request.a.name = "made " + to_string(t) + " " + to_string(i);
+            } else {
+                EntsOp ops[] = {OP_FIND, OP_GET_PARENTS, OP_GET_CHILDREN};
+                request.op = ops[random() % 3];
+                request.a.uid = ents[random() % ents.size()]->getUID();
+                expected[t].push_back(direct.execute(request));
+            }
+            requests[t].push_back(request);
+        }
+    }
+    
+    unique_ptr<EntsServer> server(new EntsServer(&tree, 0, 2, "127.0.0.1"));
+    server->start();
+    EntsClient client("127.0.0.1", server->getPort(), 3);
+    try {
+        client.connect();
+    } catch (exception& e) {
+        return e.what();
+    }
+    
+    //Half of each thread's requests are called one by one, with all their
+    //futures out at once, and half go in batches of odd sizes.
+    vector<string> failures(THREADS);
+    vector<thread> threads;
+    for (unsigned int t = 0; t < THREADS; t++) {
+        threads.push_back(thread([&, t] {
+            mt19937 sizes(380 + t);
+            vector<EntsRequest>& mine = requests[t];
+            vector<EntsResponse> answers;
+            try {
+                size_t half = mine.size() / 2;
+                vector<future<EntsResponse> > calls;
+                for (size_t i = 0; i < half; i++)
+                    calls.push_back(client.call(mine[i]));
+                for (future<EntsResponse>& call : calls)
+                    answers.push_back(call.get());
+                for (size_t i = half; i < mine.size();) {
+                    size_t size = min<size_t>(1 + sizes() % 100, mine.size() - i);
+                    vector<EntsRequest> batch(mine.begin() + i, mine.begin() + i + size);
+                    vector<EntsResponse> batchAnswers = client.callBatch(batch).get();
+                    if (batchAnswers.size() != size) {
+                        failures[t] = "a batch of " + to_string(size) + " had "
+                                + to_string(batchAnswers.size()) + " answers";
+                        return;
+                    }
+                    for (EntsResponse& answer : batchAnswers)
+                        answers.push_back(std::move(answer));
+                    i += size;
+                }
+            } catch (exception& e) {
+                failures[t] = e.what();
+                return;
+            }
+            
+            size_t lookup = 0;
+            for (size_t i = 0; i < mine.size(); i++) {
+                EntsResponse& answer = answers[i];
+                if (mine[i].op == OP_CREATE_ENT) {
+                    if (answer.status != STATUS_OK || answer.ents.size() != 1
+                            || answer.ents[0].name != mine[i].a.name) {
+                        failures[t] = "creating " + mine[i].a.name + " got another answer";
+                        return;
+                    }
+                } else if (answer.status != expected[t][lookup].status
+                        || answer.ents != expected[t][lookup].ents) {
+                    failures[t] = "request " + to_string(i) + " of thread " + to_string(t)
+                            + " got another request's answer";
+                    return;
+                } else {
+                    lookup++;
+                }
+            }
+        }));
+    }
+    for (thread& t : threads)
+        t.join();
+    for (string& failure : failures) {
+        if (!failure.empty())
+            return failure;
+    }
+    
+    //With the server gone, calls fail instead of waiting for good.
+    server.reset();
+    EntsRequest ping;
+    ping.op = OP_PING;
+    for (int i = 0; i < 3; i++) {
+        try {
+            client.call(ping).get();
+            return "a call was answered after the server stopped";
+        } catch (exception&) {
+        }
+    }
+    return "";
+}
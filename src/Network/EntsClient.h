@@ -21,24 +21,300 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <chrono>
 #include <boost/asio.hpp>
 #include <exception>
+#include "EntsService.h"
 
 using boost::asio::ip::tcp;
 
 using namespace std;
 
+class EntsConnection;
+struct EntsStreamState;
+struct EntsWatchState;
+
+/**
+ * The answer to a streamed request, like all the descendents of an Ent,
+ * read as it arrives. Only a few chunks are held at a time, however much
+ * there is. Use it from one thread, and don't keep it longer than the
+ * client it came from.
+ *
+ *      for (const EntRef& ent : stream)
+ *          ...
+ */
+class EntsStream {
+
+    boost::asio::io_context* io;
+    shared_ptr<EntsConnection> connection;
+    shared_ptr<EntsStreamState> state;
+    EntsResponse chunk;
+    size_t at;
+
+    friend class EntsClient;
+
+    EntsStream(boost::asio::io_context* context, shared_ptr<EntsConnection> c,
+            shared_ptr<EntsStreamState> s);
+
+public:
+
+    EntsStream(EntsStream&& other);
+
+    /**
+     * Cancels the stream if it hasn't been read to the end.
+     */
+    ~EntsStream();
+
+    EntsStream(const EntsStream&) = delete;
+    EntsStream& operator=(const EntsStream&) = delete;
+
+    /**
+     * Reads the next Ent, waiting for it to arrive if need be.
+     * @return          false at the end.
+     * @throws boost::system::system_error if the connection fails.
+     */
+    bool next(EntRef* ent);
+
+    /**
+     * How the request went, once next() has returned false. STATUS_OK if it
+     * all arrived.
+     */
+    EntsStatus getStatus() const {
+        return chunk.status;
+    }
+
+    class iterator {
+
+        EntsStream* stream;
+        EntRef current;
+
+    public:
+
+        typedef input_iterator_tag iterator_category;
+        typedef EntRef value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const EntRef* pointer;
+        typedef const EntRef& reference;
+
+        iterator(): stream(nullptr) {}
+
+        iterator(EntsStream* s): stream(s) {
+            ++*this;
+        }
+
+        const EntRef& operator*() const {
+            return current;
+        }
+
+        const EntRef* operator->() const {
+            return &current;
+        }
+
+        iterator& operator++() {
+            if (!stream->next(&current))
+                stream = nullptr;
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const {
+            return stream == other.stream;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return stream != other.stream;
+        }
+
+    };
+
+    /**
+     * Starts reading. Only call it once.
+     */
+    iterator begin() {
+        return iterator(this);
+    }
+
+    iterator end() {
+        return iterator();
+    }
+
+};
+
+/**
+ * A Watch on an Ent, from EntsClient::watch(). The changes made at or under
+ * the Ent arrive in batches, as they're made, until it's deleted. Use it
+ * from one thread, and don't keep it longer than the client it came from.
+ */
+class EntsWatch {
+
+    boost::asio::io_context* io;
+    shared_ptr<EntsConnection> connection;
+    shared_ptr<EntsWatchState> state;
+    EntsStatus status;
+
+    friend class EntsClient;
+
+    EntsWatch(boost::asio::io_context* context, shared_ptr<EntsConnection> c,
+            shared_ptr<EntsWatchState> s);
+
+public:
+
+    EntsWatch(EntsWatch&& other);
+
+    /**
+     * Cancels the watch if it's still going.
+     */
+    ~EntsWatch();
+
+    EntsWatch(const EntsWatch&) = delete;
+    EntsWatch& operator=(const EntsWatch&) = delete;
+
+    /**
+     * Waits for the next batch of changes. If its snapshot flag is set, some
+     * were missed, and what's under the Ent should be read again. The last
+     * batch has the status the watch ended with.
+     * @param wait      How long to wait at most. Forever if negative.
+     * @return          false if none came in time, or the watch was over.
+     * @throws boost::system::system_error if the connection fails.
+     */
+    bool next(ChangeBatch* batch, chrono::milliseconds wait = chrono::milliseconds(-1));
+
+    /**
+     * STATUS_MORE while the watch is going. Otherwise why it isn't:
+     * STATUS_NOT_FOUND if the Ent isn't there, or has been removed.
+     */
+    EntsStatus getStatus() const {
+        return status;
+    }
+
+};
+
+/**
+ * Results from EntsClient::benchmark(), in requests per second.
+ */
+struct ClientBenchmark {
+    unsigned int connections;
+    /** Waiting for each answer before asking again. */
+    double oneAtATime;
+    /** Many calls going at once, waiting on their futures afterwards. */
+    double pipelined;
+    /** Batches sent with callBatch(). */
+    double batched;
+    unsigned int batchSize;
+    /** Ents per second streamed by OP_GET_DESCENDENTS of root. */
+    double streamed;
+    size_t streamedEnts;
+};
+
+/**
+ * Talks to an EntsServer.
+ *
+ * A client keeps a small pool of connections open and shares them between
+ * all the threads using it, so nobody pays to connect for each call. Any
+ * number of calls can be going on one connection at once. Calls return
+ * straight away with a future for the answer. A batch sends many requests
+ * together in one write, so they cost one round trip between them.
+ *
+ * Connections are opened when first used, and opened again after they
+ * fail. Calls that were waiting on a connection when it failed get the
+ * error through their futures.
+ */
 class EntsClient {
-    
+
+    string host;
+    string port;
+    boost::asio::io_context io;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+    /**
+     * Runs every connection's reads and writes.
+     */
+    thread ioThread;
+    vector<shared_ptr<EntsConnection> > connections;
+    atomic<unsigned int> nextConnection;
+
+    /**
+     * Takes turns between the connections.
+     */
+    shared_ptr<EntsConnection> pick() {
+        return connections[nextConnection.fetch_add(1, memory_order_relaxed) % connections.size()];
+    }
+
 public:
-    
-    int connect();
-    
-    
+
+    /**
+     * Nothing is connected until it's used.
+     * @param host          Name or address of the server.
+     * @param port          Its port.
+     * @param poolSize      How many connections to share between calls.
+     */
+    EntsClient(const string& host = "35.160.222.230", unsigned short port = 1037,
+            unsigned int poolSize = 4);
+
+    /**
+     * Calls still waiting get a broken_promise future_error.
+     */
+    ~EntsClient();
+
+    EntsClient(const EntsClient&) = delete;
+    EntsClient& operator=(const EntsClient&) = delete;
+
+    /**
+     * Connects every connection in the pool and pings the server on each.
+     * Throws a runtime_error saying why if any of them doesn't answer.
+     */
+    void connect();
+
+    /**
+     * Sends a request.
+     * @return          The answer, when it comes. get() throws a
+     *                  boost::system::system_error if the connection fails.
+     */
+    future<EntsResponse> call(const EntsRequest& request);
+
+    /**
+     * Sends a number of requests together on one connection.
+     * @return          Their answers, in the same order as the requests, once
+     *                  they've all come.
+     */
+    future<vector<EntsResponse> > callBatch(vector<EntsRequest> requests);
+
+    /**
+     * Sends a streamed request, OP_GET_DESCENDENTS or OP_GET_ANCESTORS. The
+     * Ents come back a chunk at a time as they're read from the stream.
+     */
+    EntsStream stream(const EntsRequest& request);
+
+    /**
+     * Watches an Ent for changes made at or under it. Returns once the watch
+     * is in place, so every change made after that is seen.
+     * @throws boost::system::system_error if the connection fails.
+     */
+    EntsWatch watch(const EntKey& key);
+
+    /**
+     * Starts a server for the Tree on a free localhost port and times looking
+     * up Ents through a client, one at a time, with many calls going at once,
+     * and in batches, then streams all of root's descendents. Nothing is
+     * printed.
+     */
+    static ClientBenchmark benchmark(Tree* tree, unsigned int poolSize, double seconds);
+
+    /**
+     * Has threads share a client to a server of a made up Tree, making calls
+     * and batches of lookups and creates at once.
+     * @return          "" if every answer is the one meant for its request,
+     *                  and calls fail once the server is gone, otherwise what
+     *                  went wrong.
+     */
+    static string check();
+
 };
 
 
 
 
 #endif /* ENTSCLIENT_H */
-
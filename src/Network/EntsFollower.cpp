@@ -0,0 +1,398 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EntsFollower.h"
+#include "EntsServer.h"
+#include "../Algorithms/TreeDiff.h"
+#include <chrono>
+#include <sstream>
+#include <random>
+#include <thread>
+
+using namespace std;
+
+EntsFollower::EntsFollower(Tree* tr, const string& h, unsigned short p): tree(tr),
+        host(h), port(p), resolver(io), socket(io), retry(io), snapshotStarted(false) {
+}
+
+EntsFollower::~EntsFollower() {
+    stop();
+}
+
+void EntsFollower::start() {
+    
+    if (runner.joinable())
+        return;
+    
+    boost::asio::post(io, [this] { connect(); });
+    runner = thread([this] { io.run(); });
+}
+
+void EntsFollower::stop() {
+    io.stop();
+    if (runner.joinable())
+        runner.join();
+}
+
+ReplicationStatus EntsFollower::getStatus() const {
+    lock_guard<mutex> hold(statusLock);
+    return status;
+}
+
+string EntsFollower::describe(const ReplicationStatus& status) {
+    
+    ostringstream text;
+    if (!status.caughtUp) {
+        text << "Copying a snapshot, " << status.changes << " changes in";
+    } else {
+        text << "Applied the primary's log up to " << status.applied << " of "
+                << status.end << " (" << status.getBehind() << " behind), last change took "
+                << status.lag << " ms to arrive";
+    }
+    if (status.skipped > 0)
+        text << ", " << status.skipped << " changes didn't fit";
+    if (!status.connected)
+        text << ". Not connected" << (status.error.empty() ? "" : ": " + status.error);
+    text << ".";
+    return text.str();
+}
+
+void EntsFollower::connect() {
+    
+    resolver.async_resolve(host, to_string(port), [this](const boost::system::error_code& error,
+            tcp::resolver::results_type endpoints) {
+        if (error) {
+            lost("Couldn't find " + host + ": " + error.message());
+            return;
+        }
+        boost::asio::async_connect(socket, endpoints, [this](const boost::system::error_code& error,
+                const tcp::endpoint&) {
+            if (error) {
+                lost("Couldn't connect to the primary: " + error.message());
+                return;
+            }
+            boost::system::error_code ignored;
+            socket.set_option(tcp::no_delay(true), ignored);
+            {
+                lock_guard<mutex> hold(statusLock);
+                status.connected = true;
+                status.error.clear();
+            }
+            follow();
+        });
+    });
+}
+
+void EntsFollower::follow() {
+    
+    //Only this thread changes the status, so it can be read without the lock.
+    request.op = OP_FOLLOW;
+    request.offset = status.caughtUp ? status.applied : FOLLOW_SNAPSHOT;
+    if (request.offset == FOLLOW_SNAPSHOT) {
+        Tree::Reader reading;
+        if (tree->getNameMap()->size() > 1) {
+            fail("Following from a snapshot needs an empty Tree.");
+            return;
+        }
+    }
+    
+    requestFrame.reset(new EntsFrame(1, request));
+    vector<boost::asio::const_buffer> buffers;
+    requestFrame->addBuffers(&buffers);
+    boost::asio::async_write(socket, buffers, [](const boost::system::error_code&, size_t) {
+        //A failed write shows up as a failed read too.
+    });
+    read();
+}
+
+void EntsFollower::read() {
+    
+    socket.async_read_some(input.space(), [this](const boost::system::error_code& error,
+            size_t bytes) {
+        if (error) {
+            lost(error == boost::asio::error::eof ? "The primary hung up." : error.message());
+            return;
+        }
+        input.filled(bytes);
+        
+        const char* body;
+        size_t size;
+        while (input.next(&body, &size)) {
+            uint32_t id;
+            ChangeBatch batch;
+            if (!EntsFrame::readBatch(body, size, &id, &batch)) {
+                fail("The primary sent something other than changes.");
+                return;
+            }
+            if (batch.status == STATUS_NOT_FOUND) {
+                fail("The primary no longer has the changes needed to catch up. "
+                        "Follow it again with an empty Tree.");
+                return;
+            }
+            if (batch.status != STATUS_MORE) {
+                fail("The primary turned down the request to follow it.");
+                return;
+            }
+            apply(batch);
+        }
+        if (input.isBroken()) {
+            fail("The primary sent a frame that's too big.");
+            return;
+        }
+        read();
+    });
+}
+
+void EntsFollower::apply(ChangeBatch& batch) {
+    
+    uint64_t skipped = 0;
+    {
+        Tree::Writer writing(tree);
+        //The copy's UIDs are the primary's.
+        if (batch.snapshot)
+            tree->setOrigin(batch.origin);
+        for (const TreeChange& change : batch.changes) {
+            if (!apply(tree, change))
+                skipped++;
+        }
+    }
+    
+    lock_guard<mutex> hold(statusLock);
+    status.changes += batch.changes.size() - skipped;
+    status.skipped += skipped;
+    status.end = batch.end;
+    if (batch.snapshot) {
+        snapshotStarted = true;
+        return;
+    }
+    status.caughtUp = true;
+    status.applied = batch.offset;
+    if (!batch.changes.empty())
+        status.lag = ChangeLog::now() - batch.time;
+}
+
+bool EntsFollower::apply(Tree* tree, const TreeChange& change) {
+    
+    Ent* a = tree->getEntPtrByUID(change.a);
+    switch (change.type) {
+        case CHANGE_ADD_ENT: {
+            if (a != nullptr || tree->getEntPtrByName(change.name) != nullptr)
+                return false;
+            Ent* added = new Ent();
+            added->setName(change.name);
+            added->setUID(change.a);
+            tree->addEntToNameMapUnattached(added);
+            return true;
+        }
+        case CHANGE_REMOVE_ENT:
+            if (a == nullptr || a == tree->getRoot())
+                return false;
+            tree->removeEnt(a);
+            return true;
+        case CHANGE_RENAME:
+            if (a == nullptr)
+                return false;
+            //A snapshot may already have the new name.
+            return a->getName() == change.name || tree->renameEnt(a, change.name);
+        default:
+            break;
+    }
+    
+    Ent* b = tree->getEntPtrByUID(change.b);
+    if (a == nullptr || b == nullptr)
+        return false;
+    switch (change.type) {
+        case CHANGE_CONNECT:
+            Ent::connectUnchecked(a, b);
+            break;
+        case CHANGE_DISCONNECT:
+            Ent::disconnectUnchecked(a, b);
+            break;
+        case CHANGE_SET_EXCLUSIVE:
+            Ent::setExclusive(a, b);
+            break;
+        case CHANGE_UNSET_EXCLUSIVE:
+            Ent::unsetExclusive(a, b);
+            break;
+        case CHANGE_SET_OVERLAP:
+            Ent::setOverlap(a, b);
+            break;
+        case CHANGE_UNSET_OVERLAP:
+            Ent::unsetOverlap(a, b);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+void EntsFollower::lost(const string& why) {
+    
+    boost::system::error_code ignored;
+    socket.close(ignored);
+    input = FrameBuffer();
+    {
+        lock_guard<mutex> hold(statusLock);
+        status.connected = false;
+        status.error = why;
+    }
+    
+    if (snapshotStarted && !status.caughtUp) {
+        fail("Lost the primary partway through the snapshot. " + why);
+        return;
+    }
+    retry.expires_after(chrono::seconds(1));
+    retry.async_wait([this](const boost::system::error_code& error) {
+        if (!error)
+            connect();
+    });
+}
+
+void EntsFollower::fail(const string& why) {
+    
+    boost::system::error_code ignored;
+    socket.close(ignored);
+    lock_guard<mutex> hold(statusLock);
+    status.connected = false;
+    status.error = why;
+}
+
+/**
+ * Makes a round of random edits to a Tree: some within Writers, a batch at a
+ * time, and some through the Editor path, one at a time.
+ * @param ents      The Tree's Ents, besides root. Parents always come before
+ *                  their children, so edits can't make loops.
+ */
+static void editForCheck(Tree* tree, vector<Ent*>* ents, mt19937& random, unsigned int* made) {
+    
+    for (int batch = 0; batch < 10; batch++) {
+        Tree::Writer writing(tree);
+        for (int i = 0; i < 50; i++) {
+            size_t c = random() % ents->size();
+            Ent* ent = (*ents)[c];
+            switch (random() % 6) {
+                case 0:
+                    if (c > 0) {
+                        Ent* parent = (*ents)[random() % c];
+                        if (!ent->isChildOf(parent))
+                            Ent::connectUnchecked(parent, ent);
+                    }
+                    break;
+                case 1: {
+                    vector<Ent*> parents = ent->getParents();
+                    if (parents.size() > 1)
+                        Ent::disconnectUnchecked(parents[random() % parents.size()], ent);
+                    break;
+                }
+                case 2:
+                    tree->renameEnt(ent, "renamed " + to_string((*made)++));
+                    break;
+                case 3:
+                    tree->removeEnt(ent);
+                    ents->erase(ents->begin() + c);
+                    break;
+                case 4: {
+                    Ent* other = (*ents)[random() % ents->size()];
+                    if (other != ent)
+                        Ent::setExclusive(ent, other);
+                    break;
+                }
+                default: {
+                    Ent* added = new Ent();
+                    added->setName("added " + to_string((*made)++));
+                    tree->addEntToNameMap(added, ent);
+                    ents->push_back(added);
+                }
+            }
+        }
+    }
+    for (int i = 0; i < 100; i++) {
+        string name = "created " + to_string((*made)++);
+        if (tree->tryToCreateNewEnt(name) != SUCCESS)
+            continue;
+        Ent* created = tree->getEntPtrByName(name);
+        tree->connectAndPrune((*ents)[random() % ents->size()], created);
+        ents->push_back(created);
+    }
+}
+
+/**
+ * Waits up to ten seconds for a follower to apply everything in a log.
+ */
+static bool waitForFollower(EntsFollower& follower, ChangeLog* log) {
+    for (int tries = 0; tries < 1000; tries++) {
+        ReplicationStatus status = follower.getStatus();
+        if (status.caughtUp && status.applied == log->getEnd())
+            return true;
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    return false;
+}
+
+string EntsFollower::check() {
+    
+    mt19937 random(40);
+    Tree primary("Follower check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 2000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        primary.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 50 == 0) {
+            Ent::connectUnchecked(primary.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    
+    EntsServer server(&primary, 0, 2, "127.0.0.1");
+    server.start();
+    unsigned int made = 0;
+    
+    Tree early("Early follower");
+    EntsFollower first(&early, "127.0.0.1", server.getPort());
+    first.start();
+    editForCheck(&primary, &ents, random, &made);
+    Tree late("Late follower");
+    EntsFollower second(&late, "127.0.0.1", server.getPort());
+    second.start();
+    editForCheck(&primary, &ents, random, &made);
+    
+    ChangeLog* log = primary.getChangeLog();
+    if (log == nullptr)
+        return "following didn't start the primary's log";
+    EntsFollower* followers[] = {&first, &second};
+    for (EntsFollower* follower : followers) {
+        if (!waitForFollower(*follower, log))
+            return follower->getTree()->getName() + " didn't catch up: "
+                    + describe(follower->getStatus());
+        follower->stop();
+        if (follower->getStatus().skipped != 0)
+            return follower->getTree()->getName() + " skipped changes";
+        TreeDelta left = TreeDiff::diff(&primary, follower->getTree());
+        if (!left.isEmpty())
+            return follower->getTree()->getName() + " differs from the primary: "
+                    + TreeDiff::write(left);
+    }
+    return "";
+}
@@ -0,0 +1,192 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENTSFOLLOWER_H
+#define ENTSFOLLOWER_H
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <boost/asio.hpp>
+#include "EntsService.h"
+#include "EntsProtocol.h"
+
+using boost::asio::ip::tcp;
+
+using namespace std;
+
+/**
+ * How a follower is doing, from EntsFollower::getStatus().
+ */
+struct ReplicationStatus {
+    bool connected;
+    /** Whether the snapshot has all come in, so the Tree is whole. */
+    bool caughtUp;
+    /** The primary's log offset, up to which its changes have been applied. */
+    uint64_t applied;
+    /** How far the primary's log went, when it was last heard from. */
+    uint64_t end;
+    /** Changes applied so far, the snapshot's included. */
+    uint64_t changes;
+    /**
+     * Changes that couldn't be applied, because an Ent they name wasn't
+     * there or a name was taken. Anything but 0 means the Tree has drifted
+     * from the primary's.
+     */
+    uint64_t skipped;
+    /**
+     * How long the latest change took to get here after the primary made
+     * it, in milliseconds. Only meaningful if both clocks agree, as they do
+     * on one machine.
+     */
+    int64_t lag;
+    /**
+     * What went wrong last, if anything. If it isn't connected, it's either
+     * trying again or has stopped for good because of it.
+     */
+    string error;
+
+    ReplicationStatus(): connected(false), caughtUp(false), applied(0), end(0),
+            changes(0), skipped(0), lag(0) {}
+
+    /**
+     * How many of the primary's changes haven't been applied here yet.
+     */
+    uint64_t getBehind() const {
+        return end > applied ? end - applied : 0;
+    }
+};
+
+/**
+ * Keeps a Tree a read-only copy of another server's, by playing back the
+ * changes the primary sends (see ReplicationSource).
+ *
+ * A follower starting out asks for a snapshot, and its Tree must be empty.
+ * After that it asks for changes from the log offset it has reached, so if
+ * the connection drops it reconnects and picks up where it left off, unless
+ * the primary has dropped those changes from its log by then. Each batch is
+ * applied within a Tree::Writer, so the Tree can be served to readers the
+ * whole time, from an EntsServer made read-only.
+ *
+ * Runs on a thread of its own.
+ */
+class EntsFollower {
+
+    Tree* tree;
+    string host;
+    unsigned short port;
+    boost::asio::io_context io;
+    tcp::resolver resolver;
+    tcp::socket socket;
+    boost::asio::steady_timer retry;
+    FrameBuffer input;
+    EntsRequest request;
+    unique_ptr<EntsFrame> requestFrame;
+    thread runner;
+    /**
+     * Whether part of a snapshot has been applied. If the connection drops
+     * before it's all in, the Tree is neither empty nor whole.
+     */
+    bool snapshotStarted;
+    mutable mutex statusLock;
+    ReplicationStatus status;
+
+    void connect();
+
+    /**
+     * Asks the primary for changes, once connected.
+     */
+    void follow();
+
+    void read();
+
+    /**
+     * Applies a batch within a Writer, and notes how far it got.
+     */
+    void apply(ChangeBatch& batch);
+
+    /**
+     * Tries again shortly, if it can pick up where it left off.
+     */
+    void lost(const string& why);
+
+    /**
+     * Stops following for good.
+     */
+    void fail(const string& why);
+
+public:
+
+    /**
+     * Makes a follower, which doesn't connect until start().
+     * @param tree      The Tree to keep up to date. Nothing else may edit it.
+     * @param host      The primary's address.
+     * @param port      The primary's port.
+     */
+    EntsFollower(Tree* tree, const string& host, unsigned short port = 1037);
+
+    /**
+     * Stops following.
+     */
+    ~EntsFollower();
+
+    EntsFollower(const EntsFollower&) = delete;
+    EntsFollower& operator=(const EntsFollower&) = delete;
+
+    /**
+     * Starts following on its own thread. Returns straight away.
+     */
+    void start();
+
+    /**
+     * Disconnects and waits for the thread to finish. A stopped follower
+     * can't be started again.
+     */
+    void stop();
+
+    ReplicationStatus getStatus() const;
+
+    /**
+     * Puts a status into words, on one line.
+     */
+    static string describe(const ReplicationStatus& status);
+
+    /**
+     * Plays back one of a primary's changes on a copy of its Tree. Call
+     * within a Tree::Writer.
+     * @return          false if it couldn't be.
+     */
+    static bool apply(Tree* tree, const TreeChange& change);
+
+    Tree* getTree() {
+        return tree;
+    }
+
+    /**
+     * Serves a made up Tree and has two followers copy it while it's edited,
+     * one from the start and one from part way through.
+     * @return          "" if both end up the same as the primary, otherwise
+     *                  what went wrong.
+     */
+    static string check();
+
+};
+
+#endif /* ENTSFOLLOWER_H */
@@ -0,0 +1,584 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EntsProtocol.h"
+#include <cstring>
+#include <random>
+#include <climits>
+
+using namespace std;
+
+/**
+ * Reads the packed numbers back out of a frame's body, never going past
+ * the end of it.
+ */
+class FrameReader {
+
+    const unsigned char* at;
+    const unsigned char* end;
+
+public:
+
+    FrameReader(const char* body, size_t size):
+            at(reinterpret_cast<const unsigned char*>(body)), end(at + size) {}
+
+    bool fixed(uint32_t* value) {
+        if (end - at < 4)
+            return false;
+        *value = (uint32_t(at[0]) << 24) | (uint32_t(at[1]) << 16)
+                | (uint32_t(at[2]) << 8) | uint32_t(at[3]);
+        at += 4;
+        return true;
+    }
+
+    bool byte(uint8_t* value) {
+        if (at == end)
+            return false;
+        *value = *at++;
+        return true;
+    }
+
+    bool varint(uint32_t* value) {
+        *value = 0;
+        for (unsigned int shift = 0; shift < 35; shift += 7) {
+            if (at == end)
+                return false;
+            uint8_t b = *at++;
+            *value |= uint32_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool varint64(uint64_t* value) {
+        *value = 0;
+        for (unsigned int shift = 0; shift < 70; shift += 7) {
+            if (at == end)
+                return false;
+            uint8_t b = *at++;
+            *value |= uint64_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool name(string* value) {
+        uint32_t length;
+        if (!varint(&length) || uint32_t(end - at) < length)
+            return false;
+        value->assign(reinterpret_cast<const char*>(at), length);
+        at += length;
+        return true;
+    }
+
+    bool key(EntKey* value) {
+        return varint(&value->uid) && name(&value->name);
+    }
+
+    bool done() const {
+        return at == end;
+    }
+
+};
+
+static void putFixed(string* out, uint32_t value) {
+    out->push_back(char(value >> 24));
+    out->push_back(char(value >> 16));
+    out->push_back(char(value >> 8));
+    out->push_back(char(value));
+}
+
+/**
+ * Reads a count, then that many UIDs.
+ */
+static bool readUIDs(FrameReader* reader, size_t size, vector<unsigned int>* uids) {
+    uint32_t count;
+    if (!reader->varint(&count))
+        return false;
+    //Each takes at least a byte.
+    uids->reserve(min<size_t>(count, size));
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t uid;
+        if (!reader->varint(&uid))
+            return false;
+        uids->push_back(uid);
+    }
+    return true;
+}
+
+/**
+ * How many Ents an operation names.
+ */
+static int keysFor(EntsOp op) {
+    switch (op) {
+        case OP_PING:
+        case OP_MORE:
+        case OP_CANCEL:
+        case OP_FOLLOW:
+        case OP_EXPAND_DESCENDENTS:
+        case OP_EXPAND_ANCESTORS:
+            return 0;
+        case OP_CONNECT:
+        case OP_DISCONNECT:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+
+EntsFrame::EntsFrame(uint32_t id): length(0) {
+    //Room for the length, filled in by finish().
+    packed.assign(4, '\0');
+    putFixed(&packed, id);
+}
+
+EntsFrame::EntsFrame(uint32_t id, const EntsRequest& request): EntsFrame(id) {
+    
+    packed.push_back(char(request.op));
+    int keys = keysFor(request.op);
+    if (keys > 0)
+        putKey(request.a);
+    if (keys > 1)
+        putKey(request.b);
+    if (request.op == OP_FOLLOW)
+        putVarint64(request.offset);
+    if (EntsService::isExpansion(request.op)) {
+        putVarint(request.uids.size());
+        for (unsigned int uid : request.uids)
+            putVarint(uid);
+    }
+    if (request.timeout != 0)
+        putVarint(request.timeout);
+    finish();
+}
+
+EntsFrame::EntsFrame(uint32_t id, const EntsResponse& response): EntsFrame(id) {
+    
+    packed.reserve(16 + response.ents.size() * 16);
+    packed.push_back(char(response.status));
+    putVarint(response.ents.size());
+    for (const EntRef& ent : response.ents) {
+        putVarint(ent.uid);
+        putName(ent.name);
+    }
+    if (!response.frontier.empty()) {
+        putVarint(response.frontier.size());
+        for (unsigned int uid : response.frontier)
+            putVarint(uid);
+    }
+    finish();
+}
+
+EntsFrame::EntsFrame(uint32_t id, const ChangeBatch& batch): EntsFrame(id) {
+    
+    packed.reserve(32 + batch.changes.size() * 12);
+    packed.push_back(char(batch.status));
+    packed.push_back(char(batch.snapshot));
+    putVarint64(batch.offset);
+    putVarint64(batch.end);
+    putVarint64(batch.time);
+    putVarint(batch.changes.size());
+    for (const TreeChange& change : batch.changes) {
+        packed.push_back(char(change.type));
+        putVarint(change.a);
+        putVarint(change.b);
+        putName(change.name);
+    }
+    //Last, and only when there is one, like a response's frontier.
+    if (batch.origin != 0)
+        putVarint64(batch.origin);
+    finish();
+}
+
+void EntsFrame::putVarint(uint32_t value) {
+    while (value >= 0x80) {
+        packed.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    packed.push_back(char(value));
+}
+
+void EntsFrame::putVarint64(uint64_t value) {
+    while (value >= 0x80) {
+        packed.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    packed.push_back(char(value));
+}
+
+void EntsFrame::putName(const string& name) {
+    putVarint(name.size());
+    if (name.size() < COPY_BELOW) {
+        packed += name;
+    } else {
+        names.push_back(make_pair(packed.size(), &name));
+        length += name.size();
+    }
+}
+
+void EntsFrame::putKey(const EntKey& key) {
+    putVarint(key.uid);
+    putName(key.name);
+}
+
+void EntsFrame::finish() {
+    length += packed.size();
+    uint32_t body = length - 4;
+    packed[0] = char(body >> 24);
+    packed[1] = char(body >> 16);
+    packed[2] = char(body >> 8);
+    packed[3] = char(body);
+}
+
+void EntsFrame::addBuffers(vector<boost::asio::const_buffer>* buffers) const {
+    
+    size_t from = 0;
+    for (const pair<size_t, const string*>& name : names) {
+        buffers->push_back(boost::asio::buffer(packed.data() + from, name.first - from));
+        buffers->push_back(boost::asio::buffer(*name.second));
+        from = name.first;
+    }
+    buffers->push_back(boost::asio::buffer(packed.data() + from, packed.size() - from));
+}
+
+bool EntsFrame::readRequest(const char* body, size_t size, uint32_t* id,
+        EntsRequest* request) {
+    
+    FrameReader reader(body, size);
+    uint8_t op;
+    if (!reader.fixed(id) || !reader.byte(&op) || op > OP_EXPLAIN)
+        return false;
+    
+    request->op = EntsOp(op);
+    request->a = EntKey();
+    request->b = EntKey();
+    request->offset = 0;
+    request->uids.clear();
+    request->timeout = 0;
+    int keys = keysFor(request->op);
+    if (keys > 0 && !reader.key(&request->a))
+        return false;
+    if (keys > 1 && !reader.key(&request->b))
+        return false;
+    if (request->op == OP_FOLLOW && !reader.varint64(&request->offset))
+        return false;
+    if (EntsService::isExpansion(request->op) && !readUIDs(&reader, size, &request->uids))
+        return false;
+    if (!reader.done() && !reader.varint(&request->timeout))
+        return false;
+    return reader.done();
+}
+
+bool EntsFrame::readResponse(const char* body, size_t size, uint32_t* id,
+        EntsResponse* response) {
+    
+    FrameReader reader(body, size);
+    uint8_t status;
+    uint32_t count;
+    if (!reader.fixed(id) || !reader.byte(&status) || status > STATUS_OVERLOADED
+            || !reader.varint(&count))
+        return false;
+    
+    response->status = EntsStatus(status);
+    response->ents.clear();
+    //Every Ent takes at least two bytes, which keeps a bad count from
+    //reserving a huge amount.
+    response->ents.reserve(min<size_t>(count, size / 2));
+    for (uint32_t i = 0; i < count; i++) {
+        EntRef ent;
+        if (!reader.varint(&ent.uid) || !reader.name(&ent.name))
+            return false;
+        response->ents.push_back(std::move(ent));
+    }
+    response->frontier.clear();
+    if (!reader.done() && !readUIDs(&reader, size, &response->frontier))
+        return false;
+    return reader.done();
+}
+
+bool EntsFrame::readBatch(const char* body, size_t size, uint32_t* id,
+        ChangeBatch* batch) {
+    
+    FrameReader reader(body, size);
+    uint8_t status, snapshot;
+    uint64_t time;
+    uint32_t count;
+    if (!reader.fixed(id) || !reader.byte(&status) || status > STATUS_OVERLOADED
+            || !reader.byte(&snapshot) || !reader.varint64(&batch->offset)
+            || !reader.varint64(&batch->end) || !reader.varint64(&time)
+            || !reader.varint(&count))
+        return false;
+    
+    batch->status = EntsStatus(status);
+    batch->snapshot = snapshot != 0;
+    batch->time = int64_t(time);
+    batch->changes.clear();
+    //Every change takes at least four bytes.
+    batch->changes.reserve(min<size_t>(count, size / 4));
+    for (uint32_t i = 0; i < count; i++) {
+        TreeChange change;
+        uint8_t type;
+        if (!reader.byte(&type) || type > CHANGE_UNSET_OVERLAP || !reader.varint(&change.a)
+                || !reader.varint(&change.b) || !reader.name(&change.name))
+            return false;
+        change.type = ChangeType(type);
+        batch->changes.push_back(std::move(change));
+    }
+    batch->origin = 0;
+    if (!reader.done() && !reader.varint64(&batch->origin))
+        return false;
+    return reader.done();
+}
+
+bool EntsFrame::readID(const char* body, size_t size, uint32_t* id) {
+    FrameReader reader(body, size);
+    return reader.fixed(id);
+}
+
+string EntsFrame::check() {
+    
+    mt19937 random(37);
+    //Mostly short names, but some long enough to be sent from where they are.
+    auto makeName = [&random]() {
+        string name(random() % 4 == 0 ? 64 + random() % 200 : random() % 20, '\0');
+        for (char& c : name)
+            c = char(random());
+        return name;
+    };
+    auto makeKey = [&](EntKey* key) {
+        key->uid = random() % 3 == 0 ? 0 : random();
+        key->name = key->uid == 0 || random() % 2 ? makeName() : "";
+    };
+    auto makeUIDs = [&random](vector<unsigned int>* uids) {
+        for (unsigned int n = random() % 50; n > 0; n--)
+            uids->push_back(random() >> (random() % 32));
+    };
+    
+    vector<EntsRequest> requests(300);
+    vector<EntsResponse> responses(300);
+    vector<ChangeBatch> batches(300);
+    for (size_t i = 0; i < requests.size(); i++) {
+        EntsRequest& request = requests[i];
+        request.op = EntsOp(i % (OP_EXPLAIN + 1));
+        int keys = keysFor(request.op);
+        if (keys > 0)
+            makeKey(&request.a);
+        if (keys > 1)
+            makeKey(&request.b);
+        if (request.op == OP_FOLLOW)
+            request.offset = random() % 2 ? FOLLOW_SNAPSHOT : (uint64_t(random()) << 32) | random();
+        if (EntsService::isExpansion(request.op))
+            makeUIDs(&request.uids);
+        request.timeout = random() % 2 ? 0 : random() % 100000;
+    }
+    for (size_t i = 0; i < responses.size(); i++) {
+        EntsResponse& response = responses[i];
+        response.status = EntsStatus(i % (STATUS_OVERLOADED + 1));
+        for (unsigned int n = random() % (i % 10 == 0 ? 3000 : 20); n > 0; n--) {
+            EntRef ent;
+            ent.uid = random();
+            ent.name = makeName();
+            response.ents.push_back(ent);
+        }
+        if (random() % 3 == 0)
+            makeUIDs(&response.frontier);
+    }
+    for (size_t i = 0; i < batches.size(); i++) {
+        ChangeBatch& batch = batches[i];
+        batch.status = EntsStatus(i % (STATUS_OVERLOADED + 1));
+        batch.snapshot = random() % 2;
+        batch.offset = (uint64_t(random()) << 32) | random();
+        batch.end = batch.offset + random();
+        batch.time = (int64_t(random() % 1000000) << 20) | random() % 1000000;
+        batch.origin = random() % 2 ? 0 : (uint64_t(random()) << 32) | random();
+        for (unsigned int n = random() % 100; n > 0; n--) {
+            TreeChange change;
+            change.type = ChangeType(random() % (CHANGE_UNSET_OVERLAP + 1));
+            change.a = random();
+            change.b = random();
+            if (change.type == CHANGE_ADD_ENT || change.type == CHANGE_RENAME)
+                change.name = makeName();
+            batch.changes.push_back(change);
+        }
+    }
+    
+    //Everything, as one stream of bytes, the way a gather write sends it.
+    string wire;
+    size_t frames = 0;
+    auto send = [&wire, &frames](const EntsFrame& frame) {
+        vector<boost::asio::const_buffer> buffers;
+        frame.addBuffers(&buffers);
+        size_t before = wire.size();
+        for (const boost::asio::const_buffer& buffer : buffers)
+            wire.append(boost::asio::buffer_cast<const char*>(buffer),
+                    boost::asio::buffer_size(buffer));
+        frames++;
+        return wire.size() - before == frame.size();
+    };
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (!send(EntsFrame(i, requests[i])) || !send(EntsFrame(i, responses[i]))
+                || !send(EntsFrame(i, batches[i])))
+            return "a frame's buffers don't add up to its size";
+    }
+    
+    //Read back in pieces that start and end anywhere in a frame.
+    FrameBuffer buffer;
+    vector<string> bodies;
+    size_t sent = 0;
+    while (sent < wire.size()) {
+        boost::asio::mutable_buffer space = buffer.space();
+        size_t bytes = min(boost::asio::buffer_size(space), min(wire.size() - sent,
+                size_t(1 + random() % (random() % 4 == 0 ? 100000 : 100))));
+        memcpy(boost::asio::buffer_cast<char*>(space), wire.data() + sent, bytes);
+        buffer.filled(bytes);
+        sent += bytes;
+        const char* body;
+        size_t size;
+        while (buffer.next(&body, &size))
+            bodies.push_back(string(body, size));
+    }
+    if (bodies.size() != frames)
+        return "read " + to_string(bodies.size()) + " frames, not " + to_string(frames);
+    
+    auto sameKey = [](const EntKey& x, const EntKey& y) {
+        return x.uid == y.uid && x.name == y.name;
+    };
+    for (size_t i = 0; i < requests.size(); i++) {
+        const string& requestBody = bodies[i * 3];
+        const string& responseBody = bodies[i * 3 + 1];
+        const string& batchBody = bodies[i * 3 + 2];
+        uint32_t id;
+        
+        EntsRequest request;
+        const EntsRequest& sentRequest = requests[i];
+        if (!readRequest(requestBody.data(), requestBody.size(), &id, &request) || id != i
+                || request.op != sentRequest.op || !sameKey(request.a, sentRequest.a)
+                || !sameKey(request.b, sentRequest.b) || request.offset != sentRequest.offset
+                || request.uids != sentRequest.uids || request.timeout != sentRequest.timeout)
+            return "request " + to_string(i) + " didn't come back the same";
+        
+        EntsResponse response;
+        const EntsResponse& sentResponse = responses[i];
+        if (!readResponse(responseBody.data(), responseBody.size(), &id, &response) || id != i
+                || response.status != sentResponse.status
+                || response.ents.size() != sentResponse.ents.size()
+                || response.frontier != sentResponse.frontier)
+            return "response " + to_string(i) + " didn't come back the same";
+        for (size_t e = 0; e < response.ents.size(); e++) {
+            if (response.ents[e].uid != sentResponse.ents[e].uid
+                    || response.ents[e].name != sentResponse.ents[e].name)
+                return "response " + to_string(i) + " didn't come back the same";
+        }
+        
+        ChangeBatch batch;
+        const ChangeBatch& sentBatch = batches[i];
+        if (!readBatch(batchBody.data(), batchBody.size(), &id, &batch) || id != i
+                || batch.status != sentBatch.status || batch.snapshot != sentBatch.snapshot
+                || batch.offset != sentBatch.offset || batch.end != sentBatch.end
+                || batch.time != sentBatch.time || batch.origin != sentBatch.origin
+                || batch.changes.size() != sentBatch.changes.size())
+            return "batch " + to_string(i) + " didn't come back the same";
+        for (size_t c = 0; c < batch.changes.size(); c++) {
+            const TreeChange& x = batch.changes[c];
+            const TreeChange& y = sentBatch.changes[c];
+            if (x.type != y.type || x.a != y.a || x.b != y.b || x.name != y.name)
+                return "batch " + to_string(i) + " didn't come back the same";
+        }
+        
+        //A body cut short anywhere past its ID mustn't be read as something
+        //else. A timeout can be left off, so only requests without one are
+        //cut anywhere. Frontiers and origins can be too, so responses and
+        //batches with one are only tried a byte short, which leaves part of a
+        //varint.
+        for (size_t cut = 4; sentRequest.timeout == 0 && cut < requestBody.size(); cut++) {
+            if (readRequest(requestBody.data(), cut, &id, &request))
+                return "request " + to_string(i) + " was read with only "
+                        + to_string(cut) + " bytes";
+        }
+        for (size_t cut = 4; sentResponse.frontier.empty() && cut < responseBody.size();
+                cut += 1 + cut / 8) {
+            if (readResponse(responseBody.data(), cut, &id, &response))
+                return "response " + to_string(i) + " was read with only "
+                        + to_string(cut) + " bytes";
+        }
+        if (!sentResponse.frontier.empty()
+                && readResponse(responseBody.data(), responseBody.size() - 1, &id, &response))
+            return "response " + to_string(i) + " was read one byte short";
+        for (size_t cut = 4; sentBatch.origin == 0 && cut < batchBody.size(); cut += 1 + cut / 8) {
+            if (readBatch(batchBody.data(), cut, &id, &batch))
+                return "batch " + to_string(i) + " was read with only "
+                        + to_string(cut) + " bytes";
+        }
+        if (sentBatch.origin != 0
+                && readBatch(batchBody.data(), batchBody.size() - 1, &id, &batch))
+            return "batch " + to_string(i) + " was read one byte short";
+    }
+    
+    return "";
+}
+
+
+FrameBuffer::FrameBuffer(): data(16 * 1024), start(0), end(0), broken(false) {
+}
+
+boost::asio::mutable_buffer FrameBuffer::space() {
+    
+    //Move what's left to the front, once it's worth it.
+    if (start > 0 && (start == end || end == data.size() || start > data.size() / 2)) {
+        memmove(data.data(), data.data() + start, end - start);
+        end -= start;
+        start = 0;
+    }
+    
+    //Make room for all of a frame that's started arriving.
+    if (end - start >= 4) {
+        FrameReader reader(data.data() + start, 4);
+        uint32_t body;
+        reader.fixed(&body);
+        if (body <= MAX_FRAME_SIZE && start + 4 + body > data.size())
+            data.resize(start + 4 + body);
+    }
+    if (end == data.size())
+        data.resize(data.size() * 2);
+    
+    return boost::asio::buffer(data.data() + end, data.size() - end);
+}
+
+bool FrameBuffer::next(const char** body, size_t* size) {
+    
+    if (broken || end - start < 4)
+        return false;
+    
+    FrameReader reader(data.data() + start, 4);
+    uint32_t length;
+    reader.fixed(&length);
+    if (length > MAX_FRAME_SIZE) {
+        broken = true;
+        return false;
+    }
+    if (end - start - 4 < length)
+        return false;
+    
+    *body = data.data() + start + 4;
+    *size = length;
+    start += 4 + length;
+    return true;
+}
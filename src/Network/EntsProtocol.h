@@ -0,0 +1,275 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENTSPROTOCOL_H
+#define ENTSPROTOCOL_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <boost/asio/buffer.hpp>
+#include "EntsService.h"
+
+using namespace std;
+
+/*
+ * How requests and responses look on the wire.
+ *
+ * Every message is a frame: a 4 byte length, then that many bytes. The body
+ * starts with a 4 byte request ID, chosen by the client and sent back with
+ * the response, so a client can have many requests going at once on one
+ * connection and match up the answers in whatever order they arrive.
+ * Fixed size numbers are big endian. Everything else is packed as varints,
+ * 7 bits to a byte, low bits first.
+ *
+ *  request:    length, id, op (1 byte), then a key for each Ent the op needs
+ *  key:        uid (varint), name length (varint), name. The name may be
+ *              left out (length 0) when there's a UID.
+ *  response:   length, id, status (1 byte), count (varint), then for each
+ *              Ent its uid (varint), name length (varint) and name. An
+ *              expansion's response then has its frontier, as a count and
+ *              that many UIDs (varints), if it isn't empty.
+ *
+ * OP_EXPAND_DESCENDENTS and OP_EXPAND_ANCESTORS have a count and that many
+ * UIDs (varints) after the op, instead of keys.
+ *
+ * OP_QUERY and OP_EXPLAIN send the query as the name of their key, with UID
+ * 0. The answer to OP_EXPLAIN is its plan, a line to an Ent with UID 0. So
+ * is what's wrong with a query answered with STATUS_BAD_REQUEST.
+ *
+ * Any request may end with a timeout in milliseconds (varint). If the server
+ * can't answer in time it gives up, with STATUS_TIMED_OUT.
+ *
+ * Descendents and ancestors can be far too many to send at once, so they're
+ * streamed: a number of responses with the request's ID, each with a chunk
+ * of STREAM_CHUNK Ents and STATUS_MORE, until the last, which has whatever
+ * status the request ended with. The server only sends STREAM_WINDOW chunks
+ * ahead. The client sends OP_MORE, with the same ID, for each chunk it takes,
+ * to let another one come, or OP_CANCEL to stop early.
+ *
+ * A connection may have CONNECTION_WINDOW requests waiting to be answered,
+ * not counting OP_MORE, OP_CANCEL, OP_FOLLOW and OP_WATCH (LANE_CONTROL). A
+ * stream counts until its first chunk. The server doesn't read any more from
+ * a connection that's used up its window until answers have gone out, so a
+ * client that sends too much is held back by TCP instead of piling requests
+ * up in the server's memory. Clients should keep to the window themselves,
+ * so their own control requests aren't stuck behind the rest. At most
+ * CONNECTION_STREAMS streams can be open at once on a connection.
+ *
+ * A server with more requests going than it's set to take, across all its
+ * connections, answers new ones straight away with STATUS_OVERLOADED, so the
+ * client can back off or go elsewhere.
+ *
+ * A follower sends OP_FOLLOW with a log offset (varint, after the op) and
+ * gets back a never ending run of change batches with the request's ID:
+ *
+ *  batch:      length, id, status (1 byte), snapshot (1 byte), offset, end
+ *              and time (varints), count (varint), then for each change its
+ *              type (1 byte), a and b (varints), name length (varint) and
+ *              name. A snapshot's batches end with the primary's origin
+ *              (varint), unless it's 0.
+ *
+ * The next batch is only made once the one before has been written, so a
+ * follower that can't keep up holds the server back through TCP, rather
+ * than having batches pile up in memory.
+ *
+ * OP_WATCH is answered with batches too, all with the request's ID. The
+ * first has no changes, and says the watch is in place, or why it isn't.
+ * After that each one has the changes made under the Ent since the last.
+ * Its snapshot flag means some were missed, and its offset is just after
+ * the last change in the log. The watch goes on until OP_CANCEL, or until
+ * a batch with STATUS_NOT_FOUND says the Ent is gone.
+ */
+
+/**
+ * The biggest frame either side will read. Anything bigger is taken as
+ * garbage and the connection is dropped.
+ */
+const uint32_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+/**
+ * How many Ents go in each chunk of a stream.
+ */
+const size_t STREAM_CHUNK = 1024;
+
+/**
+ * How many chunks of a stream can be on their way at once.
+ */
+const unsigned int STREAM_WINDOW = 4;
+
+/**
+ * How many requests a connection can have waiting to be answered.
+ */
+const unsigned int CONNECTION_WINDOW = 256;
+
+/**
+ * How many streams a connection can have open at once.
+ */
+const unsigned int CONNECTION_STREAMS = 16;
+
+/**
+ * How many changes go in each batch sent to a follower or a watch.
+ */
+const size_t FOLLOW_CHUNK = 4096;
+
+/**
+ * A request or response ready to be written, as a list of buffers to hand
+ * to a gather write.
+ *
+ * Numbers are packed into a small buffer of the frame's own, but long names
+ * are pointed to where they are, so they're never copied. The request or
+ * response the frame was made from must stay put until it's written.
+ */
+class EntsFrame {
+
+    /**
+     * Names shorter than this are copied in with the numbers. A buffer of
+     * their own costs more than copying them.
+     */
+    static const size_t COPY_BELOW = 64;
+
+    string packed;
+    /**
+     * Names sent from where they are, each with the place in packed it
+     * comes before.
+     */
+    vector<pair<size_t, const string*> > names;
+    size_t length;
+
+    EntsFrame(uint32_t id);
+
+    void putVarint(uint32_t value);
+    void putVarint64(uint64_t value);
+    void putName(const string& name);
+    void putKey(const EntKey& key);
+    /**
+     * Writes the length at the front, once everything's been put.
+     */
+    void finish();
+
+public:
+
+    /**
+     * Frames a request. request must outlive the frame.
+     */
+    EntsFrame(uint32_t id, const EntsRequest& request);
+
+    /**
+     * Frames a response. response must outlive the frame.
+     */
+    EntsFrame(uint32_t id, const EntsResponse& response);
+
+    /**
+     * Frames a batch of changes for a follower. batch must outlive the frame.
+     */
+    EntsFrame(uint32_t id, const ChangeBatch& batch);
+
+    /**
+     * Adds the frame's pieces, in order, to a list of buffers to write.
+     */
+    void addBuffers(vector<boost::asio::const_buffer>* buffers) const;
+
+    /**
+     * Bytes on the wire, length included.
+     */
+    size_t size() const {
+        return length;
+    }
+
+    /**
+     * Reads a request from a frame's body, which is what FrameBuffer::next()
+     * gives.
+     * @return          false if it isn't a request.
+     */
+    static bool readRequest(const char* body, size_t size, uint32_t* id,
+            EntsRequest* request);
+
+    /**
+     * Reads a response from a frame's body.
+     * @return          false if it isn't a response.
+     */
+    static bool readResponse(const char* body, size_t size, uint32_t* id,
+            EntsResponse* response);
+
+    /**
+     * Reads a batch of changes from a frame's body.
+     * @return          false if it isn't a batch.
+     */
+    static bool readBatch(const char* body, size_t size, uint32_t* id,
+            ChangeBatch* batch);
+
+    /**
+     * Just the ID of a frame's body, for answering one that can't be read.
+     * @return          false if it's too short to have one.
+     */
+    static bool readID(const char* body, size_t size, uint32_t* id);
+
+    /**
+     * Frames made up requests, responses and batches, passes the bytes
+     * through a FrameBuffer in odd sized pieces, and reads them back.
+     * @return          "" if everything comes back as it went in, and every
+     *                  cut short body is turned down, otherwise what didn't.
+     */
+    static string check();
+
+};
+
+/**
+ * Collects bytes as they're read from a connection, and splits them up into
+ * frames. Read into space(), tell it how much came with filled(), then take
+ * frames out with next() until there are no whole ones left.
+ */
+class FrameBuffer {
+
+    vector<char> data;
+    size_t start;
+    size_t end;
+    bool broken;
+
+public:
+
+    FrameBuffer();
+
+    /**
+     * Somewhere to read into. Whole frames already taken out are dropped to
+     * make room, and it grows to fit a big frame that's partly in.
+     */
+    boost::asio::mutable_buffer space();
+
+    void filled(size_t bytes) {
+        end += bytes;
+    }
+
+    /**
+     * Takes out the next whole frame. body points into the buffer, and is
+     * good until the next call to space().
+     * @return          false if no whole frame has arrived yet.
+     */
+    bool next(const char** body, size_t* size);
+
+    /**
+     * true once a frame bigger than MAX_FRAME_SIZE has shown up, after which
+     * nothing more can be read from the connection.
+     */
+    bool isBroken() const {
+        return broken;
+    }
+
+};
+
+#endif /* ENTSPROTOCOL_H */
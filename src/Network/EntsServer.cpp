@@ -17,40 +17,1172 @@
  */
 
 #include "EntsServer.h"
+#include "EntsProtocol.h"
+#include "ReplicationSource.h"
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+#include <fstream>
+#include <random>
+#include <unistd.h>
 
 
 using boost::asio::ip::tcp;
 
 
-EntsServer::EntsServer() {
-    
-    int tcpPort = 1037;
-    
-    
-    try {
-        
-        boost::asio::io_service io_service;
-        
-        tcp::acceptor acceptor(io_service, tcp::endpoint(tcp::v4(), tcpPort));
+/**
+ * A response, or a follower's batch of changes, and its frame, kept together
+ * until it's been written. answers is set if it's the reply that frees up
+ * its request's place in the connection's window, and admitted if the
+ * request was counted against the server's limit too.
+ */
+struct EntsReply {
+    EntsResponse response;
+    ChangeBatch batch;
+    EntsFrame frame;
+    bool answers;
+    bool admitted;
+
+    EntsReply(uint32_t id, EntsResponse r, bool a = true): response(std::move(r)),
+            frame(id, response), answers(a), admitted(a) {}
+
+    EntsReply(uint32_t id, ChangeBatch b): batch(std::move(b)), frame(id, batch),
+            answers(false), admitted(false) {}
+};
+
+/**
+ * One client's connection. It keeps itself alive through the handlers
+ * waiting on it, and goes away once the client hangs up.
+ *
+ * Everything that touches the socket or the replies runs on the session's
+ * strand, one thing at a time, but different sessions run on different
+ * threads at once.
+ */
+class EntsSession : public enable_shared_from_this<EntsSession> {
+
+    EntsServer* server;
+    tcp::socket socket;
+    boost::asio::strand<boost::asio::io_context::executor_type> strand;
+    FrameBuffer input;
+    /**
+     * Replies ready to go out, and those being written now.
+     */
+    vector<shared_ptr<EntsReply> > waiting;
+    vector<shared_ptr<EntsReply> > sending;
+    vector<boost::asio::const_buffer> buffers;
+    bool writing;
+    /**
+     * How many of the client's requests haven't been answered yet (see
+     * CONNECTION_WINDOW), how many of those weren't turned down, and whether
+     * reading has stopped until some are answered.
+     */
+    unsigned int unanswered;
+    unsigned int admitted;
+    bool paused;
+
+    /**
+     * A streamed request, and how many more chunks it may send. Its next
+     * chunk is made on the traversal pool, and busy is set until it's back.
+     * started is set once the first chunk is on its way.
+     */
+    struct Stream {
+        shared_ptr<RelativeStream> walk;
+        unsigned int credit;
+        bool busy;
+        bool started;
+        shared_ptr<Cancellation> cancel;
+        chrono::steady_clock::time_point received;
+    };
+    unordered_map<uint32_t, Stream> streams;
+    /**
+     * Expansions and queries on the traversal pool, so they can be stopped
+     * if the client hangs up.
+     */
+    unordered_map<uint32_t, shared_ptr<Cancellation> > expanding;
+
+    /**
+     * Set if the client is a follower. waiting is true while it's caught up,
+     * until the server hears there's more in the log.
+     */
+    struct Follow {
+        unique_ptr<ReplicationSource> source;
+        uint32_t id;
+        bool waiting;
+    };
+    unique_ptr<Follow> following;
+
+    /**
+     * The client's Watches, by request ID, and the IDs of those with changes
+     * to send.
+     */
+    unordered_map<uint32_t, shared_ptr<Watch> > watches;
+    vector<uint32_t> ready;
+
+    /**
+     * Changes can wait on locks, so they're run elsewhere and don't hold up
+     * lookups behind them. Their answers may come back out of order.
+     */
+    static bool isEdit(EntsOp op) {
+        return op == OP_CREATE_ENT || op == OP_CONNECT || op == OP_DISCONNECT;
+    }
+
+    /**
+     * Frees up an answered request's place. Requests that were turned down
+     * only had a place in the window, or retrying them would keep the server
+     * full forever.
+     */
+    void answered(bool wasAdmitted) {
+        unanswered--;
+        if (wasAdmitted) {
+            admitted--;
+            server->inFlight.fetch_sub(1, memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Turns a request down without trying it.
+     * @param wasAdmitted   Whether it got past the server's limit, and was
+     *                      turned down by the connection's own.
+     */
+    void overloaded(uint32_t id, bool wasAdmitted) {
+        EntsResponse busy;
+        busy.status = STATUS_OVERLOADED;
+        shared_ptr<EntsReply> reply = make_shared<EntsReply>(id, std::move(busy));
+        reply->admitted = wasAdmitted;
+        waiting.push_back(reply);
+        server->overloads.fetch_add(1, memory_order_relaxed);
+    }
+
+    void timed(EntsLane lane, chrono::steady_clock::time_point received) {
+        server->latencies[lane].record(chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - received).count());
+    }
+
+    /**
+     * Stops everything the client was waiting for, once it's gone.
+     */
+    void hangUp() {
+        for (pair<const uint32_t, Stream>& stream : streams)
+            stream.second.cancel->cancel();
+        streams.clear();
+        for (pair<const uint32_t, shared_ptr<Cancellation> >& expansion : expanding)
+            expansion.second->cancel();
+        expanding.clear();
+    }
+
+public:
+
+    EntsSession(EntsServer* s, tcp::socket sock): server(s), socket(std::move(sock)),
+            strand(boost::asio::make_strand(s->io)), writing(false), unanswered(0),
+            admitted(0), paused(false) {
+        server->connections.fetch_add(1, memory_order_relaxed);
+    }
+
+    ~EntsSession() {
+        for (pair<const uint32_t, shared_ptr<Watch> >& watch : watches)
+            server->watchHub.unwatch(watch.second);
+        if (following != nullptr)
+            server->followers.fetch_sub(1, memory_order_relaxed);
+        //Whatever the client never got.
+        server->inFlight.fetch_sub(admitted, memory_order_relaxed);
+        server->connections.fetch_sub(1, memory_order_relaxed);
+    }
+
+    void read() {
+        shared_ptr<EntsSession> self = shared_from_this();
+        socket.async_read_some(input.space(), boost::asio::bind_executor(strand,
+                [self](const boost::system::error_code& error, size_t bytes) {
+                    if (error) {
+                        self->hangUp();
+                        return;
+                    }
+                    self->input.filled(bytes);
+                    self->answer();
+                }));
+    }
+
+    /**
+     * Answers every whole request that's come in, then writes back all the
+     * replies that are ready. Stops once the client's window is used up, and
+     * doesn't read any more until write() has made room.
+     */
+    void answer() {
         
-        for (;;) {
+        const char* body;
+        size_t size;
+        chrono::steady_clock::time_point received = chrono::steady_clock::now();
+        while (unanswered < CONNECTION_WINDOW && input.next(&body, &size)) {
             
-            tcp::socket socket(io_service);
+            uint32_t id;
+            EntsRequest request;
+            bool parsed = EntsFrame::readRequest(body, size, &id, &request);
+            //Still answered when it has an ID, so the client isn't left waiting.
+            if (!parsed && !EntsFrame::readID(body, size, &id))
+                return;
             
-            std::cout << "Waiting for client to connect...\n";
-            
-            acceptor.accept(socket);
-            
-            std::cout << "Client connected.\n";
+            //Everything but control requests takes a place in the window.
+            if (!parsed || EntsService::laneFor(request.op) != LANE_CONTROL) {
+                unanswered++;
+                if (server->inFlight.load(memory_order_relaxed) >= server->mostInFlight) {
+                    overloaded(id, false);
+                    continue;
+                }
+                admitted++;
+                server->inFlight.fetch_add(1, memory_order_relaxed);
+            }
             
+            if (!parsed) {
+                EntsResponse bad;
+                bad.status = STATUS_BAD_REQUEST;
+                waiting.push_back(make_shared<EntsReply>(id, std::move(bad)));
+            } else if (request.op == OP_CANCEL && watches.count(id) > 0) {
+                server->watchHub.unwatch(watches[id]);
+                watches.erase(id);
+                continue;
+            } else if (request.op == OP_MORE || request.op == OP_CANCEL) {
+                //Streams that have already ended are ignored.
+                unordered_map<uint32_t, Stream>::iterator stream = streams.find(id);
+                if (stream != streams.end()) {
+                    if (request.op == OP_CANCEL) {
+                        stream->second.cancel->cancel();
+                        if (!stream->second.started)
+                            answered(true);
+                        streams.erase(stream);
+                    } else {
+                        stream->second.credit = min(stream->second.credit + 1, STREAM_WINDOW);
+                        send(id);
+                    }
+                }
+                continue;
+            } else if (request.op == OP_FOLLOW) {
+                if (following != nullptr) {
+                    EntsResponse bad;
+                    bad.status = STATUS_BAD_REQUEST;
+                    waiting.push_back(make_shared<EntsReply>(id, std::move(bad), false));
+                } else {
+                    server->startFollowing();
+                    following.reset(new Follow{unique_ptr<ReplicationSource>(
+                            new ReplicationSource(server->followed, request.offset)), id, false});
+                    server->followers.fetch_add(1, memory_order_relaxed);
+                }
+            } else if (request.op == OP_WATCH) {
+                startWatching(id, request.a);
+            } else if (isEdit(request.op) && server->forwarder) {
+                shared_ptr<EntsSession> self = shared_from_this();
+                server->forwarder(request, [self, id, received](EntsResponse response) {
+                    shared_ptr<EntsReply> reply = make_shared<EntsReply>(id, std::move(response));
+                    self->server->requests.fetch_add(1, memory_order_relaxed);
+                    self->timed(LANE_EDIT, received);
+                    boost::asio::post(self->strand, [self, reply] {
+                        self->waiting.push_back(reply);
+                        self->write();
+                    });
+                });
+                continue;
+            } else if (isEdit(request.op) && server->readOnly.load()) {
+                EntsResponse refused;
+                refused.status = STATUS_READ_ONLY;
+                waiting.push_back(make_shared<EntsReply>(id, std::move(refused)));
+            } else if (EntsService::isStreamed(request.op)) {
+                //A short enough answer the cache has is sent as the stream's
+                //one and only chunk.
+                EntsResponse cached;
+                if (server->service.answerFromCache(request, &cached)) {
+                    waiting.push_back(make_shared<EntsReply>(id, std::move(cached)));
+                    server->requests.fetch_add(1, memory_order_relaxed);
+                    timed(LANE_TRAVERSAL, received);
+                    continue;
+                }
+                //Each open stream holds a snapshot of the Tree.
+                if (streams.size() >= CONNECTION_STREAMS) {
+                    overloaded(id, true);
+                    continue;
+                }
+                EntsStatus status;
+                Stream stream = {nullptr, STREAM_WINDOW, false, false,
+                        make_shared<Cancellation>(request.timeout), received};
+                stream.walk = server->service.startStream(request, &status);
+                if (stream.walk == nullptr) {
+                    EntsResponse failed;
+                    failed.status = status;
+                    waiting.push_back(make_shared<EntsReply>(id, std::move(failed)));
+                } else {
+                    streams[id] = std::move(stream);
+                    send(id);
+                }
+            } else if (EntsService::laneFor(request.op) == LANE_TRAVERSAL) {
+                //Expansions and queries can take a while, so they go with
+                //the other traversals.
+                shared_ptr<EntsSession> self = shared_from_this();
+                shared_ptr<Cancellation> cancel = make_shared<Cancellation>(request.timeout);
+                expanding[id] = cancel;
+                boost::asio::post(server->traversals, [self, id, request, cancel, received] {
+                    shared_ptr<EntsReply> reply = make_shared<EntsReply>(id,
+                            self->server->service.execute(request, cancel.get()));
+                    boost::asio::post(self->strand, [self, id, reply, received] {
+                        //Dropped if the client hung up.
+                        if (self->expanding.erase(id) == 0)
+                            return;
+                        self->server->requests.fetch_add(1, memory_order_relaxed);
+                        self->timed(LANE_TRAVERSAL, received);
+                        self->waiting.push_back(reply);
+                        self->write();
+                    });
+                });
+                continue;
+            } else if (isEdit(request.op)) {
+                //Edits can wait on locks, which would hold up the session's
+                //other requests.
+                shared_ptr<EntsSession> self = shared_from_this();
+                boost::asio::post(server->io, [self, id, request, received] {
+                    EntsResponse response;
+                    //Not made at all if it's already too late.
+                    if (request.timeout != 0 && chrono::steady_clock::now() - received
+                            >= chrono::milliseconds(request.timeout))
+                        response.status = STATUS_TIMED_OUT;
+                    else
+                        response = self->server->service.execute(request);
+                    shared_ptr<EntsReply> reply = make_shared<EntsReply>(id, std::move(response));
+                    self->server->requests.fetch_add(1, memory_order_relaxed);
+                    self->timed(LANE_EDIT, received);
+                    boost::asio::post(self->strand, [self, reply] {
+                        self->waiting.push_back(reply);
+                        self->write();
+                    });
+                });
+                continue;
+            } else {
+                waiting.push_back(make_shared<EntsReply>(id, server->service.execute(request)));
+                if (EntsService::laneFor(request.op) == LANE_LOOKUP)
+                    timed(LANE_LOOKUP, received);
+            }
+            server->requests.fetch_add(1, memory_order_relaxed);
         }
         
-    } catch (std::exception& e) {
+        write();
+        follow();
+        if (unanswered >= CONNECTION_WINDOW)
+            paused = true;
+        //Nothing more can be read once a frame is too big to be real.
+        else if (!input.isBroken())
+            read();
+    }
+
+    /**
+     * Has the next chunk of a stream made on the traversal pool, if it has
+     * credit for one and isn't making one already. sent() carries on from
+     * there, so only the chunks it has credit for are ever held, however big
+     * the stream is.
+     */
+    void send(uint32_t id) {
         
-        std::cerr << "EntsServer ERROR: " << e.what() << std::endl;
+        unordered_map<uint32_t, Stream>::iterator found = streams.find(id);
+        if (found == streams.end() || found->second.busy || found->second.credit == 0)
+            return;
         
+        Stream& stream = found->second;
+        stream.busy = true;
+        shared_ptr<EntsSession> self = shared_from_this();
+        shared_ptr<RelativeStream> walk = stream.walk;
+        shared_ptr<Cancellation> cancel = stream.cancel;
+        boost::asio::post(server->traversals, [self, id, walk, cancel] {
+            shared_ptr<EntsResponse> chunk = make_shared<EntsResponse>();
+            if (cancel->isCancelled())
+                chunk->status = STATUS_TIMED_OUT;
+            else
+                EntsService::nextChunk(walk.get(), STREAM_CHUNK, chunk.get());
+            boost::asio::post(self->strand, [self, id, chunk] {
+                self->sent(id, std::move(*chunk));
+                self->write();
+            });
+        });
+    }
+
+    /**
+     * Queues a chunk made for a stream, and asks for the next.
+     */
+    void sent(uint32_t id, EntsResponse chunk) {
+        
+        //Dropped if the stream was cancelled meanwhile.
+        unordered_map<uint32_t, Stream>::iterator found = streams.find(id);
+        if (found == streams.end())
+            return;
+        
+        Stream& stream = found->second;
+        stream.busy = false;
+        stream.credit--;
+        bool last = chunk.status != STATUS_MORE;
+        waiting.push_back(make_shared<EntsReply>(id, std::move(chunk), !stream.started));
+        stream.started = true;
+        if (last) {
+            timed(LANE_TRAVERSAL, stream.received);
+            streams.erase(found);
+            return;
+        }
+        send(id);
+    }
+
+    /**
+     * Sends a follower its next batch of changes, once everything before it
+     * has been written, or waits for more if it has them all.
+     */
+    void follow() {
+        
+        if (following == nullptr || following->waiting || writing || !waiting.empty())
+            return;
+        
+        ChangeBatch batch;
+        if (!following->source->next(FOLLOW_CHUNK, &batch)) {
+            following->waiting = true;
+            server->waitForChanges(shared_from_this());
+            //In case something came in before the server was listening.
+            if (following->source->hasMore())
+                resume();
+            return;
+        }
+        
+        bool last = batch.status != STATUS_MORE;
+        waiting.push_back(make_shared<EntsReply>(following->id, std::move(batch)));
+        if (last) {
+            following.reset();
+            server->followers.fetch_sub(1, memory_order_relaxed);
+        }
+        write();
+    }
+
+    /**
+     * Carries on following once there's more in the log. Run on the strand.
+     */
+    void resume() {
+        if (following == nullptr || !following->waiting)
+            return;
+        following->waiting = false;
+        follow();
+    }
+
+    /**
+     * Puts a Watch on an Ent for the client, and answers whether it took.
+     */
+    void startWatching(uint32_t id, const EntKey& key) {
+        
+        ChangeBatch answer;
+        if (watches.count(id) > 0) {
+            answer.status = STATUS_BAD_REQUEST;
+            waiting.push_back(make_shared<EntsReply>(id, std::move(answer)));
+            return;
+        }
+        
+        //Changes are matched on whatever thread makes them. The Watch only
+        //has the session woken, and mustn't keep it alive.
+        weak_ptr<EntsSession> session = shared_from_this();
+        EntsStatus status;
+        uint64_t from = 0;
+        shared_ptr<Watch> watch = server->watchHub.watch(key, [session, id] {
+            shared_ptr<EntsSession> self = session.lock();
+            if (self == nullptr)
+                return;
+            boost::asio::post(self->strand, [self, id] {
+                self->ready.push_back(id);
+                self->sendWatched();
+            });
+        }, &status, &from);
+        
+        if (watch != nullptr)
+            watches[id] = watch;
+        answer.status = watch != nullptr ? STATUS_MORE : status;
+        answer.offset = answer.end = from;
+        answer.time = ChangeLog::now();
+        waiting.push_back(make_shared<EntsReply>(id, std::move(answer)));
+    }
+
+    /**
+     * Sends the changes each ready Watch has. While a write is going they're
+     * left to pile up, and go together once it's done.
+     */
+    void sendWatched() {
+        
+        if (writing || ready.empty())
+            return;
+        
+        vector<uint32_t> taking;
+        taking.swap(ready);
+        for (uint32_t id : taking) {
+            unordered_map<uint32_t, shared_ptr<Watch> >::iterator watch = watches.find(id);
+            if (watch == watches.end())
+                continue;
+            ChangeBatch batch;
+            bool more;
+            if (!watch->second->take(FOLLOW_CHUNK, &batch, &more))
+                continue;
+            bool last = batch.status != STATUS_MORE;
+            waiting.push_back(make_shared<EntsReply>(id, std::move(batch)));
+            if (last)
+                watches.erase(watch);
+            else if (more)
+                ready.push_back(id);
+        }
+        write();
+    }
+
+    boost::asio::strand<boost::asio::io_context::executor_type>& getStrand() {
+        return strand;
+    }
+
+    /**
+     * Writes all the replies that are waiting in one go, unless a write is
+     * already going, in which case they go when it's done.
+     */
+    void write() {
+        
+        if (writing || waiting.empty())
+            return;
+        
+        writing = true;
+        sending.swap(waiting);
+        buffers.clear();
+        for (shared_ptr<EntsReply>& reply : sending)
+            reply->frame.addBuffers(&buffers);
+        
+        shared_ptr<EntsSession> self = shared_from_this();
+        boost::asio::async_write(socket, buffers, boost::asio::bind_executor(strand,
+                [self](const boost::system::error_code& error, size_t) {
+                    self->writing = false;
+                    for (shared_ptr<EntsReply>& reply : self->sending) {
+                        if (reply->answers)
+                            self->answered(reply->admitted);
+                    }
+                    self->sending.clear();
+                    if (error)
+                        return;
+                    self->write();
+                    self->sendWatched();
+                    self->follow();
+                    //Carries on with the frames already read, then reads more.
+                    if (self->paused && self->unanswered < CONNECTION_WINDOW) {
+                        self->paused = false;
+                        self->answer();
+                    }
+                }));
+    }
+
+};
+
+
+EntsServer::EntsServer(Tree* tree, unsigned short port, unsigned int count,
+        const string& address, bool sharePort): service(tree), requests(0), connections(0),
+        followers(0), inFlight(0), overloads(0), watchHub(tree), acceptor(io),
+        threadCount(count), mostInFlight(DEFAULT_MOST_IN_FLIGHT), readOnly(false),
+        followed(tree), cpu(-1), log(nullptr), wakeFollowers(false) {
+    
+    if (threadCount == 0)
+        threadCount = max(1u, thread::hardware_concurrency());
+    traversalThreadCount = max(1u, threadCount / 4);
+    
+    tcp::endpoint endpoint(boost::asio::ip::make_address(address), port);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(tcp::acceptor::reuse_address(true));
+    if (sharePort)
+        acceptor.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+    acceptor.bind(endpoint);
+    acceptor.listen();
+    service.startCaching(QueryCache::DEFAULT_CAPACITY);
+}
+
+EntsServer::~EntsServer() {
+    stop();
+}
+
+void EntsServer::accept() {
+    acceptor.async_accept([this](const boost::system::error_code& error, tcp::socket socket) {
+        if (error == boost::asio::error::operation_aborted || !acceptor.is_open())
+            return;
+        if (!error) {
+            boost::system::error_code ignored;
+            socket.set_option(tcp::no_delay(true), ignored);
+            make_shared<EntsSession>(this, std::move(socket))->read();
+        }
+        accept();
+    });
+}
+
+void EntsServer::start() {
+    
+    if (!threads.empty() || !acceptor.is_open())
+        return;
+    
+    io.restart();
+    accept();
+    traversals.restart();
+    //Nothing waits on traversals, so they'd run out of work without this.
+    traversing.reset(new boost::asio::executor_work_guard<boost::asio::io_context::executor_type>(
+            traversals.get_executor()));
+    for (unsigned int i = 0; i < threadCount + traversalThreadCount; i++) {
+        if (i < threadCount)
+            threads.push_back(thread([this] { io.run(); }));
+        else
+            threads.push_back(thread([this] { traversals.run(); }));
+        if (cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu, &cpus);
+            pthread_setaffinity_np(threads.back().native_handle(), sizeof(cpus), &cpus);
+        }
+    }
+}
+
+void EntsServer::stop() {
+    
+    //The log outlives the server, and mustn't call back into it.
+    {
+        lock_guard<mutex> hold(followLock);
+        if (log != nullptr)
+            log->unlisten(this);
+    }
+    watchHub.stop();
+    
+    if (threads.empty())
+        return;
+    
+    //Nothing else touches the acceptor once the threads are gone.
+    io.stop();
+    traversals.stop();
+    traversing.reset();
+    for (thread& t : threads)
+        t.join();
+    threads.clear();
+    boost::system::error_code ignored;
+    acceptor.close(ignored);
+}
+
+ChangeLog* EntsServer::startFollowing() {
+    
+    lock_guard<mutex> hold(followLock);
+    if (log == nullptr) {
+        log = followed->startChangeLog();
+        //Called with the log locked, on whatever thread made the change, so
+        //it only hands off to the server's threads, and only once.
+        log->listen(this, [this] {
+            if (wakeFollowers.exchange(false))
+                boost::asio::post(io, [this] { resumeFollowers(); });
+        });
+    }
+    return log;
+}
+
+void EntsServer::waitForChanges(const shared_ptr<EntsSession>& session) {
+    lock_guard<mutex> hold(followLock);
+    waitingFollowers.push_back(session);
+    wakeFollowers.store(true);
+}
+
+void EntsServer::resumeFollowers() {
+    
+    vector<weak_ptr<EntsSession> > resuming;
+    {
+        lock_guard<mutex> hold(followLock);
+        resuming.swap(waitingFollowers);
+    }
+    for (weak_ptr<EntsSession>& follower : resuming) {
+        shared_ptr<EntsSession> session = follower.lock();
+        if (session != nullptr)
+            boost::asio::post(session->getStrand(), [session] { session->resume(); });
+    }
+}
+
+ServerBenchmark EntsServer::benchmark(Tree* tree, unsigned int threadCount,
+        unsigned int clients, double seconds) {
+    
+    EntsServer server(tree, 0, threadCount, "127.0.0.1");
+    server.start();
+    ServerBenchmark result = measure(tree, server.getPort(), clients, seconds);
+    result.threads = server.threadCount;
+    return result;
+}
+
+ServerBenchmark EntsServer::measure(Tree* tree, unsigned short port,
+        unsigned int clients, double seconds) {
+    
+    //Requests are made up ahead of time from a sample of names.
+    vector<EntsRequest> batch;
+    for (string& name : tree->sampleNames(64)) {
+        EntsRequest request;
+        request.op = batch.size() % 2 ? OP_FIND : OP_GET_CHILDREN;
+        request.a.name = name;
+        batch.push_back(request);
+    }
+    vector<EntsFrame> frames;
+    vector<boost::asio::const_buffer> requestBuffers;
+    for (size_t i = 0; i < batch.size(); i++)
+        frames.push_back(EntsFrame(i, batch[i]));
+    for (EntsFrame& frame : frames)
+        frame.addBuffers(&requestBuffers);
+    
+    atomic<uint64_t> answered(0);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point until = start
+            + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+    
+    vector<thread> clientThreads;
+    for (unsigned int i = 0; i < clients; i++) {
+        clientThreads.push_back(thread([&] {
+            try {
+                boost::asio::io_context clientIO;
+                tcp::socket socket(clientIO);
+                socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port));
+                socket.set_option(tcp::no_delay(true));
+                FrameBuffer responses;
+                uint64_t mine = 0;
+                while (chrono::steady_clock::now() < until) {
+                    boost::asio::write(socket, requestBuffers);
+                    size_t received = 0;
+                    while (received < batch.size()) {
+                        responses.filled(socket.read_some(responses.space()));
+                        const char* body;
+                        size_t size;
+                        while (responses.next(&body, &size))
+                            received++;
+                    }
+                    mine += received;
+                }
+                answered.fetch_add(mine);
+            } catch (exception& e) {
+                //Counted as nothing answered.
+            }
+        }));
+    }
+    for (thread& t : clientThreads)
+        t.join();
+    
+    ServerBenchmark result;
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    result.threads = 0;
+    result.clients = clients;
+    result.requests = answered.load();
+    return result;
+}
+
+/**
+ * How much memory the process has resident, in kilobytes.
+ */
+static size_t residentMemory() {
+    ifstream statm("/proc/self/statm");
+    size_t total = 0;
+    size_t resident = 0;
+    statm >> total >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+vector<OverloadSample> EntsServer::overload(Tree* tree, unsigned int threadCount,
+        unsigned int clients, unsigned int mostInFlight, unsigned int seconds) {
+    
+    vector<OverloadSample> samples;
+    if (seconds == 0)
+        return samples;
+    
+    EntsServer server(tree, 0, threadCount, "127.0.0.1");
+    server.setMostInFlight(mostInFlight);
+    server.start();
+    unsigned short port = server.getPort();
+    
+    vector<EntsRequest> lookups;
+    for (string& name : tree->sampleNames(64)) {
+        EntsRequest request;
+        request.op = lookups.size() % 2 ? OP_FIND : OP_GET_CHILDREN;
+        request.a.name = name;
+        lookups.push_back(request);
     }
     
+    //Everything is counted by the second its answer came in.
+    unique_ptr<LatencyHistogram[]> latencies(new LatencyHistogram[seconds]);
+    unique_ptr<atomic<uint64_t>[]> answered(new atomic<uint64_t>[seconds]());
+    unique_ptr<atomic<uint64_t>[]> overloaded(new atomic<uint64_t>[seconds]());
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point until = start + chrono::seconds(seconds);
+    
+    vector<thread> clientThreads;
+    for (unsigned int i = 0; i < clients; i++) {
+        clientThreads.push_back(thread([&] {
+            try {
+                boost::asio::io_context clientIO;
+                tcp::socket socket(clientIO);
+                socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port));
+                socket.set_option(tcp::no_delay(true));
+                FrameBuffer responses;
+                //Answers come back in order, so the requests waiting are
+                //always the last window's worth of IDs.
+                vector<chrono::steady_clock::time_point> sentAt(CONNECTION_WINDOW);
+                uint32_t next = 0;
+                unsigned int credit = CONNECTION_WINDOW;
+                vector<EntsFrame> frames;
+                vector<boost::asio::const_buffer> buffers;
+                frames.reserve(CONNECTION_WINDOW);
+                
+                chrono::steady_clock::time_point now = start;
+                while (now < until) {
+                    frames.clear();
+                    buffers.clear();
+                    for (; credit > 0; credit--) {
+                        sentAt[next % CONNECTION_WINDOW] = now;
+                        frames.push_back(EntsFrame(next, lookups[next % lookups.size()]));
+                        next++;
+                    }
+                    for (EntsFrame& frame : frames)
+                        frame.addBuffers(&buffers);
+                    if (!buffers.empty())
+                        boost::asio::write(socket, buffers);
+                    
+                    responses.filled(socket.read_some(responses.space()));
+                    now = chrono::steady_clock::now();
+                    size_t second = min<size_t>(seconds - 1,
+                            chrono::duration_cast<chrono::seconds>(now - start).count());
+                    const char* body;
+                    size_t size;
+                    while (responses.next(&body, &size)) {
+                        uint32_t id;
+                        EntsResponse response;
+                        if (!EntsFrame::readResponse(body, size, &id, &response))
+                            return;
+                        credit++;
+                        if (response.status == STATUS_OVERLOADED) {
+                            overloaded[second].fetch_add(1, memory_order_relaxed);
+                        } else {
+                            answered[second].fetch_add(1, memory_order_relaxed);
+                            latencies[second].record(chrono::duration_cast<chrono::microseconds>(
+                                    now - sentAt[id % CONNECTION_WINDOW]).count());
+                        }
+                    }
+                }
+            } catch (exception& e) {
+                //Counted as nothing more answered.
+            }
+        }));
+    }
     
+    vector<size_t> memory;
+    for (unsigned int i = 0; i < seconds; i++) {
+        this_thread::sleep_until(start + chrono::seconds(i + 1));
+        memory.push_back(residentMemory());
+    }
+    for (thread& t : clientThreads)
+        t.join();
     
-}
\ No newline at end of file
+    for (unsigned int i = 0; i < seconds; i++) {
+        OverloadSample sample;
+        sample.answered = answered[i].load();
+        sample.overloaded = overloaded[i].load();
+        sample.latency = latencies[i].summarize();
+        sample.memory = memory[i];
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+/**
+ * Sends requests down a socket all at once, and waits for every answer.
+ * @param responses Set to the answers, in the order of the requests.
+ * @return          false if one couldn't be read.
+ */
+static bool exchange(tcp::socket& socket, const vector<EntsRequest>& requests,
+        vector<EntsResponse>* responses) {
+    
+    vector<EntsFrame> frames;
+    vector<boost::asio::const_buffer> buffers;
+    for (size_t i = 0; i < requests.size(); i++)
+        frames.push_back(EntsFrame(i, requests[i]));
+    for (EntsFrame& frame : frames)
+        frame.addBuffers(&buffers);
+    boost::asio::write(socket, buffers);
+    
+    //Edits can be answered out of order, so answers go by their IDs.
+    responses->assign(requests.size(), EntsResponse());
+    FrameBuffer input;
+    size_t received = 0;
+    while (received < requests.size()) {
+        input.filled(socket.read_some(input.space()));
+        const char* body;
+        size_t size;
+        while (input.next(&body, &size)) {
+            uint32_t id;
+            EntsResponse response;
+            if (!EntsFrame::readResponse(body, size, &id, &response) || id >= requests.size())
+                return false;
+            (*responses)[id] = std::move(response);
+            received++;
+        }
+    }
+    return true;
+}
+
+string EntsServer::check() {
+    
+    const unsigned int CLIENTS = 8;
+    const unsigned int NAMES = 200;
+    
+    mt19937 random(36);
+    Tree tree("Server check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 3000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        tree.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 50 == 0) {
+            Ent::connectUnchecked(tree.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    
+    //Each client's lookups, and what the Tree answers itself.
+    EntsService direct(&tree);
+    vector<vector<EntsRequest> > lookups(CLIENTS);
+    vector<vector<EntsResponse> > expected(CLIENTS);
+    for (unsigned int c = 0; c < CLIENTS; c++) {
+        for (int i = 0; i < 500; i++) {
+            EntsRequest request;
+            EntsOp ops[] = {OP_FIND, OP_GET_PARENTS, OP_GET_CHILDREN};
+            request.op = ops[random() % 3];
+            if (random() % 20 == 0)
+                request.a.name = "missing";
+            else if (random() % 2)
+                request.a.uid = ents[random() % ents.size()]->getUID();
+            else
+                request.a.name = ents[random() % ents.size()]->getName();
+            lookups[c].push_back(request);
+            expected[c].push_back(direct.execute(request));
+        }
+    }
+    
+    EntsServer server(&tree, 0, 4, "127.0.0.1");
+    server.start();
+    unsigned short port = server.getPort();
+    
+    vector<string> failures(CLIENTS);
+    vector<thread> clients;
+    for (unsigned int c = 0; c < CLIENTS; c++) {
+        clients.push_back(thread([&, c] {
+            try {
+                boost::asio::io_context clientIO;
+                tcp::socket socket(clientIO);
+                socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port));
+                vector<EntsResponse> answers;
+                if (!exchange(socket, lookups[c], &answers)) {
+                    failures[c] = "a lookup's answer couldn't be read";
+                    return;
+                }
+                for (size_t i = 0; i < answers.size(); i++) {
+                    if (answers[i].status != expected[c][i].status
+                            || answers[i].ents != expected[c][i].ents) {
+                        failures[c] = "lookup " + to_string(i) + " of client " + to_string(c)
+                                + " was answered differently to the Tree";
+                        return;
+                    }
+                }
+            } catch (exception& e) {
+                failures[c] = e.what();
+            }
+        }));
+    }
+    for (thread& t : clients)
+        t.join();
+    
+    //Then every client tries to create the same names, and connects the
+    //ones it gets under Ents of its own choosing.
+    vector<vector<bool> > won(CLIENTS, vector<bool>(NAMES));
+    vector<vector<string> > parentNames(CLIENTS, vector<string>(NAMES));
+    for (unsigned int c = 0; c < CLIENTS; c++) {
+        for (unsigned int i = 0; i < NAMES; i++)
+            parentNames[c][i] = ents[random() % ents.size()]->getName();
+    }
+    clients.clear();
+    for (unsigned int c = 0; c < CLIENTS; c++) {
+        clients.push_back(thread([&, c] {
+            try {
+                boost::asio::io_context clientIO;
+                tcp::socket socket(clientIO);
+                socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port));
+                vector<EntsResponse> answers;
+                vector<EntsRequest> creates;
+                for (unsigned int i = 0; i < NAMES; i++) {
+                    EntsRequest create;
+                    create.op = OP_CREATE_ENT;
+                    create.a.name = "shared " + to_string((i + c * 7) % NAMES);
+                    creates.push_back(create);
+                }
+                if (!exchange(socket, creates, &answers)) {
+                    failures[c] = "a create's answer couldn't be read";
+                    return;
+                }
+                vector<EntsRequest> connects;
+                for (unsigned int i = 0; i < NAMES; i++) {
+                    if (answers[i].status == STATUS_NAME_TAKEN)
+                        continue;
+                    if (answers[i].status != STATUS_OK || answers[i].ents.size() != 1
+                            || answers[i].ents[0].name != creates[i].a.name) {
+                        failures[c] = "creating " + creates[i].a.name + " went wrong";
+                        return;
+                    }
+                    unsigned int name = (i + c * 7) % NAMES;
+                    won[c][name] = true;
+                    EntsRequest connect;
+                    connect.op = OP_CONNECT;
+                    connect.a.name = parentNames[c][name];
+                    connect.b.uid = answers[i].ents[0].uid;
+                    connects.push_back(connect);
+                }
+                if (!exchange(socket, connects, &answers)) {
+                    failures[c] = "a connect's answer couldn't be read";
+                    return;
+                }
+                for (EntsResponse& answer : answers) {
+                    if (answer.status != STATUS_OK) {
+                        failures[c] = "a connect was turned down";
+                        return;
+                    }
+                }
+            } catch (exception& e) {
+                failures[c] = e.what();
+            }
+        }));
+    }
+    for (thread& t : clients)
+        t.join();
+    server.stop();
+    for (string& failure : failures) {
+        if (!failure.empty())
+            return failure;
+    }
+    
+    for (unsigned int i = 0; i < NAMES; i++) {
+        string name = "shared " + to_string(i);
+        unsigned int winners = 0;
+        unsigned int winner = 0;
+        for (unsigned int c = 0; c < CLIENTS; c++) {
+            if (won[c][i]) {
+                winners++;
+                winner = c;
+            }
+        }
+        if (winners != 1)
+            return name + " was created by " + to_string(winners) + " clients";
+        Ent* ent = tree.getEntPtrByName(name);
+        Ent* parent = tree.getEntPtrByName(parentNames[winner][i]);
+        if (ent == nullptr || parent == nullptr || !ent->isChildOf(parent))
+            return name + " isn't under the Ent its client connected it to";
+    }
+    return "";
+}
+
+string EntsServer::checkOverload() {
+    
+    const unsigned int CLIENTS = 16;
+    
+    mt19937 random(46);
+    Tree tree("Overload check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 2000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        tree.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 50 == 0) {
+            Ent::connectUnchecked(tree.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    
+    //More than a connection may have waiting, so the server has to stop
+    //reading from each for a while.
+    EntsService direct(&tree);
+    vector<vector<EntsRequest> > lookups(CLIENTS);
+    vector<vector<EntsResponse> > expected(CLIENTS);
+    for (unsigned int c = 0; c < CLIENTS; c++) {
+        for (unsigned int i = 0; i < CONNECTION_WINDOW * 2; i++) {
+            EntsRequest request;
+            request.op = i % 2 ? OP_GET_CHILDREN : OP_GET_PARENTS;
+            request.a.uid = ents[random() % ents.size()]->getUID();
+            lookups[c].push_back(request);
+            expected[c].push_back(direct.execute(request));
+        }
+    }
+    
+    EntsServer server(&tree, 0, 2, "127.0.0.1");
+    server.setMostInFlight(64);
+    server.start();
+    unsigned short port = server.getPort();
+    
+    vector<string> failures(CLIENTS);
+    atomic<uint64_t> overloaded(0);
+    vector<thread> clients;
+    for (unsigned int c = 0; c < CLIENTS; c++) {
+        clients.push_back(thread([&, c] {
+            try {
+                boost::asio::io_context clientIO;
+                tcp::socket socket(clientIO);
+                socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port));
+                vector<EntsResponse> answers;
+                if (!exchange(socket, lookups[c], &answers)) {
+                    failures[c] = "an answer couldn't be read";
+                    return;
+                }
+                for (size_t i = 0; i < answers.size(); i++) {
+                    if (answers[i].status == STATUS_OVERLOADED) {
+                        overloaded++;
+                    } else if (answers[i].status != expected[c][i].status
+                            || answers[i].ents != expected[c][i].ents) {
+                        failures[c] = "lookup " + to_string(i) + " of client " + to_string(c)
+                                + " was answered differently to the Tree";
+                        return;
+                    }
+                }
+            } catch (exception& e) {
+                failures[c] = e.what();
+            }
+        }));
+    }
+    for (thread& t : clients)
+        t.join();
+    for (string& failure : failures) {
+        if (!failure.empty())
+            return failure;
+    }
+    
+    if (overloaded.load() == 0)
+        return "nothing was turned down";
+    if (server.getOverloadCount() != overloaded.load())
+        return "the server turned down " + to_string(server.getOverloadCount())
+                + " requests, but clients were told of " + to_string(overloaded.load());
+    //Requests are counted out once their answers have been written, which
+    //can be just after the client has read them.
+    for (int tries = 0; server.getInFlightCount() != 0; tries++) {
+        if (tries == 100)
+            return to_string(server.getInFlightCount()) + " requests were left in flight";
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    //Once the rush is over, as many as the limit are all answered again.
+    try {
+        boost::asio::io_context clientIO;
+        tcp::socket socket(clientIO);
+        socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port));
+        vector<EntsRequest> few(lookups[0].begin(), lookups[0].begin() + 64);
+        vector<EntsResponse> answers;
+        if (!exchange(socket, few, &answers))
+            return "an answer couldn't be read";
+        for (size_t i = 0; i < answers.size(); i++) {
+            if (answers[i].status != expected[0][i].status || answers[i].ents != expected[0][i].ents)
+                return "a lookup on its own was answered differently to the Tree";
+        }
+    } catch (exception& e) {
+        return e.what();
+    }
+    return "";
+}
@@ -21,26 +21,391 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
 #include <boost/asio.hpp>
+#include <mutex>
+#include <memory>
+#include "EntsService.h"
+#include "WatchHub.h"
+#include "QueryCache.h"
+#include "../Util/LatencyHistogram.h"
 
 /**
  * Currently uses the Boost C++ library.
  */
 using boost::asio::ip::tcp;
 
+class EntsSession;
 
 /**
- * A server object which listens for clients.
+ * Results from EntsServer::benchmark().
+ */
+struct ServerBenchmark {
+    unsigned int threads;
+    unsigned int clients;
+    uint64_t requests;
+    double seconds;
+
+    double getRequestsPerSecond() const {
+        return seconds > 0 ? requests / seconds : 0;
+    }
+};
+
+/**
+ * One second of EntsServer::overload(). Latencies are of the requests that
+ * were answered, not turned away, and memory is what the whole process has
+ * resident, in kilobytes.
+ */
+struct OverloadSample {
+    uint64_t answered;
+    uint64_t overloaded;
+    LatencySummary latency;
+    size_t memory;
+};
+
+/**
+ * Takes an edit the server won't make itself, and calls back with the
+ * answer once it's been made elsewhere. The callback can be called on any
+ * thread.
+ */
+typedef function<void(const EntsRequest&, function<void(EntsResponse)>)> EntsForwarder;
+
+/**
+ * A server object which listens for clients, and answers their requests
+ * about a Tree.
+ *
+ * Everything is asynchronous. A pool of threads runs the io_context, and
+ * each connection is a chain of reads and writes handed from one to the
+ * next, so a few threads can look after any number of clients.
+ *
+ * Requests are frames (see EntsProtocol.h). A client may send any number of
+ * requests without waiting. Lookups are answered in order, but changes can
+ * finish later, so clients match up the answers by request ID. A lookup
+ * sent right behind a change may not see it, so wait for the change's
+ * answer first if that matters. Replies that are ready together go back in
+ * one gather write.
+ *
+ * Other servers can follow this one's Tree (see EntsFollower). Each is sent
+ * a snapshot, if it needs one, then every change from the Tree's log as
+ * it's made. Clients can also watch an Ent, and are sent the changes made
+ * under it (see WatchHub).
+ *
+ * Ancestors and siblings of popular Ents are kept in a QueryCache, which
+ * drops an answer as soon as an edit changes it.
+ *
+ * Requests are split into lanes (see EntsLane). Lookups are answered right
+ * away by the threads reading them. Traversals, which can take much longer,
+ * run a chunk at a time on a smaller pool of their own, so however many
+ * there are they can't take every thread from the lookups. A traversal whose
+ * timeout passes, or whose client hangs up, is stopped at its next chunk.
+ * How long each lane's requests take is kept in a LatencyHistogram.
+ *
+ * Nothing a client sends can make the server hold more than a set amount
+ * for it. Each connection has a window of requests it may have waiting (see
+ * CONNECTION_WINDOW), and the server stops reading from it while it's full.
+ * Across all the connections, requests past the server's limit are turned
+ * down at once with STATUS_OVERLOADED, so a rush of clients gets quick
+ * answers to retry with instead of ever longer waits.
  */
 class EntsServer {
-    
-public: 
-    
-    EntsServer();
-    
-    
+
+    EntsService service;
+    //Sessions still waiting when the server goes count themselves out, so
+    //these have to outlive io.
+    atomic<uint64_t> requests;
+    atomic<unsigned int> connections;
+    atomic<unsigned int> followers;
+    /**
+     * Requests read but not yet answered, on every connection, and how many
+     * have been turned down for it.
+     */
+    atomic<unsigned int> inFlight;
+    atomic<uint64_t> overloads;
+    /**
+     * Clients' Watches on the Tree. Sessions take theirs out as they go.
+     */
+    WatchHub watchHub;
+    boost::asio::io_context io;
+    /**
+     * Runs traversals, on threads of its own.
+     */
+    boost::asio::io_context traversals;
+    unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type> > traversing;
+    tcp::acceptor acceptor;
+    vector<thread> threads;
+    unsigned int threadCount;
+    unsigned int traversalThreadCount;
+    /**
+     * How many requests can be in flight before new ones are turned down.
+     */
+    unsigned int mostInFlight;
+    /**
+     * How long requests took, from being read to being answered, in each
+     * lane but LANE_CONTROL.
+     */
+    LatencyHistogram latencies[LANE_CONTROL];
+    /**
+     * Set on a follower's server, which doesn't take edits.
+     */
+    atomic<bool> readOnly;
+    /**
+     * Where edits go instead, if anywhere.
+     */
+    EntsForwarder forwarder;
+    /**
+     * The Tree followers are sent. Usually the one being served.
+     */
+    Tree* followed;
+    /**
+     * The CPU the threads are kept on, or -1 to let them go anywhere.
+     */
+    int cpu;
+    /**
+     * The Tree's log, once a follower has asked for it, and the followers
+     * waiting for it to grow.
+     */
+    ChangeLog* log;
+    mutex followLock;
+    vector<weak_ptr<EntsSession> > waitingFollowers;
+    /**
+     * Set while any follower is waiting, so the log's listener only wakes
+     * them once.
+     */
+    atomic<bool> wakeFollowers;
+
+    /**
+     * Waits for the next client.
+     */
+    void accept();
+
+    /**
+     * Gets the Tree's log for a new follower, starting it and listening to
+     * it the first time.
+     */
+    ChangeLog* startFollowing();
+
+    /**
+     * Has a follower's session carry on once there's more in the log.
+     */
+    void waitForChanges(const shared_ptr<EntsSession>& session);
+
+    /**
+     * Carries on with every follower waiting for more.
+     */
+    void resumeFollowers();
+
+    friend class EntsSession;
+
+public:
+
+    static const unsigned int DEFAULT_MOST_IN_FLIGHT = 16384;
+
+    /**
+     * Creates a server for the given Tree and starts listening, but doesn't
+     * answer anyone until start().
+     * @param tree          The Tree clients can read and change.
+     * @param port          The TCP port. 0 picks a free one.
+     * @param threadCount   How many threads run the server. As many as the
+     *                      hardware supports if 0.
+     * @param address       Where to listen. Everywhere by default.
+     * @param sharePort     Whether other servers can listen on the same port
+     *                      (SO_REUSEPORT). The system spreads new clients
+     *                      between them.
+     * @throws boost::system::system_error if the port can't be opened.
+     */
+    EntsServer(Tree* tree, unsigned short port = 1037, unsigned int threadCount = 0,
+            const string& address = "0.0.0.0", bool sharePort = false);
+
+    /**
+     * Stops the server if it's running.
+     */
+    ~EntsServer();
+
+    EntsServer(const EntsServer&) = delete;
+    EntsServer& operator=(const EntsServer&) = delete;
+
+    /**
+     * Starts the threads. Returns straight away.
+     */
+    void start();
+
+    /**
+     * Stops the threads and stops listening. Clients are cut off when the
+     * server is deleted. A stopped server can't be started again.
+     */
+    void stop();
+
+    unsigned short getPort() {
+        return acceptor.local_endpoint().port();
+    }
+
+    uint64_t getRequestCount() {
+        return requests.load(memory_order_relaxed);
+    }
+
+    unsigned int getConnectionCount() {
+        return connections.load(memory_order_relaxed);
+    }
+
+    /**
+     * Sets how many requests the server will have in flight, across all its
+     * connections, before it turns new ones down with STATUS_OVERLOADED.
+     * Control requests, like OP_MORE, are never turned down.
+     */
+    void setMostInFlight(unsigned int most) {
+        mostInFlight = max(1u, most);
+    }
+
+    unsigned int getInFlightCount() {
+        return inFlight.load(memory_order_relaxed);
+    }
+
+    /**
+     * How many requests have been turned down with STATUS_OVERLOADED.
+     */
+    uint64_t getOverloadCount() {
+        return overloads.load(memory_order_relaxed);
+    }
+
+    Tree* getTree() {
+        return service.getTree();
+    }
+
+    /**
+     * Makes the server turn down edits, with STATUS_READ_ONLY, as a
+     * follower's server should. Its Tree can still be followed in turn.
+     */
+    void setReadOnly(bool only) {
+        readOnly.store(only);
+    }
+
+    bool isReadOnly() {
+        return readOnly.load();
+    }
+
+    /**
+     * Has edits made somewhere else, rather than on the server's own Tree,
+     * which is then only read. Call it before start().
+     */
+    void setForwarder(EntsForwarder forward) {
+        forwarder = forward;
+    }
+
+    /**
+     * Sends followers another Tree's changes, like the original a copy being
+     * served was made from. Call it before start().
+     */
+    void setFollowed(Tree* tree) {
+        followed = tree;
+    }
+
+    /**
+     * Keeps the server's threads on one CPU. Call it before start().
+     */
+    void pin(unsigned int toCPU) {
+        cpu = toCPU;
+    }
+
+    /**
+     * Sets how many threads run traversals. A quarter of the server's
+     * threads by default, and at least one. Call it before start().
+     */
+    void setTraversalThreads(unsigned int count) {
+        traversalThreadCount = max(1u, count);
+    }
+
+    /**
+     * How long a lane's requests have taken so far. A stream's time runs
+     * until its last chunk is ready, so it includes waiting for the client
+     * to ask for more.
+     */
+    LatencySummary getLatency(EntsLane lane) {
+        return lane < LANE_CONTROL ? latencies[lane].summarize() : LatencySummary();
+    }
+
+    /**
+     * Runs something on one of the server's threads.
+     */
+    void post(function<void()> task) {
+        boost::asio::post(io, task);
+    }
+
+    /**
+     * Makes the server one shard of a hierarchy split up between a number of
+     * them, as with EntsService::setShard(). Call it before start().
+     */
+    void setShard(unsigned int index, unsigned int count) {
+        service.setShard(index, count);
+    }
+
+    /**
+     * How many followers are connected, snapshots included.
+     */
+    unsigned int getFollowerCount() {
+        return followers.load(memory_order_relaxed);
+    }
+
+    /**
+     * How many Watches clients have on the Tree.
+     */
+    size_t getWatchCount() {
+        return watchHub.getWatchCount();
+    }
+
+    /**
+     * How well the query cache is doing.
+     */
+    QueryCacheStats getCacheStats() {
+        return service.getCache()->getStats();
+    }
+
+    /**
+     * Starts a server for the Tree on a free localhost port, and has a number
+     * of clients look up Ents and their children as fast as they can for a
+     * while. Each client keeps a batch of requests in flight. Nothing is
+     * printed.
+     */
+    static ServerBenchmark benchmark(Tree* tree, unsigned int threadCount,
+            unsigned int clients, double seconds);
+
+    /**
+     * Has a number of clients look up Ents of the Tree on a server already
+     * running on a localhost port, as in benchmark(). threads is left 0.
+     */
+    static ServerBenchmark measure(Tree* tree, unsigned short port,
+            unsigned int clients, double seconds);
+
+    /**
+     * Starts a server for the Tree on a free localhost port with a limit of
+     * mostInFlight requests, and has far more clients than that hammer it.
+     * Each keeps a whole CONNECTION_WINDOW of lookups going, and sends
+     * another as soon as one is answered or turned down. Nothing is printed.
+     * @return          How each second went.
+     */
+    static vector<OverloadSample> overload(Tree* tree, unsigned int threadCount,
+            unsigned int clients, unsigned int mostInFlight, unsigned int seconds);
+
+    /**
+     * Serves a made up Tree to clients which each send a pipeline of
+     * lookups at once, then all race to create and connect Ents.
+     * @return          "" if every answer is the one the Tree gives itself,
+     *                  and each name went to one client, otherwise what
+     *                  went wrong.
+     */
+    static string check();
+
+    /**
+     * Has clients send a server with a small limit two windows of lookups
+     * each, all at once.
+     * @return          "" if every request gets one answer, either the
+     *                  Tree's or STATUS_OVERLOADED, and nothing is left in
+     *                  flight afterwards, otherwise what went wrong.
+     */
+    static string checkOverload();
+
 };
 
 
 #endif /* ENTSSERVER_H */
-
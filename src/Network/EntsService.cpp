@@ -0,0 +1,336 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EntsService.h"
+#include "QueryCache.h"
+#include "../Algorithms/EntQuery.h"
+#include "../Interface/Tests.h"
+#include <sstream>
+#include <unordered_set>
+
+using namespace std;
+
+EntsService::EntsService(Tree* tr): tree(tr), shardIndex(0), shardCount(0) {
+}
+
+EntsService::~EntsService() {
+}
+
+void EntsService::startCaching(size_t capacity) {
+    if (cache == nullptr)
+        cache.reset(new QueryCache(tree, capacity));
+    //For queries.
+    tree->startSetCache();
+}
+
+bool EntsService::answerFromCache(const EntsRequest& request, EntsResponse* response) {
+    
+    if (cache == nullptr || request.op != OP_GET_ANCESTORS)
+        return false;
+    
+    Tree::Reader reading;
+    Ent* ent = find(request.a);
+    if (ent == nullptr)
+        return false;
+    cache->get(QUERY_ANCESTORS, ent, &response->ents);
+    response->status = STATUS_OK;
+    return response->ents.size() <= QueryCache::MOST_ENTS;
+}
+
+Ent* EntsService::find(const EntKey& key) {
+    if (key.uid != 0)
+        return tree->getEntPtrByUID(key.uid);
+    return tree->getEntPtrByName(key.name);
+}
+
+Ent* EntsService::addReference(const EntKey& key) {
+    
+    if (key.uid == 0 || key.name.empty() || isOwned(key.uid))
+        return nullptr;
+    
+    //Its owner has it under the same name, and names are split up between
+    //shards by hash, so nothing here can have it. It only clashes with
+    //another request making the same reference.
+    tree->tryToCreateNewEnt(key.name, key.uid);
+    Ent* ent = tree->getEntPtrByUID(key.uid);
+    return ent != nullptr && ent->getName() == key.name ? ent : nullptr;
+}
+
+void EntsService::expand(const EntsRequest& request, const Cancellation* cancel,
+        EntsResponse* response) {
+    
+    bool up = request.op == OP_EXPAND_ANCESTORS;
+    unordered_set<Ent*> reached;
+    vector<Ent*> pending;
+    for (unsigned int uid : request.uids) {
+        Ent* ent = tree->getEntPtrByUID(uid);
+        if (ent != nullptr && reached.insert(ent).second)
+            pending.push_back(ent);
+    }
+    
+    //References are walked through too. The relations they have here are
+    //real ones, just not all of them.
+    size_t steps = 0;
+    while (!pending.empty()) {
+        if (cancel != nullptr && ++steps % 1024 == 0 && cancel->isCancelled()) {
+            response->status = STATUS_TIMED_OUT;
+            response->ents.clear();
+            response->frontier.clear();
+            return;
+        }
+        Ent* ent = pending.back();
+        pending.pop_back();
+        if (isOwned(ent->getUID()))
+            response->ents.push_back(refer(ent));
+        else
+            response->frontier.push_back(ent->getUID());
+        for (Ent* next : ent->getList(up ? RELATION_PARENT : RELATION_CHILD).view()) {
+            if (reached.insert(next).second)
+                pending.push_back(next);
+        }
+    }
+}
+
+void EntsService::query(const EntsRequest& request, const Cancellation* cancel,
+        EntsResponse* response) {
+    
+    //Lines of text go back as Ents with no UID.
+    EntRef line = {0, ""};
+    if (shardCount != 0) {
+        response->status = STATUS_BAD_REQUEST;
+        line.name = "Queries can't be answered by one shard.";
+        response->ents.push_back(line);
+        return;
+    }
+    
+    EntQuery query(tree->snapshot(), request.a.name);
+    if (!query.isValid()) {
+        response->status = STATUS_BAD_REQUEST;
+        line.name = query.getError();
+        response->ents.push_back(line);
+        return;
+    }
+    
+    vector<Ent*> found;
+    if (!query.run(&found, [cancel]() { return cancel != nullptr && cancel->isCancelled(); })) {
+        response->status = STATUS_TIMED_OUT;
+        return;
+    }
+    
+    if (request.op == OP_EXPLAIN) {
+        istringstream plan(query.explain());
+        while (getline(plan, line.name))
+            response->ents.push_back(line);
+        return;
+    }
+    
+    if (found.size() > MOST_QUERY_ENTS) {
+        response->status = STATUS_BAD_REQUEST;
+        line.name = "The query found " + to_string(found.size()) + " Ents, more than "
+                + to_string(MOST_QUERY_ENTS) + " can be sent.";
+        response->ents.push_back(line);
+        return;
+    }
+    //The query's snapshot keeps the Ents it found until it's gone.
+    response->ents.reserve(found.size());
+    for (Ent* ent : found)
+        response->ents.push_back(refer(ent));
+}
+
+EntsLane EntsService::laneFor(EntsOp op) {
+    switch (op) {
+        case OP_PING:
+        case OP_FIND:
+        case OP_GET_PARENTS:
+        case OP_GET_CHILDREN:
+        case OP_GET_EXCLUSIVES:
+        case OP_GET_OVERLAPS:
+        case OP_GET_SIBLINGS:
+            return LANE_LOOKUP;
+        case OP_GET_DESCENDENTS:
+        case OP_GET_ANCESTORS:
+        case OP_EXPAND_DESCENDENTS:
+        case OP_EXPAND_ANCESTORS:
+        case OP_QUERY:
+        case OP_EXPLAIN:
+            return LANE_TRAVERSAL;
+        case OP_CREATE_ENT:
+        case OP_CONNECT:
+        case OP_DISCONNECT:
+            return LANE_EDIT;
+        default:
+            return LANE_CONTROL;
+    }
+}
+
+EntRef EntsService::refer(Ent* ent) {
+    EntRef ref = {ent->getUID(), ent->getName()};
+    return ref;
+}
+
+EntsResponse EntsService::execute(const EntsRequest& request, const Cancellation* cancel) {
+    
+    EntsResponse response;
+    Tree::Reader reading;
+    
+    switch (request.op) {
+        
+        case OP_PING:
+            break;
+        
+        case OP_FIND:
+        case OP_GET_PARENTS:
+        case OP_GET_CHILDREN:
+        case OP_GET_EXCLUSIVES:
+        case OP_GET_OVERLAPS:
+        case OP_GET_SIBLINGS: {
+            Ent* ent = find(request.a);
+            if (ent == nullptr) {
+                response.status = STATUS_NOT_FOUND;
+                break;
+            }
+            if (request.op == OP_FIND) {
+                response.ents.push_back(refer(ent));
+                break;
+            }
+            if (request.op == OP_GET_SIBLINGS) {
+                if (cache != nullptr) {
+                    cache->get(QUERY_SIBLINGS, ent, &response.ents);
+                    break;
+                }
+                for (Ent* sibling : ent->getSiblings())
+                    response.ents.push_back(refer(sibling));
+                break;
+            }
+            vector<Ent*> relatives;
+            if (request.op == OP_GET_PARENTS)
+                relatives = ent->getParents();
+            else if (request.op == OP_GET_CHILDREN)
+                relatives = ent->getChildren();
+            else if (request.op == OP_GET_EXCLUSIVES)
+                relatives = ent->getExclusives();
+            else
+                relatives = ent->getOverlaps();
+            //References only sit under root so they aren't orphans. Their
+            //owners know where they really go.
+            bool ownedOnly = shardCount != 0 && request.op == OP_GET_CHILDREN
+                    && ent == tree->getRoot();
+            response.ents.reserve(relatives.size());
+            for (Ent* relative : relatives) {
+                if (!ownedOnly || isOwned(relative->getUID()))
+                    response.ents.push_back(refer(relative));
+            }
+            break;
+        }
+        
+        case OP_CREATE_ENT: {
+            //Held to the same rules as names typed into the CLI.
+            string failure;
+            if (!Tests::isValidEntName(request.a.name, &failure)) {
+                response.status = STATUS_BAD_REQUEST;
+                break;
+            }
+            if (tree->tryToCreateNewEnt(request.a.name) != SUCCESS) {
+                response.status = STATUS_NAME_TAKEN;
+                break;
+            }
+            Ent* created = tree->getEntPtrByName(request.a.name);
+            if (created != nullptr)
+                response.ents.push_back(refer(created));
+            break;
+        }
+        
+        case OP_CONNECT:
+        case OP_DISCONNECT: {
+            Ent* parent = find(request.a);
+            Ent* child = find(request.b);
+            if (shardCount != 0) {
+                unsigned int a = parent != nullptr ? parent->getUID() : request.a.uid;
+                unsigned int b = child != nullptr ? child->getUID() : request.b.uid;
+                if (a != 0 && b != 0 && !isOwned(a) && !isOwned(b)) {
+                    //Neither is this shard's business.
+                    response.status = STATUS_BAD_REQUEST;
+                    break;
+                }
+                if (request.op == OP_CONNECT && parent == nullptr)
+                    parent = addReference(request.a);
+                if (request.op == OP_CONNECT && child == nullptr)
+                    child = addReference(request.b);
+            }
+            if (parent == nullptr || child == nullptr) {
+                response.status = STATUS_NOT_FOUND;
+                break;
+            }
+            bool done = request.op == OP_DISCONNECT ? tree->disconnect(parent, child)
+                    : tree->connectAndPrune(parent, child);
+            if (!done)
+                response.status = STATUS_CONFLICT;
+            break;
+        }
+        
+        case OP_EXPAND_DESCENDENTS:
+        case OP_EXPAND_ANCESTORS:
+            expand(request, cancel, &response);
+            break;
+        
+        case OP_QUERY:
+        case OP_EXPLAIN:
+            query(request, cancel, &response);
+            break;
+        
+        default:
+            response.status = STATUS_BAD_REQUEST;
+    }
+    
+    return response;
+}
+
+unique_ptr<RelativeStream> EntsService::startStream(const EntsRequest& request,
+        EntsStatus* status) {
+    
+    if (!isStreamed(request.op)) {
+        *status = STATUS_BAD_REQUEST;
+        return nullptr;
+    }
+    
+    TreeSnapshot snapshot = tree->snapshot();
+    Ent* ent = request.a.uid != 0 ? snapshot.getEntPtrByUID(request.a.uid)
+            : snapshot.getEntPtrByName(request.a.name);
+    if (ent == nullptr) {
+        *status = STATUS_NOT_FOUND;
+        return nullptr;
+    }
+    
+    *status = STATUS_OK;
+    return unique_ptr<RelativeStream>(new RelativeStream(std::move(snapshot), ent,
+            request.op == OP_GET_ANCESTORS));
+}
+
+void EntsService::nextChunk(RelativeStream* stream, size_t size, EntsResponse* response) {
+    
+    vector<Ent*> found;
+    found.reserve(size);
+    stream->next(&found, size);
+    
+    response->ents.clear();
+    response->ents.reserve(found.size());
+    //The stream's snapshot keeps the Ents it found.
+    for (Ent* ent : found)
+        response->ents.push_back(refer(ent));
+    response->status = stream->isDone() ? STATUS_OK : STATUS_MORE;
+}
@@ -0,0 +1,393 @@
+/*
+ * This file is part of the Ents Tree Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENTSSERVICE_H
+#define ENTSSERVICE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include "../Core/Tree.h"
+#include "../Algorithms/RelativeStream.h"
+
+using namespace std;
+
+class QueryCache;
+
+/**
+ * What a client can ask the server to do. These are sent as numbers, so new
+ * ones go at the end.
+ */
+typedef enum {
+    OP_PING,
+    /** Finds an Ent by name or UID. */
+    OP_FIND,
+    OP_GET_PARENTS,
+    OP_GET_CHILDREN,
+    /** Creates an Ent with the given name, under root. */
+    OP_CREATE_ENT,
+    /** Connects a as the parent of b, pruning what that makes redundant. */
+    OP_CONNECT,
+    OP_DISCONNECT,
+    OP_GET_EXCLUSIVES,
+    OP_GET_OVERLAPS,
+    /**
+     * All the descendents or ancestors, however many levels away. They're
+     * streamed back in chunks (see EntsProtocol.h).
+     */
+    OP_GET_DESCENDENTS,
+    OP_GET_ANCESTORS,
+    /** Lets a stream send one more chunk. Sent with the stream's request ID. */
+    OP_MORE,
+    /** Stops a stream. Also sent with its request ID. */
+    OP_CANCEL,
+    /**
+     * Asks for the Tree's changes from the given log offset on, or for a
+     * snapshot and then the changes after it. Used by an EntsFollower.
+     */
+    OP_FOLLOW,
+    /**
+     * For a shard of a partitioned hierarchy: walks down, or up, from the
+     * Ents with the given UIDs as far as this shard can see. See
+     * EntsService::setShard().
+     */
+    OP_EXPAND_DESCENDENTS,
+    OP_EXPAND_ANCESTORS,
+    /**
+     * Subscribes to changes made at or under an Ent, which are pushed to the
+     * client as they happen, until it sends OP_CANCEL with the same ID.
+     */
+    OP_WATCH,
+    /** The other children of an Ent's parents. */
+    OP_GET_SIBLINGS,
+    /**
+     * Answers a query, like "descendents(Dogs) & descendents(Pets)", sent
+     * as a's name. See EntQuery.
+     */
+    OP_QUERY,
+    /** Answers a query, then sends back its plan instead of its Ents. */
+    OP_EXPLAIN
+} EntsOp;
+
+/**
+ * How a request went. Also sent as numbers.
+ */
+typedef enum {
+    STATUS_OK,
+    STATUS_NOT_FOUND,
+    STATUS_NAME_TAKEN,
+    /** Connecting them would make a loop, or disconnecting them an orphan. */
+    STATUS_CONFLICT,
+    STATUS_BAD_REQUEST,
+    /** A chunk of a stream, with more to come. */
+    STATUS_MORE,
+    /** The server is a follower, and only answers lookups. */
+    STATUS_READ_ONLY,
+    /** The request's timeout passed before it was done. */
+    STATUS_TIMED_OUT,
+    /** The server has too much to do already, and didn't try. Safe to retry,
+     *  here later or on another server. */
+    STATUS_OVERLOADED
+} EntsStatus;
+
+/**
+ * The kinds of request a server keeps apart, so slow ones can't hold up
+ * fast ones.
+ */
+typedef enum {
+    /** Finding an Ent or its immediate relatives. */
+    LANE_LOOKUP,
+    /** Walks which can reach any number of Ents. */
+    LANE_TRAVERSAL,
+    LANE_EDIT,
+    /** Everything else, which isn't timed. */
+    LANE_CONTROL
+} EntsLane;
+
+/**
+ * How a request names an Ent: by UID, or by name when uid is 0. A shard
+ * needs both for an Ent it doesn't own, so it can keep a reference to it.
+ */
+struct EntKey {
+    unsigned int uid;
+    string name;
+
+    EntKey(): uid(0) {}
+};
+
+/**
+ * The offset to follow from to get a snapshot first.
+ */
+const uint64_t FOLLOW_SNAPSHOT = UINT64_MAX;
+
+struct EntsRequest {
+    EntsOp op;
+    EntKey a;
+    /** The child, for OP_CONNECT and OP_DISCONNECT. */
+    EntKey b;
+    /** Where to start, for OP_FOLLOW. A log offset, or FOLLOW_SNAPSHOT. */
+    uint64_t offset;
+    /** Where to start, for OP_EXPAND_DESCENDENTS and OP_EXPAND_ANCESTORS. */
+    vector<unsigned int> uids;
+    /**
+     * How many milliseconds the server has to answer, from when it reads the
+     * request, or 0 for as long as it takes.
+     */
+    uint32_t timeout;
+
+    EntsRequest(): op(OP_PING), offset(0), timeout(0) {}
+};
+
+/**
+ * Lets a long request be given up on part way through: once its timeout
+ * passes, or when the client who asked for it has gone. The work checks it
+ * every so often.
+ */
+class Cancellation {
+
+    atomic<bool> cancelled;
+    bool timed;
+    chrono::steady_clock::time_point deadline;
+
+public:
+
+    /**
+     * @param timeout   Milliseconds from now, or 0 for no deadline.
+     */
+    Cancellation(uint32_t timeout): cancelled(false), timed(timeout != 0),
+            deadline(chrono::steady_clock::now() + chrono::milliseconds(timeout)) {}
+
+    void cancel() {
+        cancelled.store(true, memory_order_relaxed);
+    }
+
+    bool isTimedOut() const {
+        return timed && chrono::steady_clock::now() >= deadline;
+    }
+
+    bool isCancelled() const {
+        return cancelled.load(memory_order_relaxed) || isTimedOut();
+    }
+
+};
+
+/**
+ * An Ent as it's sent back to a client.
+ */
+struct EntRef {
+    unsigned int uid;
+    string name;
+};
+
+inline bool operator==(const EntRef& a, const EntRef& b) {
+    return a.uid == b.uid && a.name == b.name;
+}
+
+struct EntsResponse {
+    EntsStatus status;
+    /** The Ent found, or the relatives asked for. */
+    vector<EntRef> ents;
+    /**
+     * For an expansion, the UIDs of Ents it reached which other shards own.
+     * They have to be expanded there to go any further.
+     */
+    vector<unsigned int> frontier;
+
+    EntsResponse(): status(STATUS_OK) {}
+};
+
+/**
+ * Some of a Tree's changes, as they're sent to a follower.
+ */
+struct ChangeBatch {
+    /** STATUS_MORE while following. Anything else ends it. */
+    EntsStatus status;
+    /**
+     * Part of a snapshot. Its changes rebuild the Tree from nothing, and
+     * offset is where the log picks up once it's done.
+     */
+    bool snapshot;
+    /** The log offset just after these changes. */
+    uint64_t offset;
+    /** The end of the primary's log when they were sent. */
+    uint64_t end;
+    /** When the last of them was made, like LoggedChange::time. */
+    int64_t time;
+    /**
+     * For a snapshot, the primary's origin (see Tree::getOrigin()). The
+     * follower takes it on, since its Ents get the primary's UIDs.
+     */
+    uint64_t origin;
+    vector<TreeChange> changes;
+
+    ChangeBatch(): status(STATUS_MORE), snapshot(false), offset(0), end(0), time(0),
+            origin(0) {}
+};
+
+/**
+ * Carries out requests from clients on a Tree, whatever they came over.
+ *
+ * Any number of threads can call execute() at once. Lookups read the Tree
+ * within a Tree::Reader and never wait. Changes go through the Tree's
+ * Editor path, so each only locks the Ents it changes.
+ *
+ * Siblings, and ancestors when there aren't too many, can be answered from
+ * a QueryCache, once startCaching() has been called.
+ */
+class EntsService {
+
+    Tree* tree;
+    unique_ptr<QueryCache> cache;
+    /**
+     * Which shard this is, and out of how many. shardCount is 0 when the
+     * Tree isn't partitioned.
+     */
+    unsigned int shardIndex;
+    unsigned int shardCount;
+
+    /**
+     * Finds the Ent a key names, or nullptr.
+     */
+    Ent* find(const EntKey& key);
+
+    /**
+     * Makes a reference to an Ent another shard owns, which has none here
+     * yet. The key needs its UID and name.
+     * @return          The reference, or nullptr if the key won't do.
+     */
+    Ent* addReference(const EntKey& key);
+
+    /**
+     * Walks from the request's UIDs, for OP_EXPAND_DESCENDENTS and
+     * OP_EXPAND_ANCESTORS.
+     */
+    void expand(const EntsRequest& request, const Cancellation* cancel,
+            EntsResponse* response);
+
+    /**
+     * Answers OP_QUERY and OP_EXPLAIN.
+     */
+    void query(const EntsRequest& request, const Cancellation* cancel,
+            EntsResponse* response);
+
+    static EntRef refer(Ent* ent);
+
+public:
+
+    EntsService(Tree* tr);
+
+    ~EntsService();
+
+    /**
+     * Keeps the answers to popular queries from now on, and starts the
+     * Tree's EntSetCache for OP_QUERY. Don't call it within a Tree::Reader,
+     * or once requests are being carried out.
+     * @param capacity  How many answers to keep.
+     */
+    void startCaching(size_t capacity);
+
+    /**
+     * The cache, or nullptr if there isn't one.
+     */
+    QueryCache* getCache() {
+        return cache.get();
+    }
+
+    /**
+     * Answers OP_GET_ANCESTORS all at once from the cache, if there is one
+     * and the answer fits in one chunk of a stream.
+     * @return          false if it has to be streamed after all.
+     */
+    bool answerFromCache(const EntsRequest& request, EntsResponse* response);
+
+    /**
+     * Carries out a request, other than a streamed one.
+     * @param cancel    Checked now and then by an expansion, which gives up
+     *                  with STATUS_TIMED_OUT once it's set.
+     */
+    EntsResponse execute(const EntsRequest& request, const Cancellation* cancel = nullptr);
+
+    static EntsLane laneFor(EntsOp op);
+
+    /**
+     * The most Ents a query can find and still be answered. Any more would
+     * make too big a frame to send.
+     */
+    static const size_t MOST_QUERY_ENTS = 1 << 20;
+
+    static bool isStreamed(EntsOp op) {
+        return op == OP_GET_DESCENDENTS || op == OP_GET_ANCESTORS;
+    }
+
+    static bool isExpansion(EntsOp op) {
+        return op == OP_EXPAND_DESCENDENTS || op == OP_EXPAND_ANCESTORS;
+    }
+
+    /**
+     * Makes the Tree one shard of a hierarchy split up between count of
+     * them by UID. This shard owns the Ents whose UIDs leave index when
+     * divided by count, and root, which every shard has. Its Tree should
+     * use a UIDAllocator(count, index), and only be asked to create Ents
+     * it's meant to own.
+     *
+     * An Ent connected to one owned by another shard is kept here as a
+     * reference: an Ent with the other one's UID and name, and only the
+     * relations this shard knows about. Both shards keep the relation, so
+     * an Ent's owner always knows all its parents and children.
+     *
+     * Expansions only go on through Ents this shard owns, and list the
+     * references they reach in the response's frontier, for ShardRouter to
+     * send on to their owners.
+     */
+    void setShard(unsigned int index, unsigned int count) {
+        shardIndex = index;
+        shardCount = count;
+    }
+
+    /**
+     * true if this shard owns the Ent, or the Tree isn't split up.
+     */
+    bool isOwned(unsigned int uid) const {
+        return shardCount == 0 || uid == 1 || uid % shardCount == shardIndex;
+    }
+
+    /**
+     * Starts a streamed request, which sees the Tree as it is now however
+     * long it takes to read.
+     * @param status    Set to why, if it can't be started.
+     * @return          The walk, or nullptr.
+     */
+    unique_ptr<RelativeStream> startStream(const EntsRequest& request, EntsStatus* status);
+
+    /**
+     * Fills in a response with the next chunk of a stream. Its status is
+     * STATUS_MORE, unless it's the last.
+     * @param size      How many Ents to put in it at most.
+     */
+    static void nextChunk(RelativeStream* stream, size_t size, EntsResponse* response);
+
+    Tree* getTree() {
+        return tree;
+    }
+
+};
+
+#endif /* ENTSSERVICE_H */
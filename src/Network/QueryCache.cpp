@@ -0,0 +1,321 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QueryCache.h"
+#include <unordered_set>
+#include <algorithm>
+#include <random>
+
+using namespace std;
+
+/**
+ * Spreads the bits of a key out, so nearby keys land far apart.
+ */
+static uint64_t mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+FrequencySketch::FrequencySketch(size_t capacity): additions(0) {
+    size_t width = 64;
+    while (width < capacity * 2)
+        width *= 2;
+    counters.assign(width * ROWS, 0);
+    mask = width - 1;
+    //Long enough to tell the popular keys apart, short enough to notice
+    //when they change.
+    halveAt = 10 * max<size_t>(capacity, 1);
+}
+
+size_t FrequencySketch::place(uint64_t key, unsigned int row) const {
+    return row * (mask + 1) + (mix(key + row * 0x9e3779b97f4a7c15ULL) & mask);
+}
+
+void FrequencySketch::increment(uint64_t key) {
+    
+    for (unsigned int row = 0; row < ROWS; row++) {
+        uint8_t& counter = counters[place(key, row)];
+        if (counter < MOST)
+            counter++;
+    }
+    if (++additions == halveAt) {
+        for (uint8_t& counter : counters)
+            counter >>= 1;
+        additions /= 2;
+    }
+}
+
+unsigned int FrequencySketch::estimate(uint64_t key) const {
+    unsigned int least = MOST;
+    for (unsigned int row = 0; row < ROWS; row++)
+        least = min<unsigned int>(least, counters[place(key, row)]);
+    return least;
+}
+
+
+QueryCache::QueryCache(Tree* tr, size_t cap): tree(tr), capacity(max<size_t>(cap, 1)),
+        sketch(capacity), generation(0) {
+    
+    stats = QueryCacheStats();
+    stats.capacity = capacity;
+    log = tree->startChangeLog();
+    log->addWatcher(this);
+}
+
+QueryCache::~QueryCache() {
+    log->removeWatcher(this);
+}
+
+void QueryCache::work(QueryType type, Ent* ent, vector<EntRef>* answer,
+        vector<pair<unsigned int, uint8_t> >* depends) {
+    
+    if (type == QUERY_ANCESTORS) {
+        //Each ancestor's parents, and its name. ent's own name isn't in it.
+        unordered_set<Ent*> found;
+        vector<Ent*> climbing(1, ent);
+        depends->push_back(make_pair(ent->getUID(), DEPENDS_ON_PARENTS));
+        while (!climbing.empty()) {
+            Ent* at = climbing.back();
+            climbing.pop_back();
+            for (Ent* parent : at->getParents()) {
+                if (!found.insert(parent).second)
+                    continue;
+                answer->push_back(EntRef{parent->getUID(), parent->getName()});
+                depends->push_back(make_pair(parent->getUID(),
+                        uint8_t(DEPENDS_ON_PARENTS | DEPENDS_ON_NAME)));
+                climbing.push_back(parent);
+            }
+        }
+        return;
+    }
+    
+    //ent's parents, their children, and the names of those.
+    unordered_set<Ent*> found;
+    found.insert(ent);
+    depends->push_back(make_pair(ent->getUID(), DEPENDS_ON_PARENTS));
+    for (Ent* parent : ent->getParents()) {
+        depends->push_back(make_pair(parent->getUID(), DEPENDS_ON_CHILDREN));
+        for (Ent* sibling : parent->getChildren()) {
+            if (!found.insert(sibling).second)
+                continue;
+            answer->push_back(EntRef{sibling->getUID(), sibling->getName()});
+            depends->push_back(make_pair(sibling->getUID(), DEPENDS_ON_NAME));
+        }
+    }
+}
+
+void QueryCache::get(QueryType type, Ent* ent, vector<EntRef>* answer) {
+    
+    uint64_t key = keyFor(type, ent->getUID());
+    uint64_t started;
+    {
+        lock_guard<mutex> hold(lock);
+        sketch.increment(key);
+        unordered_map<uint64_t, Entry>::iterator found = entries.find(key);
+        if (found != entries.end()) {
+            stats.hits++;
+            order.splice(order.begin(), order, found->second.used);
+            *answer = found->second.answer;
+            return;
+        }
+        stats.misses++;
+        started = generation;
+    }
+    
+    //Worked out without the lock, so misses don't hold up hits.
+    vector<pair<unsigned int, uint8_t> > depends;
+    work(type, ent, answer, &depends);
+    
+    lock_guard<mutex> hold(lock);
+    if (generation != started || answer->size() > MOST_ENTS || entries.count(key) > 0) {
+        stats.rejections++;
+        return;
+    }
+    if (entries.size() >= capacity) {
+        uint64_t victim = order.back();
+        if (sketch.estimate(key) <= sketch.estimate(victim)) {
+            stats.rejections++;
+            return;
+        }
+        drop(entries.find(victim));
+        stats.evictions++;
+    }
+    
+    order.push_front(key);
+    Entry& entry = entries[key];
+    entry.answer = *answer;
+    entry.used = order.begin();
+    for (pair<unsigned int, uint8_t>& on : depends)
+        dependents[on.first][key] |= on.second;
+    entry.depends = std::move(depends);
+    stats.admissions++;
+}
+
+void QueryCache::drop(unordered_map<uint64_t, Entry>::iterator entry) {
+    
+    for (pair<unsigned int, uint8_t>& on : entry->second.depends) {
+        unordered_map<unsigned int, unordered_map<uint64_t, uint8_t> >::iterator ent
+                = dependents.find(on.first);
+        if (ent == dependents.end())
+            continue;
+        ent->second.erase(entry->first);
+        if (ent->second.empty())
+            dependents.erase(ent);
+    }
+    order.erase(entry->second.used);
+    entries.erase(entry);
+}
+
+void QueryCache::invalidate(unsigned int uid, uint8_t how) {
+    
+    unordered_map<unsigned int, unordered_map<uint64_t, uint8_t> >::iterator ent
+            = dependents.find(uid);
+    if (ent == dependents.end())
+        return;
+    
+    vector<uint64_t> stale;
+    for (pair<const uint64_t, uint8_t>& dependent : ent->second) {
+        if (dependent.second & how)
+            stale.push_back(dependent.first);
+    }
+    for (uint64_t key : stale) {
+        drop(entries.find(key));
+        stats.invalidations++;
+    }
+}
+
+void QueryCache::changed(const LoggedChange& change, uint64_t, Ent*, Ent*) {
+    
+    const TreeChange& made = change.change;
+    lock_guard<mutex> hold(lock);
+    switch (made.type) {
+        case CHANGE_CONNECT:
+        case CHANGE_DISCONNECT:
+            generation++;
+            invalidate(made.a, DEPENDS_ON_CHILDREN);
+            invalidate(made.b, DEPENDS_ON_PARENTS);
+            break;
+        case CHANGE_RENAME:
+            generation++;
+            invalidate(made.a, DEPENDS_ON_NAME);
+            break;
+        case CHANGE_REMOVE_ENT:
+            generation++;
+            invalidate(made.a, DEPENDS_ON_PARENTS | DEPENDS_ON_CHILDREN | DEPENDS_ON_NAME);
+            break;
+        default:
+            //New Ents, exclusives and overlaps don't change any answers.
+            break;
+    }
+}
+
+QueryCacheStats QueryCache::getStats() {
+    lock_guard<mutex> hold(lock);
+    QueryCacheStats now = stats;
+    now.entries = entries.size();
+    return now;
+}
+
+string QueryCache::check() {
+    
+    //Parents always come before their children in ents, so edits can't
+    //make loops.
+    mt19937 random(43);
+    Tree tree("Query cache check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 2000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        tree.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 20 == 0) {
+            Ent::connectUnchecked(tree.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    
+    auto sorted = [](vector<EntRef> refs) {
+        vector<pair<unsigned int, string> > list;
+        for (EntRef& ref : refs)
+            list.push_back(make_pair(ref.uid, ref.name));
+        sort(list.begin(), list.end());
+        return list;
+    };
+    
+    //Small, so answers are pushed out as well as thrown away.
+    QueryCache cache(&tree, 256);
+    unsigned int renamed = 0;
+    for (int round = 0; round < 30; round++) {
+        {
+            Tree::Reader reading;
+            for (int i = 0; i < 500; i++) {
+                //Mostly the same few Ents, so there's something to hit.
+                Ent* ent = ents[random() % (random() % 4 ? 300 : ents.size())];
+                QueryType type = QueryType(random() % 2);
+                vector<EntRef> answer, fresh;
+                vector<pair<unsigned int, uint8_t> > depends;
+                cache.get(type, ent, &answer);
+                work(type, ent, &fresh, &depends);
+                if (sorted(answer) != sorted(fresh))
+                    return string(type == QUERY_ANCESTORS ? "ancestors" : "siblings")
+                            + " of " + ent->getName() + " were out of date, in round "
+                            + to_string(round);
+            }
+        }
+        
+        Tree::Writer writing(&tree);
+        for (int i = 0; i < 20; i++) {
+            size_t c = 1 + random() % (ents.size() - 1);
+            Ent* child = ents[c];
+            switch (random() % 4) {
+                case 0: {
+                    Ent* parent = ents[random() % c];
+                    if (!child->isChildOf(parent))
+                        Ent::connectUnchecked(parent, child);
+                    break;
+                }
+                case 1: {
+                    vector<Ent*> parents = child->getParents();
+                    if (parents.size() > 1)
+                        Ent::disconnectUnchecked(parents[random() % parents.size()], child);
+                    break;
+                }
+                case 2:
+                    tree.renameEnt(child, "renamed" + to_string(renamed++));
+                    break;
+                default:
+                    tree.removeEnt(child);
+                    ents.erase(ents.begin() + c);
+            }
+        }
+    }
+    
+    QueryCacheStats stats = cache.getStats();
+    if (stats.hits == 0 || stats.invalidations == 0 || stats.evictions == 0)
+        return "never hit, threw away or pushed out an answer, so it wasn't tested";
+    return "";
+}
@@ -0,0 +1,207 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUERYCACHE_H
+#define QUERYCACHE_H
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include "../Core/ChangeLog.h"
+#include "EntsService.h"
+
+using namespace std;
+
+/**
+ * The queries QueryCache keeps answers to.
+ */
+typedef enum {
+    QUERY_ANCESTORS,
+    QUERY_SIBLINGS
+} QueryType;
+
+/**
+ * How a QueryCache has done so far.
+ */
+struct QueryCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    /** Answers put in the cache. */
+    uint64_t admissions;
+    /**
+     * Answers left out, because they were asked for less often than the one
+     * they'd have pushed out, were too big, or an edit came while they were
+     * being worked out.
+     */
+    uint64_t rejections;
+    /** Answers pushed out to make room. */
+    uint64_t evictions;
+    /** Answers thrown away because an edit changed them. */
+    uint64_t invalidations;
+    size_t entries;
+    size_t capacity;
+};
+
+/**
+ * Roughly how often each key has been asked for lately: a count-min sketch
+ * of small counters, all halved every so often so old popularity fades.
+ */
+class FrequencySketch {
+
+    static const unsigned int ROWS = 4;
+    static const uint8_t MOST = 15;
+
+    vector<uint8_t> counters;
+    size_t mask;
+    size_t additions;
+    size_t halveAt;
+
+    size_t place(uint64_t key, unsigned int row) const;
+
+public:
+
+    /**
+     * @param capacity  How many keys the cache it's for holds.
+     */
+    FrequencySketch(size_t capacity);
+
+    void increment(uint64_t key);
+
+    unsigned int estimate(uint64_t key) const;
+
+};
+
+/**
+ * Keeps the answers to popular queries, like an Ent's ancestors or its
+ * siblings, so they aren't worked out again for each request.
+ *
+ * Each answer remembers what it was worked out from: the parents, children
+ * and names of particular Ents. The cache watches the Tree's log, and when
+ * a change touches one of those, only the answers that used it are thrown
+ * away. Connecting a parent and child touches the parent's children and the
+ * child's parents, renaming touches a name, and removing touches all three.
+ *
+ * Once it's full, a new answer only gets in if its query has been asked for
+ * more often than the one it would push out, which is the least recently
+ * used (TinyLFU). So a burst of one-off queries can't flush out the popular
+ * ones. How often is counted in a FrequencySketch, for every query asked,
+ * whether or not its answer is kept.
+ *
+ * Only edits made within a Writer or Editor are seen, which is how the
+ * server makes all of its own. Any number of threads can use it at once.
+ */
+class QueryCache : public ChangeWatcher {
+
+    /**
+     * What an answer depends on, for each Ent it looked at.
+     */
+    static const uint8_t DEPENDS_ON_PARENTS = 1;
+    static const uint8_t DEPENDS_ON_CHILDREN = 2;
+    static const uint8_t DEPENDS_ON_NAME = 4;
+
+    struct Entry {
+        vector<EntRef> answer;
+        vector<pair<unsigned int, uint8_t> > depends;
+        /** Its place in the LRU order. */
+        list<uint64_t>::iterator used;
+    };
+
+    Tree* tree;
+    ChangeLog* log;
+    size_t capacity;
+
+    mutex lock;
+    unordered_map<uint64_t, Entry> entries;
+    /** Most recently used first. */
+    list<uint64_t> order;
+    /** For each Ent, the answers that depend on it, and how. */
+    unordered_map<unsigned int, unordered_map<uint64_t, uint8_t> > dependents;
+    FrequencySketch sketch;
+    /**
+     * Goes up with every change that could make an answer wrong. An answer
+     * worked out while it changed isn't kept, since it may already be out
+     * of date without any entry there to be thrown away.
+     */
+    uint64_t generation;
+    QueryCacheStats stats;
+
+    static uint64_t keyFor(QueryType type, unsigned int uid) {
+        return (uint64_t(uid) << 1) | type;
+    }
+
+    /**
+     * Works out an answer, and what it depends on.
+     */
+    static void work(QueryType type, Ent* ent, vector<EntRef>* answer,
+            vector<pair<unsigned int, uint8_t> >* depends);
+
+    /**
+     * Takes an entry out. The lock must be held.
+     */
+    void drop(unordered_map<uint64_t, Entry>::iterator entry);
+
+    /**
+     * Throws away the answers depending on an Ent in any of the given ways.
+     * The lock must be held.
+     */
+    void invalidate(unsigned int uid, uint8_t how);
+
+public:
+
+    static const size_t DEFAULT_CAPACITY = 4096;
+    /**
+     * Bigger answers aren't kept. They'd crowd out many small ones.
+     */
+    static const size_t MOST_ENTS = 1024;
+
+    /**
+     * Starts the Tree's log, if it hasn't been, and watches it. Don't call
+     * it within a Tree::Reader.
+     * @param capacity  How many answers to keep at most.
+     */
+    QueryCache(Tree* tree, size_t capacity = DEFAULT_CAPACITY);
+
+    ~QueryCache();
+
+    QueryCache(const QueryCache&) = delete;
+    QueryCache& operator=(const QueryCache&) = delete;
+
+    /**
+     * Answers a query about an Ent, from the cache if it can. Call within a
+     * Tree::Reader.
+     * @param answer    Filled in with the Ents.
+     */
+    void get(QueryType type, Ent* ent, vector<EntRef>* answer);
+
+    QueryCacheStats getStats();
+
+    void changed(const LoggedChange& change, uint64_t offset, Ent* a, Ent* b) override;
+
+    /**
+     * Asks a small cache about a made up Tree between rounds of connecting,
+     * disconnecting, renaming and removing Ents, and compares each answer
+     * with working it out afresh.
+     * @return          "" if they agree, otherwise what went wrong.
+     */
+    static string check();
+
+};
+
+#endif /* QUERYCACHE_H */
@@ -0,0 +1,132 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ReplicationSource.h"
+
+using namespace std;
+
+ReplicationSource::ReplicationSource(Tree* tree, uint64_t from):
+        log(tree->startChangeLog()), place(0), relating(false), relation(0),
+        relatedPlace(0), offset(from), skipThrough(0), announce(false) {
+    
+    if (from != FOLLOW_SNAPSHOT)
+        return;
+    
+    //Every change up to the snapshot's version was logged before it was
+    //committed, so the log's already got everything after it.
+    snapshot.reset(new TreeSnapshot(tree));
+    skipThrough = snapshot->getVersion();
+    offset = log->findAfter(skipThrough);
+    
+    Ent* root = tree->getRoot();
+    unordered_set<Ent*> below = snapshot->getDescendents(root);
+    ents.reserve(below.size() + 1);
+    ents.push_back(root);
+    ents.insert(ents.end(), below.begin(), below.end());
+}
+
+void ReplicationSource::relate() {
+    
+    Ent* ent = ents[place];
+    related.clear();
+    relatedPlace = 0;
+    if (relation == 0) {
+        related = snapshot->getChildren(ent);
+        return;
+    }
+    for (Ent* other : relation == 1 ? snapshot->getExclusives(ent) : snapshot->getOverlaps(ent)) {
+        if (other->getUID() > ent->getUID())
+            related.push_back(other);
+    }
+}
+
+void ReplicationSource::nextFromSnapshot(size_t most, ChangeBatch* batch) {
+    
+    batch->snapshot = true;
+    batch->origin = snapshot->getTree()->getOrigin();
+    batch->offset = offset;
+    batch->time = ChangeLog::now();
+    
+    while (batch->changes.size() < most) {
+        
+        if (!relating) {
+            if (place == ents.size()) {
+                relating = true;
+                place = 0;
+                relate();
+                continue;
+            }
+            Ent* ent = ents[place++];
+            //root is in every Tree already.
+            if (ent->getUID() != 1)
+                batch->changes.push_back(TreeChange{CHANGE_ADD_ENT, ent->getUID(), 0, ent->getName()});
+            continue;
+        }
+        
+        if (relatedPlace == related.size()) {
+            if (++relation == 3) {
+                relation = 0;
+                if (++place == ents.size()) {
+                    //That's everything. Let the snapshot go.
+                    snapshot.reset();
+                    vector<Ent*>().swap(ents);
+                    vector<Ent*>().swap(related);
+                    announce = true;
+                    return;
+                }
+            }
+            relate();
+            continue;
+        }
+        
+        static const ChangeType types[] = {CHANGE_CONNECT, CHANGE_SET_EXCLUSIVE, CHANGE_SET_OVERLAP};
+        Ent* other = related[relatedPlace++];
+        batch->changes.push_back(TreeChange{types[relation], ents[place]->getUID(),
+                other->getUID(), string()});
+    }
+}
+
+bool ReplicationSource::next(size_t most, ChangeBatch* batch) {
+    
+    batch->end = log->getEnd();
+    if (snapshot != nullptr) {
+        nextFromSnapshot(most, batch);
+        return true;
+    }
+    
+    vector<LoggedChange> read;
+    if (!log->read(offset, most, &read)) {
+        batch->status = offset > batch->end ? STATUS_BAD_REQUEST : STATUS_NOT_FOUND;
+        batch->offset = offset;
+        return true;
+    }
+    if (read.empty() && !announce)
+        return false;
+    
+    announce = false;
+    batch->time = ChangeLog::now();
+    for (LoggedChange& logged : read) {
+        if (logged.version <= skipThrough)
+            continue;
+        batch->changes.push_back(std::move(logged.change));
+        batch->time = logged.time;
+    }
+    offset += read.size();
+    batch->offset = offset;
+    return true;
+}
@@ -0,0 +1,122 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REPLICATIONSOURCE_H
+#define REPLICATIONSOURCE_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "../Core/Tree.h"
+#include "EntsService.h"
+
+using namespace std;
+
+/**
+ * What a primary sends one follower: a snapshot first, if the follower is
+ * starting from nothing, then the Tree's changes from its log, for as long
+ * as the follower keeps up.
+ *
+ * A snapshot is sent as changes too. Every Ent is added, then every relation
+ * is set, as they were at the snapshot's version. Ents are only read as
+ * they're sent, so a snapshot of a big Tree costs a list of its Ents and
+ * nothing more. The log picks up at the first change made after the
+ * snapshot, skipping any it already covers.
+ *
+ * Only used by one thread at a time.
+ */
+class ReplicationSource {
+
+    ChangeLog* log;
+    /**
+     * Held while the snapshot is being sent.
+     */
+    unique_ptr<TreeSnapshot> snapshot;
+    /**
+     * All the Ents in the snapshot, root first.
+     */
+    vector<Ent*> ents;
+    size_t place;
+    /**
+     * Whether all the Ents have been added, and their relations are being
+     * sent.
+     */
+    bool relating;
+    /**
+     * The children, exclusives or overlaps of ents[place] being sent, and how
+     * far through them it is.
+     */
+    vector<Ent*> related;
+    int relation;
+    size_t relatedPlace;
+    /**
+     * The next change to send from the log.
+     */
+    uint64_t offset;
+    /**
+     * Changes at or before this version are in the snapshot.
+     */
+    uint64_t skipThrough;
+    /**
+     * Set once the snapshot is done, until something's been sent from the
+     * log, so the follower hears that it has caught up even if nothing
+     * changes.
+     */
+    bool announce;
+
+    /**
+     * Fills related with the next kind of relation of ents[place]. Each
+     * exclusive or overlap pair is only sent from one of its Ents.
+     */
+    void relate();
+
+    void nextFromSnapshot(size_t most, ChangeBatch* batch);
+
+public:
+
+    /**
+     * Starts the Tree's log if it hasn't been already.
+     * @param tree      The Tree to follow.
+     * @param from      The log offset to start at, or FOLLOW_SNAPSHOT.
+     */
+    ReplicationSource(Tree* tree, uint64_t from);
+
+    /**
+     * Fills in the next batch to send. Its status is STATUS_MORE, unless
+     * the follower can't go on: STATUS_NOT_FOUND if the changes it needs
+     * have been dropped from the log, or STATUS_BAD_REQUEST if it asked for
+     * changes from the future.
+     * @param most      How many changes to put in it at most.
+     * @return          false if there's nothing new to send yet.
+     */
+    bool next(size_t most, ChangeBatch* batch);
+
+    /**
+     * Whether the log has changes this hasn't sent.
+     */
+    bool hasMore() const {
+        return snapshot != nullptr || announce || log->getEnd() != offset;
+    }
+
+    ChangeLog* getLog() {
+        return log;
+    }
+
+};
+
+#endif /* REPLICATIONSOURCE_H */
@@ -0,0 +1,199 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ShardCluster.h"
+#include <stdexcept>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+ShardCluster::ShardCluster(unsigned int count, unsigned short firstPort) {
+    
+    posix_spawn_file_actions_t quiet;
+    posix_spawn_file_actions_init(&quiet);
+    posix_spawn_file_actions_addopen(&quiet, 1, "/dev/null", O_WRONLY, 0);
+    
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned short port = firstPort + i;
+        string index = to_string(i), total = to_string(count), listen = to_string(port);
+        char* args[] = {const_cast<char*>("ents"), const_cast<char*>("shard"),
+                &index[0], &total[0], &listen[0], nullptr};
+        pid_t process;
+        if (posix_spawn(&process, "/proc/self/exe", &quiet, nullptr, args, environ) != 0) {
+            posix_spawn_file_actions_destroy(&quiet);
+            stopAll();
+            throw runtime_error("couldn't start a shard");
+        }
+        processes.push_back(process);
+        ports.push_back(port);
+    }
+    posix_spawn_file_actions_destroy(&quiet);
+    
+    //Give each a few seconds to start listening.
+    for (size_t i = 0; i < ports.size(); i++) {
+        EntsRequest ping;
+        ping.op = OP_PING;
+        for (int tries = 0;; tries++) {
+            try {
+                EntsClient client("127.0.0.1", ports[i], 1);
+                client.call(ping).get();
+                break;
+            } catch (exception&) {
+                int status;
+                if (tries == 100 || waitpid(processes[i], &status, WNOHANG) != 0) {
+                    stopAll();
+                    throw runtime_error("shard on port " + to_string(ports[i]) + " didn't answer");
+                }
+                this_thread::sleep_for(chrono::milliseconds(50));
+            }
+        }
+    }
+}
+
+ShardCluster::~ShardCluster() {
+    stopAll();
+}
+
+void ShardCluster::stopAll() {
+    for (pid_t process : processes)
+        kill(process, SIGTERM);
+    for (pid_t process : processes)
+        waitpid(process, nullptr, 0);
+    processes.clear();
+}
+
+ShardBenchmark ShardCluster::benchmark(Tree* tree, unsigned int maxShards,
+        unsigned short firstPort) {
+    
+    const size_t BATCH = 4096;
+    const size_t SAMPLES = 16;
+    
+    ShardBenchmark result;
+    
+    //What to copy, and how many relatives each sample should turn up.
+    vector<Ent*> ents;
+    vector<pair<Ent*, Ent*> > parents;
+    vector<Ent*> samples;
+    vector<pair<size_t, size_t> > expected;
+    {
+        //Walking the whole name map needs Editors kept out, not just a Reader.
+        Tree::Writer writing(tree);
+        TreeSnapshot snapshot = tree->snapshot();
+        Ent* root = tree->getRoot();
+        for (pair<const string, Ent*>& p : *tree->getNameMap()) {
+            if (p.second == root)
+                continue;
+            ents.push_back(p.second);
+            for (Ent* parent : snapshot.getParents(p.second)) {
+                if (parent != root)
+                    parents.push_back(make_pair(parent, p.second));
+            }
+        }
+        for (size_t i = 0; i < SAMPLES && i < ents.size(); i++) {
+            Ent* sample = ents[i * ents.size() / SAMPLES];
+            samples.push_back(sample);
+            expected.push_back(make_pair(snapshot.getAncestors(sample).size(),
+                    snapshot.getDescendents(sample).size()));
+        }
+    }
+    result.ents = ents.size();
+    result.samples = samples.size();
+    
+    for (unsigned int count = 1; count <= maxShards; count *= 2) {
+        
+        ShardCluster cluster(count, firstPort);
+        ShardRouter router("127.0.0.1", cluster.getPorts());
+        ShardRun run;
+        run.shards = count;
+        run.refused = 0;
+        run.agrees = true;
+        
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        //Each Ent's UID in the cluster.
+        unordered_map<Ent*, unsigned int> uids;
+        vector<EntsRequest> batch;
+        for (size_t i = 0; i < ents.size(); i += BATCH) {
+            batch.clear();
+            for (size_t j = i; j < ents.size() && j < i + BATCH; j++) {
+                EntsRequest create;
+                create.op = OP_CREATE_ENT;
+                create.a.name = ents[j]->getName();
+                batch.push_back(std::move(create));
+            }
+            vector<EntsResponse> created = router.callBatch(batch);
+            for (size_t j = 0; j < created.size(); j++) {
+                if (created[j].status == STATUS_OK && !created[j].ents.empty())
+                    uids[ents[i + j]] = created[j].ents[0].uid;
+            }
+        }
+        for (size_t i = 0; i < parents.size(); i += BATCH) {
+            batch.clear();
+            for (size_t j = i; j < parents.size() && j < i + BATCH; j++) {
+                EntsRequest connect;
+                connect.op = OP_CONNECT;
+                connect.a.uid = uids[parents[j].first];
+                connect.a.name = parents[j].first->getName();
+                connect.b.uid = uids[parents[j].second];
+                connect.b.name = parents[j].second->getName();
+                batch.push_back(std::move(connect));
+            }
+            for (EntsResponse& answer : router.callBatch(batch)) {
+                if (answer.status != STATUS_OK)
+                    run.refused++;
+            }
+        }
+        run.loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        EntKey root;
+        root.uid = 1;
+        start = chrono::steady_clock::now();
+        run.everything = router.traverse(root, false);
+        run.everythingSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (run.everything.ents.size() != ents.size())
+            run.agrees = false;
+        
+        size_t rounds = 0, exchanged = 0;
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < samples.size(); i++) {
+            EntKey key;
+            key.uid = uids[samples[i]];
+            ShardTraversal up = router.traverse(key, true);
+            ShardTraversal down = router.traverse(key, false);
+            rounds += up.rounds + down.rounds;
+            exchanged += up.exchanged + down.exchanged;
+            if (up.ents.size() != expected[i].first || down.ents.size() != expected[i].second)
+                run.agrees = false;
+        }
+        double traversals = max<size_t>(samples.size() * 2, 1);
+        run.sampleSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count()
+                / traversals;
+        run.sampleRounds = rounds / traversals;
+        run.sampleExchanged = exchanged / traversals;
+        
+        result.runs.push_back(std::move(run));
+    }
+    
+    return result;
+}
@@ -0,0 +1,111 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHARDCLUSTER_H
+#define SHARDCLUSTER_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "ShardRouter.h"
+
+using namespace std;
+
+/**
+ * How a partitioned copy of a Tree did with one number of shards.
+ */
+struct ShardRun {
+    unsigned int shards;
+    /** Creating the Ents and connecting them through a ShardRouter. */
+    double loadSeconds;
+    /** Connects the shards turned down. */
+    size_t refused;
+    /** Finding all of root's descendents. */
+    ShardTraversal everything;
+    double everythingSeconds;
+    /** Each sample Ent's ancestors and descendents, on average. */
+    double sampleSeconds;
+    double sampleRounds;
+    double sampleExchanged;
+    /** Whether every traversal found as many Ents as the Tree itself does. */
+    bool agrees;
+};
+
+/**
+ * Results from ShardCluster::benchmark().
+ */
+struct ShardBenchmark {
+    size_t ents;
+    size_t samples;
+    vector<ShardRun> runs;
+};
+
+/**
+ * A number of shard processes on this machine, each serving one part of a
+ * hierarchy on its own port. They're this same program, run as
+ * "ents shard INDEX COUNT PORT", so they can be tried out, or timed, without
+ * setting up any other machines.
+ *
+ * The processes are stopped when the cluster is deleted.
+ */
+class ShardCluster {
+
+    vector<pid_t> processes;
+    vector<unsigned short> ports;
+
+    /**
+     * Stops and waits for every process started so far.
+     */
+    void stopAll();
+
+public:
+
+    /**
+     * Starts the shards, and waits until they all answer.
+     * @param count         How many.
+     * @param firstPort     The first shard's port. The rest follow it.
+     * @throws runtime_error if one can't be started, or doesn't answer.
+     */
+    ShardCluster(unsigned int count, unsigned short firstPort);
+
+    ~ShardCluster();
+
+    ShardCluster(const ShardCluster&) = delete;
+    ShardCluster& operator=(const ShardCluster&) = delete;
+
+    const vector<unsigned short>& getPorts() {
+        return ports;
+    }
+
+    /**
+     * Copies a Tree's Ents and parents into clusters of 1, 2, 4 and so on up
+     * to maxShards shards, and times finding descendents and ancestors in
+     * each, to see how the cost grows as the hierarchy is spread thinner.
+     * Nothing is printed.
+     * @param tree          The Tree to copy. Its exclusives and overlaps
+     *                      aren't.
+     * @param maxShards     The most shards to try.
+     * @param firstPort     Where the shards' ports start.
+     * @throws runtime_error if the shards can't be started.
+     */
+    static ShardBenchmark benchmark(Tree* tree, unsigned int maxShards,
+            unsigned short firstPort);
+
+};
+
+#endif /* SHARDCLUSTER_H */
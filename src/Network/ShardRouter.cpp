@@ -0,0 +1,456 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ShardRouter.h"
+#include "EntsServer.h"
+#include <unordered_set>
+#include <unordered_map>
+#include <set>
+#include <random>
+
+using namespace std;
+
+ShardRouter::ShardRouter(const string& host, const vector<unsigned short>& ports,
+        unsigned int poolSize) {
+    for (unsigned short port : ports)
+        shards.push_back(unique_ptr<EntsClient>(new EntsClient(host, port, poolSize)));
+}
+
+unsigned int ShardRouter::shardOfName(const string& name) {
+    //FNV-1a.
+    uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash ^= (unsigned char) c;
+        hash *= 16777619u;
+    }
+    return hash % shards.size();
+}
+
+void ShardRouter::connect() {
+    for (unique_ptr<EntsClient>& shard : shards)
+        shard->connect();
+}
+
+vector<vector<EntsResponse> > ShardRouter::sendToShards(vector<vector<EntsRequest> > batches) {
+    
+    vector<future<vector<EntsResponse> > > waiting(shards.size());
+    for (size_t i = 0; i < shards.size(); i++) {
+        if (!batches[i].empty())
+            waiting[i] = shards[i]->callBatch(std::move(batches[i]));
+    }
+    vector<vector<EntsResponse> > answers(shards.size());
+    for (size_t i = 0; i < shards.size(); i++) {
+        if (waiting[i].valid())
+            answers[i] = waiting[i].get();
+    }
+    return answers;
+}
+
+vector<unsigned int> ShardRouter::shardsFor(const EntsRequest& request) {
+    
+    vector<unsigned int> to;
+    const EntKey& a = request.a;
+    unsigned int owner = a.uid != 0 ? shardOfUID(a.uid) : shardOfName(a.name);
+    
+    switch (request.op) {
+        
+        case OP_PING:
+            for (unsigned int i = 0; i < shards.size(); i++)
+                to.push_back(i);
+            break;
+        
+        case OP_FIND:
+        case OP_CREATE_ENT:
+            to.push_back(owner);
+            break;
+        
+        case OP_GET_PARENTS:
+        case OP_GET_CHILDREN:
+        case OP_GET_EXCLUSIVES:
+        case OP_GET_OVERLAPS:
+            //Each shard only has root's relatives that it owns.
+            if (isRoot(a)) {
+                for (unsigned int i = 0; i < shards.size(); i++)
+                    to.push_back(i);
+            } else {
+                to.push_back(owner);
+            }
+            break;
+        
+        case OP_CONNECT:
+        case OP_DISCONNECT: {
+            const EntKey& b = request.b;
+            unsigned int other = b.uid != 0 ? shardOfUID(b.uid) : shardOfName(b.name);
+            //Every shard has root, so only the other Ent's owner is needed.
+            if (!isRoot(b))
+                to.push_back(other);
+            if (!isRoot(a) && (to.empty() || owner != other))
+                to.push_back(owner);
+            break;
+        }
+        
+        default:
+            break;
+    }
+    
+    return to;
+}
+
+void ShardRouter::completeKeys(vector<EntsRequest>* requests) {
+    
+    vector<vector<EntsRequest> > finds(shards.size());
+    //The key each find fills in.
+    vector<vector<EntKey*> > filling(shards.size());
+    
+    for (EntsRequest& request : *requests) {
+        if (request.op != OP_CONNECT && request.op != OP_DISCONNECT)
+            continue;
+        for (EntKey* key : {&request.a, &request.b}) {
+            if (isRoot(*key)) {
+                key->uid = 1;
+                key->name = "root";
+                continue;
+            }
+            if (key->uid != 0 && !key->name.empty())
+                continue;
+            unsigned int shard = key->uid != 0 ? shardOfUID(key->uid) : shardOfName(key->name);
+            EntsRequest find;
+            find.op = OP_FIND;
+            find.a = *key;
+            finds[shard].push_back(std::move(find));
+            filling[shard].push_back(key);
+        }
+    }
+    
+    vector<vector<EntsResponse> > found = sendToShards(std::move(finds));
+    for (size_t i = 0; i < shards.size(); i++) {
+        for (size_t j = 0; j < found[i].size(); j++) {
+            if (found[i][j].status != STATUS_OK || found[i][j].ents.empty())
+                continue;
+            filling[i][j]->uid = found[i][j].ents[0].uid;
+            filling[i][j]->name = found[i][j].ents[0].name;
+        }
+    }
+}
+
+EntsResponse ShardRouter::combine(vector<EntsResponse>& responses) {
+    
+    if (responses.size() == 1)
+        return std::move(responses[0]);
+    
+    for (EntsResponse& response : responses) {
+        if (response.status != STATUS_OK)
+            return std::move(response);
+    }
+    
+    //Root's relatives, from all over. Each shard only has root's relatives
+    //it owns, but references can repeat them.
+    EntsResponse combined;
+    unordered_set<unsigned int> seen;
+    for (EntsResponse& response : responses) {
+        for (EntRef& ent : response.ents) {
+            if (seen.insert(ent.uid).second)
+                combined.ents.push_back(std::move(ent));
+        }
+    }
+    return combined;
+}
+
+EntsRequest ShardRouter::undo(const EntsRequest& request) {
+    EntsRequest undone = request;
+    undone.op = request.op == OP_CONNECT ? OP_DISCONNECT : OP_CONNECT;
+    return undone;
+}
+
+EntsResponse ShardRouter::call(const EntsRequest& request) {
+    return callBatch(vector<EntsRequest>(1, request))[0];
+}
+
+vector<EntsResponse> ShardRouter::callBatch(vector<EntsRequest> requests) {
+    
+    completeKeys(&requests);
+    
+    vector<EntsResponse> answers(requests.size());
+    vector<vector<EntsRequest> > batches(shards.size());
+    //For each request, the shards it went to and where in their batches.
+    vector<vector<pair<unsigned int, size_t> > > places(requests.size());
+    
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (EntsService::isStreamed(requests[i].op))
+            continue;
+        vector<unsigned int> to = shardsFor(requests[i]);
+        if (to.empty())
+            answers[i].status = STATUS_BAD_REQUEST;
+        for (unsigned int shard : to) {
+            places[i].push_back(make_pair(shard, batches[shard].size()));
+            batches[shard].push_back(requests[i]);
+        }
+    }
+    
+    vector<vector<EntsResponse> > results = sendToShards(std::move(batches));
+    
+    vector<vector<EntsRequest> > undos(shards.size());
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (places[i].empty())
+            continue;
+        vector<EntsResponse> parts;
+        for (pair<unsigned int, size_t>& place : places[i])
+            parts.push_back(std::move(results[place.first][place.second]));
+        //An edit that only worked on one side would leave the shards
+        //disagreeing about it.
+        if ((requests[i].op == OP_CONNECT || requests[i].op == OP_DISCONNECT)
+                && parts.size() == 2 && (parts[0].status == STATUS_OK) != (parts[1].status == STATUS_OK)) {
+            unsigned int worked = places[i][parts[0].status == STATUS_OK ? 0 : 1].first;
+            undos[worked].push_back(undo(requests[i]));
+        }
+        answers[i] = combine(parts);
+    }
+    sendToShards(std::move(undos));
+    
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (!EntsService::isStreamed(requests[i].op))
+            continue;
+        ShardTraversal traversal = traverse(requests[i].a, requests[i].op == OP_GET_ANCESTORS);
+        answers[i].status = traversal.status;
+        answers[i].ents = std::move(traversal.ents);
+    }
+    
+    return answers;
+}
+
+ShardTraversal ShardRouter::traverse(const EntKey& key, bool up) {
+    
+    ShardTraversal traversal;
+    
+    EntsRequest find;
+    find.op = OP_FIND;
+    find.a = key;
+    EntsResponse found = call(find);
+    if (found.status != STATUS_OK || found.ents.empty()) {
+        traversal.status = found.status != STATUS_OK ? found.status : STATUS_NOT_FOUND;
+        return traversal;
+    }
+    unsigned int start = found.ents[0].uid;
+    
+    //Ents reported by their owners, which have walked on from them as far
+    //as they could already.
+    unordered_set<unsigned int> reached;
+    //Ents sent to their owners to walk on from.
+    unordered_set<unsigned int> sent;
+    vector<vector<unsigned int> > frontier(shards.size());
+    sent.insert(start);
+    if (start == 1) {
+        for (vector<unsigned int>& uids : frontier)
+            uids.push_back(start);
+    } else {
+        frontier[shardOfUID(start)].push_back(start);
+    }
+    
+    for (;;) {
+        vector<vector<EntsRequest> > batches(shards.size());
+        bool working = false;
+        for (size_t i = 0; i < shards.size(); i++) {
+            if (frontier[i].empty())
+                continue;
+            EntsRequest expand;
+            expand.op = up ? OP_EXPAND_ANCESTORS : OP_EXPAND_DESCENDENTS;
+            expand.uids = std::move(frontier[i]);
+            batches[i].push_back(std::move(expand));
+            traversal.messages++;
+            working = true;
+        }
+        if (!working)
+            break;
+        traversal.rounds++;
+        
+        vector<vector<EntsResponse> > results = sendToShards(std::move(batches));
+        frontier.assign(shards.size(), vector<unsigned int>());
+        
+        //All the Ents first, so none of them are sent out again below.
+        for (vector<EntsResponse>& answers : results) {
+            for (EntsResponse& answer : answers) {
+                if (answer.status != STATUS_OK) {
+                    traversal.status = answer.status;
+                    return traversal;
+                }
+                for (EntRef& ent : answer.ents) {
+                    if (reached.insert(ent.uid).second && ent.uid != start)
+                        traversal.ents.push_back(std::move(ent));
+                }
+            }
+        }
+        for (vector<EntsResponse>& answers : results) {
+            for (EntsResponse& answer : answers) {
+                for (unsigned int uid : answer.frontier) {
+                    if (reached.count(uid) == 0 && sent.insert(uid).second) {
+                        frontier[shardOfUID(uid)].push_back(uid);
+                        traversal.exchanged++;
+                    }
+                }
+            }
+        }
+    }
+    
+    return traversal;
+}
+
+/**
+ * The names of some Ents, to compare what the shards send back with.
+ */
+static set<string> namesOf(const vector<EntRef>& refs) {
+    set<string> names;
+    for (const EntRef& ref : refs)
+        names.insert(ref.name);
+    return names;
+}
+
+template <typename Ents>
+static set<string> namesOf(const Ents& ents) {
+    set<string> names;
+    for (Ent* ent : ents)
+        names.insert(ent->getName());
+    return names;
+}
+
+string ShardRouter::check() {
+    
+    const unsigned int SHARDS = 3;
+    
+    mt19937 random(41);
+    Tree whole("Shard check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 2000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("ent " + to_string(i));
+        whole.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 50 == 0) {
+            Ent::connectUnchecked(whole.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    
+    vector<unique_ptr<UIDAllocator> > allocators;
+    vector<unique_ptr<Tree> > trees;
+    vector<unique_ptr<EntsServer> > servers;
+    vector<unsigned short> ports;
+    for (unsigned int i = 0; i < SHARDS; i++) {
+        allocators.push_back(unique_ptr<UIDAllocator>(new UIDAllocator(SHARDS, i)));
+        trees.push_back(unique_ptr<Tree>(new Tree("Shard " + to_string(i), allocators[i].get())));
+        servers.push_back(unique_ptr<EntsServer>(new EntsServer(trees[i].get(), 0, 1, "127.0.0.1")));
+        servers[i]->setShard(i, SHARDS);
+        servers[i]->start();
+        ports.push_back(servers[i]->getPort());
+    }
+    ShardRouter router("127.0.0.1", ports);
+    
+    try {
+        router.connect();
+        
+        //Ents are created, then given their parents, as ShardCluster does.
+        vector<EntsRequest> batch;
+        for (Ent* ent : ents) {
+            EntsRequest create;
+            create.op = OP_CREATE_ENT;
+            create.a.name = ent->getName();
+            batch.push_back(create);
+        }
+        unordered_map<string, unsigned int> uids;
+        vector<EntsResponse> created = router.callBatch(batch);
+        for (size_t i = 0; i < created.size(); i++) {
+            if (created[i].status != STATUS_OK || created[i].ents.size() != 1)
+                return "couldn't create " + batch[i].a.name;
+            if (router.shardOfUID(created[i].ents[0].uid) != router.shardOfName(batch[i].a.name))
+                return batch[i].a.name + " was created on the wrong shard";
+            uids[batch[i].a.name] = created[i].ents[0].uid;
+        }
+        batch.clear();
+        for (Ent* ent : ents) {
+            for (Ent* parent : ent->getParents()) {
+                if (parent == whole.getRoot())
+                    continue;
+                EntsRequest connect;
+                connect.op = OP_CONNECT;
+                connect.a.uid = uids[parent->getName()];
+                connect.b.uid = uids[ent->getName()];
+                batch.push_back(connect);
+            }
+        }
+        for (EntsResponse& answer : router.callBatch(batch)) {
+            if (answer.status != STATUS_OK)
+                return "a connect was turned down";
+        }
+        
+        for (int round = 0; round < 2; round++) {
+            TreeSnapshot snapshot = whole.snapshot();
+            for (int i = 0; i < 40; i++) {
+                Ent* ent = i == 0 ? whole.getRoot() : ents[random() % ents.size()];
+                EntsRequest request;
+                request.a.uid = i == 0 ? 1 : uids[ent->getName()];
+                request.op = OP_GET_PARENTS;
+                if (namesOf(router.call(request).ents) != namesOf(snapshot.getParents(ent)))
+                    return "the shards have other parents for " + ent->getName();
+                request.op = OP_GET_CHILDREN;
+                if (namesOf(router.call(request).ents) != namesOf(snapshot.getChildren(ent)))
+                    return "the shards have other children for " + ent->getName();
+                ShardTraversal down = router.traverse(request.a, false);
+                if (down.status != STATUS_OK
+                        || namesOf(down.ents) != namesOf(snapshot.getDescendents(ent)))
+                    return "the shards have other descendents for " + ent->getName();
+                ShardTraversal up = router.traverse(request.a, true);
+                if (up.status != STATUS_OK
+                        || namesOf(up.ents) != namesOf(snapshot.getAncestors(ent)))
+                    return "the shards have other ancestors for " + ent->getName();
+            }
+            
+            //The same edits to both, then everything is looked at again.
+            for (int i = 0; i < 100; i++) {
+                size_t c = 1 + random() % (ents.size() - 1);
+                Ent* child = ents[c];
+                EntsRequest edit;
+                edit.b.uid = uids[child->getName()];
+                vector<Ent*> parents = child->getParents();
+                if (parents.size() > 1 && random() % 2) {
+                    Ent* parent = parents[random() % parents.size()];
+                    edit.op = OP_DISCONNECT;
+                    edit.a.uid = parent == whole.getRoot() ? 1 : uids[parent->getName()];
+                    if (!whole.disconnect(parent, child))
+                        continue;
+                } else {
+                    Ent* parent = ents[random() % c];
+                    if (child->isChildOf(parent))
+                        continue;
+                    edit.op = OP_CONNECT;
+                    edit.a.uid = uids[parent->getName()];
+                    if (!whole.connectAndPrune(parent, child))
+                        continue;
+                }
+                if (router.call(edit).status != STATUS_OK)
+                    return "an edit the Tree made was turned down by the shards";
+            }
+        }
+    } catch (exception& e) {
+        return e.what();
+    }
+    return "";
+}
@@ -0,0 +1,168 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHARDROUTER_H
+#define SHARDROUTER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "EntsClient.h"
+
+using namespace std;
+
+/**
+ * The descendents or ancestors of an Ent in a partitioned hierarchy, and
+ * what it took to find them.
+ */
+struct ShardTraversal {
+    EntsStatus status;
+    vector<EntRef> ents;
+    /** How many times the frontier went back out to the shards. */
+    unsigned int rounds;
+    /** Expansion requests sent, at most one per shard each round. */
+    size_t messages;
+    /** UIDs passed from one shard to another after the first round. */
+    size_t exchanged;
+
+    ShardTraversal(): status(STATUS_OK), rounds(0), messages(0), exchanged(0) {}
+};
+
+/**
+ * Talks to a hierarchy which is split up between a number of EntsServers,
+ * each one a shard (see EntsService::setShard()), as if it were one.
+ *
+ * Ents belong to shards by UID. New ones are created on the shard their
+ * name hashes to, whose UIDs all leave the shard's index when divided by
+ * the number of shards, so after that the UID alone says where an Ent is.
+ * A relation between Ents of two shards is made on both, each keeping a
+ * reference to the other's Ent.
+ *
+ * Descendents and ancestors are found as a breadth first search spread
+ * over the shards. Each round, every shard with work to do gets one request
+ * with all its UIDs, and walks as far as it can on its own. The references
+ * to other shards' Ents that it reaches are gathered up, and sent to their
+ * owners together in the next round. So the number of rounds depends on
+ * how many times a path crosses between shards, not how long it is.
+ *
+ * Use it from one thread at a time.
+ */
+class ShardRouter {
+
+    vector<unique_ptr<EntsClient> > shards;
+
+    /**
+     * Sends each shard its batch of requests, all at once, and waits for
+     * the answers. Shards with nothing to do are left alone.
+     */
+    vector<vector<EntsResponse> > sendToShards(vector<vector<EntsRequest> > batches);
+
+    /**
+     * Which shards a request goes to. Edits between two shards' Ents go to
+     * both, and looking at root's relatives goes to every shard.
+     */
+    vector<unsigned int> shardsFor(const EntsRequest& request);
+
+    /**
+     * Fills in the UIDs and names of the Ents an edit names, so each shard
+     * can make its reference to the other's. Keys that can't be found are
+     * left as they are.
+     */
+    void completeKeys(vector<EntsRequest>* requests);
+
+    /**
+     * Puts together the answers from each shard a request went to.
+     */
+    static EntsResponse combine(vector<EntsResponse>& responses);
+
+    /**
+     * The request that takes back a connect or disconnect.
+     */
+    static EntsRequest undo(const EntsRequest& request);
+
+    static bool isRoot(const EntKey& key) {
+        return key.uid == 1 || (key.uid == 0 && key.name == "root");
+    }
+
+public:
+
+    /**
+     * Nothing is connected until it's used.
+     * @param host      Where the shards are.
+     * @param ports     Each shard's port, in the order of their indexes.
+     * @param poolSize  Connections to each shard.
+     */
+    ShardRouter(const string& host, const vector<unsigned short>& ports,
+            unsigned int poolSize = 2);
+
+    unsigned int getShardCount() {
+        return shards.size();
+    }
+
+    /**
+     * The shard a new Ent with this name is created on.
+     */
+    unsigned int shardOfName(const string& name);
+
+    /**
+     * The shard which owns the Ent with this UID.
+     */
+    unsigned int shardOfUID(unsigned int uid) {
+        return uid % shards.size();
+    }
+
+    /**
+     * Connects to every shard. Throws a runtime_error saying why if one
+     * doesn't answer.
+     */
+    void connect();
+
+    /**
+     * Carries out a request on whichever shards it needs, and waits for the
+     * answer. A connect or disconnect that only works on one of its two
+     * shards is taken back there. OP_GET_DESCENDENTS and OP_GET_ANCESTORS
+     * are answered all at once, through traverse().
+     * @throws boost::system::system_error if a shard can't be reached.
+     */
+    EntsResponse call(const EntsRequest& request);
+
+    /**
+     * Carries out a number of requests, sending each shard its share of them
+     * in one batch.
+     * @return          Their answers, in the same order.
+     */
+    vector<EntsResponse> callBatch(vector<EntsRequest> requests);
+
+    /**
+     * Finds all the descendents, or ancestors, of an Ent across the shards.
+     * @param key       The Ent to start from.
+     * @param up        true for ancestors.
+     */
+    ShardTraversal traverse(const EntKey& key, bool up);
+
+    /**
+     * Copies a made up Tree into three shards served here, through a
+     * router, then edits both.
+     * @return          "" if the shards' relatives, descendents and
+     *                  ancestors are the Tree's, otherwise what went wrong.
+     */
+    static string check();
+
+};
+
+#endif /* SHARDROUTER_H */
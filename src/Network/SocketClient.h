@@ -22,12 +22,14 @@
 
 #include <string>
 #include <boost/asio.hpp>
-#include <boost/array.hpp>
 #include <iostream>
 
 
 
-void send_something(std::string host, int port, std::string message)
+/**
+ * Connects, sends the whole message, and hangs up.
+ */
+inline void send_something(std::string host, int port, std::string message)
 {
 	boost::asio::io_service ios;
 			
@@ -37,10 +39,8 @@ void send_something(std::string host, int port, std::string message)
 
 	socket.connect(endpoint);
 
-	boost::array<char, 128> buf;
-        std::copy(message.begin(),message.end(),buf.begin());
 	boost::system::error_code error;
-	socket.write_some(boost::asio::buffer(buf, message.size()), error);
+	boost::asio::write(socket, boost::asio::buffer(message), error);
         socket.close();
 }
 
@@ -0,0 +1,407 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WatchHub.h"
+#include "../Core/Epoch.h"
+#include <unordered_set>
+#include <algorithm>
+#include <random>
+
+using namespace std;
+
+Watch::Watch(unsigned int u, function<void()> w): offset(0), time(0), missed(false),
+        ended(false), woken(false), wake(std::move(w)), uid(u) {
+}
+
+void Watch::add(const LoggedChange& change, uint64_t at, bool last) {
+    
+    {
+        lock_guard<mutex> hold(lock);
+        if (ended)
+            return;
+        if (pending.size() == MAX_PENDING) {
+            pending.clear();
+            missed = true;
+        }
+        pending.push_back(change.change);
+        offset = at + 1;
+        time = change.time;
+        ended = last;
+        if (woken)
+            return;
+        woken = true;
+    }
+    wake();
+}
+
+bool Watch::take(size_t most, ChangeBatch* batch, bool* more) {
+    
+    lock_guard<mutex> hold(lock);
+    *more = false;
+    if (pending.empty() && !missed) {
+        woken = false;
+        return false;
+    }
+    
+    size_t taking = min(most, pending.size());
+    batch->changes.assign(pending.begin(), pending.begin() + taking);
+    pending.erase(pending.begin(), pending.begin() + taking);
+    *more = !pending.empty();
+    woken = *more;
+    
+    batch->snapshot = missed;
+    missed = false;
+    //Offsets and times of changes still pending aren't kept, so a batch
+    //that doesn't take them all says where the last of them is.
+    batch->offset = batch->end = offset;
+    batch->time = time;
+    batch->status = ended && !*more ? STATUS_NOT_FOUND : STATUS_MORE;
+    return true;
+}
+
+
+WatchHub::WatchHub(Tree* tr): tree(tr), log(nullptr), stopped(false), count(0) {
+}
+
+WatchHub::~WatchHub() {
+    stop();
+}
+
+shared_ptr<Watch> WatchHub::watch(const EntKey& key, function<void()> wake,
+        EntsStatus* status, uint64_t* from) {
+    
+    {
+        lock_guard<mutex> hold(starting);
+        if (stopped) {
+            *status = STATUS_BAD_REQUEST;
+            return nullptr;
+        }
+        if (log == nullptr) {
+            log = tree->startChangeLog();
+            log->addWatcher(this);
+        }
+    }
+    
+    Ent* ent;
+    {
+        Tree::Reader reading;
+        ent = key.uid != 0 ? tree->getEntPtrByUID(key.uid) : tree->getEntPtrByName(key.name);
+    }
+    if (ent == nullptr) {
+        *status = STATUS_NOT_FOUND;
+        return nullptr;
+    }
+    
+    shared_ptr<Watch> watch = make_shared<Watch>(ent->getUID(), std::move(wake));
+    *from = log->getEnd();
+    {
+        lock_guard<mutex> hold(lock);
+        watches[watch->uid].push_back(watch);
+        count.fetch_add(1, memory_order_relaxed);
+    }
+    
+    //It may have been removed before the Watch was there to see it.
+    Tree::Reader reading;
+    if (tree->getEntPtrByUID(watch->uid) != ent) {
+        unwatch(watch);
+        *status = STATUS_NOT_FOUND;
+        return nullptr;
+    }
+    *status = STATUS_OK;
+    return watch;
+}
+
+void WatchHub::unwatch(const shared_ptr<Watch>& watch) {
+    
+    lock_guard<mutex> hold(lock);
+    unordered_map<unsigned int, vector<shared_ptr<Watch> > >::iterator found
+            = watches.find(watch->uid);
+    if (found == watches.end())
+        return;
+    vector<shared_ptr<Watch> >& on = found->second;
+    vector<shared_ptr<Watch> >::iterator place = find(on.begin(), on.end(), watch);
+    if (place == on.end())
+        return;
+    on.erase(place);
+    count.fetch_sub(1, memory_order_relaxed);
+    if (on.empty())
+        watches.erase(found);
+}
+
+void WatchHub::stop() {
+    lock_guard<mutex> hold(starting);
+    stopped = true;
+    if (log != nullptr)
+        log->removeWatcher(this);
+}
+
+void WatchHub::changed(const LoggedChange& change, uint64_t offset, Ent* a, Ent* b) {
+    
+    if (count.load(memory_order_relaxed) == 0)
+        return;
+    
+    ChangeType type = change.change.type;
+    //No one can have found it to watch yet.
+    if (type == CHANGE_ADD_ENT)
+        return;
+    
+    lock_guard<mutex> hold(lock);
+    
+    if (type == CHANGE_REMOVE_ENT) {
+        //Its relations were taken away first, and those changes have
+        //already gone to the Watches above it.
+        unordered_map<unsigned int, vector<shared_ptr<Watch> > >::iterator found
+                = watches.find(a->getUID());
+        if (found == watches.end())
+            return;
+        for (shared_ptr<Watch>& watch : found->second)
+            watch->add(change, offset, true);
+        count.fetch_sub(found->second.size(), memory_order_relaxed);
+        watches.erase(found);
+        return;
+    }
+    
+    //Where to climb from. A child being connected or disconnected is only
+    //touched itself, since what's under it stays the same.
+    vector<Ent*> climbing;
+    unordered_set<Ent*> seen;
+    climbing.push_back(a);
+    seen.insert(a);
+    if (b != nullptr && seen.insert(b).second) {
+        if (type == CHANGE_CONNECT || type == CHANGE_DISCONNECT) {
+            unordered_map<unsigned int, vector<shared_ptr<Watch> > >::iterator found
+                    = watches.find(b->getUID());
+            if (found != watches.end()) {
+                for (shared_ptr<Watch>& watch : found->second)
+                    watch->add(change, offset, false);
+            }
+        } else {
+            climbing.push_back(b);
+        }
+    }
+    
+    EpochGuard guard;
+    while (!climbing.empty()) {
+        Ent* ent = climbing.back();
+        climbing.pop_back();
+        unordered_map<unsigned int, vector<shared_ptr<Watch> > >::iterator found
+                = watches.find(ent->getUID());
+        if (found != watches.end()) {
+            for (shared_ptr<Watch>& watch : found->second)
+                watch->add(change, offset, false);
+        }
+        for (Ent* parent : ent->getList(RELATION_PARENT).view()) {
+            if (seen.insert(parent).second)
+                climbing.push_back(parent);
+        }
+    }
+}
+
+/**
+ * An Ent and everything above it.
+ */
+static unordered_set<Ent*> selfAndAncestors(Ent* ent) {
+    unordered_set<Ent*> found = {ent};
+    vector<Ent*> queue(1, ent);
+    for (size_t at = 0; at < queue.size(); at++) {
+        for (Ent* parent : queue[at]->getParents()) {
+            if (found.insert(parent).second)
+                queue.push_back(parent);
+        }
+    }
+    return found;
+}
+
+/**
+ * Takes everything pending from a Watch.
+ * @return          The status of the last batch, or STATUS_MORE if there
+ *                  wasn't one.
+ */
+static EntsStatus takeAll(Watch* watch, vector<TreeChange>* changes, bool* missed) {
+    EntsStatus status = STATUS_MORE;
+    ChangeBatch batch;
+    bool more = true;
+    while (more && watch->take(100, &batch, &more)) {
+        changes->insert(changes->end(), batch.changes.begin(), batch.changes.end());
+        *missed = *missed || batch.snapshot;
+        status = batch.status;
+    }
+    return status;
+}
+
+string WatchHub::check() {
+    
+    const unsigned int WATCHES = 6;
+    
+    mt19937 random(42);
+    Tree tree("Watch check");
+    vector<Ent*> ents;
+    for (unsigned int i = 0; i < 2000; i++) {
+        Ent* ent = new Ent();
+        ent->setName("e" + to_string(i));
+        tree.addEntToNameMapUnattached(ent);
+        if (ents.empty() || random() % 50 == 0) {
+            Ent::connectUnchecked(tree.getRoot(), ent);
+        } else {
+            for (unsigned int n = random() % 2; n < 2; n++) {
+                Ent* parent = ents[random() % ents.size()];
+                if (!ent->isChildOf(parent))
+                    Ent::connectUnchecked(parent, ent);
+            }
+        }
+        ents.push_back(ent);
+    }
+    
+    //Some watched Ents high up, with a lot under them, and some lower down.
+    WatchHub hub(&tree);
+    vector<Ent*> watched;
+    vector<shared_ptr<Watch> > watches;
+    for (unsigned int i = 0; i < WATCHES; i++) {
+        Ent* ent = ents[i < WATCHES / 2 ? i * 5 : random() % ents.size()];
+        EntKey key;
+        key.uid = ent->getUID();
+        EntsStatus status;
+        uint64_t from;
+        shared_ptr<Watch> watch = hub.watch(key, [] {}, &status, &from);
+        if (watch == nullptr || status != STATUS_OK)
+            return "couldn't watch " + ent->getName();
+        watched.push_back(ent);
+        watches.push_back(watch);
+    }
+    
+    //Each change is worked out before it's made. Parents always come
+    //before their children in ents, so edits can't make loops.
+    vector<vector<TreeChange> > expected(WATCHES);
+    unsigned int renames = 0;
+    for (int round = 0; round < 50; round++) {
+        Tree::Writer writing(&tree);
+        for (int i = 0; i < 20; i++) {
+            size_t c = 1 + random() % (ents.size() - 1);
+            Ent* ent = ents[c];
+            TreeChange change = {CHANGE_CONNECT, 0, 0, string()};
+            unordered_set<Ent*> touched;
+            Ent* b = nullptr;
+            switch (random() % 5) {
+                case 0: {
+                    Ent* parent = ents[random() % c];
+                    if (ent->isChildOf(parent))
+                        continue;
+                    change.a = parent->getUID();
+                    touched = selfAndAncestors(parent);
+                    b = ent;
+                    Ent::connectUnchecked(parent, ent);
+                    break;
+                }
+                case 1: {
+                    vector<Ent*> parents = ent->getParents();
+                    if (parents.size() < 2)
+                        continue;
+                    Ent* parent = parents[random() % parents.size()];
+                    change.type = CHANGE_DISCONNECT;
+                    change.a = parent->getUID();
+                    touched = selfAndAncestors(parent);
+                    b = ent;
+                    Ent::disconnectUnchecked(parent, ent);
+                    break;
+                }
+                case 2:
+                    change.type = CHANGE_RENAME;
+                    change.a = ent->getUID();
+                    change.name = "renamed " + to_string(renames++);
+                    touched = selfAndAncestors(ent);
+                    tree.renameEnt(ent, change.name);
+                    break;
+                case 3: {
+                    Ent* other = ents[random() % ents.size()];
+                    if (other == ent)
+                        continue;
+                    vector<Ent*> exclusives = ent->getExclusives();
+                    bool set = find(exclusives.begin(), exclusives.end(), other) == exclusives.end();
+                    change.type = set ? CHANGE_SET_EXCLUSIVE : CHANGE_UNSET_EXCLUSIVE;
+                    change.a = ent->getUID();
+                    change.b = other->getUID();
+                    touched = selfAndAncestors(ent);
+                    for (Ent* above : selfAndAncestors(other))
+                        touched.insert(above);
+                    if (set)
+                        Ent::setExclusive(ent, other);
+                    else
+                        Ent::unsetExclusive(ent, other);
+                    break;
+                }
+                default: {
+                    //Its CHANGE_ADD_ENT isn't seen, only its parent getting it.
+                    Ent* added = new Ent();
+                    added->setName("added " + to_string(ents.size()));
+                    change.a = ent->getUID();
+                    touched = selfAndAncestors(ent);
+                    tree.addEntToNameMap(added, ent);
+                    change.b = added->getUID();
+                    ents.push_back(added);
+                }
+            }
+            if (b != nullptr)
+                change.b = b->getUID();
+            for (unsigned int w = 0; w < WATCHES; w++) {
+                if (touched.count(watched[w]) || watched[w] == b)
+                    expected[w].push_back(change);
+            }
+        }
+    }
+    
+    for (unsigned int w = 0; w < WATCHES; w++) {
+        vector<TreeChange> seen;
+        bool missed = false;
+        if (takeAll(watches[w].get(), &seen, &missed) == STATUS_NOT_FOUND || missed)
+            return "the Watch on " + watched[w]->getName() + " ended early";
+        if (seen.size() != expected[w].size())
+            return "the Watch on " + watched[w]->getName() + " saw " + to_string(seen.size())
+                    + " changes, not " + to_string(expected[w].size());
+        for (size_t i = 0; i < seen.size(); i++) {
+            TreeChange& a = seen[i];
+            TreeChange& b = expected[w][i];
+            if (a.type != b.type || a.a != b.a || a.b != b.b || a.name != b.name)
+                return "the Watch on " + watched[w]->getName() + " saw another change "
+                        + to_string(i);
+        }
+    }
+    
+    //A Watch that isn't taken from is told it missed some, and gets only
+    //the changes after the ones thrown away.
+    {
+        Tree::Writer writing(&tree);
+        for (size_t i = 0; i < Watch::MAX_PENDING + 10; i++)
+            tree.renameEnt(watched[0], "renamed " + to_string(renames++));
+    }
+    vector<TreeChange> seen;
+    bool missed = false;
+    takeAll(watches[0].get(), &seen, &missed);
+    if (!missed || seen.size() != 10)
+        return "a Watch that fell behind wasn't told, or kept " + to_string(seen.size())
+                + " changes";
+    
+    //Once its Ent is gone, a Watch ends.
+    {
+        Tree::Writer writing(&tree);
+        tree.removeEnt(watched[WATCHES - 1]);
+    }
+    seen.clear();
+    if (takeAll(watches[WATCHES - 1].get(), &seen, &missed) != STATUS_NOT_FOUND)
+        return "a Watch wasn't ended when its Ent was removed";
+    return "";
+}
@@ -0,0 +1,175 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WATCHHUB_H
+#define WATCHHUB_H
+
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include "../Core/ChangeLog.h"
+#include "EntsService.h"
+
+using namespace std;
+
+/**
+ * A client's subscription to everything that changes at or under an Ent:
+ * the Ent itself, and its descendents and their relations. Changes pile up
+ * here until the client's session takes them to send.
+ */
+class Watch {
+
+    mutex lock;
+    vector<TreeChange> pending;
+    /** Just after the last change pending. */
+    uint64_t offset;
+    int64_t time;
+    /** Changes were thrown away because the client wasn't taking them. */
+    bool missed;
+    /** The Ent is gone, so nothing more will come. */
+    bool ended;
+    /** wake has been called, and take() hasn't been since. */
+    bool woken;
+    function<void()> wake;
+
+    friend class WatchHub;
+
+    /**
+     * Adds a change, and wakes the session if it isn't already.
+     * @param last      true if it removes the watched Ent.
+     */
+    void add(const LoggedChange& change, uint64_t at, bool last);
+
+public:
+
+    /**
+     * How many changes are kept for a client that isn't taking them, before
+     * they're thrown away and it's told it missed some.
+     */
+    static const size_t MAX_PENDING = 1 << 16;
+
+    const unsigned int uid;
+
+    /**
+     * @param uid       The watched Ent.
+     * @param wake      Called, on the thread making a change, when there's
+     *                  something to take. Only once until take() is.
+     */
+    Watch(unsigned int uid, function<void()> wake);
+
+    /**
+     * Takes the changes pending, as a batch to send. Its snapshot flag is
+     * set if changes were missed, so what's under the Ent has to be read
+     * again. Its status is STATUS_NOT_FOUND once the Ent is gone.
+     * @param most      How many changes to take at most.
+     * @param more      Set if some are still pending.
+     * @return          false if there was nothing to take.
+     */
+    bool take(size_t most, ChangeBatch* batch, bool* more);
+
+};
+
+/**
+ * Matches each change made to a Tree against the Watches on it.
+ *
+ * A change touches one or two Ents, and it matters to every Watch on those
+ * Ents or their ancestors. So rather than asking of each Watch whether the
+ * change is under it, the hub climbs from the changed Ents up through their
+ * ancestors and looks each one up among the watched UIDs. That costs the
+ * same whether there are no Watches or thousands of them, and nothing at
+ * all when there are none.
+ *
+ * Connecting or disconnecting a parent and child touches the parent, its
+ * ancestors, and the child itself. Nothing under the child changes.
+ *
+ * Only changes made within a Writer or Editor are seen. The hub starts the
+ * Tree's ChangeLog, and watches it, from the first Watch on.
+ */
+class WatchHub : public ChangeWatcher {
+
+    Tree* tree;
+    /**
+     * Held while the log is started, or the hub stopped. Never while a
+     * change is being matched.
+     */
+    mutex starting;
+    ChangeLog* log;
+    bool stopped;
+    /**
+     * The Watches on each watched Ent's UID. Locked after the log, while a
+     * change is matched.
+     */
+    mutex lock;
+    unordered_map<unsigned int, vector<shared_ptr<Watch> > > watches;
+    atomic<size_t> count;
+
+public:
+
+    WatchHub(Tree* tree);
+
+    /**
+     * Stops watching the Tree's log.
+     */
+    ~WatchHub();
+
+    WatchHub(const WatchHub&) = delete;
+    WatchHub& operator=(const WatchHub&) = delete;
+
+    /**
+     * Starts watching an Ent.
+     * @param key       The Ent.
+     * @param wake      For the new Watch.
+     * @param status    STATUS_NOT_FOUND if there's no such Ent.
+     * @param from      Set to the log offset changes will be seen from.
+     * @return          The Watch, or nullptr.
+     */
+    shared_ptr<Watch> watch(const EntKey& key, function<void()> wake,
+            EntsStatus* status, uint64_t* from);
+
+    /**
+     * Once this returns, the Watch gets no more changes.
+     */
+    void unwatch(const shared_ptr<Watch>& watch);
+
+    /**
+     * Stops matching changes. Nothing more is added to any Watch.
+     */
+    void stop();
+
+    size_t getWatchCount() {
+        return count.load(memory_order_relaxed);
+    }
+
+    void changed(const LoggedChange& change, uint64_t offset, Ent* a, Ent* b) override;
+
+    /**
+     * Watches some Ents of a made up Tree while it's edited, and works out
+     * which changes each should see from a plain search of the ancestors of
+     * the Ents each change touches.
+     * @return          "" if every Watch gets just those, in order, and is
+     *                  told when it misses some or its Ent goes, otherwise
+     *                  what went wrong.
+     */
+    static string check();
+
+};
+
+#endif /* WATCHHUB_H */
@@ -17,6 +17,9 @@
  */
 
 #include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
 #include "EntsFile.h"
 #include "IO.h"
 
@@ -49,11 +52,51 @@ const string* EntsFile::generateSaveData() {
     //Append the number of Ents that will follow.
     stream << size << endl;
     
-    for (pair<string, Ent*> p : *nameMap) {
-        
-        stream << p.first << endl;
-        
+    //Relations refer to Ents by their place in the list, so remember it.
+    unordered_map<Ent*, unsigned int> indices;
+    indices.reserve(size);
+    vector<Ent*> ents;
+    ents.reserve(size);
+    //root goes first so it's easy to find again.
+    ents.push_back(tree->getRoot());
+    for (pair<const string, Ent*>& p : *nameMap) {
+        if (p.second != tree->getRoot())
+            ents.push_back(p.second);
     }
+    for (unsigned int i = 0; i < ents.size(); i++) {
+        indices[ents[i]] = i;
+        stream << ents[i]->getUID() << '\t' << ents[i]->getName() << endl;
+    }
+    
+    //Each relation once. Exclusives and overlaps are listed on both Ents,
+    //so only write them from the one that comes first.
+    ostringstream relations;
+    unsigned int relationCount = 0;
+    for (unsigned int i = 0; i < ents.size(); i++) {
+        for (Ent* child : ents[i]->getChildren()) {
+            relations << "p\t" << i << '\t' << indices[child] << endl;
+            relationCount++;
+        }
+        for (Ent* exclusive : ents[i]->getExclusives()) {
+            if (indices[exclusive] > i) {
+                relations << "x\t" << i << '\t' << indices[exclusive] << endl;
+                relationCount++;
+            }
+        }
+        for (Ent* overlap : ents[i]->getOverlaps()) {
+            if (indices[overlap] > i) {
+                relations << "o\t" << i << '\t' << indices[overlap] << endl;
+                relationCount++;
+            }
+        }
+    }
+    stream << relationCount << endl << relations.str();
+    
+    //Last, so older versions can still read the rest. Keeps UIDs of removed
+    //Ents from being handed out again after a load.
+    stream << "uids\t" << tree->getUIDAllocator()->getHighWater() << endl;
+    //So a Tree loaded from it is only matched by UID with its own kind.
+    stream << "origin\t" << tree->getOrigin() << endl;
     
     string *outString = new string();
     
@@ -61,4 +104,90 @@ const string* EntsFile::generateSaveData() {
     
     return outString;
     
+}
+
+
+Tree* EntsFile::load(const string fileName) {
+    
+    string data;
+    if (!IO::loadFile(fileName + "." + FILE_POSTFIX, &data))
+        return nullptr;
+    
+    istringstream stream(data);
+    string line;
+    
+    //The Tree's name, then how many Ents follow.
+    if (!getline(stream, line))
+        return nullptr;
+    Tree* tree = new Tree(line);
+    
+    unsigned int size = 0;
+    if (getline(stream, line))
+        size = strtoul(line.c_str(), nullptr, 10);
+    tree->reserve(size);
+    
+    vector<Ent*> ents;
+    ents.reserve(size);
+    for (unsigned int i = 0; i < size && getline(stream, line); i++) {
+        unsigned int uid = 0;
+        string name = line;
+        //Old files have just the name.
+        size_t tab = line.find('\t');
+        if (tab != string::npos) {
+            uid = strtoul(line.c_str(), nullptr, 10);
+            name = line.substr(tab + 1);
+        }
+        Ent* ent;
+        if (name == tree->getRoot()->getName()) {
+            ent = tree->getRoot();
+        } else {
+            //The no-arg constructor skips the creation message, which would
+            //flood the console for a big Tree.
+            ent = new Ent();
+            ent->setName(name);
+            //Set before adding, so the Tree indexes it under this UID.
+            //Old files have none, so one is given to it.
+            ent->setUID(uid);
+            if (!tree->addEntToNameMapUnattached(ent)) {
+                //A repeated name. Its relations go to the Ent already there.
+                delete ent;
+                ent = tree->getEntPtrByName(name);
+            }
+        }
+        ents.push_back(ent);
+    }
+    
+    unsigned int relationCount = 0;
+    if (getline(stream, line))
+        relationCount = strtoul(line.c_str(), nullptr, 10);
+    for (unsigned int r = 0; r < relationCount && getline(stream, line); r++) {
+        char type;
+        unsigned int i, j;
+        if (sscanf(line.c_str(), "%c\t%u\t%u", &type, &i, &j) != 3
+                || i >= ents.size() || j >= ents.size())
+            continue;
+        if (type == 'p')
+            Ent::connectUnchecked(ents[i], ents[j]);
+        else if (type == 'x')
+            Ent::setExclusive(ents[i], ents[j]);
+        else if (type == 'o')
+            Ent::setOverlap(ents[i], ents[j]);
+    }
+    
+    //Files from before origins were saved have UIDs from who knows where.
+    tree->setOrigin(0);
+    while (getline(stream, line)) {
+        if (line.compare(0, 5, "uids\t") == 0)
+            tree->getUIDAllocator()->raiseTo(strtoull(line.c_str() + 5, nullptr, 10));
+        else if (line.compare(0, 7, "origin\t") == 0)
+            tree->setOrigin(strtoull(line.c_str() + 7, nullptr, 10));
+    }
+    
+    //Anything the file didn't give a parent goes under root.
+    for (Ent* ent : ents) {
+        if (ent != tree->getRoot() && ent->getParents().empty())
+            Ent::connectUnchecked(tree->getRoot(), ent);
+    }
+    
+    return tree;
 }
\ No newline at end of file
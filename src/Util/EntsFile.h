@@ -30,6 +30,22 @@ class Tree;
 /**
  * Holds all we need for an Ents file, including the file name, the
  * Tree instance it represents, and other various options.
+ * 
+ * A file is plain text, one item per line:
+ * 
+ *      the Tree's name
+ *      the number of Ents, N
+ *      N lines of "uid<tab>name", root first
+ *      the number of relations, R
+ *      R lines of "p<tab>i<tab>j" (i is a parent of j), "x<tab>i<tab>j"
+ *      (i and j are exclusive) or "o<tab>i<tab>j" (i and j overlap), where
+ *      i and j count Ents from 0 in the order above
+ *      "uids<tab>" and the UID high-water mark
+ *      "origin<tab>" and the Tree's origin (see Tree::getOrigin())
+ * 
+ * Files from before UIDs and relations were saved only have names. They
+ * still load, with every Ent under root. Files from before origins were
+ * saved load with origin 0, so their UIDs aren't matched with other Trees'.
  */
 class EntsFile {
     
@@ -59,6 +75,14 @@ public:
     
     void save();
     
+    /**
+     * Reads a saved Tree back into memory.
+     * @param fileName      The file's name, without the .ents postfix.
+     * @return              A new Tree, which the caller now owns, or nullptr
+     *                      if the file couldn't be read.
+     */
+    static Tree* load(const string fileName);
+    
     void setFileName(string newName) {
         fileName = newName;
     }
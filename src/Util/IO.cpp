@@ -20,13 +20,13 @@
 
 using namespace std;
 
+//For now, writing files to an external USB drive. In case things go wrong.
+const string IO::fileDirectory = "/home/jstockwell/DatabaseTestDrive/";
+
 void IO::saveFile(string fileName, const string *dataStringPtr) {
         
         if (!dataStringPtr)
             cout << "ERROR: No data to be written.\n";
-        
-        //For now, writing files to an external USB drive. In case things go wrong.
-        const string fileDirectory = "/home/jstockwell/DatabaseTestDrive/";
 
     //Put this stuff in a try/catch so we can use RAII.
     try {
@@ -49,4 +49,19 @@ void IO::saveFile(string fileName, const string *dataStringPtr) {
         //If we're here, we probably didn't write the string to file, or delete it.
         delete dataStringPtr;
     }
+}
+
+bool IO::loadFile(string fileName, string *data) {
+    
+    ifstream file(fileDirectory + fileName, ios::in | ios::binary);
+    if (!file.is_open()) {
+        cout << "Could not open file \"" << fileName << "\".\n";
+        return false;
+    }
+    //Read it all in one go.
+    ostringstream stream;
+    stream << file.rdbuf();
+    *data = stream.str();
+    
+    return true;
 }
\ No newline at end of file
@@ -37,13 +37,21 @@ class IO {
     /**
      * The directory the user is currently using to load and save files.
      */
-    const string fileDirectory;
+    static const string fileDirectory;
     
     
 public:
     
     static void saveFile(string fileName, const string *dataStringPtr);
     
+    /**
+     * Reads a whole file from the same directory saveFile writes to.
+     * @param fileName      Name of the file within the directory.
+     * @param data          Set to the contents of the file.
+     * @return              false if the file couldn't be read.
+     */
+    static bool loadFile(string fileName, string *data);
+    
     
 };
 
@@ -0,0 +1,493 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Importer.h"
+#include "../Algorithms/ParentCycles.h"
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unistd.h>
+
+using namespace std;
+
+Importer::Importer(Tree* tr): tree(tr), chunkSize(16 << 20) {
+    //One parsing thread per core. hardware_concurrency may not know, so
+    //fall back to a single thread.
+    setThreadCount(thread::hardware_concurrency());
+}
+
+Importer::~Importer() {
+}
+
+ImportStats Importer::importEdgeList(const string path, char delimiter) {
+
+    ImportStats stats;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    if (!streamFile(path, EDGE_LIST, delimiter, &stats))
+        cout << "Could not open file \"" << path << "\".\n";
+    breakLoops(&stats);
+    attachLeftoverPlaceholders();
+
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    return stats;
+}
+
+ImportStats Importer::importNcbiTaxonomy(const string nodesPath, const string namesPath) {
+
+    ImportStats stats;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    //Names have to be known before any taxon is created, so read them first.
+    //Only the tax_id -> name table is kept, not the rows themselves.
+    if (!streamFile(namesPath, NCBI_NAMES, '|', &stats)) {
+        cout << "Could not open file \"" << namesPath << "\".\n";
+    } else if (!streamFile(nodesPath, NCBI_NODES, '|', &stats)) {
+        cout << "Could not open file \"" << nodesPath << "\".\n";
+    }
+    breakLoops(&stats);
+    attachLeftoverPlaceholders();
+    //The names are all on Ents now, or were never needed.
+    taxNames.clear();
+
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    return stats;
+}
+
+
+string Importer::check() {
+
+    //Each Ent gets up to 3 parents from those before it, so there are no
+    //loops, or root. e0 never gets a line of its own.
+    mt19937 random(26);
+    map<string, set<string> > expected;
+    vector<string> lines;
+    for (unsigned int i = 1; i < 3000; i++) {
+        string name = "e" + to_string(i);
+        if (random() % 10 == 0) {
+            lines.push_back(name + ",");
+            expected[name].insert("root");
+            continue;
+        }
+        for (unsigned int n = random() % 3; n < 3; n++) {
+            string parent = "e" + to_string(random() % i);
+            lines.push_back(name + "," + parent);
+            expected[name].insert(parent);
+            if (parent == "e0")
+                expected["e0"].insert("root");
+        }
+    }
+    shuffle(lines.begin(), lines.end(), random);
+    //The last line closes a loop of parents, so it's left out and b goes
+    //under root instead.
+    lines.push_back("a,b");
+    lines.push_back("b,a");
+    expected["a"].insert("b");
+    expected["b"].insert("root");
+
+    char path[] = "/tmp/entscheckXXXXXX";
+    int descriptor = mkstemp(path);
+    if (descriptor < 0)
+        return "couldn't make a file to import";
+    FILE* file = fdopen(descriptor, "w");
+    fputs("name,parent\n", file);
+    for (string& line : lines)
+        fprintf(file, "%s\n", line.c_str());
+    fclose(file);
+
+    Tree tree("Import check");
+    Importer importer(&tree);
+    importer.setThreadCount(4);
+    importer.setChunkSize(4096);
+    ImportStats stats = importer.importEdgeList(path);
+    unlink(path);
+
+    if (stats.rows != lines.size())
+        return "read " + to_string(stats.rows) + " of " + to_string(lines.size()) + " lines";
+    if (stats.loopsSkipped != 1)
+        return "left out " + to_string(stats.loopsSkipped) + " lines for making loops, not 1";
+    for (pair<const string, set<string> >& ent : expected) {
+        Ent* found = tree.getEntPtrByName(ent.first);
+        if (found == nullptr)
+            return ent.first + " is missing";
+        set<string> parents;
+        for (Ent* parent : found->getParents())
+            parents.insert(parent->getName());
+        if (parents != ent.second)
+            return ent.first + " has the wrong parents";
+    }
+    return "";
+}
+
+bool Importer::streamFile(const string path, LineFormat format, char delimiter,
+        ImportStats* stats) {
+
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+
+    //Let the Tree know roughly how many Ents are coming, so its map doesn't
+    //rehash over and over during a big import. Lines are rarely shorter
+    //than 16 bytes.
+    if (format != NCBI_NAMES && fseek(file, 0, SEEK_END) == 0) {
+        long size = ftell(file);
+        if (size > 0)
+            tree->reserve(tree->getNameMap()->size() + size / 16);
+        fseek(file, 0, SEEK_SET);
+    }
+
+    vector<char> buffer(chunkSize);
+    //Each thread fills its own list of rows, so no locking is needed.
+    vector<vector<ImportRow> > rowsPerThread(threadCount);
+    //Bytes of an unfinished line left over from the previous chunk.
+    size_t carried = 0;
+    bool atEnd = false;
+
+    while (!atEnd) {
+        //Make room for a full chunk after whatever was carried over.
+        if (buffer.size() < carried + chunkSize)
+            buffer.resize(carried + chunkSize);
+
+        size_t n = fread(&buffer[carried], 1, chunkSize, file);
+        stats->bytes += n;
+        size_t filled = carried + n;
+        atEnd = n < chunkSize;
+
+        //Only hand whole lines to the parser. At the end of the file the last
+        //line may not end in a newline, but it's still whole.
+        size_t usable = filled;
+        if (!atEnd) {
+            const char* last = (const char*) memrchr(&buffer[0], '\n', filled);
+            //A line longer than the chunk. Carry it all and read more.
+            usable = last == nullptr ? 0 : last - &buffer[0] + 1;
+        }
+
+        if (usable > 0) {
+            const char* begin = &buffer[0];
+            const char* end = begin + usable;
+            //Cut the chunk into one slice per thread, each ending on a newline.
+            vector<const char*> cuts;
+            cuts.push_back(begin);
+            for (unsigned int t = 1; t < threadCount; t++) {
+                const char* cut = begin + usable * t / threadCount;
+                if (cut < cuts.back())
+                    cut = cuts.back();
+                const char* newline = (const char*) memchr(cut, '\n', end - cut);
+                cuts.push_back(newline == nullptr ? end : newline + 1);
+            }
+            cuts.push_back(end);
+
+            //The first slice is parsed on this thread while the others run.
+            vector<thread> workers;
+            for (unsigned int t = 1; t < threadCount; t++) {
+                workers.push_back(thread(parseSlice, cuts[t], cuts[t + 1], format,
+                        delimiter, &rowsPerThread[t]));
+            }
+            parseSlice(cuts[0], cuts[1], format, delimiter, &rowsPerThread[0]);
+            for (thread& worker : workers)
+                worker.join();
+
+            //Feed the Tree in file order, one batch per slice.
+            for (vector<ImportRow>& rows : rowsPerThread)
+                apply(rows, format, stats);
+        }
+
+        //Move the unfinished line to the front for the next read.
+        carried = filled - usable;
+        if (carried > 0)
+            memmove(&buffer[0], &buffer[usable], carried);
+    }
+
+    fclose(file);
+    return true;
+}
+
+
+void Importer::parseSlice(const char* begin, const char* end, LineFormat format,
+        char delimiter, vector<ImportRow>* rows) {
+
+    rows->clear();
+
+    while (begin < end) {
+        const char* newline = (const char*) memchr(begin, '\n', end - begin);
+        const char* lineEnd = newline == nullptr ? end : newline;
+        //Files written on Windows end their lines with \r\n.
+        const char* contentEnd = lineEnd;
+        if (contentEnd > begin && contentEnd[-1] == '\r')
+            contentEnd--;
+
+        ImportRow row;
+        bool parsed = false;
+        if (contentEnd > begin) {
+            switch (format) {
+                case EDGE_LIST:
+                    parsed = parseEdgeLine(begin, contentEnd, delimiter, &row);
+                    break;
+                case NCBI_NODES:
+                    parsed = parseNodesLine(begin, contentEnd, &row);
+                    break;
+                case NCBI_NAMES:
+                    parsed = parseNamesLine(begin, contentEnd, &row);
+                    break;
+            }
+        }
+        if (parsed)
+            rows->push_back(row);
+
+        begin = lineEnd + 1;
+    }
+}
+
+/**
+ * Cuts one field off the front of [*pos, end) up to the delimiter, and moves
+ * *pos past it. Surrounding spaces are trimmed, as are simple double quotes.
+ */
+static ImportField nextField(const char** pos, const char* end, char delimiter) {
+
+    const char* begin = *pos;
+    const char* stop;
+
+    //Skip leading blanks, but not the delimiter itself since it may be a tab.
+    while (begin < end && (*begin == ' ' || *begin == '\t') && *begin != delimiter)
+        begin++;
+
+    if (begin < end && *begin == '"') {
+        //Quoted field. It runs to the next quote, delimiters and all.
+        const char* quote = (const char*) memchr(begin + 1, '"', end - begin - 1);
+        if (quote == nullptr)
+            quote = end;
+        const char* next = (const char*) memchr(quote, delimiter, end - quote);
+        *pos = next == nullptr ? end : next + 1;
+        ImportField field = {begin + 1, (size_t) (quote - begin - 1)};
+        return field;
+    }
+
+    const char* next = (const char*) memchr(begin, delimiter, end - begin);
+    stop = next == nullptr ? end : next;
+    *pos = next == nullptr ? end : next + 1;
+
+    //Trim trailing blanks.
+    while (stop > begin && (stop[-1] == ' ' || stop[-1] == '\t'))
+        stop--;
+
+    ImportField field = {begin, (size_t) (stop - begin)};
+    return field;
+}
+
+/**
+ * Reads an unsigned number from a field. Returns false if it isn't one.
+ */
+static bool fieldToNumber(const ImportField& field, unsigned int* number) {
+
+    if (field.length == 0)
+        return false;
+
+    unsigned int n = 0;
+    for (size_t i = 0; i < field.length; i++) {
+        char c = field.start[i];
+        if (c < '0' || c > '9')
+            return false;
+        n = n * 10 + (c - '0');
+    }
+    *number = n;
+    return true;
+}
+
+static bool fieldEquals(const ImportField& field, const char* text) {
+    size_t length = strlen(text);
+    return field.length == length && memcmp(field.start, text, length) == 0;
+}
+
+
+bool Importer::parseEdgeLine(const char* begin, const char* end, char delimiter,
+        ImportRow* row) {
+
+    row->child = nextField(&begin, end, delimiter);
+    row->parent = nextField(&begin, end, delimiter);
+    //An Ent needs a name. An empty parent is fine, it means root.
+    return row->child.length > 0;
+}
+
+bool Importer::parseNodesLine(const char* begin, const char* end, ImportRow* row) {
+
+    //"tax_id | parent tax_id | rank | ..." We only need the first two.
+    ImportField id = nextField(&begin, end, '|');
+    ImportField parentId = nextField(&begin, end, '|');
+
+    return fieldToNumber(id, &row->childId) && fieldToNumber(parentId, &row->parentId);
+}
+
+bool Importer::parseNamesLine(const char* begin, const char* end, ImportRow* row) {
+
+    //"tax_id | name_txt | unique name | name class |"
+    ImportField id = nextField(&begin, end, '|');
+    ImportField name = nextField(&begin, end, '|');
+    ImportField uniqueName = nextField(&begin, end, '|');
+    ImportField nameClass = nextField(&begin, end, '|');
+
+    //Synonyms, common names and so on aren't needed.
+    if (!fieldEquals(nameClass, "scientific name"))
+        return false;
+    //The unique name is only filled in when name_txt is shared by other taxa.
+    row->child = uniqueName.length > 0 ? uniqueName : name;
+
+    return fieldToNumber(id, &row->childId) && row->child.length > 0;
+}
+
+
+void Importer::apply(const vector<ImportRow>& rows, LineFormat format,
+        ImportStats* stats) {
+
+    for (const ImportRow& row : rows) {
+
+        switch (format) {
+            case EDGE_LIST: {
+                //Skip a "name,parent" header on the very first line.
+                if (stats->rows == 0 && fieldEquals(row.child, "name")
+                        && fieldEquals(row.parent, "parent"))
+                    continue;
+
+                Ent* parent = tree->getRoot();
+                if (row.parent.length > 0)
+                    parent = getOrCreatePlaceholder(row.parent, stats);
+
+                key.assign(row.child.start, row.child.length);
+                Ent* child = tree->getEntPtrByName(key);
+                if (child == nullptr) {
+                    //Seen for the first time, so it can go straight under
+                    //its parent. The no-arg constructor skips the creation
+                    //message, which would dominate a large import.
+                    child = new Ent();
+                    child->setName(key);
+                    tree->addEntToNameMap(child, parent);
+                    stats->entsCreated++;
+                } else {
+                    attach(parent, child);
+                }
+                break;
+            }
+            case NCBI_NODES: {
+                //root is its own parent in nodes.dmp.
+                if (row.childId != row.parentId)
+                    attach(getOrCreateTaxon(row.parentId, stats),
+                            getOrCreateTaxon(row.childId, stats));
+                break;
+            }
+            case NCBI_NAMES:
+                taxNames[row.childId].assign(row.child.start, row.child.length);
+                break;
+        }
+
+        stats->rows++;
+    }
+}
+
+
+Ent* Importer::getOrCreatePlaceholder(const ImportField& name, ImportStats* stats) {
+
+    key.assign(name.start, name.length);
+
+    Ent* ent = tree->getEntPtrByName(key);
+    if (ent == nullptr)
+        ent = createPlaceholder(key, stats);
+
+    return ent;
+}
+
+Ent* Importer::getOrCreateTaxon(unsigned int taxId, ImportStats* stats) {
+
+    //tax_id 1 is "root" in NCBI dumps, which is just our root.
+    if (taxId == 1)
+        return tree->getRoot();
+
+    unordered_map<unsigned int, Ent*>::iterator it = entsByTaxId.find(taxId);
+    if (it != entsByTaxId.end())
+        return it->second;
+
+    unordered_map<unsigned int, string>::iterator nameIt = taxNames.find(taxId);
+    if (nameIt != taxNames.end())
+        key = nameIt->second;
+    else
+        key = to_string(taxId);
+    //Names must be unique within a Tree, so tag a clash with its tax_id.
+    if (tree->getEntPtrByName(key) != nullptr)
+        key += " (" + to_string(taxId) + ")";
+
+    Ent* ent = createPlaceholder(key, stats);
+    entsByTaxId[taxId] = ent;
+
+    return ent;
+}
+
+Ent* Importer::createPlaceholder(const string& name, ImportStats* stats) {
+
+    Ent* ent = new Ent();
+    ent->setName(name);
+    //No parent until its own line turns up. Putting it under root for now
+    //would mean searching root's huge list of children to take it back out.
+    tree->addEntToNameMapUnattached(ent);
+    placeholders.insert(ent);
+    stats->entsCreated++;
+
+    return ent;
+}
+
+void Importer::attach(Ent* parent, Ent* child) {
+
+    //root can't have a parent, and nothing is its own parent.
+    if (parent == child || child == tree->getRoot())
+        return;
+
+    placeholders.erase(child);
+
+    //Repeated lines shouldn't connect the same pair twice.
+    if (child->isChildOf(parent))
+        return;
+    //A child with no children yet can't be on a loop. If a later line
+    //closes one through here, that line's connection is the one checked.
+    if (!child->getList(RELATION_CHILD).empty())
+        mayLoop.push_back(make_pair(parent, child));
+    Ent::connectUnchecked(parent, child);
+}
+
+void Importer::breakLoops(ImportStats* stats) {
+
+    for (pair<Ent*, Ent*>& looping : ParentCycles::findLooping(tree, mayLoop)) {
+        Ent::disconnectUnchecked(looping.first, looping.second);
+        if (looping.second->getList(RELATION_PARENT).empty())
+            placeholders.insert(looping.second);
+        stats->loopsSkipped++;
+    }
+    mayLoop.clear();
+}
+
+void Importer::attachLeftoverPlaceholders() {
+
+    for (Ent* ent : placeholders)
+        Ent::connectUnchecked(tree->getRoot(), ent);
+
+    placeholders.clear();
+}
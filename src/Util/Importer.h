@@ -0,0 +1,246 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMPORTER_H
+#define IMPORTER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdio>
+#include "../Core/Tree.h"
+
+using namespace std;
+
+/**
+ * A view of a single field within the read buffer. Parsing a line only records
+ * where its fields start and how long they are, so no strings are allocated
+ * until an Ent actually needs a name.
+ */
+struct ImportField {
+    const char* start;
+    size_t length;
+};
+
+/**
+ * One parsed line of a file. Edge lists fill in names, taxonomy dumps fill
+ * in the numeric ids. Either way it only points into the read buffer.
+ */
+struct ImportRow {
+    ImportField child;
+    ImportField parent;
+    unsigned int childId;
+    unsigned int parentId;
+};
+
+/**
+ * Totals from one import, so the user can see how fast it went.
+ */
+struct ImportStats {
+    unsigned long long rows;
+    unsigned long long entsCreated;
+    unsigned long long bytes;
+    /**
+     * Lines left out because they would have made a loop of parents.
+     */
+    unsigned long long loopsSkipped;
+    double seconds;
+
+    ImportStats(): rows(0), entsCreated(0), bytes(0), loopsSkipped(0), seconds(0) {}
+
+    double getRowsPerSecond() const {
+        return seconds > 0 ? rows / seconds : 0;
+    }
+};
+
+/**
+ * Streams large files of existing taxonomies into a Tree.
+ *
+ * Two kinds of files are understood. Edge lists have one "name,parent" pair
+ * per line, separated by a comma (CSV) or a tab (TSV). NCBI taxonomy dumps
+ * come as a nodes.dmp file holding "tax_id | parent tax_id | ..." and a
+ * names.dmp file holding the names of each tax_id.
+ *
+ * Files are read a chunk at a time. Each chunk is cut at line boundaries into
+ * slices which are parsed on separate threads, then the parsed rows are fed
+ * into the Tree in file order before the next chunk is read. Memory use stays
+ * at about one chunk no matter how big the file is.
+ *
+ * A parent may be named before its own line shows up. When that happens it is
+ * created as a placeholder with no parent, and gets one once its line is
+ * reached. Placeholders whose line never shows up go under root at the end.
+ *
+ * Lines aren't checked for loops of parents as they go, which would mean a
+ * walk per line. Instead, once the whole file is in, any connection which
+ * ended up on a loop is taken back out and counted in loopsSkipped.
+ */
+class Importer {
+
+    /**
+     * The Tree being filled.
+     */
+    Tree* tree;
+    /**
+     * How many threads parse each chunk.
+     */
+    unsigned int threadCount;
+    /**
+     * How many bytes are read from the file at a time.
+     */
+    size_t chunkSize;
+    /**
+     * Ents created only because they were named as a parent. They have no
+     * parent until their own line gives them one.
+     */
+    unordered_set<Ent*> placeholders;
+    /**
+     * Connections made to a child which already had children, as parent then
+     * child. Only those can close a loop of parents, so only they are
+     * checked at the end.
+     */
+    vector<pair<Ent*, Ent*> > mayLoop;
+    /**
+     * Reused to look up names, so a lookup doesn't allocate once it has
+     * grown to fit the longest name.
+     */
+    string key;
+    /**
+     * Taxonomy dumps refer to Ents by tax_id.
+     */
+    unordered_map<unsigned int, Ent*> entsByTaxId;
+    /**
+     * Names from names.dmp, by tax_id.
+     */
+    unordered_map<unsigned int, string> taxNames;
+
+    /**
+     * The kinds of line the parser understands.
+     */
+    typedef enum {
+        EDGE_LIST,
+        NCBI_NODES,
+        NCBI_NAMES
+    } LineFormat;
+
+    /**
+     * Reads the whole file chunk by chunk, parsing each chunk in parallel and
+     * handing the rows to apply(). Returns false if the file can't be opened.
+     */
+    bool streamFile(const string path, LineFormat format, char delimiter,
+            ImportStats* stats);
+
+    /**
+     * Parses every complete line in [begin, end) into rows.
+     */
+    static void parseSlice(const char* begin, const char* end, LineFormat format,
+            char delimiter, vector<ImportRow>* rows);
+
+    static bool parseEdgeLine(const char* begin, const char* end, char delimiter,
+            ImportRow* row);
+
+    static bool parseNodesLine(const char* begin, const char* end, ImportRow* row);
+
+    static bool parseNamesLine(const char* begin, const char* end, ImportRow* row);
+
+    /**
+     * Feeds a batch of parsed rows into the Tree.
+     */
+    void apply(const vector<ImportRow>& rows, LineFormat format, ImportStats* stats);
+
+    /**
+     * Finds the Ent with the given name, or creates it as a placeholder.
+     */
+    Ent* getOrCreatePlaceholder(const ImportField& name, ImportStats* stats);
+
+    /**
+     * Same as above, but for a tax_id from nodes.dmp.
+     */
+    Ent* getOrCreateTaxon(unsigned int taxId, ImportStats* stats);
+
+    /**
+     * Creates a new Ent with no parent and remembers it as a placeholder.
+     */
+    Ent* createPlaceholder(const string& name, ImportStats* stats);
+
+    /**
+     * Connects child under parent. A placeholder stops being one.
+     */
+    void attach(Ent* parent, Ent* child);
+
+    /**
+     * Takes back connections in mayLoop that ended up on a loop of parents.
+     * Children left with no parent become placeholders again.
+     */
+    void breakLoops(ImportStats* stats);
+
+    /**
+     * Puts any placeholders left at the end of an import under root, so no
+     * Ent is left an orphan.
+     */
+    void attachLeftoverPlaceholders();
+
+public:
+
+    /**
+     * Create an Importer which will add to the given Tree.
+     * Uses as many parsing threads as the hardware supports.
+     */
+    Importer(Tree* tr);
+
+    ~Importer();
+
+    /**
+     * Imports a file of "name,parent" lines. An empty parent means root.
+     * A first line of exactly "name,parent" is treated as a header.
+     * @param path          Path of the file to read.
+     * @param delimiter     ',' for CSV or '\t' for TSV.
+     * @return              The totals. rows is 0 if the file couldn't be read.
+     */
+    ImportStats importEdgeList(const string path, char delimiter = ',');
+
+    /**
+     * Imports an NCBI taxonomy dump. Each taxon is named after its scientific
+     * name, or its unique name when the scientific name is shared. tax_id 1
+     * is the Tree's root.
+     */
+    ImportStats importNcbiTaxonomy(const string nodesPath, const string namesPath);
+
+    /**
+     * Imports a made-up edge list, its lines shuffled so parents often come
+     * after their children and read in small chunks on several threads, and
+     * compares every Ent's parents with what the lines say.
+     * @return              What went wrong, or nothing if it all matched.
+     */
+    static string check();
+
+    void setThreadCount(unsigned int n) {
+        threadCount = n > 0 ? n : 1;
+    }
+
+    unsigned int getThreadCount() const {
+        return threadCount;
+    }
+
+    void setChunkSize(size_t bytes) {
+        chunkSize = bytes > 4096 ? bytes : 4096;
+    }
+
+};
+
+#endif /* IMPORTER_H */
@@ -0,0 +1,135 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "LatencyHistogram.h"
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <random>
+
+using namespace std;
+
+LatencyHistogram::LatencyHistogram(): most(0) {
+    for (atomic<uint64_t>& count : counts)
+        count.store(0, memory_order_relaxed);
+}
+
+unsigned int LatencyHistogram::bucketOf(uint64_t micros) {
+    
+    if (micros < EXACT)
+        return micros;
+    unsigned int power = 63 - __builtin_clzll(micros);
+    //The three bits after the top one pick the bucket within the power.
+    unsigned int part = (micros >> (power - 3)) & (SPLIT - 1);
+    return EXACT + (power - 4) * SPLIT + part;
+}
+
+uint64_t LatencyHistogram::topOf(unsigned int bucket) {
+    
+    if (bucket < EXACT)
+        return bucket;
+    unsigned int power = (bucket - EXACT) / SPLIT + 4;
+    uint64_t part = (bucket - EXACT) % SPLIT;
+    return ((SPLIT + part + 1) << (power - 3)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t micros) {
+    
+    counts[bucketOf(micros)].fetch_add(1, memory_order_relaxed);
+    uint64_t seen = most.load(memory_order_relaxed);
+    while (micros > seen && !most.compare_exchange_weak(seen, micros, memory_order_relaxed));
+}
+
+LatencySummary LatencyHistogram::summarize() const {
+    
+    LatencySummary summary;
+    //Counted up from the buckets, so the percentiles agree with each other
+    //even while more are being recorded.
+    uint64_t taken[BUCKETS];
+    for (unsigned int i = 0; i < BUCKETS; i++) {
+        taken[i] = counts[i].load(memory_order_relaxed);
+        summary.count += taken[i];
+    }
+    summary.max = most.load(memory_order_relaxed);
+    if (summary.count == 0)
+        return summary;
+    
+    const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+    uint64_t* into[] = {&summary.p50, &summary.p90, &summary.p99, &summary.p999};
+    uint64_t seen = 0;
+    unsigned int next = 0;
+    for (unsigned int i = 0; i < BUCKETS && next < 4; i++) {
+        seen += taken[i];
+        while (next < 4 && seen >= fractions[next] * summary.count) {
+            *into[next] = min(topOf(i), summary.max);
+            next++;
+        }
+    }
+    return summary;
+}
+
+string LatencyHistogram::check() {
+    
+    const unsigned int THREADS = 4;
+    
+    for (int round = 0; round < 20; round++) {
+        //Each thread draws from a spread that grows with the round, and a
+        //few come from anywhere at all.
+        vector<vector<uint64_t> > drawn(THREADS);
+        for (unsigned int t = 0; t < THREADS; t++) {
+            mt19937_64 random(45 + round * THREADS + t);
+            unsigned int bits = 1 + (round * 3 + t) % 40;
+            for (int i = 0; i < 20000 + round * 1000; i++) {
+                uint64_t value = random() % 100 == 0 ? random() >> (random() % 64)
+                        : random() % (uint64_t(1) << bits);
+                drawn[t].push_back(value);
+            }
+        }
+        LatencyHistogram histogram;
+        vector<thread> threads;
+        for (unsigned int t = 0; t < THREADS; t++) {
+            threads.push_back(thread([&histogram, &drawn, t] {
+                for (uint64_t value : drawn[t])
+                    histogram.record(value);
+            }));
+        }
+        for (thread& t : threads)
+            t.join();
+        
+        vector<uint64_t> all;
+        for (vector<uint64_t>& values : drawn)
+            all.insert(all.end(), values.begin(), values.end());
+        sort(all.begin(), all.end());
+        LatencySummary summary = histogram.summarize();
+        if (summary.count != all.size() || summary.max != all.back())
+            return "the count or max was off in round " + to_string(round);
+        
+        const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+        uint64_t got[] = {summary.p50, summary.p90, summary.p99, summary.p999};
+        for (int i = 0; i < 4; i++) {
+            //The first value with at least that fraction of them at or below it.
+            size_t at = 0;
+            while (at + 1 < fractions[i] * all.size())
+                at++;
+            uint64_t exact = all[at];
+            if (got[i] < exact || got[i] - exact > exact / SPLIT)
+                return "a percentile was " + to_string(got[i]) + " instead of "
+                        + to_string(exact) + " in round " + to_string(round);
+        }
+    }
+    return "";
+}
@@ -0,0 +1,89 @@
+/*
+ * This file is part of the Ents Hierarchy Database Project.
+ * Copyright (C) 2016 OpenPatterns Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+/**
+ * Percentiles of the latencies a LatencyHistogram has seen, in
+ * microseconds. Each is at most an eighth more than the real one.
+ */
+struct LatencySummary {
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    /** Exact. */
+    uint64_t max;
+
+    LatencySummary(): count(0), p50(0), p90(0), p99(0), p999(0), max(0) {}
+};
+
+/**
+ * Counts latencies into buckets, so percentiles can be read off at any time
+ * without keeping every one.
+ *
+ * Below 16 microseconds each value has a bucket of its own. Above that, each
+ * power of 2 is split into 8 buckets, so a bucket is never more than an
+ * eighth of its values wide, however big they get. Recording is a few
+ * relaxed atomic adds, so any number of threads can record at once.
+ */
+class LatencyHistogram {
+
+    static const unsigned int EXACT = 16;
+    static const unsigned int SPLIT = 8;
+    static const unsigned int BUCKETS = EXACT + (64 - 4) * SPLIT;
+
+    atomic<uint64_t> counts[BUCKETS];
+    atomic<uint64_t> most;
+
+    static unsigned int bucketOf(uint64_t micros);
+
+    /**
+     * The biggest value that goes in a bucket.
+     */
+    static uint64_t topOf(unsigned int bucket);
+
+public:
+
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void record(uint64_t micros);
+
+    LatencySummary summarize() const;
+
+    /**
+     * Has threads record made up latencies of every size at once, and
+     * compares the summary with the percentiles of the sorted latencies.
+     * @return          "" if each is within an eighth, and the count and
+     *                  max are exact, otherwise what went wrong.
+     */
+    static string check();
+
+};
+
+#endif /* LATENCYHISTOGRAM_H */
@@ -17,14 +17,43 @@
  */
 
 #include "Prime.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <random>
 
 using namespace std;
 
-Prime::Prime(): nextPrimeIndex(0), batchNum(10) {
+/**
+ * The numbers below 30 which aren't multiples of 2, 3 or 5. Bit k of a byte in
+ * the sieve stands for 30 times the byte's place plus wheel[k].
+ */
+static const unsigned int wheel[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+/**
+ * Which bit each number below 30 goes in, or -1 if it's on no bit.
+ */
+static const int wheelBit[30] = {
+    -1, 0, -1, -1, -1, -1, -1, 1, -1, -1,
+    -1, 2, -1, 3, -1, -1, -1, 4, -1, 5,
+    -1, -1, -1, 6, -1, -1, -1, -1, -1, 7
+};
+/**
+ * Bytes per block. 32KB fits in the L1 data cache of most CPUs and covers
+ * almost a million numbers.
+ */
+static const uint64_t blockBytes = 32 * 1024;
+/**
+ * Enough bytes to cover every unsigned int.
+ */
+static const uint64_t lastByte = (uint64_t) UINT_MAX / 30 + 1;
+
+Prime::Prime(): nextPrimeIndex(0), batchNum(10), sievedBytes(0) {
     
     //primes.push_back(1);
+    //The wheel leaves these three out, so they're added up front.
     primes.push_back(2);
     primes.push_back(3);
+    primes.push_back(5);
     
 }
 
@@ -33,43 +62,201 @@ Prime::~Prime() {
 
 void Prime::generateMorePrimes(int n) {
     
-    int numSoFar = primes.size();
+    size_t wanted = primes.size() + n;
     
-    unsigned int max = primes[numSoFar - 1];
+    while (primes.size() < wanted && sieveNextBlock());
     
-    unsigned int candidate = max + 2;
+}
+
+bool Prime::sieveNextBlock() {
     
-    unsigned int added = 0;
+    if (sievedBytes >= lastByte)
+        return false;
     
-    while (added < n) {
-        for (int p = 1; p < primes.size(); p++) {
-            if (candidate % primes[p] == 0)
-                break;
-            else if (primes[p] * primes[p] > candidate) {
-                //found a primeroni!
-                cout << "Prime: " << candidate << endl;
-                primes.push_back(candidate);
-                max = candidate;
-                added++;
+    //The first time through, find the primes to sieve with using a plain
+    //sieve. Any composite unsigned int has a factor below 65536.
+    if (smallPrimes.empty()) {
+        vector<bool> composite(65536, false);
+        for (unsigned int i = 7; i < 65536; i += 2) {
+            if (composite[i])
+                continue;
+            if (i % 3 != 0 && i % 5 != 0)
+                smallPrimes.push_back(i);
+            for (unsigned int j = i * i; j < 65536; j += 2 * i)
+                composite[j] = true;
+        }
+    }
+    
+    uint64_t start = sievedBytes;
+    uint64_t end = min(start + blockBytes, lastByte);
+    
+    //Only primes up to the square root of the block's end have anything
+    //to cross off in it.
+    while (sieving.size() < smallPrimes.size()) {
+        uint64_t p = smallPrimes[sieving.size()];
+        if (p * p >= end * 30)
+            break;
+        addSievingPrime(p);
+    }
+    
+    block.assign(end - start, 0xFF);
+    //1 isn't prime.
+    if (start == 0)
+        block[0] &= 0xFE;
+    
+    for (SievingPrime& sp : sieving) {
+        for (int k = 0; k < 8; k++) {
+            uint64_t b = sp.next[k];
+            uint8_t mask = sp.mask[k];
+            for (; b < end; b += sp.prime)
+                block[b - start] &= mask;
+            sp.next[k] = b;
+        }
+    }
+    
+    //Whatever wasn't crossed off is prime.
+    for (size_t i = 0; i < block.size(); i++) {
+        unsigned int bits = block[i];
+        while (bits != 0) {
+            uint64_t number = (start + i) * 30 + wheel[__builtin_ctz(bits)];
+            if (number > UINT_MAX)
                 break;
-            }
+            primes.push_back(number);
+            bits &= bits - 1;
         }
-        candidate += 2;
     }
     
+    sievedBytes = end;
+    
+    return true;
+}
+
+void Prime::addSievingPrime(unsigned int p) {
+    
+    SievingPrime sp;
+    sp.prime = p;
+    
+    //The multiples worth crossing off are p times a number on the wheel,
+    //starting from p itself. The 8 of them from there land on 8 different
+    //bits, and p * 30 later each one lands on the same bit again, p bytes on.
+    uint64_t base = p - p % 30;
+    int first = wheelBit[p % 30];
+    for (int k = 0; k < 8; k++) {
+        int w = first + k;
+        uint64_t multiple = (uint64_t) p * (base + wheel[w % 8] + (w >= 8 ? 30 : 0));
+        sp.next[k] = multiple / 30;
+        sp.mask[k] = ~(1 << wheelBit[multiple % 30]);
+    }
+    
+    sieving.push_back(sp);
 }
 
 /**
  * Returns the next prime number in the list. Starts by returning 2, 1 is always
  * for root.
- * @return      The next prime that hasn't been returned.
+ * @return      The next prime that hasn't been returned, or 0 once there are
+ *              none left that fit in an unsigned int.
  */
 unsigned int Prime::getNextPrime() {
     
     //Are there still primes left in the list which haven't been returned?
     if (primes.size() < nextPrimeIndex + 1)
         generateMorePrimes(batchNum);
+    if (primes.size() < nextPrimeIndex + 1)
+        return 0;
     //Return the next one, and then increment the index.
     return primes[nextPrimeIndex++];
     
-}
\ No newline at end of file
+}
+
+void Prime::getNextPrimes(unsigned int n, vector<unsigned int>* out) {
+    
+    if (primes.size() < (size_t) nextPrimeIndex + n)
+        generateMorePrimes(nextPrimeIndex + n - primes.size());
+    
+    unsigned int end = min((size_t) nextPrimeIndex + n, primes.size());
+    out->insert(out->end(), primes.begin() + nextPrimeIndex, primes.begin() + end);
+    nextPrimeIndex = end;
+    
+}
+
+void Prime::generateByTrialDivision(unsigned int n, vector<unsigned int>* primes) {
+    
+    primes->clear();
+    primes->push_back(2);
+    primes->push_back(3);
+    
+    unsigned int candidate = 5;
+    
+    while (primes->size() < n) {
+        for (size_t p = 1; p < primes->size(); p++) {
+            if (candidate % (*primes)[p] == 0)
+                break;
+            else if ((*primes)[p] * (*primes)[p] > candidate) {
+                primes->push_back(candidate);
+                break;
+            }
+        }
+        candidate += 2;
+    }
+    
+}
+
+PrimeBenchmark Prime::benchmark(unsigned int n) {
+    
+    PrimeBenchmark result;
+    result.count = n;
+    
+    vector<unsigned int> divided;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    generateByTrialDivision(n, &divided);
+    result.trialDivisionSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    vector<unsigned int> sieved;
+    start = chrono::steady_clock::now();
+    Prime prime;
+    prime.getNextPrimes(n, &sieved);
+    result.sieveSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    divided.resize(min(divided.size(), (size_t) n));
+    result.agree = divided == sieved;
+    
+    return result;
+}
+
+string Prime::check() {
+    
+    //A plain sieve up to a limit covering about 20 blocks.
+    const unsigned int limit = 20000000;
+    vector<bool> composite(limit, false);
+    vector<unsigned int> expected;
+    for (unsigned int i = 2; i < limit; i++) {
+        if (composite[i])
+            continue;
+        expected.push_back(i);
+        for (uint64_t j = (uint64_t) i * i; j < limit; j += i)
+            composite[j] = true;
+    }
+    
+    //Odd sized handfuls, so the calls start and end all over the blocks.
+    mt19937 random(29);
+    Prime prime;
+    vector<unsigned int> given;
+    while (given.size() < expected.size()) {
+        unsigned int n = random() % 4 == 0 ? 1 + random() % 5 : random() % 100000;
+        n = min(n, (unsigned int) (expected.size() - given.size()));
+        if (n < 5) {
+            for (unsigned int i = 0; i < n; i++)
+                given.push_back(prime.getNextPrime());
+        } else
+            prime.getNextPrimes(n, &given);
+    }
+    
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (given[i] != expected[i])
+            return "prime " + to_string(i) + " was " + to_string(given[i])
+                    + ", not " + to_string(expected[i]);
+    }
+    
+    return "";
+}
@@ -22,9 +22,23 @@
 #include <vector>
 #include <math.h>
 #include <iostream>
+#include <cstdint>
+#include <string>
 
 using namespace std;
 
+/**
+ * Timings from Prime::benchmark(), comparing the sieve with the old trial
+ * division on the same number of primes.
+ */
+struct PrimeBenchmark {
+    unsigned int count;
+    double trialDivisionSeconds;
+    double sieveSeconds;
+    /** Whether both came up with exactly the same primes. */
+    bool agree;
+};
+
 /**
  * This file contains programs to generate prime numbers. These prime numbers will
  * be used to represent the hierarchal location of Ents via factorization.
@@ -34,9 +48,26 @@ using namespace std;
  * with calculations done up-front like testing "are humans fish?" without needing
  * to iterate through the hierarchy which can be relatively "unordered" compared
  * to traditional trees.
+ *
+ * Primes are found with a segmented sieve of Eratosthenes. Numbers are sieved
+ * one block at a time, sized to fit in the CPU's L1 cache, instead of testing
+ * each candidate by division. The sieve skips multiples of 2, 3 and 5 (a mod 30
+ * wheel), so each byte of a block covers 30 numbers with one bit for each of
+ * the 8 that could be prime.
  */
 class Prime {
     
+    /**
+     * A prime used to cross off multiples in the blocks. Its multiples which
+     * aren't multiples of 2, 3 or 5 fall in 8 different bits, and each of those
+     * repeats every p bytes, so it keeps where it's up to in each of them.
+     */
+    struct SievingPrime {
+        unsigned int prime;
+        uint64_t next[8];
+        uint8_t mask[8];
+    };
+    
     /**
      * Vector holding a list of prime numbers from 1 to the nth prime, where
      * n is the size of the vector.
@@ -50,10 +81,45 @@ class Prime {
      * How many new primes to generate at a time.
      */
     int batchNum;
+    /**
+     * Every prime up to the square root of the largest unsigned int, which is
+     * all the sieve can ever need. Found once, the first time they're needed.
+     */
+    vector<unsigned int> smallPrimes;
+    /**
+     * The small primes currently crossing off multiples. Only those up to the
+     * square root of the end of the current block are needed.
+     */
+    vector<SievingPrime> sieving;
+    /**
+     * Numbers below 30 times this have already been sieved.
+     */
+    uint64_t sievedBytes;
+    /**
+     * The block being sieved. Reused from block to block.
+     */
+    vector<uint8_t> block;
+    
+    /**
+     * Sieves the next block and adds the primes it holds to the list.
+     * Returns false once there are no more primes that fit in an unsigned int.
+     */
+    bool sieveNextBlock();
+    
+    /**
+     * Starts crossing off the multiples of p, beginning at p * p.
+     */
+    void addSievingPrime(unsigned int p);
+    
+    /**
+     * The original way of finding primes, by dividing each odd number by the
+     * primes found so far. Kept for the benchmark.
+     */
+    static void generateByTrialDivision(unsigned int n, vector<unsigned int>* primes);
     
 public:
     /**
-     * Constructs a Prime class which is only filled with 1.
+     * Constructs a Prime class holding the first few primes.
      */
     Prime();
     /**
@@ -61,15 +127,31 @@ public:
      */
     ~Prime();
     /**
-     * Generates n more primes to add to the vector. 
+     * Generates at least n more primes to add to the vector. A whole block is
+     * sieved at a time, so usually many more are found.
      */
     void generateMorePrimes(int n);
     /**
      * Returns the next prime number after currentPrimeIndex.
      */
     unsigned int getNextPrime();
-    
-    
+    /**
+     * Hands out the next n primes all at once, adding them to out.
+     * @param n         How many primes to give.
+     * @param out       Where to add them.
+     */
+    void getNextPrimes(unsigned int n, vector<unsigned int>* out);
+    /**
+     * Times finding the first n primes with the sieve against the old trial
+     * division. Nothing is printed.
+     */
+    static PrimeBenchmark benchmark(unsigned int n);
+    /**
+     * Hands out primes with a mix of getNextPrime() and getNextPrimes() calls,
+     * across many blocks, and compares them with a plain sieve.
+     * @return      "" if they agree, otherwise what went wrong.
+     */
+    static string check();
     
     
 };
@@ -77,4 +159,3 @@ public:
 
 
 #endif /* PRIME_H */
-
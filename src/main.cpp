@@ -17,11 +17,164 @@
  */
 
 #include <iostream>
+#include <string>
+#include <cstdlib>
+#include <csignal>
+#include <thread>
+#include <chrono>
 #include "CLI/CLI.h"
+#include "Network/EntsServer.h"
+#include "Network/EntsFollower.h"
+#include "Network/CoreServer.h"
+#include "Util/Importer.h"
 
 using namespace std;
 
-int main() {
+/**
+ * Set by Ctrl-C or kill, to stop a server or follower started from the
+ * command line.
+ */
+static volatile sig_atomic_t stopping = 0;
+
+static void stopRunning(int) {
+    stopping = 1;
+}
+
+/**
+ * Serves a Tree, loaded from a "name,parent" file if one is given, and
+ * prints how it's doing every second until stopped. Other processes can
+ * follow it.
+ */
+static int runPrimary(unsigned short port, const char* file) {
+    
+    Tree tree("Primary");
+    if (file != nullptr) {
+        Importer importer(&tree);
+        ImportStats stats = importer.importEdgeList(file);
+        cout << "Imported " << stats.entsCreated << " Ents.\n";
+    }
+    EntsServer server(&tree, port);
+    server.start();
+    cout << "Serving on port " << server.getPort() << ".\n" << flush;
+    
+    while (!stopping) {
+        this_thread::sleep_for(chrono::seconds(1));
+        ChangeLog* log = tree.getChangeLog();
+        cout << server.getRequestCount() << " requests, " << server.getFollowerCount()
+                << " followers, log at " << (log != nullptr ? log->getEnd() : 0) << ".\n" << flush;
+    }
+    return 0;
+}
+
+/**
+ * Like runPrimary(), but with a copy of the Tree on each of count cores, or
+ * all of them if count is 0.
+ */
+static int runCores(unsigned short port, const char* file, unsigned int count) {
+    
+    Tree tree("Primary");
+    if (file != nullptr) {
+        Importer importer(&tree);
+        ImportStats stats = importer.importEdgeList(file);
+        cout << "Imported " << stats.entsCreated << " Ents.\n";
+    }
+    CoreServer server(&tree, port, count);
+    server.start();
+    cout << "Serving on port " << server.getPort() << " from "
+            << server.getCoreCount() << " cores.\n" << flush;
+    
+    while (!stopping) {
+        this_thread::sleep_for(chrono::seconds(1));
+        uint64_t behind = 0;
+        for (unsigned int i = 0; i < server.getCoreCount(); i++)
+            behind = max(behind, server.getReplicaStatus(i).getBehind());
+        cout << server.getRequestCount() << " requests, replicas at most "
+                << behind << " changes behind.\n" << flush;
+    }
+    return 0;
+}
+
+/**
+ * Serves one shard of a hierarchy split up between count of them, until
+ * stopped. ShardCluster starts these.
+ */
+static int runShard(unsigned int index, unsigned int count, unsigned short port) {
+    
+    if (count == 0 || index >= count) {
+        cout << "There's no shard " << index << " of " << count << ".\n";
+        return 1;
+    }
+    //Its own UIDs, so every shard's are different.
+    UIDAllocator uids(count, index);
+    Tree tree("Shard " + to_string(index), &uids);
+    EntsServer server(&tree, port);
+    server.setShard(index, count);
+    server.start();
+    cout << "Serving shard " << index << " of " << count << " on port "
+            << server.getPort() << ".\n" << flush;
+    
+    while (!stopping) {
+        this_thread::sleep_for(chrono::seconds(1));
+    }
+    return 0;
+}
+
+/**
+ * Follows a primary, serving the copy read-only on servePort if it isn't 0,
+ * and prints how far behind it is every second until stopped.
+ */
+static int runFollower(const string& host, unsigned short port, unsigned short servePort) {
+    
+    Tree tree("Follower");
+    EntsFollower follower(&tree, host, port);
+    follower.start();
+    unique_ptr<EntsServer> server;
+    if (servePort != 0) {
+        server.reset(new EntsServer(&tree, servePort));
+        server->setReadOnly(true);
+        server->start();
+        cout << "Serving the copy on port " << server->getPort() << ".\n" << flush;
+    }
+    
+    while (!stopping) {
+        this_thread::sleep_for(chrono::seconds(1));
+        cout << EntsFollower::describe(follower.getStatus()) << "\n" << flush;
+    }
+    //The server reads the Tree the follower writes, so it stops first.
+    server.reset();
+    follower.stop();
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    
+    //ents serve PORT [FILE], ents cores PORT [FILE [COUNT]],
+    //ents follow HOST PORT [SERVE_PORT] and ents shard INDEX COUNT PORT run
+    //without the CLI, so several can be started on one machine.
+    string mode = argc > 1 ? argv[1] : "";
+    if (mode == "serve" || mode == "cores" || mode == "follow" || mode == "shard") {
+        signal(SIGINT, stopRunning);
+        signal(SIGTERM, stopRunning);
+        try {
+            if (mode == "serve" && argc > 2)
+                return runPrimary(atoi(argv[2]), argc > 3 ? argv[3] : nullptr);
+            if (mode == "cores" && argc > 2)
+                return runCores(atoi(argv[2]), argc > 3 ? argv[3] : nullptr,
+                        argc > 4 ? atoi(argv[4]) : 0);
+            if (mode == "follow" && argc > 3)
+                return runFollower(argv[2], atoi(argv[3]), argc > 4 ? atoi(argv[4]) : 0);
+            if (mode == "shard" && argc > 4)
+                return runShard(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+        } catch (exception& e) {
+            cout << e.what() << "\n";
+            return 1;
+        }
+        cout << "Usage: ents serve PORT [FILE]\n"
+                << "       ents cores PORT [FILE [COUNT]]\n"
+                << "       ents follow HOST PORT [SERVE_PORT]\n"
+                << "       ents shard INDEX COUNT PORT\n";
+        return 1;
+    }
     
     CLI cli;
     cli.listen();